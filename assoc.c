@@ -26,6 +26,11 @@
 #include <pthread.h>
 #include "slabs.h"
 #include "assoc.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
 
@@ -39,62 +44,333 @@ static unsigned int hashpower = HASHPOWER_DEFAULT;
 #define hashsize(n) ((ub4)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
+/*
+ * With "-o hash_index=tagged" the buckets are cache line sized groups of
+ * GROUP_SLOTS item pointers, each with a one byte tag taken from the top
+ * bits of the hash. A lookup compares all the tags of its group at once and
+ * only touches the items whose tag matches. When a group is full, further
+ * items chain off the last slot through h_next, and the tag byte after the
+ * slots flags it; a delete pulls a chained item back into the freed slot.
+ *
+ * Every item stays in the group its hash picks, so the table grows and
+ * shrinks a group at a time exactly like the chained one. A group holds
+ * what two chained buckets would: there are hashsize(hashpower - 1).
+ */
+#define GROUP_SLOTS 7
+#define GROUP_SLOTS_MASK ((1U << GROUP_SLOTS) - 1)
+#define GROUP_OVERFLOW GROUP_SLOTS  /* index of the overflow flag in tags */
+/* Full slots have the top bit set, so 0 marks an empty one */
+#define GROUP_TAG(hv) ((uint8_t)(((hv) >> 25) | 0x80))
+
+typedef struct {
+    uint8_t tags[GROUP_SLOTS + 1];
+    item *slots[GROUP_SLOTS];
+} tag_group;
+
+/* log2 of the number of buckets (or groups) in a table of hashpower n */
+#define bucketpower(n) (settings.hash_tagged ? (n) - 1 : (n))
+
 /* Main hash table. This is where we look except during expansion. */
 static item** primary_hashtable = 0;
 
 /*
- * Previous hash table. During expansion, we look here for keys that haven't
- * been moved over to the primary yet.
+ * Previous hash table. During expansion or contraction, we look here for
+ * keys that haven't been moved over to the primary yet.
  */
 static item** old_hashtable = 0;
 
+/* The same two tables when the index is tagged */
+static tag_group *primary_groups = 0;
+static tag_group *old_groups = 0;
+
 /* Number of items in the hash table. */
 static unsigned int hash_items = 0;
 
 /* Flag: Are we in the middle of expanding now? */
 static bool expanding = false;
+/* Flag: the maintenance thread was asked to expand (guarded by cache_lock) */
+static bool started_expanding = false;
+
+/* Flag: Are we in the middle of shrinking now? */
+static bool shrinking = false;
+/* Flag: the memory limit was lowered, shrink as items go away */
+static bool shrink_requested = false;
 
 /*
- * During expansion we migrate values with bucket granularity; this is how
- * far we've gotten so far. Ranges from 0 .. hashsize(hashpower - 1) - 1.
+ * During expansion or contraction we migrate values with bucket
+ * granularity, several threads at once, each bucket under the item lock
+ * its keys hash to. A bucket of the old table that has been emptied into
+ * the primary one is marked, and lookups of its keys go to the primary.
+ * Tagged tables migrate groups the same way.
  */
-static unsigned int expand_bucket = 0;
+#define BUCKET_MOVED ((item *)1)
+#define GROUP_MOVED 2   /* in tags[GROUP_OVERFLOW] */
 
 int tell_hashsize(void){
     return stats.hash_bytes;
 }
 
+unsigned int assoc_hashpower(void) {
+    return hashpower;
+}
+
+unsigned int assoc_bucketpower(void) {
+    return bucketpower(hashpower);
+}
+
+/* Bytes taken by a table of the given hashpower */
+static size_t table_bytes(const unsigned int power) {
+    if (settings.hash_tagged)
+        return hashsize(bucketpower(power)) * sizeof(tag_group);
+    return hashsize(power) * sizeof(void *);
+}
+
+/* Allocates a zeroed table of the given hashpower, and writes to every page
+ * so the migration doesn't take page faults while holding item locks. */
+static void *table_alloc(const unsigned int power) {
+    size_t bytes = table_bytes(power);
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t off;
+    void *table;
+
+    if (settings.hash_tagged) {
+        if (posix_memalign(&table, 64, bytes) != 0)
+            return NULL;
+        memset(table, 0, bytes);
+    } else {
+        if ((table = calloc(hashsize(power), sizeof(void *))) == NULL)
+            return NULL;
+        for (off = 0; off < bytes; off += pagesize)
+            ((volatile char *)table)[off] = 0;
+    }
+    return table;
+}
+
 void assoc_init(const int hashtable_init) {
     if (hashtable_init) {
         hashpower = hashtable_init;
     }
-    primary_hashtable = calloc(hashsize(hashpower), sizeof(void *));
-    if (! primary_hashtable) {
+    void *table = table_alloc(hashpower);
+    if (! table) {
         fprintf(stderr, "Failed to init hashtable.\n");
         exit(EXIT_FAILURE);
     }
+    if (settings.hash_tagged)
+        primary_groups = table;
+    else
+        primary_hashtable = table;
     STATS_LOCK();
     stats.hash_power_level = hashpower;
-    stats.hash_bytes = hashsize(hashpower) * sizeof(void *);
+    stats.hash_bytes = table_bytes(hashpower);
     STATS_UNLOCK();
 }
 
-item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
-    item *it;
+static inline bool _old_bucket_moved(const unsigned int bucket) {
+    if (settings.hash_tagged)
+        return old_groups[bucket].tags[GROUP_OVERFLOW] == GROUP_MOVED;
+    return old_hashtable[bucket] == BUCKET_MOVED;
+}
+
+/* Returns the bucket the given hash lives in right now, and whether that
+ * is in the old table. */
+static unsigned int _hashitem_index(const uint32_t hv, bool *old) {
+    const unsigned int power = bucketpower(hashpower);
     unsigned int oldbucket;
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-        {
-            it = old_hashtable[oldbucket];
-        } else {
-        it = primary_hashtable[hv & hashmask(hashpower)];
+    *old = false;
+    if (expanding || shrinking) {
+        oldbucket = hv & hashmask(expanding ? power - 1 : power + 1);
+        if (!_old_bucket_moved(oldbucket)) {
+            *old = true;
+            return oldbucket;
+        }
     }
+    return hv & hashmask(power);
+}
+
+/* Returns the head of the chain the given hash lives on right now. */
+static item** _hashitem_bucket(const uint32_t hv) {
+    bool old;
+    unsigned int bucket = _hashitem_index(hv, &old);
+    return old ? &old_hashtable[bucket] : &primary_hashtable[bucket];
+}
+
+static tag_group *_hashitem_group(const uint32_t hv) {
+    bool old;
+    unsigned int group = _hashitem_index(hv, &old);
+    return old ? &old_groups[group] : &primary_groups[group];
+}
+
+/*
+ * Hints the cache to load the bucket a lookup of hv will start at. Called
+ * without the item lock, so it only computes addresses and never loads
+ * from the tables, which may be swapped or freed under it; a stale
+ * address costs nothing but the wasted prefetch.
+ */
+void assoc_prefetch(const uint32_t hv) {
+    const unsigned int power = bucketpower(hashpower);
+
+    if (settings.hash_tagged)
+        __builtin_prefetch(&primary_groups[hv & hashmask(power)]);
+    else
+        __builtin_prefetch(&primary_hashtable[hv & hashmask(power)]);
+}
+
+/* Gathers the top bit of each byte of x into the low byte */
+static inline unsigned int group_bits(const uint64_t x) {
+#ifdef ENDIAN_BIG
+    unsigned int bits = ((x & 0x8080808080808080ULL) * 0x0002040810204081ULL) >> 56;
+    /* byte 0 of the tags is the top byte of x here */
+    bits = ((bits & 0xf0) >> 4) | ((bits & 0x0f) << 4);
+    bits = ((bits & 0xcc) >> 2) | ((bits & 0x33) << 2);
+    return ((bits & 0xaa) >> 1) | ((bits & 0x55) << 1);
+#else
+    return ((x & 0x8080808080808080ULL) * 0x0002040810204081ULL) >> 56;
+#endif
+}
+
+/* Bit i is set for every slot i whose tag is the given one */
+static inline unsigned int group_match(const tag_group *g, const uint8_t tag) {
+#ifdef __SSE2__
+    __m128i tags = _mm_loadl_epi64((const __m128i *)g->tags);
+    __m128i eq = _mm_cmpeq_epi8(tags, _mm_set1_epi8((char)tag));
+    return _mm_movemask_epi8(eq) & GROUP_SLOTS_MASK;
+#elif defined(__ARM_NEON)
+    uint8x8_t eq = vceq_u8(vld1_u8(g->tags), vdup_n_u8(tag));
+    return group_bits(vget_lane_u64(vreinterpret_u64_u8(eq), 0)) &
+        GROUP_SLOTS_MASK;
+#else
+    /* Exact per byte zero test of tags ^ tag, no borrow between bytes */
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    uint64_t x;
+    memcpy(&x, g->tags, sizeof(x));
+    x ^= 0x0101010101010101ULL * tag;
+    return group_bits(~(((x & low7) + low7) | x | low7)) & GROUP_SLOTS_MASK;
+#endif
+}
 
+static inline bool item_is(const item *it, const char *key, const size_t nkey,
+                           const uint32_t hv) {
+    return (hv == it->hv) && (nkey == it->nkey) &&
+        (memcmp(key, ITEM_key(it), nkey) == 0);
+}
+
+/* Looks key up in g. depth counts the items compared on the way. */
+static item *group_search(tag_group *g, const char *key, const size_t nkey,
+                          const uint32_t hv, int *depth) {
+    unsigned int match = group_match(g, GROUP_TAG(hv));
+    item *it;
+
+    for (; match; match &= match - 1, ++*depth) {
+        it = g->slots[__builtin_ctz(match)];
+        if (item_is(it, key, nkey, hv))
+            return it;
+    }
+    if (g->tags[GROUP_OVERFLOW]) {
+        for (it = g->slots[GROUP_SLOTS - 1]->h_next; it; it = it->h_next) {
+            ++*depth;
+            if (item_is(it, key, nkey, hv))
+                return it;
+        }
+    }
+    return NULL;
+}
+
+/* Puts it in the first free slot of g, or on the overflow chain */
+static void group_insert(tag_group *g, item *it) {
+    unsigned int empty = group_match(g, 0);
+
+    if (empty) {
+        int i = __builtin_ctz(empty);
+        g->tags[i] = GROUP_TAG(it->hv);
+        g->slots[i] = it;
+        it->h_next = 0;
+    } else {
+        item *last = g->slots[GROUP_SLOTS - 1];
+        it->h_next = last->h_next;
+        last->h_next = it;
+        g->tags[GROUP_OVERFLOW] = 1;
+    }
+}
+
+/* Takes slot i out of g, refilling it from the overflow chain */
+static void group_remove_slot(tag_group *g, const int i) {
+    item *it = g->slots[i];
+    item *last = g->slots[GROUP_SLOTS - 1];
+
+    if (!g->tags[GROUP_OVERFLOW]) {
+        g->tags[i] = 0;
+        g->slots[i] = 0;
+    } else if (i == GROUP_SLOTS - 1) {
+        /* the rest of the chain hangs off the item that moves up */
+        g->slots[i] = last->h_next;
+        g->tags[i] = GROUP_TAG(g->slots[i]->hv);
+        g->tags[GROUP_OVERFLOW] = (g->slots[i]->h_next != NULL);
+    } else {
+        item *next = last->h_next;
+        last->h_next = next->h_next;
+        next->h_next = 0;
+        g->slots[i] = next;
+        g->tags[i] = GROUP_TAG(next->hv);
+        g->tags[GROUP_OVERFLOW] = (last->h_next != NULL);
+    }
+    it->h_next = 0;
+}
+
+/* Finds the slot of it in g. Returns -1 with *pos set when it is chained. */
+static int group_locate(tag_group *g, const item *it, item ***pos) {
+    unsigned int match = group_match(g, GROUP_TAG(it->hv));
+
+    for (; match; match &= match - 1) {
+        if (g->slots[__builtin_ctz(match)] == it)
+            return __builtin_ctz(match);
+    }
+    *pos = NULL;
+    if (g->tags[GROUP_OVERFLOW]) {
+        for (*pos = &g->slots[GROUP_SLOTS - 1]->h_next; **pos;
+             *pos = &(**pos)->h_next) {
+            if (**pos == it)
+                return -1;
+        }
+    }
+    *pos = NULL;
+    return -1;
+}
+
+/* Moves every item of an old group into the primary table, and marks it */
+static void group_drain(tag_group *g) {
+    const unsigned int mask = hashmask(bucketpower(hashpower));
+    item *it, *next = NULL;
+    int i;
+
+    if (g->tags[GROUP_OVERFLOW])
+        next = g->slots[GROUP_SLOTS - 1]->h_next;
+    for (i = 0; i < GROUP_SLOTS; i++) {
+        if ((it = g->slots[i]) != NULL)
+            group_insert(&primary_groups[it->hv & mask], it);
+    }
+    for (it = next; it; it = next) {
+        next = it->h_next;
+        group_insert(&primary_groups[it->hv & mask], it);
+    }
+    memset(g, 0, sizeof(*g));
+    g->tags[GROUP_OVERFLOW] = GROUP_MOVED;
+}
+
+item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
     item *ret = NULL;
     int depth = 0;
+
+    if (settings.hash_tagged) {
+        ret = group_search(_hashitem_group(hv), key, nkey, hv, &depth);
+        MEMCACHED_ASSOC_FIND(key, nkey, depth);
+        return ret;
+    }
+
+    item *it = *_hashitem_bucket(hv);
     while (it) {
-        if ((nkey == it->nkey) && (memcmp(key, ITEM_key(it), nkey) == 0)) {
+        if ((hv == it->hv) && (nkey == it->nkey) &&
+            (memcmp(key, ITEM_key(it), nkey) == 0)) {
             ret = it;
             break;
         }
@@ -109,72 +385,156 @@ item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
    the item wasn't found */
 
 static item** _hashitem_before (const char *key, const size_t nkey, const uint32_t hv) {
-    item **pos;
-    unsigned int oldbucket;
-
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        pos = &old_hashtable[oldbucket];
-    } else {
-        pos = &primary_hashtable[hv & hashmask(hashpower)];
-    }
+    item **pos = _hashitem_bucket(hv);
 
-    while (*pos && ((nkey != (*pos)->nkey) || memcmp(key, ITEM_key(*pos), nkey))) {
+    while (*pos && ((hv != (*pos)->hv) || (nkey != (*pos)->nkey) ||
+                    memcmp(key, ITEM_key(*pos), nkey))) {
         pos = &(*pos)->h_next;
     }
     return pos;
 }
 
-/* grows the hashtable to the next power of 2. */
-static void assoc_expand(void) {
+/* Swaps in table, of twice the size, as the primary hashtable. Called with
+ * every worker on the global item lock. */
+static void assoc_expand(void *table) {
     old_hashtable = primary_hashtable;
+    old_groups = primary_groups;
+    if (settings.hash_tagged)
+        primary_groups = table;
+    else
+        primary_hashtable = table;
+
+    if (settings.verbose > 1)
+        fprintf(stderr, "Hash table expansion starting\n");
+    hashpower++;
+    expanding = true;
+    STATS_LOCK();
+    stats.hash_power_level = hashpower;
+    stats.hash_bytes += table_bytes(hashpower);
+    stats.hash_is_expanding = 1;
+    STATS_UNLOCK();
+}
 
-    primary_hashtable = calloc(hashsize(hashpower + 1), sizeof(void *));
-    if (primary_hashtable) {
-        if (settings.verbose > 1)
-            fprintf(stderr, "Hash table expansion starting\n");
-        hashpower++;
-        expanding = true;
-        expand_bucket = 0;
+/* halves the hashtable. Buckets b and b + hashsize(hashpower - 1) of the
+ * old table are merged into bucket b of the new one. */
+static void assoc_shrink(void *table) {
+    old_hashtable = primary_hashtable;
+    old_groups = primary_groups;
+    if (settings.hash_tagged)
+        primary_groups = table;
+    else
+        primary_hashtable = table;
+
+    if (settings.verbose > 1)
+        fprintf(stderr, "Hash table shrink starting\n");
+    hashpower--;
+    shrinking = true;
+    STATS_LOCK();
+    stats.hash_power_level = hashpower;
+    stats.hash_bytes += table_bytes(hashpower);
+    stats.hash_is_shrinking = 1;
+    STATS_UNLOCK();
+}
+
+/* Drops the old table once every bucket has moved. Called with every
+ * worker on the global item lock, and cache_lock held. */
+static void assoc_migration_done(void) {
+    if (expanding) {
+        expanding = false;
         STATS_LOCK();
-        stats.hash_power_level = hashpower;
-        stats.hash_bytes += hashsize(hashpower) * sizeof(void *);
-        stats.hash_is_expanding = 1;
+        stats.hash_bytes -= table_bytes(hashpower - 1);
+        stats.hash_is_expanding = 0;
         STATS_UNLOCK();
-        pthread_cond_signal(&maintenance_cond);
+        if (settings.verbose > 1)
+            fprintf(stderr, "Hash table expansion done\n");
     } else {
-        primary_hashtable = old_hashtable;
-        /* Bad news, but we can keep running. */
+        shrinking = false;
+        STATS_LOCK();
+        stats.hash_bytes -= table_bytes(hashpower + 1);
+        stats.hash_is_shrinking = 0;
+        STATS_UNLOCK();
+        if (settings.verbose > 1)
+            fprintf(stderr, "Hash table shrink done\n");
     }
+    free(settings.hash_tagged ? (void *)old_groups : (void *)old_hashtable);
+    old_groups = NULL;
+    old_hashtable = NULL;
+}
+
+/* Shrink only once the items fit well below the expansion threshold of the
+ * smaller table, and never below the item lock table (see thread_init). */
+static bool assoc_shrink_ok(void) {
+    return !expanding && !shrinking &&
+        bucketpower(hashpower) > item_lock_hashpower &&
+        hash_items < (hashsize(hashpower - 1) * 3) / 4;
+}
+
+void assoc_request_shrink(void) {
+    mutex_lock(&cache_lock);
+    shrink_requested = true;
+    pthread_cond_signal(&maintenance_cond);
+    mutex_unlock(&cache_lock);
+}
+
+/* Readers don't hold cache_lock, so the table can only be swapped by the
+ * maintenance thread once every worker is on the global item lock. */
+static void assoc_start_expand(void) {
+    if (started_expanding)
+        return;
+    started_expanding = true;
+    pthread_cond_signal(&maintenance_cond);
 }
 
 /* Note: this isn't an assoc_update.  The key must not already exist to call this */
 int assoc_insert(item *it, const uint32_t hv) {
-    unsigned int oldbucket;
-
     //    assert(assoc_find(ITEM_key(it), it->nkey) == 0);  /* shouldn't have duplicately named things defined */
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-        {
-            it->h_next = old_hashtable[oldbucket];
-            old_hashtable[oldbucket] = it;
-        } else {
-        it->h_next = primary_hashtable[hv & hashmask(hashpower)];
-        primary_hashtable[hv & hashmask(hashpower)] = it;
+    if (settings.hash_tagged) {
+        group_insert(_hashitem_group(hv), it);
+    } else {
+        item **bucket = _hashitem_bucket(hv);
+        it->h_next = *bucket;
+        *bucket = it;
     }
 
     hash_items++;
-    if (! expanding && hash_items > (hashsize(hashpower) * 3) / 2) {
-        assoc_expand();
+    if (! expanding && ! shrinking && hash_items > (hashsize(hashpower) * 3) / 2) {
+        assoc_start_expand();
     }
 
     MEMCACHED_ASSOC_INSERT(ITEM_key(it), it->nkey, hash_items);
     return 1;
 }
 
+/* Unlinks the item for key from a tagged table */
+static void group_delete(const char *key, const size_t nkey, const uint32_t hv) {
+    tag_group *g = _hashitem_group(hv);
+    int depth = 0;
+    item *it = group_search(g, key, nkey, hv, &depth);
+    item **pos;
+    int i;
+
+    /* The callers don't delete things they can't find. */
+    assert(it != NULL);
+    if (it == NULL)
+        return;
+    hash_items--;
+    MEMCACHED_ASSOC_DELETE(key, nkey, hash_items);
+    if ((i = group_locate(g, it, &pos)) >= 0) {
+        group_remove_slot(g, i);
+    } else {
+        *pos = it->h_next;
+        it->h_next = 0;
+        g->tags[GROUP_OVERFLOW] = (g->slots[GROUP_SLOTS - 1]->h_next != NULL);
+    }
+}
+
 void assoc_delete(const char *key, const size_t nkey, const uint32_t hv) {
+    if (settings.hash_tagged) {
+        group_delete(key, nkey, hv);
+        return;
+    }
+
     item **before = _hashitem_before(key, nkey, hv);
 
     if (*before) {
@@ -194,55 +554,177 @@ void assoc_delete(const char *key, const size_t nkey, const uint32_t hv) {
     assert(*before != 0);
 }
 
+/* Swaps new_it in at the chain position of old_it, which must be linked. */
+void assoc_replace(item *old_it, item *new_it, const uint32_t hv) {
+    if (settings.hash_tagged) {
+        tag_group *g = _hashitem_group(hv);
+        item **pos;
+        int i = group_locate(g, old_it, &pos);
 
-static volatile int do_run_maintenance_thread = 1;
+        /* Same key, so the tag stays */
+        if (i >= 0) {
+            g->slots[i] = new_it;
+        } else {
+            assert(pos != NULL);
+            *pos = new_it;
+        }
+        new_it->h_next = old_it->h_next;
+        old_it->h_next = 0;
+        return;
+    }
 
-#define DEFAULT_HASH_BULK_MOVE 1
-int hash_bulk_move = DEFAULT_HASH_BULK_MOVE;
+    item **before = _hashitem_before(ITEM_key(old_it), old_it->nkey, hv);
 
-static void *assoc_maintenance_thread(void *arg) {
+    assert(*before == old_it);
+    new_it->h_next = old_it->h_next;
+    old_it->h_next = 0;
+    *before = new_it;
+}
 
-    while (do_run_maintenance_thread) {
-        int ii = 0;
+static volatile int do_run_maintenance_thread = 1;
 
-        /* Lock the cache, and bulk move multiple buckets to the new
-         * hash table. */
-        mutex_lock(&cache_lock);
+/* Moves the keys of one bucket to the primary table: bucket b of the old
+ * table when expanding, or the two old buckets merging into bucket b of the
+ * primary when shrinking. The item lock table is never wider than either
+ * table, so one lock covers all the keys involved. */
+static void assoc_move_bucket(const unsigned int b) {
+    const unsigned int half = hashsize(bucketpower(hashpower));
+    item *it, *next;
+
+    item_lock(b);
+    if (settings.hash_tagged) {
+        group_drain(&old_groups[b]);
+        if (shrinking)
+            group_drain(&old_groups[b + half]);
+    } else if (expanding) {
+        for (it = old_hashtable[b]; NULL != it; it = next) {
+            unsigned int bucket = it->hv & hashmask(hashpower);
+            next = it->h_next;
+            it->h_next = primary_hashtable[bucket];
+            primary_hashtable[bucket] = it;
+        }
+        old_hashtable[b] = BUCKET_MOVED;
+    } else {
+        item **tail = &primary_hashtable[b];
+        int i;
+
+        /* Both halves land in the same bucket, so just chain them */
+        while (*tail)
+            tail = &(*tail)->h_next;
+        for (i = 0; i < 2; i++) {
+            *tail = old_hashtable[b + i * half];
+            while (*tail)
+                tail = &(*tail)->h_next;
+            old_hashtable[b + i * half] = BUCKET_MOVED;
+        }
+    }
+    item_unlock(b);
+}
 
-        for (ii = 0; ii < hash_bulk_move && expanding; ++ii) {
-            item *it, *next;
-            int bucket;
+struct move_range {
+    unsigned int from;
+    unsigned int to;
+};
 
-            for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
-                next = it->h_next;
+static void *assoc_move_thread(void *arg) {
+    struct move_range *range = arg;
+    unsigned int b;
 
-                bucket = hash(ITEM_key(it), it->nkey, 0) & hashmask(hashpower);
-                it->h_next = primary_hashtable[bucket];
-                primary_hashtable[bucket] = it;
-            }
+    for (b = range->from; b < range->to; b++)
+        assoc_move_bucket(b);
+    return NULL;
+}
+
+/* Splits the buckets to move between settings.hash_move_threads threads,
+ * one of them the caller, and returns once they are all done. */
+static void assoc_move_all(void) {
+    const unsigned int power = bucketpower(hashpower);
+    const unsigned int buckets = hashsize(expanding ? power - 1 : power);
+    const int nthreads = settings.hash_move_threads;
+    struct move_range ranges[nthreads];
+    pthread_t tids[nthreads];
+    bool started[nthreads];
+    int i;
+
+    for (i = 0; i < nthreads; i++) {
+        ranges[i].from = (uint64_t)buckets * i / nthreads;
+        ranges[i].to = (uint64_t)buckets * (i + 1) / nthreads;
+        started[i] = i > 0 &&
+            pthread_create(&tids[i], NULL, assoc_move_thread, &ranges[i]) == 0;
+    }
+    for (i = 0; i < nthreads; i++) {
+        if (!started[i])
+            assoc_move_thread(&ranges[i]);
+    }
+    for (i = 1; i < nthreads; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+}
+
+static void *assoc_maintenance_thread(void *arg) {
 
-            old_hashtable[expand_bucket] = NULL;
-
-            expand_bucket++;
-            if (expand_bucket == hashsize(hashpower - 1)) {
-                expanding = false;
-                free(old_hashtable);
-                STATS_LOCK();
-                stats.hash_bytes -= hashsize(hashpower - 1) * sizeof(void *);
-                stats.hash_is_expanding = 0;
-                STATS_UNLOCK();
-                if (settings.verbose > 1)
-                    fprintf(stderr, "Hash table expansion done\n");
+    mutex_lock(&cache_lock);
+    while (do_run_maintenance_thread) {
+        bool shrink = false;
+        void *table;
+
+        if (!started_expanding) {
+            if (shrink_requested && assoc_shrink_ok()) {
+                shrink = true;
+            } else if (shrink_requested) {
+                /* The slab shrinker is still evicting; look again later */
+                struct timeval tv;
+                struct timespec ts;
+                gettimeofday(&tv, NULL);
+                ts.tv_sec = tv.tv_sec + 1;
+                ts.tv_nsec = tv.tv_usec * 1000;
+                pthread_cond_timedwait(&maintenance_cond, &cache_lock, &ts);
+                if (!slabs_over_limit() && !assoc_shrink_ok())
+                    shrink_requested = false;
+                continue;
+            } else {
+                /* We are done expanding.. just wait for next invocation */
+                pthread_cond_wait(&maintenance_cond, &cache_lock);
+                continue;
             }
         }
 
-        if (!expanding) {
-            /* We are done expanding.. just wait for next invocation */
-            pthread_cond_wait(&maintenance_cond, &cache_lock);
+        /* The new table is allocated and faulted in while requests still
+         * run; they only wait for the pointers to be swapped. */
+        mutex_unlock(&cache_lock);
+        table = table_alloc(shrink ? hashpower - 1 : hashpower + 1);
+        if (table != NULL) {
+            switch_item_lock_type(ITEM_LOCK_GLOBAL);
+            item_lock_global();
+            mutex_lock(&cache_lock);
+            if (shrink)
+                assoc_shrink(table);
+            else
+                assoc_expand(table);
+            mutex_unlock(&cache_lock);
+            item_unlock_global();
+            switch_item_lock_type(ITEM_LOCK_GRANULAR);
+
+            /* Workers run on their fine-grained locks while buckets move */
+            assoc_move_all();
+
+            switch_item_lock_type(ITEM_LOCK_GLOBAL);
+            item_lock_global();
+            mutex_lock(&cache_lock);
+            assoc_migration_done();
+            mutex_unlock(&cache_lock);
+            item_unlock_global();
+            switch_item_lock_type(ITEM_LOCK_GRANULAR);
         }
+        /* Bad news if the table could not be allocated, but we can keep
+         * running. */
 
-        mutex_unlock(&cache_lock);
+        mutex_lock(&cache_lock);
+        if (!shrink)
+            started_expanding = false;
     }
+    mutex_unlock(&cache_lock);
     return NULL;
 }
 
@@ -250,13 +732,6 @@ static pthread_t maintenance_tid;
 
 int start_assoc_maintenance_thread() {
     int ret;
-    char *env = getenv("MEMCACHED_HASH_BULK_MOVE");
-    if (env != NULL) {
-        hash_bulk_move = atoi(env);
-        if (hash_bulk_move == 0) {
-            hash_bulk_move = DEFAULT_HASH_BULK_MOVE;
-        }
-    }
     if ((ret = pthread_create(&maintenance_tid, NULL,
                               assoc_maintenance_thread, NULL)) != 0) {
         fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
@@ -3,11 +3,18 @@
 /* associative array */
 void assoc_init(const int hashpower_init);
 item *assoc_find(const char *key, const size_t nkey, const uint32_t hv);
+/** Start loading the bucket of hv, ahead of a batch of lookups */
+void assoc_prefetch(const uint32_t hv);
 int assoc_insert(item *item, const uint32_t hv);
 void assoc_delete(const char *key, const size_t nkey, const uint32_t hv);
-void do_assoc_move_next_bucket(void);
+void assoc_replace(item *old_it, item *new_it, const uint32_t hv);
+/** Ask the maintenance thread to halve the table as items go away */
+void assoc_request_shrink(void);
 int start_assoc_maintenance_thread(void);
 void stop_assoc_maintenance_thread(void);
+unsigned int assoc_hashpower(void);
+/** log2 of the number of buckets, or of groups in a tagged table */
+unsigned int assoc_bucketpower(void);
 /*memory size evaluation*/
 int tell_hashsize(void);
 #endif
@@ -0,0 +1,254 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Balloon mode: resize the cache with the memory pressure on the host.
+ *
+ * Once a second the controller reads a pressure figure, either the share of
+ * time tasks were stalled on memory over the last ten seconds (PSI, "some
+ * avg10" in /proc/pressure/memory), or the usage of our cgroup as a
+ * percentage of memory.high (memory.max when there is no high limit). Under
+ * high pressure the limit is lowered by a step, as the "m" command would,
+ * and the slab mover gives the memory back. Once pressure has stayed low for
+ * a while it is raised again by a step. Between the two thresholds nothing
+ * changes, and after a shrink the controller waits for it to take effect
+ * before shrinking again, so the limit doesn't flap.
+ *
+ * A limit set with "m" becomes balloon_max: the controller still lowers it
+ * under pressure, but only raises it back as far as the operator's value.
+ */
+
+#include "memcached.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define BALLOON_INTERVAL 1          /* seconds between readings */
+#define BALLOON_HOLD 3              /* readings to let a shrink take effect */
+#define BALLOON_CALM 5              /* low readings before a grow */
+#define BALLOON_PSI_HIGH 10.0       /* percent of time stalled */
+#define BALLOON_PSI_LOW 1.0
+#define BALLOON_CGROUP_HIGH 95.0    /* percent of the cgroup limit */
+#define BALLOON_CGROUP_LOW 85.0
+
+static bool use_psi;
+static char balloon_path[PATH_MAX];
+static double high_mark, low_mark;
+
+static pthread_mutex_t balloon_lock = PTHREAD_MUTEX_INITIALIZER;
+static double pressure = 0;
+static uint64_t readings = 0;
+static uint64_t read_errors = 0;
+static uint64_t shrinks = 0;
+static uint64_t grows = 0;
+
+/* Directory of our cgroup in the v2 hierarchy */
+static bool cgroup_dir(char *dir, const size_t len) {
+    char line[PATH_MAX];
+    bool found = false;
+    FILE *f = fopen("/proc/self/cgroup", "r");
+
+    if (f == NULL)
+        return false;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            found = snprintf(dir, len, "/sys/fs/cgroup%s", line + 3) < (int)len;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+bool balloon_init(void) {
+    const char *path = getenv("T_MEMD_BALLOON_PATH");
+
+    if (strcmp(settings.balloon, "psi") == 0) {
+        use_psi = true;
+        high_mark = BALLOON_PSI_HIGH;
+        low_mark = BALLOON_PSI_LOW;
+        snprintf(balloon_path, sizeof(balloon_path), "%s",
+                 path ? path : "/proc/pressure/memory");
+    } else if (strcmp(settings.balloon, "cgroup") == 0) {
+        use_psi = false;
+        high_mark = BALLOON_CGROUP_HIGH;
+        low_mark = BALLOON_CGROUP_LOW;
+        if (path != NULL) {
+            snprintf(balloon_path, sizeof(balloon_path), "%s", path);
+        } else if (!cgroup_dir(balloon_path, sizeof(balloon_path))) {
+            fprintf(stderr, "balloon=cgroup needs a cgroup v2 hierarchy\n");
+            return false;
+        }
+    } else {
+        fprintf(stderr, "balloon must be psi or cgroup\n");
+        return false;
+    }
+
+    if (settings.balloon_max == 0)
+        settings.balloon_max = settings.maxbytes;
+    if (settings.balloon_min == 0)
+        settings.balloon_min = settings.balloon_max / 4;
+    if (settings.balloon_min < settings.slab_page_size)
+        settings.balloon_min = settings.slab_page_size;
+    if (settings.balloon_step == 0)
+        settings.balloon_step = settings.balloon_max / 16;
+    if (settings.balloon_step < settings.slab_page_size)
+        settings.balloon_step = settings.slab_page_size;
+    if (settings.balloon_min > settings.balloon_max) {
+        fprintf(stderr, "balloon_min must not be above balloon_max\n");
+        return false;
+    }
+    return true;
+}
+
+static bool read_psi(double *value) {
+    char line[256];
+    bool found = false;
+    FILE *f = fopen(balloon_path, "r");
+
+    if (f == NULL)
+        return false;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "some avg10=%lf", value) == 1) {
+            found = true;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/* A cgroup memory file holds a byte count, or "max" for no limit */
+static bool read_cgroup_file(const char *name, uint64_t *value) {
+    char file[PATH_MAX + 32];
+    char buf[64];
+    bool ok = false;
+    FILE *f;
+
+    snprintf(file, sizeof(file), "%s/%s", balloon_path, name);
+    if ((f = fopen(file, "r")) == NULL)
+        return false;
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        if (strncmp(buf, "max", 3) == 0) {
+            *value = 0;
+            ok = true;
+        } else {
+            ok = safe_strtoull(buf, value);
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+static bool read_cgroup(double *value) {
+    uint64_t current, limit;
+
+    if (!read_cgroup_file("memory.current", &current) ||
+        !read_cgroup_file("memory.high", &limit))
+        return false;
+    if (limit == 0 && !read_cgroup_file("memory.max", &limit))
+        return false;
+    /* Without a limit there is nothing to make room for */
+    *value = limit ? (double)current * 100 / limit : 0;
+    return true;
+}
+
+void balloon_limit_set(const size_t limit) {
+    settings.balloon_max = limit;
+    if (settings.balloon_min > limit)
+        settings.balloon_min = limit;
+}
+
+/* Move the limit by delta bytes within the bounds; true if it changed */
+static bool balloon_resize(const long long delta) {
+    long long limit;
+    bool changed = false;
+
+    memory_limit_lock();
+    limit = (long long)settings.maxbytes + delta;
+    if (limit < (long long)settings.balloon_min)
+        limit = settings.balloon_min;
+    if (limit > (long long)settings.balloon_max)
+        limit = settings.balloon_max;
+    if ((size_t)limit != settings.maxbytes &&
+        memory_shrink_expand((size_t)limit) >= 0) {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Balloon: memory limit %s to %.2f MB\n",
+                    delta < 0 ? "lowered" : "raised", TO_MB(limit));
+        settings.maxbytes = limit;
+        changed = true;
+    }
+    memory_limit_unlock();
+    return changed;
+}
+
+static void *balloon_thread(void *arg) {
+    int calm = 0;
+    int hold = 0;
+
+    while (1) {
+        double value;
+        bool ok;
+
+        sleep(BALLOON_INTERVAL);
+        ok = use_psi ? read_psi(&value) : read_cgroup(&value);
+
+        pthread_mutex_lock(&balloon_lock);
+        if (ok) {
+            readings++;
+            pressure = value;
+        } else {
+            read_errors++;
+        }
+        pthread_mutex_unlock(&balloon_lock);
+        if (!ok)
+            continue;
+
+        if (hold > 0)
+            hold--;
+        if (value >= high_mark) {
+            calm = 0;
+            if (hold == 0 && balloon_resize(-(long long)settings.balloon_step)) {
+                hold = BALLOON_HOLD;
+                pthread_mutex_lock(&balloon_lock);
+                shrinks++;
+                pthread_mutex_unlock(&balloon_lock);
+            }
+        } else if (value <= low_mark) {
+            if (++calm >= BALLOON_CALM) {
+                calm = 0;
+                if (balloon_resize(settings.balloon_step)) {
+                    pthread_mutex_lock(&balloon_lock);
+                    grows++;
+                    pthread_mutex_unlock(&balloon_lock);
+                }
+            }
+        } else {
+            calm = 0;
+        }
+    }
+    return NULL;
+}
+
+int start_balloon_thread(void) {
+    pthread_t tid;
+    int ret;
+
+    if ((ret = pthread_create(&tid, NULL, balloon_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create balloon thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void balloon_stats(ADD_STAT add_stats, void *c) {
+    pthread_mutex_lock(&balloon_lock);
+    APPEND_STAT("balloon_pressure", "%.2f", pressure);
+    APPEND_STAT("balloon_readings", "%llu", (unsigned long long)readings);
+    APPEND_STAT("balloon_read_errors", "%llu", (unsigned long long)read_errors);
+    APPEND_STAT("balloon_shrinks", "%llu", (unsigned long long)shrinks);
+    APPEND_STAT("balloon_grows", "%llu", (unsigned long long)grows);
+    pthread_mutex_unlock(&balloon_lock);
+}
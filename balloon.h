@@ -0,0 +1,17 @@
+#ifndef BALLOON_H
+#define BALLOON_H
+/* memory pressure driven resizing */
+
+/** Check the -o balloon settings and fill in the defaults; false if bad */
+bool balloon_init(void);
+
+/** Start the thread resizing the cache with memory pressure */
+int start_balloon_thread(void);
+
+/** The "m" command set the limit; it becomes the highest the controller
+ *  raises it to. Called with memory_limit_lock held. */
+void balloon_limit_set(const size_t limit);
+
+/** Fill buffer with what the controller has seen and done */
+void balloon_stats(ADD_STAT add_stats, void *c);
+#endif
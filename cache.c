@@ -35,6 +35,8 @@ cache_t* cache_create(const char *name, size_t bufsize, size_t align,
     ret->freetotal = initial_pool_size;
     ret->constructor = constructor;
     ret->destructor = destructor;
+    ret->allocated = sizeof(cache_t) + strlen(nm) + 1 +
+        initial_pool_size * sizeof(void*);
 
 #ifndef NDEBUG
     ret->bufsize = bufsize + 2 * sizeof(redzone_pattern);
@@ -54,6 +56,13 @@ static inline void* get_object(void *ptr) {
 #endif
 }
 
+/* Called with the mutex held */
+static inline void cache_grown(cache_t *cache, const int64_t delta) {
+    cache->allocated += delta;
+    if (cache->account != NULL)
+        cache->account(delta);
+}
+
 void cache_destroy(cache_t *cache) {
     while (cache->freecurr > 0) {
         void *ptr = cache->ptr[--cache->freecurr];
@@ -62,6 +71,8 @@ void cache_destroy(cache_t *cache) {
         }
         free(ptr);
     }
+    if (cache->account != NULL)
+        cache->account(-(int64_t)cache->allocated);
     free(cache->name);
     free(cache->ptr);
     pthread_mutex_destroy(&cache->mutex);
@@ -84,6 +95,8 @@ void* cache_alloc(cache_t *cache) {
                 cache->constructor(object, NULL, 0) != 0) {
                 free(ret);
                 object = NULL;
+            } else {
+                cache_grown(cache, cache->bufsize);
             }
         }
     }
@@ -132,6 +145,7 @@ void cache_free(cache_t *cache, void *ptr) {
         size_t newtotal = cache->freetotal * 2;
         void **new_free = realloc(cache->ptr, sizeof(char *) * newtotal);
         if (new_free) {
+            cache_grown(cache, (newtotal - cache->freetotal) * sizeof(char *));
             cache->freetotal = newtotal;
             cache->ptr = new_free;
             cache->ptr[cache->freecurr++] = ptr;
@@ -140,9 +154,25 @@ void cache_free(cache_t *cache, void *ptr) {
                 cache->destructor(ptr, NULL);
             }
             free(ptr);
-
+            cache_grown(cache, -(int64_t)cache->bufsize);
         }
     }
     pthread_mutex_unlock(&cache->mutex);
 }
 
+size_t cache_memory(cache_t *cache) {
+    size_t allocated;
+    pthread_mutex_lock(&cache->mutex);
+    allocated = cache->allocated;
+    pthread_mutex_unlock(&cache->mutex);
+    return allocated;
+}
+
+void cache_set_account(cache_t *cache, cache_account_t *account) {
+    pthread_mutex_lock(&cache->mutex);
+    cache->account = account;
+    if (account != NULL)
+        account(cache->allocated);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
@@ -2,6 +2,7 @@
 #ifndef CACHE_H
 #define CACHE_H
 #include <pthread.h>
+#include <stdint.h>
 
 #ifdef HAVE_UMEM_H
 #include <umem.h>
@@ -10,6 +11,8 @@
 #define cache_free(a, b) umem_cache_free(a, b)
 #define cache_create(a,b,c,d,e) umem_cache_create((char*)a, b, c, d, e, NULL, NULL, NULL, 0)
 #define cache_destroy(a) umem_cache_destroy(a);
+#define cache_memory(a) 0
+#define cache_set_account(a,b)
 
 #else
 
@@ -37,6 +40,13 @@ typedef int cache_constructor_t(void* obj, void* notused1, int notused2);
  * @return you should return 0, but currently this is not checked
  */
 typedef void cache_destructor_t(void* obj, void* notused);
+/**
+ * Called with the change in the bytes a cache holds, each time it grows or
+ * gives memory back, so the owner can keep a running total.
+ *
+ * @param delta bytes added (or, when negative, released)
+ */
+typedef void cache_account_t(int64_t delta);
 
 /**
  * Definition of the structure to keep track of the internal details of
@@ -56,10 +66,14 @@ typedef struct {
     int freetotal;
     /** The current number of free elements */
     int freecurr;
+    /** Bytes held by this cache, in use or on the free list */
+    size_t allocated;
     /** The constructor to be called each time we allocate more memory */
     cache_constructor_t* constructor;
     /** The destructor to be called each time before we release memory */
     cache_destructor_t* destructor;
+    /** Told of every change to allocated, if set */
+    cache_account_t* account;
 } cache_t;
 
 /**
@@ -111,6 +125,22 @@ void* cache_alloc(cache_t* handle);
  * @param ptr pointer to the object to return.
  */
 void cache_free(cache_t* handle, void* ptr);
+
+/**
+ * Get the number of bytes held by an object cache, counting the objects
+ * handed out and those kept for reuse.
+ * @param handle the object cache to look at
+ */
+size_t cache_memory(cache_t* handle);
+
+/**
+ * Report the memory held by an object cache as it changes: account is
+ * called at once with what the cache holds now, then with each change,
+ * and with what is left when the cache is destroyed.
+ * @param handle the object cache to report on
+ * @param account the function to call
+ */
+void cache_set_account(cache_t* handle, cache_account_t* account);
 #endif
 
 #endif
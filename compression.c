@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Compressed values (-o compress_threshold): values at least that long are
+ * compressed as they're stored, and kept so when that makes them smaller,
+ * which puts them in the slab class of their compressed size. A compressed
+ * value starts with its uncompressed length; the CRLF stays uncompressed.
+ *
+ * Nothing reads a compressed value in place: gets send an uncompressed
+ * copy that lives as long as the reply, and appends and prepends combine
+ * with one. The copies are malloc'd, so a hit never evicts to make room.
+ * The codec is LZ4 when available, zlib otherwise.
+ */
+
+#include "memcached.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#elif defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_LZ4) || defined(HAVE_ZLIB)
+#define HAVE_CODEC 1
+#endif
+
+#ifdef HAVE_CODEC
+/* CPU time of the calling thread, in ns */
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef HAVE_LZ4
+#define CODEC_NAME "lz4"
+
+static size_t codec_bound(const size_t len) {
+    return LZ4_compressBound(len);
+}
+
+static size_t codec_compress(const char *src, const size_t len, char *dst,
+                             const size_t size) {
+    return LZ4_compress_default(src, dst, len, size);
+}
+
+static bool codec_decompress(const char *src, const size_t len, char *dst,
+                             const size_t size) {
+    return LZ4_decompress_safe(src, dst, len, size) == (int)size;
+}
+#else
+#define CODEC_NAME "zlib"
+
+static size_t codec_bound(const size_t len) {
+    return compressBound(len);
+}
+
+static size_t codec_compress(const char *src, const size_t len, char *dst,
+                             const size_t size) {
+    uLongf out = size;
+    if (compress2((Bytef *)dst, &out, (const Bytef *)src, len,
+                  Z_BEST_SPEED) != Z_OK)
+        return 0;
+    return out;
+}
+
+static bool codec_decompress(const char *src, const size_t len, char *dst,
+                             const size_t size) {
+    uLongf out = size;
+    return uncompress((Bytef *)dst, &out, (const Bytef *)src, len) == Z_OK &&
+           out == size;
+}
+#endif
+
+bool compression_init(void) {
+    return true;
+}
+
+const char *compression_codec(void) {
+    return CODEC_NAME;
+}
+
+/* The thread's buffer to compress into, grown to hold size bytes */
+static char *compress_buffer(LIBEVENT_THREAD *t, const size_t size) {
+    char *buf;
+
+    if (t->compress_size >= size)
+        return t->compress_buf;
+    if ((buf = realloc(t->compress_buf, size)) == NULL)
+        return NULL;
+    memory_account(MEMORY_THREADS, (int64_t)(size - t->compress_size));
+    t->compress_buf = buf;
+    t->compress_size = size;
+    return buf;
+}
+
+item *item_compress(LIBEVENT_THREAD *t, item *it) {
+    const uint32_t len = it->nbytes - 2;
+    const uint64_t start = thread_cpu_ns();
+    item *new_it = NULL;
+    size_t packed = 0;
+    char *buf;
+
+    if ((buf = compress_buffer(t, codec_bound(len))) != NULL)
+        packed = codec_compress(ITEM_data(it), len, buf, t->compress_size);
+    if (packed > 0 && packed + sizeof(len) < len) {
+        new_it = item_alloc(ITEM_key(it), it->nkey,
+                            (int) strtol(ITEM_suffix(it), NULL, 10),
+                            it->exptime, sizeof(len) + packed + 2);
+    }
+    if (new_it != NULL) {
+        memcpy(ITEM_data(new_it), &len, sizeof(len));
+        memcpy(ITEM_data(new_it) + sizeof(len), buf, packed);
+        memcpy(ITEM_data(new_it) + new_it->nbytes - 2, "\r\n", 2);
+        ITEM_set_cas(new_it, ITEM_get_cas(it));
+        new_it->it_flags |= ITEM_COMPRESSED;
+        THREAD_STATS_INCR(t, compressed_items);
+        THREAD_STATS_ADD(t, compress_bytes_in, len);
+        THREAD_STATS_ADD(t, compress_bytes_out, new_it->nbytes - 2);
+    }
+    THREAD_STATS_INCR(t, compress_cmds);
+    THREAD_STATS_ADD(t, compress_time, thread_cpu_ns() - start);
+    return new_it;
+}
+
+item *item_decompress(LIBEVENT_THREAD *t, item *it) {
+    const uint64_t start = thread_cpu_ns();
+    uint32_t len;
+    item *new_it;
+
+    assert(it->it_flags & ITEM_COMPRESSED);
+    memcpy(&len, ITEM_data(it), sizeof(len));
+    new_it = item_alloc_heap(it, len + 2);
+    if (new_it == NULL)
+        return NULL;
+    if (!codec_decompress(ITEM_data(it) + sizeof(len),
+                          it->nbytes - 2 - sizeof(len), ITEM_data(new_it), len)) {
+        /* Nobody else can see the copy, so no item lock is needed */
+        do_item_remove(new_it);
+        return NULL;
+    }
+    memcpy(ITEM_data(new_it) + len, "\r\n", 2);
+    ITEM_set_cas(new_it, ITEM_get_cas(it));
+    THREAD_STATS_INCR(t, decompress_cmds);
+    THREAD_STATS_ADD(t, decompress_time, thread_cpu_ns() - start);
+    return new_it;
+}
+#else
+bool compression_init(void) {
+    fprintf(stderr, "memcached was built without a compression library\n");
+    return false;
+}
+
+const char *compression_codec(void) {
+    return "none";
+}
+
+item *item_compress(LIBEVENT_THREAD *t, item *it) {
+    return NULL;
+}
+
+item *item_decompress(LIBEVENT_THREAD *t, item *it) {
+    return NULL;
+}
+#endif
@@ -0,0 +1,23 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+/* Values stored compressed, -o compress_threshold */
+
+/** False if memcached was built without a codec */
+bool compression_init(void);
+
+/** Name of the codec in use */
+const char *compression_codec(void);
+
+/**
+ * A compressed copy of it, unlinked and with the same key, flags, expiry
+ * and cas, or NULL when that would not be smaller or there's no memory.
+ */
+item *item_compress(LIBEVENT_THREAD *t, item *it);
+
+/**
+ * An uncompressed copy of a compressed item, unlinked and outside the slabs,
+ * or NULL when there's no memory. It's freed with the last reference as
+ * usual.
+ */
+item *item_decompress(LIBEVENT_THREAD *t, item *it);
+#endif
@@ -0,0 +1,101 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * CRC32C (Castagnoli) as a key hash.
+ *
+ * x86 CPUs with SSE4.2 and ARMv8 CPUs with the CRC extension compute it in
+ * hardware, eight bytes per instruction. SSE4.2 is checked at run time, so
+ * one binary runs everywhere; the ARMv8 instructions are only used when
+ * the compiler targets them. Other machines use the table below, which
+ * gives the same values.
+ */
+#include "memcached.h"
+#include "crc32c.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42 1
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[256];
+static bool crc32c_table_ready = false;
+
+static void crc32c_table_init(void) {
+    uint32_t i, j, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        crc32c_table[i] = crc;
+    }
+    crc32c_table_ready = true;
+}
+
+uint32_t crc32c_sw(const void *key, size_t length) {
+    const uint8_t *p = key;
+    uint32_t crc = 0xffffffff;
+
+    while (length--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const void *key, size_t length) {
+    const uint8_t *p = key;
+#ifdef __x86_64__
+    uint64_t crc = 0xffffffff;
+    uint64_t word;
+
+    for (; length >= 8; length -= 8, p += 8) {
+        memcpy(&word, p, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+#else
+    uint32_t crc = 0xffffffff;
+    uint32_t word;
+
+    for (; length >= 4; length -= 4, p += 4) {
+        memcpy(&word, p, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    while (length--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return ~(uint32_t)crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_armv8(const void *key, size_t length) {
+    const uint8_t *p = key;
+    uint32_t crc = 0xffffffff;
+    uint64_t word;
+
+    for (; length >= 8; length -= 8, p += 8) {
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    while (length--)
+        crc = __crc32cb(crc, *p++);
+    return ~crc;
+}
+#endif
+
+hash_func crc32c_hash_func(void) {
+#ifdef CRC32C_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32c_sse42;
+#elif defined(__ARM_FEATURE_CRC32)
+    return crc32c_armv8;
+#endif
+    if (!crc32c_table_ready)
+        crc32c_table_init();
+    return crc32c_sw;
+}
@@ -0,0 +1,19 @@
+#ifndef CRC32C_H
+#define    CRC32C_H
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+/** CRC32C of the key, computed a byte at a time from a table */
+uint32_t crc32c_sw(const void *key, size_t length);
+
+/** Returns the fastest CRC32C this machine can run */
+hash_func crc32c_hash_func(void);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif    /* CRC32C_H */
+
@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Elastic memory scenarios: run mcload against a fresh memcached while the
+# memory limit is lowered and raised, or pages are moved between classes,
+# and print throughput, latency percentiles and hit ratio every second.
+#
+# Usage: devtools/elastic-bench.sh [scenario...]
+#   shrink    fill 64 MB, then lower the limit to 32 and 16 MB
+#   expand    start at 16 MB and raise the limit to 32 and 64 MB
+#   reassign  move pages between two busy classes and back
+#   all       all of the above (the default)
+#
+# Run it from the build directory, or set MEMCACHED and MCLOAD. PORT picks
+# the port (default 21987); MCLOAD_ARGS is passed on to mcload, e.g.
+# "-P binary -r 50000" for an open loop run over the binary protocol.
+
+MEMCACHED=${MEMCACHED:-./memcached}
+MCLOAD=${MCLOAD:-./mcload}
+PORT=${PORT:-21987}
+MCLOAD_ARGS=${MCLOAD_ARGS:-}
+
+if [ ! -x "$MEMCACHED" ] || [ ! -x "$MCLOAD" ]; then
+    echo "Can't find $MEMCACHED and $MCLOAD, run make first" >&2
+    exit 1
+fi
+
+USER_ARG=
+if [ "$(id -u)" = 0 ]; then
+    USER_ARG="-u nobody"
+fi
+
+run() {
+    name=$1
+    limit=$2
+    shift 2
+    echo "=== $name"
+    $MEMCACHED $USER_ARG -p $PORT -U 0 -m $limit \
+        -o slab_reassign,slab_automove=1 &
+    pid=$!
+    sleep 1
+    $MCLOAD -p $PORT "$@" $MCLOAD_ARGS
+    kill $pid
+    wait $pid 2>/dev/null
+    echo
+}
+
+shrink() {
+    run shrink 64 -d 30 -l -n 60000 -v 500-1500 -z 0.99 \
+        -e "10:m 32" -e "20:m 16"
+}
+
+expand() {
+    run expand 16 -d 30 -l -n 60000 -v 500-1500 -z 0.99 -g 0.8 \
+        -e "10:m 32" -e "20:m 64"
+}
+
+reassign() {
+    # Values span classes 3 and 4 with the default factor and key size;
+    # more keys than fit, so every page is in use when it is moved
+    run reassign 32 -d 20 -l -n 250000 -v 50-100 -w 8 \
+        -e "5:slabs reassign 3 4" -e "10:slabs reassign 4 3" \
+        -e "15:slabs reassign 3 4"
+}
+
+[ $# -gt 0 ] || set -- all
+for scenario in "$@"; do
+    case $scenario in
+        shrink|expand|reassign)
+            $scenario
+            ;;
+        all)
+            shrink
+            expand
+            reassign
+            ;;
+        *)
+            echo "Unknown scenario $scenario" >&2
+            exit 1
+            ;;
+    esac
+done
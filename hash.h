@@ -5,7 +5,19 @@
 extern "C" {
 #endif
 
-uint32_t hash(const void *key, size_t length, const uint32_t initval);
+typedef uint32_t (*hash_func)(const void *key, size_t length);
+
+/* The key hash picked by hash_init, called everywhere a key is hashed */
+extern hash_func hash;
+
+enum hashfunc_type {
+    JENKINS_HASH = 0,
+    MURMUR3_HASH,
+    CRC32C_HASH
+};
+
+/** Selects the key hash; returns -1 for an unknown type */
+int hash_init(enum hashfunc_type type);
 
 #ifdef    __cplusplus
 }
@@ -17,13 +17,6 @@
 static void item_link_q(item *it);
 static void item_unlink_q(item *it);
 
-/*
- * We only reposition items in the LRU queue if they haven't been repositioned
- * in this many seconds. That saves us from churning on frequently-accessed
- * items.
- */
-#define ITEM_UPDATE_INTERVAL 60
-
 #define LARGEST_ID POWER_LARGEST
 typedef struct {
     uint64_t evicted;
@@ -34,17 +27,230 @@ typedef struct {
     uint64_t tailrepairs;
     uint64_t expired_unfetched;
     uint64_t evicted_unfetched;
+    uint64_t crawler_reclaimed;
 } itemstats_t;
 
-static item *heads[LARGEST_ID];
-static item *tails[LARGEST_ID];
+/*
+ * Each class LRU is split into settings.lru_shards lists, picked by the top
+ * bits of the key hash. A list is only changed with its lru lock held. Links
+ * and unlinks also hold cache_lock, which keeps every linked item alive, so
+ * moving an item to the head needs nothing but the lru lock.
+ */
+#define LRU_SHARD(it) (((it)->hv >> 28) & (settings.lru_shards - 1))
+
+/* Counts an allocation path stat on the calling worker's own stats; other
+ * threads share the global ones. */
+#define ITEM_STATS_INCR(field) do { \
+        LIBEVENT_THREAD *me_ = worker_thread_self(); \
+        if (me_ != NULL) { \
+            THREAD_STATS_INCR(me_, field); \
+        } else { \
+            STATS_LOCK(); \
+            stats.field++; \
+            STATS_UNLOCK(); \
+        } \
+    } while (0)
+
+static item *heads[LARGEST_ID][LRU_SHARDS_MAX];
+static item *tails[LARGEST_ID][LRU_SHARDS_MAX];
 static itemstats_t itemstats[LARGEST_ID];
-static unsigned int sizes[LARGEST_ID];
+static unsigned int sizes[LARGEST_ID][LRU_SHARDS_MAX];
+static pthread_mutex_t lru_locks[LARGEST_ID][LRU_SHARDS_MAX];
+/* Where the LRU crawler carries on in each list; see item_crawl_batch() */
+static item *crawler_cursor[LARGEST_ID][LRU_SHARDS_MAX];
+
+/*
+ * Ghost lists: the hashes of recently evicted keys, so a miss on one of them
+ * can be charged to the class that evicted it. Each class remembers its last
+ * GHOST_PAGES pages' worth of evictions in an index of its own, made at its
+ * first eviction with twice that many slots, so a busy class can't push out
+ * the ghosts of a quiet one. A slot packs the full hash and the class
+ * eviction sequence number in 64 bits. The index is GHOST_WAYS-way set
+ * associative: a new ghost takes the oldest slot of its set. Slots are read
+ * and written without locks; a race just forgets a ghost.
+ */
+#define GHOST_PAGES 4
+#define GHOST_WAYS 4
+#define GHOST_INDEX_POWER 16    /* the most slots a class gets, as a power */
+
+static uint64_t *ghost_index[LARGEST_ID];
+static uint32_t ghost_mask[LARGEST_ID];
+static unsigned int ghost_top = 0; /* largest class with an index */
+static uint32_t ghost_seq[LARGEST_ID];
+static uint64_t ghost_hits[LARGEST_ID];
+static pthread_mutex_t ghost_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Sizes of the linked items (-o slab_adaptive), kept up to date on link and
+ * unlink so the slab class geometry can be fitted to them without walking
+ * the LRUs. Bucket i counts the items of ((i - 1) * width, i * width]
+ * bytes; the width is a multiple of CHUNK_ALIGN_BYTES, so a bucket top is
+ * always a valid chunk size. Guarded by cache_lock.
+ */
+#define SIZE_HIST_MAX (1 << 17)
+static unsigned int *size_hist = NULL;
+static unsigned int size_hist_buckets = 0;
+static unsigned int size_hist_width = 0;
+
+void items_init(void) {
+    int i, s;
+    for (i = 0; i < LARGEST_ID; i++) {
+        for (s = 0; s < LRU_SHARDS_MAX; s++)
+            pthread_mutex_init(&lru_locks[i][s], NULL);
+    }
+
+    if (settings.slab_adaptive > 0) {
+        for (size_hist_width = CHUNK_ALIGN_BYTES;
+             settings.slab_page_size / size_hist_width >= SIZE_HIST_MAX;
+             size_hist_width *= 2)
+            ;
+        size_hist_buckets = settings.slab_page_size / size_hist_width + 1;
+        size_hist = calloc(size_hist_buckets, sizeof(unsigned int));
+        if (size_hist == NULL) {
+            fprintf(stderr, "Failed to allocate the item size histogram\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Bytes an item takes, those of its pieces included */
+static inline size_t item_bytes(item *it) {
+    size_t ntotal = ITEM_ntotal(it);
+    if (it->it_flags & ITEM_CHUNKED)
+        ntotal += it->nbytes - ITEM_chunks(it)->used;
+    return ntotal;
+}
+
+/* Called with cache_lock held */
+static inline void size_hist_count(const item *it, const int n) {
+    if (size_hist != NULL) {
+        unsigned int b = (ITEM_ntotal(it) + size_hist_width - 1) /
+            size_hist_width;
+        if (b < size_hist_buckets)
+            size_hist[b] += n;
+    }
+}
+
+unsigned int item_size_hist(unsigned int *hist, unsigned int *width) {
+    if (size_hist == NULL)
+        return 0;
+    if (hist != NULL) {
+        mutex_lock(&cache_lock);
+        memcpy(hist, size_hist, size_hist_buckets * sizeof(unsigned int));
+        mutex_unlock(&cache_lock);
+    }
+    *width = size_hist_width;
+    return size_hist_buckets;
+}
+
+/* True if a went into the LRU before b. Times only have a second's
+ * resolution, so ties are broken on the CAS id, handed out at link time. */
+static inline bool lru_older(const item *a, const item *b) {
+    if (a->time != b->time)
+        return a->time < b->time;
+    return ITEM_get_cas(a) < ITEM_get_cas(b);
+}
+
+/* Finds the shard of a class whose tail item is the oldest, and returns it
+ * with that item in *tail, or -1 if the class has no items. Without CAS ids
+ * ties go round robin. Called with cache_lock held, which keeps the item
+ * linked after the lru lock is dropped. */
+static int lru_oldest_shard(const unsigned int id, item **tail) {
+    static unsigned int rotor[LARGEST_ID];
+    int i, s, oldest = -1;
+
+    *tail = NULL;
+    rotor[id]++;
+    for (i = 0; i < settings.lru_shards; i++) {
+        s = (rotor[id] + i) & (settings.lru_shards - 1);
+        mutex_lock(&lru_locks[id][s]);
+        if (tails[id][s] != NULL &&
+            (*tail == NULL || lru_older(tails[id][s], *tail))) {
+            *tail = tails[id][s];
+            oldest = s;
+        }
+        mutex_unlock(&lru_locks[id][s]);
+    }
+    return oldest;
+}
 
 void item_stats_reset(void) {
     mutex_lock(&cache_lock);
     memset(itemstats, 0, sizeof(itemstats));
     mutex_unlock(&cache_lock);
+    mutex_lock(&ghost_lock);
+    memset(ghost_hits, 0, sizeof(ghost_hits));
+    mutex_unlock(&ghost_lock);
+}
+
+/* Makes a class's ghost index, with room for GHOST_PAGES pages of
+ * evictions. Called with cache_lock held. */
+static bool item_ghost_index_init(const unsigned int id) {
+    const unsigned int want = 2 * GHOST_PAGES * slabs_perslab(id);
+    unsigned int power = 2;     /* at least GHOST_WAYS */
+    uint64_t *index;
+
+    while (power < GHOST_INDEX_POWER && (1U << power) < want)
+        power++;
+    if ((index = calloc(1 << power, sizeof(uint64_t))) == NULL)
+        return false;
+    memory_account(MEMORY_THREADS, sizeof(uint64_t) << power);
+    ghost_mask[id] = ((1 << power) - 1) & ~(GHOST_WAYS - 1);
+    /* Misses read the index without locks */
+    memory_barrier();
+    ghost_index[id] = index;
+    if (id > ghost_top)
+        ghost_top = id;
+    return true;
+}
+
+/* Remember an evicted key. Called with cache_lock held. */
+void item_ghost_add(const unsigned int id, const uint32_t hv) {
+    uint64_t *set;
+    unsigned int i, oldest = 0;
+
+    if (ghost_index[id] == NULL && !item_ghost_index_init(id))
+        return;
+    set = &ghost_index[id][hv & ghost_mask[id]];
+    for (i = 0; i < GHOST_WAYS; i++) {
+        if (set[i] == 0) {
+            oldest = i;
+            break;
+        }
+        if ((uint32_t)set[i] - (uint32_t)set[oldest] >= (1U << 31))
+            oldest = i;
+    }
+    set[oldest] = ((uint64_t)hv << 32) | ++ghost_seq[id];
+}
+
+/* Charge a miss to the class that recently evicted this key, if any. */
+static void item_ghost_check(const uint32_t hv) {
+    const unsigned int top = ghost_top;
+    unsigned int id, i;
+
+    for (id = POWER_SMALLEST; id <= top; id++) {
+        uint64_t *index = ghost_index[id];
+
+        if (index == NULL)
+            continue;
+        for (i = 0; i < GHOST_WAYS; i++) {
+            uint64_t *slot = &index[(hv & ghost_mask[id]) + i];
+            uint64_t entry = *slot;
+
+            if (entry == 0 || (uint32_t)(entry >> 32) != hv ||
+                ghost_seq[id] - (uint32_t)entry >=
+                    GHOST_PAGES * slabs_perslab(id))
+                continue;
+
+            mutex_lock(&ghost_lock);
+            if (*slot == entry) {
+                *slot = 0;
+                ghost_hits[id]++;
+            }
+            mutex_unlock(&ghost_lock);
+            return;
+        }
+    }
 }
 
 
@@ -84,66 +290,97 @@ static size_t item_make_header(const uint8_t nkey, const int flags, const int nb
     return sizeof(item) + nkey + *nsuffix + nbytes;
 }
 
-/*@null@*/
-item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes) {
-    uint8_t nsuffix;
-    item *it = NULL;
-    char suffix[40];
-    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, suffix, &nsuffix);
-    if (settings.use_cas) {
-        ntotal += sizeof(uint64_t);
+/* Frees the pieces of a chunked item */
+static void item_free_chunks(item *it) {
+    item_chunk *ch, *next;
+
+    for (ch = ITEM_chunks(it)->first; ch != NULL; ch = next) {
+        unsigned int clsid = ch->slabs_clsid;
+        next = ch->next;
+        ch->refcount = 0;
+        ch->it_flags = 0;
+        ch->slabs_clsid = 0;
+        slabs_free(ch, sizeof(item_chunk) + ch->size, clsid);
     }
+    ITEM_chunks(it)->first = NULL;
+}
 
-    unsigned int id = slabs_clsid(ntotal);
-    if (id == 0)
-        return 0;
+/*
+ * Takes back the reference the crawler keeps its place with, when that is
+ * the item an allocation wants to evict or reclaim; otherwise the tail
+ * would stay busy while the crawler sleeps. The crawler starts from the
+ * tail again. Called with cache_lock held.
+ */
+static void crawler_cursor_release(item *it) {
+    item **cursor = &crawler_cursor[it->slabs_clsid][LRU_SHARD(it)];
 
-    mutex_lock(&cache_lock);
+    if (*cursor == it) {
+        *cursor = NULL;
+        refcount_decr(&it->refcount);
+    }
+}
+
+/*
+ * A chunk of class id for ntotal bytes: that of the LRU tail if it's dead,
+ * else a free one, else the tail's by evicting it. The caller sets up the
+ * refcount. Called with cache_lock held.
+ */
+static item *do_item_alloc_chunk(const size_t ntotal, const unsigned int id) {
     /* do a quick check if we have any expired items in the tail.. */
+    item *it = NULL;
     item *search;
+    void *hold_lock = NULL;
+    uint32_t search_hv = 0;
     rel_time_t oldest_live = settings.oldest_live;
 
-    search = tails[id];
+    lru_oldest_shard(id, &search);
+    /* Readers only hold the item lock, so the tail item may only be touched
+     * if we can take its lock too. If it's busy treat the LRU as locked. */
+    if (search != NULL) {
+        search_hv = search->hv;
+        if ((hold_lock = item_trylock(search_hv)) == NULL)
+            search = NULL;
+        else
+            crawler_cursor_release(search);
+    }
     if (search != NULL && (refcount_incr(&search->refcount) == 2)) {
         if ((search->exptime != 0 && search->exptime < current_time)
             || (search->time <= oldest_live && oldest_live <= current_time)) {  // dead by flush
-            STATS_LOCK();
-            stats.reclaimed++;
-            STATS_UNLOCK();
+            ITEM_STATS_INCR(reclaimed);
             itemstats[id].reclaimed++;
             if ((search->it_flags & ITEM_FETCHED) == 0) {
-                STATS_LOCK();
-                stats.expired_unfetched++;
-                STATS_UNLOCK();
+                ITEM_STATS_INCR(expired_unfetched);
                 itemstats[id].expired_unfetched++;
             }
             it = search;
-            slabs_adjust_mem_requested(it->slabs_clsid, ITEM_ntotal(it), ntotal);
-            do_item_unlink_nolock(it, hash(ITEM_key(it), it->nkey, 0));
+            slabs_adjust_mem_requested(it->slabs_clsid, it, ITEM_ntotal(it), ntotal);
+            do_item_unlink_nolock(it, search_hv);
+            if (it->it_flags & ITEM_CHUNKED)
+                item_free_chunks(it);
             /* Initialize the item block: */
             it->slabs_clsid = 0;
         } else if ((it = slabs_alloc(ntotal, id)) == NULL) {
             if (settings.evict_to_free == 0) {
                 itemstats[id].outofmemory++;
-                mutex_unlock(&cache_lock);
+                refcount_decr(&search->refcount);
+                item_trylock_unlock(hold_lock);
                 return NULL;
             }
+            item_ghost_add(id, search_hv);
             itemstats[id].evicted++;
             itemstats[id].evicted_time = current_time - search->time;
             if (search->exptime != 0)
                 itemstats[id].evicted_nonzero++;
             if ((search->it_flags & ITEM_FETCHED) == 0) {
-                STATS_LOCK();
-                stats.evicted_unfetched++;
-                STATS_UNLOCK();
+                ITEM_STATS_INCR(evicted_unfetched);
                 itemstats[id].evicted_unfetched++;
             }
-            STATS_LOCK();
-            stats.evictions++;
-            STATS_UNLOCK();
+            ITEM_STATS_INCR(evictions);
             it = search;
-            slabs_adjust_mem_requested(it->slabs_clsid, ITEM_ntotal(it), ntotal);
-            do_item_unlink_nolock(it, hash(ITEM_key(it), it->nkey, 0));
+            slabs_adjust_mem_requested(it->slabs_clsid, it, ITEM_ntotal(it), ntotal);
+            do_item_unlink_nolock(it, search_hv);
+            if (it->it_flags & ITEM_CHUNKED)
+                item_free_chunks(it);
             /* Initialize the item block: */
             it->slabs_clsid = 0;
 
@@ -179,20 +416,107 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_tim
             search->time + TAIL_REPAIR_TIME < current_time) {
             itemstats[id].tailrepairs++;
             search->refcount = 1;
-            do_item_unlink_nolock(search, hash(ITEM_key(search), search->nkey, 0));
+            do_item_unlink_nolock(search, search_hv);
         }
+        if (hold_lock)
+            item_trylock_unlock(hold_lock);
+        return NULL;
+    }
+
+    if (hold_lock)
+        item_trylock_unlock(hold_lock);
+    return it;
+}
+
+/*
+ * Gives a chunked item the pieces for the rest of its value, from the
+ * largest class but for the last, which comes from the class it fits if
+ * that has room. The last piece holds at least two bytes, so the CRLF is
+ * never split. Called with cache_lock held.
+ */
+static bool do_item_alloc_pieces(item *it) {
+    const int max = settings.slab_page_size - sizeof(item_chunk);
+    const unsigned int largest = slabs_clsid(settings.slab_page_size);
+    item_chunks *chunks = ITEM_chunks(it);
+    item_chunk *ch, *prev = NULL;
+    unsigned int id;
+    int rest, size;
+
+    chunks->first = NULL;
+    chunks->used = (char *)it + settings.slab_page_size - (char *)(chunks + 1);
+    rest = it->nbytes - chunks->used;
+    if (rest < 2) {
+        chunks->used -= 2 - rest;
+        rest = 2;
+    }
+    while (rest > 0) {
+        size = rest > max ? max : rest;
+        if (rest - size == 1)
+            size--;
+        id = slabs_clsid(sizeof(item_chunk) + size);
+        ch = (item_chunk *)do_item_alloc_chunk(sizeof(item_chunk) + size, id);
+        if (ch == NULL && id != largest) {
+            id = largest;
+            ch = (item_chunk *)do_item_alloc_chunk(sizeof(item_chunk) + size, id);
+        }
+        if (ch == NULL)
+            return false;
+
+        ch->next = NULL;
+        ch->prev = prev;
+        ch->head = it;
+        ch->size = ch->used = size;
+        ch->refcount = 1;
+        ch->it_flags = ITEM_CHUNK;
+        ch->slabs_clsid = id;
+        ch->hv = it->hv;
+        if (prev != NULL)
+            prev->next = ch;
+        else
+            chunks->first = ch;
+        prev = ch;
+        rest -= size;
+    }
+    return true;
+}
+
+/*@null@*/
+item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes) {
+    uint8_t nsuffix;
+    item *it = NULL;
+    char suffix[40];
+    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, suffix, &nsuffix);
+    bool chunked;
+    if (settings.use_cas) {
+        ntotal += sizeof(uint64_t);
+    }
+
+    /* Values past the largest class go on in pieces */
+    if (ntotal > settings.item_size_max)
+        return 0;
+    chunked = ntotal > settings.slab_page_size;
+    if (chunked)
+        ntotal = settings.slab_page_size;
+
+    unsigned int id = slabs_clsid(ntotal);
+    if (id == 0)
+        return 0;
+
+    latency_lock(&cache_lock, LATENCY_CACHE_LOCK, mutex_lock);
+    if ((it = do_item_alloc_chunk(ntotal, id)) == NULL) {
         mutex_unlock(&cache_lock);
         return NULL;
     }
 
     assert(it->slabs_clsid == 0);
-    assert(it != heads[id]);
+    assert(it != heads[id][LRU_SHARD(it)]);
 
     /* Item initialization can happen outside of the lock; the item's already
-     * been removed from the slab LRU.
+     * been removed from the slab LRU. A chunked one needs it for its pieces.
      */
     it->refcount = 1;     /* the caller will have a reference */
-    mutex_unlock(&cache_lock);
+    if (!chunked)
+        mutex_unlock(&cache_lock);
     it->next = it->prev = it->h_next = 0;
     it->slabs_clsid = id;
 
@@ -201,9 +525,20 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_tim
     it->nkey = nkey;
     it->nbytes = nbytes;
     memcpy(ITEM_key(it), key, nkey);
+    it->hv = hash(key, nkey);
     it->exptime = exptime;
     memcpy(ITEM_suffix(it), suffix, (size_t)nsuffix);
     it->nsuffix = nsuffix;
+
+    if (chunked) {
+        it->it_flags |= ITEM_CHUNKED;
+        if (!do_item_alloc_pieces(it)) {
+            it->refcount = 0;
+            item_free(it);
+            it = NULL;
+        }
+        mutex_unlock(&cache_lock);
+    }
     return it;
 }
 
@@ -211,10 +546,17 @@ void item_free(item *it) {
     size_t ntotal = ITEM_ntotal(it);
     unsigned int clsid;
     assert((it->it_flags & ITEM_LINKED) == 0);
-    assert(it != heads[it->slabs_clsid]);
-    assert(it != tails[it->slabs_clsid]);
+    assert(it != heads[it->slabs_clsid][LRU_SHARD(it)]);
+    assert(it != tails[it->slabs_clsid][LRU_SHARD(it)]);
     assert(it->refcount == 0);
 
+    if (it->it_flags & ITEM_HEAP) {
+        memory_account(MEMORY_CONNECTIONS, -(int64_t)ntotal);
+        free(it);
+        return;
+    }
+    if (it->it_flags & ITEM_CHUNKED)
+        item_free_chunks(it);
     /* so slab size changer can tell later if item is already free or not */
     clsid = it->slabs_clsid;
     it->slabs_clsid = 0;
@@ -222,6 +564,106 @@ void item_free(item *it) {
     slabs_free(it, ntotal, clsid);
 }
 
+/*
+ * An unlinked item with the key, flags, expiry and class of it, and room for
+ * nbytes of value, in malloc'd memory rather than a slab chunk: making one
+ * never evicts anything. The caller fills in the value and cas; it's freed
+ * with its last reference. NULL when there's no memory.
+ */
+item *item_alloc_heap(const item *it, const int nbytes) {
+    uint8_t nsuffix;
+    char suffix[40];
+    size_t ntotal = item_make_header(it->nkey + 1,
+                                     (int) strtol(ITEM_suffix(it), NULL, 10),
+                                     nbytes, suffix, &nsuffix);
+    item *copy;
+
+    if (settings.use_cas)
+        ntotal += sizeof(uint64_t);
+    if ((copy = malloc(ntotal)) == NULL)
+        return NULL;
+    memory_account(MEMORY_CONNECTIONS, ntotal);
+
+    copy->next = copy->prev = copy->h_next = 0;
+    copy->refcount = 1;
+    /* The per class hit counters still count the stored item's class */
+    copy->slabs_clsid = it->slabs_clsid;
+    copy->it_flags = (settings.use_cas ? ITEM_CAS : 0) | ITEM_HEAP;
+    copy->nkey = it->nkey;
+    copy->nbytes = nbytes;
+    memcpy(ITEM_key(copy), ITEM_key(it), it->nkey + 1);
+    copy->hv = it->hv;
+    copy->exptime = it->exptime;
+    /* Current, so nothing queues an LRU bump for it */
+    copy->time = current_time;
+    memcpy(ITEM_suffix(copy), suffix, (size_t)nsuffix);
+    copy->nsuffix = nsuffix;
+    return copy;
+}
+
+/* The start of an item's value, the bytes of it there, and the piece the
+ * rest goes on in */
+static char *item_value_start(item *it, int *len, item_chunk **next) {
+    if (it->it_flags & ITEM_CHUNKED) {
+        item_chunks *chunks = ITEM_chunks(it);
+        *len = chunks->used;
+        *next = chunks->first;
+        return (char *)(chunks + 1);
+    }
+    *len = it->nbytes;
+    *next = NULL;
+    return ITEM_data(it);
+}
+
+void item_copy_value(item *dst, int offset, item *src, int n) {
+    item_chunk *dnext, *snext;
+    int dlen, slen, len;
+    char *d = item_value_start(dst, &dlen, &dnext);
+    char *s = item_value_start(src, &slen, &snext);
+
+    while (offset >= dlen) {
+        offset -= dlen;
+        d = dnext->data;
+        dlen = dnext->used;
+        dnext = dnext->next;
+    }
+    d += offset;
+    dlen -= offset;
+    while (n > 0) {
+        if (dlen == 0) {
+            d = dnext->data;
+            dlen = dnext->used;
+            dnext = dnext->next;
+        }
+        if (slen == 0) {
+            s = snext->data;
+            slen = snext->used;
+            snext = snext->next;
+        }
+        len = n < dlen ? n : dlen;
+        if (len > slen)
+            len = slen;
+        memcpy(d, s, len);
+        d += len;
+        s += len;
+        dlen -= len;
+        slen -= len;
+        n -= len;
+    }
+}
+
+char *item_crlf(item *it) {
+    item_chunk *ch;
+    int len;
+    char *data = item_value_start(it, &len, &ch);
+
+    if (ch == NULL)
+        return data + len - 2;
+    while (ch->next != NULL)
+        ch = ch->next;
+    return ch->data + ch->used - 2;
+}
+
 /**
  * Returns true if an item will fit in the cache (its size does not exceed
  * the maximum for a cache entry.)
@@ -236,16 +678,18 @@ bool item_size_ok(const size_t nkey, const int flags, const int nbytes) {
         ntotal += sizeof(uint64_t);
     }
 
-    return slabs_clsid(ntotal) != 0;
+    return ntotal <= settings.item_size_max;
 }
 
-static void item_link_q(item *it) { /* item is the new head */
+/* Called with the lru lock of the item's shard held */
+static void lru_link(item *it) { /* item is the new head */
     item **head, **tail;
+    const unsigned int shard = LRU_SHARD(it);
     assert(it->slabs_clsid < LARGEST_ID);
     assert((it->it_flags & ITEM_SLABBED) == 0);
 
-    head = &heads[it->slabs_clsid];
-    tail = &tails[it->slabs_clsid];
+    head = &heads[it->slabs_clsid][shard];
+    tail = &tails[it->slabs_clsid][shard];
     assert(it != *head);
     assert((*head && *tail) || (*head == 0 && *tail == 0));
     it->prev = 0;
@@ -253,15 +697,17 @@ static void item_link_q(item *it) { /* item is the new head */
     if (it->next) it->next->prev = it;
     *head = it;
     if (*tail == 0) *tail = it;
-    sizes[it->slabs_clsid]++;
+    sizes[it->slabs_clsid][shard]++;
     return;
 }
 
-static void item_unlink_q(item *it) {
+/* Called with the lru lock of the item's shard held */
+static void lru_unlink(item *it) {
     item **head, **tail;
+    const unsigned int shard = LRU_SHARD(it);
     assert(it->slabs_clsid < LARGEST_ID);
-    head = &heads[it->slabs_clsid];
-    tail = &tails[it->slabs_clsid];
+    head = &heads[it->slabs_clsid][shard];
+    tail = &tails[it->slabs_clsid][shard];
 
     if (*head == it) {
         assert(it->prev == 0);
@@ -276,22 +722,37 @@ static void item_unlink_q(item *it) {
 
     if (it->next) it->next->prev = it->prev;
     if (it->prev) it->prev->next = it->next;
-    sizes[it->slabs_clsid]--;
+    sizes[it->slabs_clsid][shard]--;
     return;
 }
 
+static void item_link_q(item *it) {
+    pthread_mutex_t *lock = &lru_locks[it->slabs_clsid][LRU_SHARD(it)];
+    mutex_lock(lock);
+    lru_link(it);
+    mutex_unlock(lock);
+}
+
+static void item_unlink_q(item *it) {
+    pthread_mutex_t *lock = &lru_locks[it->slabs_clsid][LRU_SHARD(it)];
+    mutex_lock(lock);
+    lru_unlink(it);
+    mutex_unlock(lock);
+}
+
 int do_item_link(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_LINK(ITEM_key(it), it->nkey, it->nbytes);
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
-    mutex_lock(&cache_lock);
+    latency_lock(&cache_lock, LATENCY_CACHE_LOCK, mutex_lock);
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
 
     STATS_LOCK();
-    stats.curr_bytes += ITEM_ntotal(it);
+    stats.curr_bytes += item_bytes(it);
     stats.curr_items += 1;
     stats.total_items += 1;
     STATS_UNLOCK();
+    size_hist_count(it, 1);
 
     /* Allocate a new CAS ID on link. */
     ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
@@ -300,18 +761,22 @@ int do_item_link(item *it, const uint32_t hv) {
     refcount_incr(&it->refcount);
     mutex_unlock(&cache_lock);
 
+    if (settings.mrc_samples)
+        mrc_link(hv, it);
+
     return 1;
 }
 
 void do_item_unlink(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
-    mutex_lock(&cache_lock);
+    latency_lock(&cache_lock, LATENCY_CACHE_LOCK, mutex_lock);
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
         STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
+        stats.curr_bytes -= item_bytes(it);
         stats.curr_items -= 1;
         STATS_UNLOCK();
+        size_hist_count(it, -1);
         assoc_delete(ITEM_key(it), it->nkey, hv);
         item_unlink_q(it);
         do_item_remove(it);
@@ -320,20 +785,29 @@ void do_item_unlink(item *it, const uint32_t hv) {
 }
 
 /* FIXME: Is it necessary to keep this copy/pasted code? */
-void do_item_unlink_nolock(item *it, const uint32_t hv) {
+static void item_unlink_nolock(item *it, const uint32_t hv,
+                               const bool lru_locked) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
         STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
+        stats.curr_bytes -= item_bytes(it);
         stats.curr_items -= 1;
         STATS_UNLOCK();
+        size_hist_count(it, -1);
         assoc_delete(ITEM_key(it), it->nkey, hv);
-        item_unlink_q(it);
+        if (lru_locked)
+            lru_unlink(it);
+        else
+            item_unlink_q(it);
         do_item_remove(it);
     }
 }
 
+void do_item_unlink_nolock(item *it, const uint32_t hv) {
+    item_unlink_nolock(it, hv, false);
+}
+
 void do_item_remove(item *it) {
     MEMCACHED_ITEM_REMOVE(ITEM_key(it), it->nkey, it->nbytes);
     assert((it->it_flags & ITEM_SLABBED) == 0);
@@ -343,19 +817,55 @@ void do_item_remove(item *it) {
     }
 }
 
+/* Moves an item to the head of its list. An item unlinked since it was
+ * looked up is left alone. Called with the lru lock held. */
+static void lru_bump(item *it) {
+    if ((it->it_flags & ITEM_LINKED) != 0) {
+        lru_unlink(it);
+        it->time = current_time;
+        lru_link(it);
+    }
+}
+
 void do_item_update(item *it) {
     MEMCACHED_ITEM_UPDATE(ITEM_key(it), it->nkey, it->nbytes);
     if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
+        pthread_mutex_t *lock = &lru_locks[it->slabs_clsid][LRU_SHARD(it)];
         assert((it->it_flags & ITEM_SLABBED) == 0);
 
-        mutex_lock(&cache_lock);
-        if ((it->it_flags & ITEM_LINKED) != 0) {
-            item_unlink_q(it);
-            it->time = current_time;
-            item_link_q(it);
+        mutex_lock(lock);
+        lru_bump(it);
+        mutex_unlock(lock);
+    }
+}
+
+static int lru_order(const void *a, const void *b) {
+    const item *x = *(item * const *)a, *y = *(item * const *)b;
+    unsigned int kx = x->slabs_clsid * LRU_SHARDS_MAX + LRU_SHARD(x);
+    unsigned int ky = y->slabs_clsid * LRU_SHARDS_MAX + LRU_SHARD(y);
+    return (kx > ky) - (kx < ky);
+}
+
+/* Applies LRU bumps queued by a worker, taking each shard's lru lock once.
+ * The caller holds a reference to every item. */
+void do_item_update_batch(item **items, const int nitems) {
+    pthread_mutex_t *lock = NULL;
+    int i;
+
+    qsort(items, nitems, sizeof(item *), lru_order);
+    for (i = 0; i < nitems; i++) {
+        pthread_mutex_t *next = &lru_locks[items[i]->slabs_clsid][LRU_SHARD(items[i])];
+        MEMCACHED_ITEM_UPDATE(ITEM_key(items[i]), items[i]->nkey, items[i]->nbytes);
+        if (next != lock) {
+            if (lock)
+                mutex_unlock(lock);
+            lock = next;
+            mutex_lock(lock);
         }
-        mutex_unlock(&cache_lock);
+        lru_bump(items[i]);
     }
+    if (lock)
+        mutex_unlock(lock);
 }
 
 int do_item_replace(item *it, item *new_it, const uint32_t hv) {
@@ -367,6 +877,95 @@ int do_item_replace(item *it, item *new_it, const uint32_t hv) {
     return do_item_link(new_it, hv);
 }
 
+/* Moves a linked item into new_it, which already holds a copy of it, keeping
+ * its place in the LRU and in the hash chain. Used by the slab mover to save
+ * items from a page being killed. A copy in a chunk of another class goes
+ * to the head of that class LRU instead.
+ * Called with cache_lock and the item lock held. */
+void do_item_relink(item *it, item *new_it, const uint32_t hv) {
+    unsigned int id = it->slabs_clsid;
+    unsigned int shard = LRU_SHARD(it);
+
+    assert((it->it_flags & ITEM_LINKED) != 0);
+    if (new_it->slabs_clsid != id) {
+        item_unlink_q(it);
+        item_link_q(new_it);
+    } else {
+        mutex_lock(&lru_locks[id][shard]);
+        new_it->prev = it->prev;
+        new_it->next = it->next;
+        if (it->prev) it->prev->next = new_it;
+        if (it->next) it->next->prev = new_it;
+        if (heads[id][shard] == it) heads[id][shard] = new_it;
+        if (tails[id][shard] == it) tails[id][shard] = new_it;
+        mutex_unlock(&lru_locks[id][shard]);
+    }
+    assoc_replace(it, new_it, hv);
+
+    it->prev = it->next = 0;
+    it->it_flags &= ~ITEM_LINKED;
+}
+
+/* Evicts the coldest idle item of a class which doesn't live in
+ * [start, end) and isn't newer than the given time, and hands its chunk
+ * over with a single reference held. Returns NULL if there is no such item
+ * among the few at the tail.
+ * Called with cache_lock held. */
+item *do_item_evict_tail(const unsigned int id, const void *start,
+                         const void *end, const rel_time_t older_than) {
+    item *search, *candidates[5];
+    int tries, ncandidates = 0, i, shard;
+
+    /* Pick from the shard with the oldest tail. The lru lock is only held
+     * while walking it; the candidates stay linked under cache_lock. */
+    if ((shard = lru_oldest_shard(id, &search)) < 0)
+        return NULL;
+    mutex_lock(&lru_locks[id][shard]);
+    for (search = tails[id][shard], tries = 5; tries > 0 && search != NULL;
+         tries--, search = search->prev) {
+        /* A chunked item's pieces would have to be freed too */
+        if (((void *)search >= start && (void *)search < end) ||
+            (search->it_flags & ITEM_CHUNKED))
+            continue;
+        if (search->time > older_than)
+            break;
+        candidates[ncandidates++] = search;
+    }
+    mutex_unlock(&lru_locks[id][shard]);
+
+    for (i = 0; i < ncandidates; i++) {
+        uint32_t hv;
+        void *hold_lock;
+
+        search = candidates[i];
+        hv = search->hv;
+        if ((hold_lock = item_trylock(hv)) == NULL)
+            continue;
+        crawler_cursor_release(search);
+        if (refcount_incr(&search->refcount) != 2) {
+            refcount_decr(&search->refcount);
+            item_trylock_unlock(hold_lock);
+            continue;
+        }
+
+        item_ghost_add(id, hv);
+        itemstats[id].evicted++;
+        itemstats[id].evicted_time = current_time - search->time;
+        if (search->exptime != 0)
+            itemstats[id].evicted_nonzero++;
+        if ((search->it_flags & ITEM_FETCHED) == 0) {
+            ITEM_STATS_INCR(evicted_unfetched);
+            itemstats[id].evicted_unfetched++;
+        }
+        ITEM_STATS_INCR(evictions);
+
+        do_item_unlink_nolock(search, hv);
+        item_trylock_unlock(hold_lock);
+        return search;
+    }
+    return NULL;
+}
+
 /*@null@*/
 char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes) {
     unsigned int memlimit = 2 * 1024 * 1024;   /* 2MB max response size */
@@ -377,27 +976,34 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
     unsigned int shown = 0;
     char key_temp[KEY_MAX_LENGTH + 1];
     char temp[512];
-
-    it = heads[slabs_clsid];
+    bool full = false;
+    int shard;
 
     buffer = malloc((size_t)memlimit);
     if (buffer == 0) return NULL;
     bufcurr = 0;
 
-    while (it != NULL && (limit == 0 || shown < limit)) {
-        assert(it->nkey <= KEY_MAX_LENGTH);
-        /* Copy the key since it may not be null-terminated in the struct */
-        strncpy(key_temp, ITEM_key(it), it->nkey);
-        key_temp[it->nkey] = 0x00; /* terminate */
-        len = snprintf(temp, sizeof(temp), "ITEM %s [%d b; %lu s]\r\n",
-                       key_temp, it->nbytes - 2,
-                       (unsigned long)it->exptime + process_started);
-        if (bufcurr + len + 6 > memlimit)  /* 6 is END\r\n\0 */
-            break;
-        memcpy(buffer + bufcurr, temp, len);
-        bufcurr += len;
-        shown++;
-        it = it->next;
+    for (shard = 0; shard < settings.lru_shards && !full; shard++) {
+        mutex_lock(&lru_locks[slabs_clsid][shard]);
+        it = heads[slabs_clsid][shard];
+        while (it != NULL && (limit == 0 || shown < limit)) {
+            assert(it->nkey <= KEY_MAX_LENGTH);
+            /* Copy the key since it may not be null-terminated in the struct */
+            strncpy(key_temp, ITEM_key(it), it->nkey);
+            key_temp[it->nkey] = 0x00; /* terminate */
+            len = snprintf(temp, sizeof(temp), "ITEM %s [%d b; %lu s]\r\n",
+                           key_temp, it->nbytes - 2,
+                           (unsigned long)it->exptime + process_started);
+            if (bufcurr + len + 6 > memlimit) { /* 6 is END\r\n\0 */
+                full = true;
+                break;
+            }
+            memcpy(buffer + bufcurr, temp, len);
+            bufcurr += len;
+            shown++;
+            it = it->next;
+        }
+        mutex_unlock(&lru_locks[slabs_clsid][shard]);
     }
 
     memcpy(buffer + bufcurr, "END\r\n", 6);
@@ -416,20 +1022,26 @@ void item_stats_evictions(uint64_t *evicted) {
     mutex_unlock(&cache_lock);
 }
 
+void item_stats_ghost_hits(uint64_t *hits) {
+    mutex_lock(&ghost_lock);
+    memcpy(hits, ghost_hits, sizeof(ghost_hits));
+    mutex_unlock(&ghost_lock);
+}
+
 void do_item_stats(ADD_STAT add_stats, void *c) {
-    int i;
+    int i, s;
     for (i = 0; i < LARGEST_ID; i++) {
-        if (tails[i] != NULL) {
+        item *tail;
+        if (lru_oldest_shard(i, &tail) >= 0) {
             const char *fmt = "items:%d:%s";
             char key_str[STAT_KEY_LEN];
             char val_str[STAT_VAL_LEN];
             int klen = 0, vlen = 0;
-            if (tails[i] == NULL) {
-                /* We removed all of the items in this slab class */
-                continue;
-            }
-            APPEND_NUM_FMT_STAT(fmt, i, "number", "%u", sizes[i]);
-            APPEND_NUM_FMT_STAT(fmt, i, "age", "%u", current_time - tails[i]->time);
+            unsigned int size = 0;
+            for (s = 0; s < settings.lru_shards; s++)
+                size += sizes[i][s];
+            APPEND_NUM_FMT_STAT(fmt, i, "number", "%u", size);
+            APPEND_NUM_FMT_STAT(fmt, i, "age", "%u", current_time - tail->time);
             APPEND_NUM_FMT_STAT(fmt, i, "evicted",
                                 "%llu", (unsigned long long)itemstats[i].evicted);
             APPEND_NUM_FMT_STAT(fmt, i, "evicted_nonzero",
@@ -446,6 +1058,12 @@ void do_item_stats(ADD_STAT add_stats, void *c) {
                                 "%llu", (unsigned long long)itemstats[i].expired_unfetched);
             APPEND_NUM_FMT_STAT(fmt, i, "evicted_unfetched",
                                 "%llu", (unsigned long long)itemstats[i].evicted_unfetched);
+            APPEND_NUM_FMT_STAT(fmt, i, "ghost_hits",
+                                "%llu", (unsigned long long)ghost_hits[i]);
+            if (settings.lru_crawler) {
+                APPEND_NUM_FMT_STAT(fmt, i, "crawler_reclaimed", "%llu",
+                                    (unsigned long long)itemstats[i].crawler_reclaimed);
+            }
         }
     }
 
@@ -462,17 +1080,28 @@ void do_item_stats_sizes(ADD_STAT add_stats, void *c) {
     unsigned int *histogram = calloc(num_buckets, sizeof(int));
 
     if (histogram != NULL) {
-        int i;
-
-        /* build the histogram */
-        for (i = 0; i < LARGEST_ID; i++) {
-            item *iter = heads[i];
-            while (iter) {
-                int ntotal = ITEM_ntotal(iter);
-                int bucket = ntotal / 32;
-                if ((ntotal % 32) != 0) bucket++;
-                if (bucket < num_buckets) histogram[bucket]++;
-                iter = iter->next;
+        int i, s;
+
+        if (size_hist != NULL) {
+            /* Fold the kept histogram instead of walking the LRUs */
+            for (i = 1; i < size_hist_buckets; i++) {
+                int bucket = ((uint64_t)i * size_hist_width + 31) / 32;
+                if (bucket < num_buckets) histogram[bucket] += size_hist[i];
+            }
+        } else {
+            /* build the histogram */
+            for (i = 0; i < LARGEST_ID; i++) {
+                for (s = 0; s < settings.lru_shards; s++) {
+                    item *iter;
+                    mutex_lock(&lru_locks[i][s]);
+                    for (iter = heads[i][s]; iter; iter = iter->next) {
+                        int ntotal = item_bytes(iter);
+                        int bucket = ntotal / 32;
+                        if ((ntotal % 32) != 0) bucket++;
+                        if (bucket < num_buckets) histogram[bucket]++;
+                    }
+                    mutex_unlock(&lru_locks[i][s]);
+                }
             }
         }
 
@@ -490,22 +1119,24 @@ void do_item_stats_sizes(ADD_STAT add_stats, void *c) {
 }
 
 /** wrapper around assoc_find which does the lazy expiration logic */
+/* Called with the item lock held, which is all that guards the hash chain
+ * against writers; cache_lock is only taken if we have to unlink. */
 item *do_item_get(const char *key, const size_t nkey, const uint32_t hv) {
-    mutex_lock(&cache_lock);
     item *it = assoc_find(key, nkey, hv);
-    if (it != NULL) {
+    if (it == NULL) {
+        item_ghost_check(hv);
+    } else {
         refcount_incr(&it->refcount);
         /* Optimization for slab reassignment. prevents popular items from
          * jamming in busy wait. Can only do this here to satisfy lock order
-         * of item_lock, cache_lock, slabs_lock. */
-        if (slab_rebalance_signal &&
+         * of item_lock, cache_lock, slab class lock. */
+        if (slab_rebalance_signal && !settings.slab_rescue &&
             ((void *)it >= slab_rebal.slab_start && (void *)it < slab_rebal.slab_end)) {
-            do_item_unlink_nolock(it, hv);
+            do_item_unlink(it, hv);
             do_item_remove(it);
             it = NULL;
         }
     }
-    mutex_unlock(&cache_lock);
     int was_found = 0;
 
     if (settings.verbose > 2) {
@@ -556,7 +1187,7 @@ item *do_item_touch(const char *key, size_t nkey, uint32_t exptime,
 
 /* expires items that are more recent than the oldest_live setting. */
 void do_item_flush_expired(void) {
-    int i;
+    int i, s;
     item *iter, *next;
     if (settings.oldest_live == 0)
         return;
@@ -566,16 +1197,158 @@ void do_item_flush_expired(void) {
          * back until we hit an item older than the oldest_live time.
          * The oldest_live checking will auto-expire the remaining items.
          */
-        for (iter = heads[i]; iter != NULL; iter = next) {
-            if (iter->time >= settings.oldest_live) {
-                next = iter->next;
-                if ((iter->it_flags & ITEM_SLABBED) == 0) {
-                    do_item_unlink_nolock(iter, hash(ITEM_key(iter), iter->nkey, 0));
+        for (s = 0; s < settings.lru_shards; s++) {
+            mutex_lock(&lru_locks[i][s]);
+            for (iter = heads[i][s]; iter != NULL; iter = next) {
+                if (iter->time >= settings.oldest_live) {
+                    next = iter->next;
+                    if ((iter->it_flags & ITEM_SLABBED) == 0) {
+                        uint32_t hv = iter->hv;
+                        void *hold_lock;
+                        /* Busy items are left to the lazy oldest_live check
+                         * in do_item_get. */
+                        if ((hold_lock = item_trylock(hv)) != NULL) {
+                            item_unlink_nolock(iter, hv, true);
+                            item_trylock_unlock(hold_lock);
+                        }
+                    }
+                } else {
+                    /* We've hit the first old item. Continue to the next
+                     * queue. */
+                    break;
                 }
-            } else {
-                /* We've hit the first old item. Continue to the next queue. */
-                break;
             }
+            mutex_unlock(&lru_locks[i][s]);
         }
     }
 }
+
+/*
+ * LRU crawler (-o lru_crawler). Expired and flushed items are otherwise
+ * only reclaimed when they reach the LRU tail or are fetched, so a page
+ * being killed may evict live items while dead ones sit in its class. The
+ * crawler walks every list from the tail a batch at a time, under short
+ * holds of cache_lock and the lru lock, and unlinks the dead items it
+ * finds. Between batches it keeps its place with a reference on the next
+ * item. Items below it may be evicted meanwhile, making it the tail; an
+ * allocation that wants it then takes the reference back, and the crawler
+ * goes on from the tail. While memory is over the limit it doesn't rest
+ * between batches or passes.
+ */
+#define CRAWLER_BATCH 64
+#define CRAWLER_PASS_SECONDS 1
+
+static pthread_t crawler_tid;
+
+static inline bool item_is_dead(const item *it, const rel_time_t oldest_live) {
+    return (it->exptime != 0 && it->exptime < current_time) ||
+        (it->time <= oldest_live && oldest_live <= current_time);
+}
+
+/* Crawls the next batch of a list. Returns false once the pass over it is
+ * done. */
+static bool item_crawl_batch(const unsigned int id, const int s,
+                             uint64_t *reclaimed) {
+    item *it, *cursor;
+    rel_time_t oldest_live = settings.oldest_live;
+    int n;
+
+    mutex_lock(&cache_lock);
+    mutex_lock(&lru_locks[id][s]);
+    /* Read under cache_lock: an allocation may have taken it back */
+    cursor = crawler_cursor[id][s];
+    if (cursor == NULL) {
+        it = tails[id][s];
+    } else {
+        /* Once our place was unlinked the pass over the list ends */
+        it = (cursor->it_flags & ITEM_LINKED) != 0 &&
+            cursor->slabs_clsid == id ? cursor : NULL;
+        do_item_remove(cursor);
+    }
+
+    for (n = 0; it != NULL && n < CRAWLER_BATCH; n++) {
+        item *prev = it->prev;
+        if (item_is_dead(it, oldest_live)) {
+            void *hold_lock;
+            /* Busy items are left to do_item_get */
+            if ((hold_lock = item_trylock(it->hv)) != NULL) {
+                if ((it->it_flags & ITEM_FETCHED) == 0) {
+                    ITEM_STATS_INCR(expired_unfetched);
+                    itemstats[id].expired_unfetched++;
+                }
+                itemstats[id].crawler_reclaimed++;
+                (*reclaimed)++;
+                item_unlink_nolock(it, it->hv, true);
+                item_trylock_unlock(hold_lock);
+            }
+        }
+        it = prev;
+    }
+
+    /* Starting from the tail again is the same walk */
+    if (it == tails[id][s])
+        it = NULL;
+    if (it != NULL)
+        refcount_incr(&it->refcount);
+    crawler_cursor[id][s] = it;
+    mutex_unlock(&lru_locks[id][s]);
+    mutex_unlock(&cache_lock);
+    return it != NULL;
+}
+
+static void *item_crawler_thread(void *arg) {
+    static bool done[LARGEST_ID][LRU_SHARDS_MAX];
+
+    while (1) {
+        uint64_t reclaimed = 0;
+        bool more = true;
+        int i, s;
+
+        /* Round robin over the lists, so every class is cleared alike */
+        memset(done, 0, sizeof(done));
+        while (more) {
+            more = false;
+            for (i = POWER_SMALLEST; i < LARGEST_ID; i++) {
+                for (s = 0; s < settings.lru_shards; s++) {
+                    if (done[i][s] ||
+                        (tails[i][s] == NULL && crawler_cursor[i][s] == NULL))
+                        continue;
+                    if (item_crawl_batch(i, s, &reclaimed))
+                        more = true;
+                    else
+                        done[i][s] = true;
+                }
+            }
+            if (more && settings.lru_crawler_sleep > 0 && !slabs_over_limit())
+                usleep(settings.lru_crawler_sleep);
+        }
+
+        STATS_LOCK();
+        stats.crawler_passes++;
+        stats.crawler_reclaimed += reclaimed;
+        STATS_UNLOCK();
+        if (!slabs_over_limit())
+            sleep(CRAWLER_PASS_SECONDS);
+    }
+    return NULL;
+}
+
+int start_item_crawler_thread(void) {
+    int ret;
+    if ((ret = pthread_create(&crawler_tid, NULL,
+                              item_crawler_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create LRU crawler thread: %s\n",
+                strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void item_stats_crawler_reclaimed(uint64_t *reclaimed) {
+    int i;
+    mutex_lock(&cache_lock);
+    for (i = 0; i < LARGEST_ID; i++) {
+        reclaimed[i] = itemstats[i].crawler_reclaimed;
+    }
+    mutex_unlock(&cache_lock);
+}
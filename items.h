@@ -1,23 +1,43 @@
 /* See items.c */
 uint64_t get_cas_id(void);
 
+/*
+ * We only reposition items in the LRU queue if they haven't been repositioned
+ * in this many seconds. That saves us from churning on frequently-accessed
+ * items.
+ */
+#define ITEM_UPDATE_INTERVAL 60
+
+void items_init(void);
+
 /*@null@*/
 item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes);
 void item_free(item *it);
+item *item_alloc_heap(const item *it, const int nbytes);
 bool item_size_ok(const size_t nkey, const int flags, const int nbytes);
+/* Copies the first n bytes of src's value into dst's at offset; either
+ * may be chunked */
+void item_copy_value(item *dst, int offset, item *src, int n);
+/* Where the CRLF ending an item's value goes */
+char *item_crlf(item *it);
 
 int  do_item_link(item *it, const uint32_t hv);     /** may fail if transgresses limits */
 void do_item_unlink(item *it, const uint32_t hv);
 void do_item_unlink_nolock(item *it, const uint32_t hv);
 void do_item_remove(item *it);
 void do_item_update(item *it);   /** update LRU time to current and reposition */
+void do_item_update_batch(item **items, const int nitems);
 int  do_item_replace(item *it, item *new_it, const uint32_t hv);
+void do_item_relink(item *it, item *new_it, const uint32_t hv);
+item *do_item_evict_tail(const unsigned int id, const void *start,
+                         const void *end, const rel_time_t older_than);
 
 /*@null@*/
 char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
 void do_item_stats(ADD_STAT add_stats, void *c);
 /*@null@*/
 void do_item_stats_sizes(ADD_STAT add_stats, void *c);
+unsigned int item_size_hist(unsigned int *hist, unsigned int *width);
 void do_item_flush_expired(void);
 
 item *do_item_get(const char *key, const size_t nkey, const uint32_t hv);
@@ -25,3 +45,7 @@ item *do_item_touch(const char *key, const size_t nkey, uint32_t exptime, const
 void item_stats_reset(void);
 extern pthread_mutex_t cache_lock;
 void item_stats_evictions(uint64_t *evicted);
+void item_ghost_add(const unsigned int id, const uint32_t hv);
+void item_stats_ghost_hits(uint64_t *hits);
+int start_item_crawler_thread(void);
+void item_stats_crawler_reclaimed(uint64_t *reclaimed);
@@ -0,0 +1,103 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Latency histograms for "stats latency".
+ *
+ * Each worker counts into its own histograms, which live in its thread
+ * stats: they have a single writer, take no lock, and are summed up with
+ * the other thread stats when read. Buckets are log scaled like an
+ * HdrHistogram with two bits of precision: exact up to 4 ns, then four
+ * buckets per power of two, so a bucket is at most 25% wide. The last
+ * bucket takes everything from about 8.6 seconds on.
+ *
+ * Commands are timed from the moment they are parsed until their response
+ * is queued. Time spent waiting for the rest of a value to arrive from the
+ * network is left out.
+ */
+
+#include "memcached.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *hist_names[LATENCY_HISTS] = {
+    "text_get", "text_multiget", "text_set", "text_delete", "text_incrdecr",
+    "text_touch",
+    "binary_get", "binary_multiget", "binary_set", "binary_delete",
+    "binary_incrdecr", "binary_touch",
+    "cache_lock", "slabs_lock"
+};
+
+uint64_t latency_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int latency_bucket(const uint64_t ns) {
+    int k, b;
+
+    if (ns < 4)
+        return (int)ns;
+    k = 63 - __builtin_clzll(ns);
+    b = 4 + (k - 2) * 4 + (int)((ns >> (k - 2)) & 3);
+    return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+/* Smallest value, in ns, that falls in bucket b */
+static uint64_t latency_bucket_ns(const int b) {
+    if (b < 4)
+        return b;
+    return (uint64_t)(4 + (b - 4) % 4) << ((b - 4) / 4);
+}
+
+void latency_record(const int hist, const uint64_t ns) {
+    LIBEVENT_THREAD *me = worker_thread_self();
+
+    if (me != NULL)
+        THREAD_STATS_INCR(me, latency[hist][latency_bucket(ns)]);
+}
+
+void latency_stats(ADD_STAT add_stats, void *c) {
+    static const struct {
+        const char *name;
+        double fraction;
+    } pcts[] = {
+        { "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 }
+    };
+    struct thread_stats thread_stats;
+    char key[STAT_KEY_LEN];
+    int h, b, p, last;
+
+    threadlocal_stats_aggregate(&thread_stats);
+    for (h = 0; h < LATENCY_HISTS; h++) {
+        const uint64_t *hist = thread_stats.latency[h];
+        uint64_t count = 0, seen = 0;
+
+        for (b = 0; b < LATENCY_BUCKETS; b++)
+            count += hist[b];
+        if (count == 0)
+            continue;
+        for (last = LATENCY_BUCKETS - 1; hist[last] == 0; last--)
+            ;
+
+        snprintf(key, sizeof(key), "latency:%s:count", hist_names[h]);
+        APPEND_STAT(key, "%llu", (unsigned long long)count);
+        /* A percentile is reported as the top of the bucket it falls in */
+        for (b = 0, p = 0; b <= last && p < sizeof(pcts) / sizeof(pcts[0]);
+             b++) {
+            seen += hist[b];
+            while (p < sizeof(pcts) / sizeof(pcts[0]) &&
+                   seen >= pcts[p].fraction * count) {
+                snprintf(key, sizeof(key), "latency:%s:%s_us", hist_names[h],
+                         pcts[p].name);
+                APPEND_STAT(key, "%.3f", latency_bucket_ns(b + 1) / 1000.0);
+                p++;
+            }
+        }
+        snprintf(key, sizeof(key), "latency:%s:max_us", hist_names[h]);
+        APPEND_STAT(key, "%.3f", latency_bucket_ns(last + 1) / 1000.0);
+    }
+
+    /* getting here means both ascii and binary terminators fit */
+    add_stats(NULL, 0, NULL, 0, c);
+}
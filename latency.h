@@ -0,0 +1,36 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+/* latency histograms */
+
+/** Monotonic clock, in nanoseconds */
+uint64_t latency_now(void);
+
+/** Count ns in histogram hist of the calling worker; ignored elsewhere */
+void latency_record(const int hist, const uint64_t ns);
+
+/** Fill buffer with the percentiles of each histogram that has samples */
+void latency_stats(ADD_STAT add_stats, void *c);
+
+/*
+ * Lock mutex with lock (mutex_lock for the spinning locks,
+ * pthread_mutex_lock for the others), timing the wait in histogram hist.
+ * An uncontended lock costs one trylock and counts as a zero wait.
+ */
+static inline void latency_lock(pthread_mutex_t *mutex, const int hist,
+                                int (*lock)(pthread_mutex_t *)) {
+    uint64_t start;
+
+    if (pthread_mutex_trylock(mutex) == 0) {
+        if (settings.latency_stats)
+            latency_record(hist, 0);
+        return;
+    }
+    if (!settings.latency_stats) {
+        lock(mutex);
+        return;
+    }
+    start = latency_now();
+    lock(mutex);
+    latency_record(hist, latency_now() - start);
+}
+#endif
@@ -0,0 +1,952 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * mcload: a load generator for memcached.
+ *
+ * Each thread drives one connection over the text or binary protocol, or
+ * over UDP, issuing a mix of gets (optionally multigets) and sets on keys
+ * drawn uniformly or from a zipf distribution. Key and value sizes follow
+ * configurable distributions. With -r the load is open loop: requests are
+ * scheduled at a fixed rate and their latency is counted from when they
+ * were due, so a stalled server shows up in the percentiles instead of
+ * just slowing the generator down.
+ *
+ * Every interval a line with the throughput, latency percentiles and hit
+ * ratio is printed. Commands such as "m 32" or "slabs reassign 5 6" can be
+ * scheduled with -e to see how the server behaves across a resize.
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "config.h"
+#include "util.h"
+#include "protocol_binary.h"
+
+#define KEY_MAX 250
+#define VALUE_MAX (1024 * 1024)
+#define EVENTS_MAX 64
+#define UDP_DATAGRAM 1400
+#define UDP_HEADER 8
+
+/* Latency buckets: four per power of two, in ns, as in "stats latency" */
+#define LAT_BUCKETS 160
+
+enum protocol { PROTO_TEXT, PROTO_BINARY, PROTO_UDP };
+
+/* Sizes are fixed, uniform in [min, max], or exponential with mean min
+ * and the tail cut at max, 16 times the mean */
+enum dist_type { DIST_FIXED, DIST_UNIFORM, DIST_EXP };
+
+struct dist {
+    enum dist_type type;
+    unsigned int min;
+    unsigned int max;
+};
+
+struct event {
+    double at;              /* seconds into the run */
+    char *command;
+};
+
+struct counters {
+    uint64_t ops;
+    uint64_t keys;          /* keys asked for by gets */
+    uint64_t hits;
+    uint64_t errors;
+    uint64_t hist[LAT_BUCKETS];
+};
+
+struct worker {
+    pthread_t tid;
+    int id;
+    int fd;
+    uint64_t rng;
+    uint16_t udp_id;
+    char *buf;              /* requests and responses */
+    size_t buflen;
+    size_t rpos;            /* unread part of buf is [rpos, rend) */
+    size_t rend;
+    pthread_mutex_t lock;   /* guards now; main folds it into the totals */
+    struct counters now;
+};
+
+static struct {
+    const char *host;
+    int port;
+    int udp_port;           /* 0 to use port */
+    enum protocol proto;
+    int threads;
+    double duration;
+    double interval;
+    unsigned int keys;
+    struct dist key_size;
+    struct dist value_size;
+    double zipf;
+    double get_ratio;
+    int width;
+    double rate;            /* ops/s over all threads, 0 for closed loop */
+    bool preload;
+    struct event events[EVENTS_MAX];
+    int nevents;
+} cfg = {
+    .host = "127.0.0.1",
+    .port = 11211,
+    .proto = PROTO_TEXT,
+    .threads = 4,
+    .duration = 10,
+    .interval = 1,
+    .keys = 10000,
+    .key_size = { DIST_FIXED, 16, 16 },
+    .value_size = { DIST_FIXED, 100, 100 },
+    .zipf = 0,
+    .get_ratio = 0.9,
+    .width = 1,
+    .rate = 0,
+};
+
+static volatile bool running = true;
+static uint64_t run_start;
+static double *zipf_cdf = NULL;
+static char value_data[VALUE_MAX];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(const uint64_t when) {
+    uint64_t now = now_ns();
+    struct timespec ts;
+
+    if (when <= now)
+        return;
+    ts.tv_sec = (when - now) / 1000000000;
+    ts.tv_nsec = (when - now) % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+/* splitmix64 */
+static uint64_t next_rand(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double next_unit(uint64_t *state) {
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned int dist_sample(const struct dist *d, uint64_t *state) {
+    double u;
+
+    switch (d->type) {
+    case DIST_UNIFORM:
+        return d->min + next_rand(state) % (d->max - d->min + 1);
+    case DIST_EXP:
+        u = next_unit(state);
+        u = -log(1 - u) * d->min;
+        return u < 1 ? 1 : (u > d->max ? d->max : (unsigned int)u);
+    case DIST_FIXED:
+    default:
+        return d->min;
+    }
+}
+
+/* "N", "MIN-MAX" or "exp:MEAN" */
+static bool parse_dist(const char *arg, struct dist *d, const unsigned int max) {
+    uint32_t a, b;
+    char *dash;
+    char copy[64];
+
+    snprintf(copy, sizeof(copy), "%s", arg);
+    if (strncmp(copy, "exp:", 4) == 0) {
+        if (!safe_strtoul(copy + 4, &a) || a == 0 || a > max)
+            return false;
+        d->type = DIST_EXP;
+        d->min = a;
+        d->max = (uint64_t)a * 16 < max ? a * 16 : max;
+        return true;
+    }
+    if ((dash = strchr(copy, '-')) != NULL) {
+        *dash = '\0';
+        if (!safe_strtoul(copy, &a) || !safe_strtoul(dash + 1, &b) ||
+            a == 0 || a > b || b > max)
+            return false;
+        d->type = DIST_UNIFORM;
+        d->min = a;
+        d->max = b;
+        return true;
+    }
+    if (!safe_strtoul(copy, &a) || a == 0 || a > max)
+        return false;
+    d->type = DIST_FIXED;
+    d->min = d->max = a;
+    return true;
+}
+
+static void zipf_init(void) {
+    double sum = 0;
+    unsigned int i;
+
+    zipf_cdf = malloc(cfg.keys * sizeof(double));
+    if (zipf_cdf == NULL) {
+        fprintf(stderr, "Failed to allocate the zipf table\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < cfg.keys; i++) {
+        sum += 1.0 / pow(i + 1, cfg.zipf);
+        zipf_cdf[i] = sum;
+    }
+    for (i = 0; i < cfg.keys; i++)
+        zipf_cdf[i] /= sum;
+}
+
+static unsigned int pick_key(uint64_t *state) {
+    unsigned int lo = 0, hi;
+    double u;
+
+    if (zipf_cdf == NULL)
+        return next_rand(state) % cfg.keys;
+    u = next_unit(state);
+    hi = cfg.keys - 1;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The key of index n always has the same length, drawn from -k */
+static int make_key(char *key, const unsigned int n) {
+    uint64_t state = n;
+    int len = snprintf(key, KEY_MAX + 1, "key:%u", n);
+    int want = dist_sample(&cfg.key_size, &state);
+
+    while (len < want && len < KEY_MAX)
+        key[len++] = '.';
+    key[len] = '\0';
+    return len;
+}
+
+static int lat_bucket(const uint64_t ns) {
+    int k, b;
+
+    if (ns < 4)
+        return (int)ns;
+    k = 63 - __builtin_clzll(ns);
+    b = 4 + (k - 2) * 4 + (int)((ns >> (k - 2)) & 3);
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+/* Top of bucket b, in ns */
+static uint64_t lat_bucket_top(const int b) {
+    if (b < 4)
+        return b + 1;
+    return (uint64_t)(4 + (b - 3) % 4) << ((b - 3) / 4);
+}
+
+static double percentile_us(const uint64_t *hist, const uint64_t count,
+                            const double fraction) {
+    uint64_t seen = 0;
+    int b;
+
+    if (count == 0)
+        return 0;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= fraction * count)
+            break;
+    }
+    return lat_bucket_top(b < LAT_BUCKETS ? b : LAT_BUCKETS - 1) / 1000.0;
+}
+
+static int connect_server(const bool udp) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC };
+    struct addrinfo *ai;
+    char service[NI_MAXSERV];
+    int fd, error;
+
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d",
+             udp && cfg.udp_port ? cfg.udp_port : cfg.port);
+    if ((error = getaddrinfo(cfg.host, service, &hints, &ai)) != 0) {
+        fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(error));
+        return -1;
+    }
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == -1 || connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+        fprintf(stderr, "Failed to connect to %s:%s: %s\n", cfg.host,
+                service, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    } else if (udp) {
+        /* A lost datagram must not hang the thread */
+        struct timeval tv = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    } else {
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+static bool send_all(const int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Make at least n unread bytes available in the worker buffer */
+static bool fill(struct worker *w, const size_t n) {
+    if (w->rend - w->rpos >= n)
+        return true;
+    if (w->rpos > 0) {
+        memmove(w->buf, w->buf + w->rpos, w->rend - w->rpos);
+        w->rend -= w->rpos;
+        w->rpos = 0;
+    }
+    if (n > w->buflen) {
+        char *buf = realloc(w->buf, n);
+        if (buf == NULL)
+            return false;
+        w->buf = buf;
+        w->buflen = n;
+    }
+    while (w->rend < n) {
+        ssize_t r = recv(w->fd, w->buf + w->rend, w->buflen - w->rend, 0);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        w->rend += r;
+    }
+    return true;
+}
+
+/* Next line of a text response, without its \r\n; NULL on error */
+static char *read_line(struct worker *w) {
+    size_t want = 2;
+
+    while (1) {
+        char *start = w->buf + w->rpos;
+        char *end = memchr(start, '\n', w->rend - w->rpos);
+        if (end != NULL) {
+            w->rpos += end - start + 1;
+            if (end > start && end[-1] == '\r')
+                end--;
+            *end = '\0';
+            return start;
+        }
+        want = w->rend - w->rpos + 1;
+        if (!fill(w, want))
+            return NULL;
+    }
+}
+
+/* Count the hits of a text get response already in w (or read from it) */
+static bool text_get_response(struct worker *w, uint64_t *hits) {
+    char *line;
+
+    while ((line = read_line(w)) != NULL) {
+        unsigned int flags, len;
+        char key[KEY_MAX + 1];
+
+        if (strcmp(line, "END") == 0)
+            return true;
+        if (sscanf(line, "VALUE %250s %u %u", key, &flags, &len) != 3)
+            return false;
+        if (!fill(w, len + 2))
+            return false;
+        w->rpos += len + 2;
+        (*hits)++;
+    }
+    return false;
+}
+
+static size_t text_get_request(char *buf, const unsigned int *keys,
+                               const int n) {
+    size_t len = sprintf(buf, "get");
+    int i;
+
+    for (i = 0; i < n; i++) {
+        buf[len++] = ' ';
+        len += make_key(buf + len, keys[i]);
+    }
+    memcpy(buf + len, "\r\n", 2);
+    return len + 2;
+}
+
+static size_t text_set_request(char *buf, const unsigned int key,
+                               const unsigned int vlen) {
+    char k[KEY_MAX + 1];
+    size_t len;
+
+    make_key(k, key);
+    len = sprintf(buf, "set %s 0 0 %u\r\n", k, vlen);
+    memcpy(buf + len, value_data, vlen);
+    memcpy(buf + len + vlen, "\r\n", 2);
+    return len + vlen + 2;
+}
+
+static size_t binary_header(char *buf, const uint8_t opcode, const int keylen,
+                            const int extlen, const uint32_t bodylen,
+                            const uint32_t opaque) {
+    protocol_binary_request_header *req = (void *)buf;
+
+    memset(req, 0, sizeof(*req));
+    req->request.magic = PROTOCOL_BINARY_REQ;
+    req->request.opcode = opcode;
+    req->request.keylen = htons(keylen);
+    req->request.extlen = extlen;
+    req->request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    req->request.bodylen = htonl(bodylen);
+    req->request.opaque = opaque;
+    return sizeof(*req);
+}
+
+/* A single GET, or a run of GETKQ ended by a NOOP */
+static size_t binary_get_request(char *buf, const unsigned int *keys,
+                                 const int n) {
+    size_t len = 0;
+    int i, klen;
+
+    for (i = 0; i < n; i++) {
+        char *hdr = buf + len;
+        len += sizeof(protocol_binary_request_header);
+        klen = make_key(buf + len, keys[i]);
+        binary_header(hdr, n == 1 ? PROTOCOL_BINARY_CMD_GET :
+                      PROTOCOL_BINARY_CMD_GETKQ, klen, 0, klen, i);
+        len += klen;
+    }
+    if (n > 1)
+        len += binary_header(buf + len, PROTOCOL_BINARY_CMD_NOOP, 0, 0, 0, n);
+    return len;
+}
+
+static size_t binary_set_request(char *buf, const unsigned int key,
+                                 const unsigned int vlen) {
+    protocol_binary_request_set *req = (void *)buf;
+    size_t len = sizeof(req->bytes);
+    int klen = make_key(buf + len, key);
+
+    binary_header(buf, PROTOCOL_BINARY_CMD_SET, klen, 8, klen + 8 + vlen, 0);
+    req->message.body.flags = 0;
+    req->message.body.expiration = 0;
+    memcpy(buf + len + klen, value_data, vlen);
+    return len + klen + vlen;
+}
+
+/* Read one binary response, returning its opcode and status */
+static bool binary_response(struct worker *w, uint8_t *opcode,
+                            uint16_t *status) {
+    protocol_binary_response_header hdr;
+    uint32_t bodylen;
+
+    if (!fill(w, sizeof(hdr)))
+        return false;
+    memcpy(&hdr, w->buf + w->rpos, sizeof(hdr));
+    if (hdr.response.magic != PROTOCOL_BINARY_RES)
+        return false;
+    bodylen = ntohl(hdr.response.bodylen);
+    if (!fill(w, sizeof(hdr) + bodylen))
+        return false;
+    w->rpos += sizeof(hdr) + bodylen;
+    *opcode = hdr.response.opcode;
+    *status = ntohs(hdr.response.status);
+    return true;
+}
+
+static bool binary_get_response(struct worker *w, const int n,
+                                uint64_t *hits) {
+    uint8_t opcode;
+    uint16_t status;
+
+    if (n == 1) {
+        if (!binary_response(w, &opcode, &status))
+            return false;
+        if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS)
+            (*hits)++;
+        return status == PROTOCOL_BINARY_RESPONSE_SUCCESS ||
+            status == PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+    }
+    /* Quiet gets only answer hits; the NOOP ends the run */
+    while (binary_response(w, &opcode, &status)) {
+        if (opcode == PROTOCOL_BINARY_CMD_NOOP)
+            return true;
+        if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS)
+            (*hits)++;
+    }
+    return false;
+}
+
+/* Send a text request in one datagram and put the reassembled response in
+ * w->buf, as if it had been read from a stream. */
+static bool udp_exchange(struct worker *w, const char *req, const size_t len) {
+    char pkt[UDP_HEADER + 65507];
+    char *frames = NULL;
+    size_t *sizes = NULL;
+    int total = -1, got = 0, i;
+    uint16_t id = ++w->udp_id;
+    bool ok = false;
+
+    if (len > sizeof(pkt) - UDP_HEADER)
+        return false;
+    pkt[0] = id >> 8;
+    pkt[1] = id & 0xff;
+    pkt[2] = pkt[3] = pkt[4] = pkt[6] = pkt[7] = 0;
+    pkt[5] = 1;
+    memcpy(pkt + UDP_HEADER, req, len);
+    if (send(w->fd, pkt, UDP_HEADER + len, 0) < 0)
+        return false;
+
+    while (total < 0 || got < total) {
+        ssize_t n = recv(w->fd, pkt, sizeof(pkt), 0);
+        int seq, num;
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < UDP_HEADER)
+            goto out;       /* timed out, a datagram was lost */
+        if ((((uint8_t)pkt[0] << 8) | (uint8_t)pkt[1]) != id)
+            continue;       /* late answer to an earlier request */
+        seq = ((uint8_t)pkt[2] << 8) | (uint8_t)pkt[3];
+        num = ((uint8_t)pkt[4] << 8) | (uint8_t)pkt[5];
+        if (total < 0) {
+            total = num;
+            frames = calloc(total, UDP_DATAGRAM);
+            sizes = calloc(total, sizeof(size_t));
+            if (frames == NULL || sizes == NULL)
+                goto out;
+        }
+        if (num != total || seq >= total || n - UDP_HEADER > UDP_DATAGRAM)
+            goto out;
+        if (sizes[seq] == 0) {
+            memcpy(frames + (size_t)seq * UDP_DATAGRAM, pkt + UDP_HEADER,
+                   n - UDP_HEADER);
+            sizes[seq] = n - UDP_HEADER;
+            got++;
+        }
+    }
+
+    w->rpos = w->rend = 0;
+    for (i = 0; i < total; i++) {
+        if (w->rend + sizes[i] > w->buflen) {
+            char *buf = realloc(w->buf, w->buflen * 2 + sizes[i]);
+            if (buf == NULL)
+                goto out;
+            w->buf = buf;
+            w->buflen = w->buflen * 2 + sizes[i];
+        }
+        memcpy(w->buf + w->rend, frames + (size_t)i * UDP_DATAGRAM, sizes[i]);
+        w->rend += sizes[i];
+    }
+    ok = true;
+out:
+    free(frames);
+    free(sizes);
+    return ok;
+}
+
+/* Issue one operation; false when the server answered badly or not at all */
+static bool do_op(struct worker *w, const bool get, uint64_t *keys,
+                  uint64_t *hits) {
+    unsigned int ids[KEY_MAX];
+    char *req = w->buf + w->buflen / 2;     /* the front half reads responses */
+    size_t len;
+    char *line;
+    int i, n = get ? cfg.width : 1;
+
+    for (i = 0; i < n; i++)
+        ids[i] = pick_key(&w->rng);
+
+    if (get) {
+        *keys += n;
+        len = cfg.proto == PROTO_BINARY ? binary_get_request(req, ids, n)
+            : text_get_request(req, ids, n);
+    } else {
+        unsigned int vlen = dist_sample(&cfg.value_size, &w->rng);
+        len = cfg.proto == PROTO_BINARY ? binary_set_request(req, ids[0], vlen)
+            : text_set_request(req, ids[0], vlen);
+    }
+
+    if (cfg.proto == PROTO_UDP) {
+        if (!udp_exchange(w, req, len))
+            return false;
+    } else {
+        w->rpos = w->rend = 0;
+        if (!send_all(w->fd, req, len))
+            return false;
+    }
+
+    if (cfg.proto == PROTO_BINARY) {
+        uint8_t opcode;
+        uint16_t status;
+        if (get)
+            return binary_get_response(w, n, hits);
+        return binary_response(w, &opcode, &status) &&
+            status == PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    }
+    if (get)
+        return text_get_response(w, hits);
+    line = read_line(w);
+    return line != NULL && strcmp(line, "STORED") == 0;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    uint64_t period = cfg.rate > 0 ? (uint64_t)(1e9 * cfg.threads / cfg.rate) : 0;
+    uint64_t due = run_start + (period ? next_rand(&w->rng) % period : 0);
+
+    while (running) {
+        uint64_t start, keys = 0, hits = 0;
+        bool get = next_unit(&w->rng) < cfg.get_ratio;
+        bool ok;
+
+        if (period) {
+            sleep_until(due);
+            start = due;
+            due += period;
+        } else {
+            start = now_ns();
+        }
+        ok = do_op(w, get, &keys, &hits);
+
+        pthread_mutex_lock(&w->lock);
+        w->now.ops++;
+        w->now.keys += keys;
+        w->now.hits += hits;
+        if (ok) {
+            w->now.hist[lat_bucket(now_ns() - start)]++;
+        } else {
+            w->now.errors++;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        if (!ok && cfg.proto != PROTO_UDP) {
+            /* The stream is out of step; start over on a new connection */
+            close(w->fd);
+            while (running && (w->fd = connect_server(false)) == -1)
+                sleep(1);
+        }
+    }
+    return NULL;
+}
+
+/* Store every key once, so the run starts with a full hit ratio */
+static bool preload(void) {
+    struct worker w = { .rng = 1 };
+    unsigned int i;
+    int fd = connect_server(false);
+
+    if (fd == -1)
+        return false;
+    w.fd = fd;
+    w.buflen = 2 * (VALUE_MAX + 512);
+    if ((w.buf = malloc(w.buflen)) == NULL)
+        return false;
+    for (i = 0; i < cfg.keys && running; i++) {
+        char *req = w.buf + w.buflen / 2;
+        size_t len = text_set_request(req, i,
+                                      dist_sample(&cfg.value_size, &w.rng));
+        char *line;
+
+        w.rpos = w.rend = 0;
+        if (!send_all(fd, req, len) || (line = read_line(&w)) == NULL) {
+            fprintf(stderr, "Preload failed at key %u\n", i);
+            break;
+        }
+    }
+    free(w.buf);
+    close(fd);
+    return i == cfg.keys;
+}
+
+/* Send the -e commands over a text connection at their time */
+static void *events_main(void *arg) {
+    struct worker w = { 0 };
+    int i;
+
+    w.buflen = 4096;
+    if ((w.buf = malloc(w.buflen)) == NULL)
+        return NULL;
+    if ((w.fd = connect_server(false)) == -1) {
+        free(w.buf);
+        return NULL;
+    }
+    for (i = 0; i < cfg.nevents && running; i++) {
+        char req[1024];
+        char *line;
+        int len = snprintf(req, sizeof(req), "%s\r\n", cfg.events[i].command);
+
+        sleep_until(run_start + (uint64_t)(cfg.events[i].at * 1e9));
+        if (!running)
+            break;
+        w.rpos = w.rend = 0;
+        if (!send_all(w.fd, req, len) || (line = read_line(&w)) == NULL)
+            line = "(no response)";
+        printf("# %8.2f  %s -> %s\n", (now_ns() - run_start) / 1e9,
+               cfg.events[i].command, line);
+        fflush(stdout);
+    }
+    close(w.fd);
+    free(w.buf);
+    return NULL;
+}
+
+static int event_cmp(const void *a, const void *b) {
+    const struct event *x = a, *y = b;
+    return x->at < y->at ? -1 : x->at > y->at;
+}
+
+static void fold(struct counters *into, const struct counters *from) {
+    int b;
+
+    into->ops += from->ops;
+    into->keys += from->keys;
+    into->hits += from->hits;
+    into->errors += from->errors;
+    for (b = 0; b < LAT_BUCKETS; b++)
+        into->hist[b] += from->hist[b];
+}
+
+static void report(const char *label, const struct counters *c,
+                   const double seconds) {
+    uint64_t done = c->ops - c->errors;
+
+    printf("%-10s %10.0f %9.1f %9.1f %9.1f %7.2f %8llu\n", label,
+           seconds > 0 ? c->ops / seconds : 0,
+           percentile_us(c->hist, done, 0.5),
+           percentile_us(c->hist, done, 0.99),
+           percentile_us(c->hist, done, 0.999),
+           c->keys ? 100.0 * c->hits / c->keys : 0,
+           (unsigned long long)c->errors);
+    fflush(stdout);
+}
+
+static void usage(void) {
+    printf("mcload: memcached load generator\n"
+           "-s <host>     server (default: 127.0.0.1)\n"
+           "-p <num>      TCP port (default: 11211)\n"
+           "-U <num>      UDP port (default: the TCP port)\n"
+           "-P <proto>    text, binary or udp (default: text)\n"
+           "-t <num>      threads, one connection each (default: 4)\n"
+           "-d <secs>     how long to run (default: 10)\n"
+           "-i <secs>     report interval (default: 1)\n"
+           "-n <num>      number of keys (default: 10000)\n"
+           "-k <dist>     key size distribution (default: 16)\n"
+           "-v <dist>     value size distribution (default: 100)\n"
+           "              a size is N, MIN-MAX (uniform) or exp:MEAN\n"
+           "              (exponential, at most 16 times the mean)\n"
+           "-z <theta>    zipf skew of key popularity (default: 0, uniform)\n"
+           "-g <ratio>    share of operations that are gets (default: 0.9)\n"
+           "-w <num>      keys per get (default: 1)\n"
+           "-r <ops/s>    open loop at this total rate (default: closed loop)\n"
+           "-l            store every key before the run\n"
+           "-e <t>:<cmd>  send the text command cmd after t seconds, e.g.\n"
+           "              -e \"10:m 32\" or -e \"20:slabs reassign 5 6\"\n"
+           "-h            print this help and exit\n");
+}
+
+int main(int argc, char **argv) {
+    struct worker *workers;
+    struct counters total, interval;
+    pthread_t events_tid;
+    uint64_t next_report, prev_report;
+    char label[32];
+    char *colon;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "s:p:U:P:t:d:i:n:k:v:z:g:w:r:le:h")) != -1) {
+        switch (c) {
+        case 's':
+            cfg.host = optarg;
+            break;
+        case 'p':
+            cfg.port = atoi(optarg);
+            break;
+        case 'U':
+            cfg.udp_port = atoi(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "text") == 0) {
+                cfg.proto = PROTO_TEXT;
+            } else if (strcmp(optarg, "binary") == 0) {
+                cfg.proto = PROTO_BINARY;
+            } else if (strcmp(optarg, "udp") == 0) {
+                cfg.proto = PROTO_UDP;
+            } else {
+                fprintf(stderr, "-P must be text, binary or udp\n");
+                return 1;
+            }
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration = atof(optarg);
+            break;
+        case 'i':
+            cfg.interval = atof(optarg);
+            break;
+        case 'n':
+            cfg.keys = atoi(optarg);
+            break;
+        case 'k':
+            if (!parse_dist(optarg, &cfg.key_size, KEY_MAX)) {
+                fprintf(stderr, "Bad key size distribution \"%s\"\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v':
+            if (!parse_dist(optarg, &cfg.value_size, VALUE_MAX - 64)) {
+                fprintf(stderr, "Bad value size distribution \"%s\"\n", optarg);
+                return 1;
+            }
+            break;
+        case 'z':
+            cfg.zipf = atof(optarg);
+            break;
+        case 'g':
+            cfg.get_ratio = atof(optarg);
+            break;
+        case 'w':
+            cfg.width = atoi(optarg);
+            break;
+        case 'r':
+            cfg.rate = atof(optarg);
+            break;
+        case 'l':
+            cfg.preload = true;
+            break;
+        case 'e':
+            if (cfg.nevents == EVENTS_MAX ||
+                (colon = strchr(optarg, ':')) == NULL) {
+                fprintf(stderr, "Bad event \"%s\"\n", optarg);
+                return 1;
+            }
+            *colon = '\0';
+            cfg.events[cfg.nevents].at = atof(optarg);
+            cfg.events[cfg.nevents].command = colon + 1;
+            cfg.nevents++;
+            break;
+        case 'h':
+            usage();
+            return 0;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (cfg.threads < 1 || cfg.keys < 1 || cfg.duration <= 0 ||
+        cfg.interval <= 0 || cfg.width < 1 || cfg.width > KEY_MAX ||
+        cfg.get_ratio < 0 || cfg.get_ratio > 1 || cfg.rate < 0) {
+        fprintf(stderr, "Bad arguments, see -h\n");
+        return 1;
+    }
+    if (cfg.proto == PROTO_UDP &&
+        (cfg.value_size.max > 65000 || cfg.width * (KEY_MAX + 1) > 65000)) {
+        fprintf(stderr, "Requests must fit in a UDP datagram\n");
+        return 1;
+    }
+
+    /* A closed connection is an error to count, not a reason to die */
+    signal(SIGPIPE, SIG_IGN);
+    memset(value_data, 'x', sizeof(value_data));
+    if (cfg.zipf > 0)
+        zipf_init();
+    if (cfg.preload && !preload())
+        return 1;
+
+    workers = calloc(cfg.threads, sizeof(*workers));
+    if (workers == NULL)
+        return 1;
+    run_start = now_ns();
+    for (i = 0; i < cfg.threads; i++) {
+        struct worker *w = &workers[i];
+        w->id = i;
+        w->rng = 0x12345678ULL * (i + 1);
+        /* Requests go in the back half of the buffer */
+        w->buflen = 2 * (VALUE_MAX + KEY_MAX * (KEY_MAX + 32));
+        w->buf = malloc(w->buflen);
+        pthread_mutex_init(&w->lock, NULL);
+        if (w->buf == NULL ||
+            (w->fd = connect_server(cfg.proto == PROTO_UDP)) == -1)
+            return 1;
+        if (pthread_create(&w->tid, NULL, worker_main, w) != 0) {
+            fprintf(stderr, "Can't create thread: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    if (cfg.nevents > 0) {
+        qsort(cfg.events, cfg.nevents, sizeof(cfg.events[0]), event_cmp);
+        pthread_create(&events_tid, NULL, events_main, NULL);
+    }
+
+    printf("%-10s %10s %9s %9s %9s %7s %8s\n", "time", "ops/s", "p50_us",
+           "p99_us", "p999_us", "hit%", "errors");
+    memset(&total, 0, sizeof(total));
+    prev_report = run_start;
+    next_report = run_start + (uint64_t)(cfg.interval * 1e9);
+    while (1) {
+        uint64_t end = run_start + (uint64_t)(cfg.duration * 1e9);
+        bool last = next_report >= end;
+
+        sleep_until(last ? end : next_report);
+        memset(&interval, 0, sizeof(interval));
+        for (i = 0; i < cfg.threads; i++) {
+            pthread_mutex_lock(&workers[i].lock);
+            fold(&interval, &workers[i].now);
+            memset(&workers[i].now, 0, sizeof(workers[i].now));
+            pthread_mutex_unlock(&workers[i].lock);
+        }
+        fold(&total, &interval);
+        snprintf(label, sizeof(label), "%.2f", (now_ns() - run_start) / 1e9);
+        report(label, &interval, (now_ns() - prev_report) / 1e9);
+        prev_report = now_ns();
+        if (last)
+            break;
+        next_report += (uint64_t)(cfg.interval * 1e9);
+    }
+
+    running = false;
+    for (i = 0; i < cfg.threads; i++) {
+        /* Wake threads blocked on a stalled server */
+        shutdown(workers[i].fd, SHUT_RDWR);
+        pthread_join(workers[i].tid, NULL);
+    }
+    if (cfg.nevents > 0)
+        pthread_join(events_tid, NULL);
+    report("total", &total, (now_ns() - run_start) / 1e9);
+    return 0;
+}
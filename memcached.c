@@ -71,6 +71,13 @@ enum try_read_result {
 static enum try_read_result try_read_network(conn *c);
 static enum try_read_result try_read_udp(conn *c);
 
+static size_t udp_batch_bytes(void);
+static bool udp_batch_init(conn *c);
+static void udp_batch_free(conn *c);
+static bool udp_batch_pending(const conn *c);
+static void udp_batch_flush(conn *c);
+static void udp_batch_queue(conn *c);
+
 static void conn_set_state(conn *c, enum conn_states state);
 
 /* stats */
@@ -96,6 +103,7 @@ static int add_msghdr(conn *c);
 
 
 static void conn_free(conn *c);
+static void conn_buffers_put(conn *c);
 
 /** exported globals **/
 struct stats stats;
@@ -172,9 +180,13 @@ static void stats_init(void) {
     stats.touch_cmds = stats.touch_misses = stats.touch_hits = stats.rejected_conns = 0;
     stats.curr_bytes = stats.listen_disabled_num = 0;
     stats.hash_power_level = stats.hash_bytes = stats.hash_is_expanding = 0;
+    stats.hash_is_shrinking = 0;
     stats.expired_unfetched = stats.evicted_unfetched = 0;
     stats.slabs_moved = 0;
     stats.slabs_shrunk = 0;
+    stats.slab_items_rescued = 0;
+    stats.slab_items_evicted = 0;
+    stats.crawler_passes = stats.crawler_reclaimed = 0;
     stats.accepting_conns = true; /* assuming we start in this state. */
     stats.slab_reassign_running = false;
 
@@ -197,6 +209,7 @@ static void stats_reset(void) {
     STATS_UNLOCK();
     threadlocal_stats_reset();
     item_stats_reset();
+    mrc_stats_reset();
 }
 
 static void settings_init(void) {
@@ -222,10 +235,34 @@ static void settings_init(void) {
     settings.backlog = 1024;
     settings.binding_protocol = negotiating_prot;
     settings.item_size_max = 1024 * 1024; /* The famous 1MB upper limit. */
+    settings.slab_page_size = 1024 * 1024;
     settings.maxconns_fast = false;
     settings.hashpower_init = 0;
     settings.slab_reassign = false;
     settings.slab_automove = 0;
+    settings.slab_rescue = false;
+    settings.shrink_rate = 0;
+    settings.shrink_adaptive = false;
+    settings.mrc_samples = 0;
+    settings.limit_total_memory = false;
+    settings.hash_tagged = false;
+    settings.hash_algorithm = "jenkins";
+    settings.hash_move_threads = 1;
+    settings.lru_shards = 1;
+    settings.reuseport = false;
+    settings.dispatch_leastconn = false;
+    settings.udp_batch = 0;
+    settings.latency_stats = false;
+    settings.page_pool = 0;
+    settings.balloon = "off";
+    settings.balloon_min = 0;
+    settings.balloon_max = 0;
+    settings.balloon_step = 0;
+    settings.slab_adaptive = 0;
+    settings.lru_crawler = false;
+    settings.lru_crawler_sleep = 100;
+    settings.numa = false;
+    settings.compress_threshold = 0;
 }
 
 /*
@@ -240,7 +277,9 @@ static int add_msghdr(conn *c)
     assert(c != NULL);
 
     if (c->msgsize == c->msgused) {
-        msg = realloc(c->msglist, c->msgsize * 2 * sizeof(struct msghdr));
+        msg = conn_buf_realloc(c->thread, c->msglist,
+                               c->msgsize * sizeof(struct msghdr),
+                               c->msgsize * 2 * sizeof(struct msghdr));
         if (! msg)
             return -1;
         c->msglist = msg;
@@ -288,6 +327,8 @@ static void conn_init(void) {
     freecurr = 0;
     if ((freeconns = calloc(freetotal, sizeof(conn *))) == NULL) {
         fprintf(stderr, "Failed to allocate connection structures\n");
+    } else {
+        memory_account(MEMORY_CONNECTIONS, freetotal * sizeof(conn *));
     }
     return;
 }
@@ -323,6 +364,8 @@ bool conn_add_to_freelist(conn *c) {
         size_t newsize = freetotal * 2;
         conn **new_freeconns = realloc(freeconns, sizeof(conn *) * newsize);
         if (new_freeconns) {
+            memory_account(MEMORY_CONNECTIONS,
+                           (newsize - freetotal) * sizeof(conn *));
             freetotal = newsize;
             freeconns = new_freeconns;
             freeconns[freecurr++] = c;
@@ -349,6 +392,24 @@ static const char *prot_text(enum protocol prot) {
     return rv;
 }
 
+/*
+ * Updates the memory accounted to a connection after its buffers may have
+ * grown or shrunk. The buffers from the thread's pools are counted by the
+ * pools.
+ */
+static void conn_account(conn *c) {
+    size_t bytes = sizeof(conn) + c->hdrsize * UDP_HEADER_SIZE;
+
+    if (c->udp_batch != NULL)
+        bytes += udp_batch_bytes();
+
+    if (bytes != c->mem_accounted) {
+        memory_account(MEMORY_CONNECTIONS,
+                       (int64_t)bytes - (int64_t)c->mem_accounted);
+        c->mem_accounted = bytes;
+    }
+}
+
 conn *conn_new(const int sfd, enum conn_states init_state,
                 const int event_flags,
                 const int read_buffer_size, enum network_transport transport,
@@ -362,39 +423,27 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         }
         MEMCACHED_CONN_CREATE(c);
 
-        c->rbuf = c->wbuf = 0;
-        c->ilist = 0;
-        c->suffixlist = 0;
-        c->iov = 0;
-        c->msglist = 0;
         c->hdrbuf = 0;
-
-        c->rsize = read_buffer_size;
-        c->wsize = DATA_BUFFER_SIZE;
-        c->isize = ITEM_LIST_INITIAL;
-        c->suffixsize = SUFFIX_LIST_INITIAL;
-        c->iovsize = IOV_LIST_INITIAL;
-        c->msgsize = MSG_LIST_INITIAL;
         c->hdrsize = 0;
 
-        c->rbuf = (char *)malloc((size_t)c->rsize);
-        c->wbuf = (char *)malloc((size_t)c->wsize);
-        c->ilist = (item **)malloc(sizeof(item *) * c->isize);
-        c->suffixlist = (char **)malloc(sizeof(char *) * c->suffixsize);
-        c->iov = (struct iovec *)malloc(sizeof(struct iovec) * c->iovsize);
-        c->msglist = (struct msghdr *)malloc(sizeof(struct msghdr) * c->msgsize);
-
-        if (c->rbuf == 0 || c->wbuf == 0 || c->ilist == 0 || c->iov == 0 ||
-                c->msglist == 0 || c->suffixlist == 0) {
-            conn_free(c);
-            fprintf(stderr, "malloc()\n");
-            return NULL;
-        }
-
         STATS_LOCK();
         stats.conn_structs++;
         STATS_UNLOCK();
     }
+    /* The buffers are taken from the thread's pools once the connection
+     * has something to do; see conn_buffers_get() */
+    assert(c->rbuf == NULL);
+    c->rsize = read_buffer_size;
+    if (!IS_UDP(transport) || settings.udp_batch == 0) {
+        udp_batch_free(c);
+    } else if (!udp_batch_init(c)) {
+        fprintf(stderr, "Failed to allocate UDP batch buffers\n");
+        if (conn_add_to_freelist(c)) {
+            conn_free(c);
+        }
+        return NULL;
+    }
+    conn_account(c);
 
     c->transport = transport;
     c->protocol = settings.binding_protocol;
@@ -431,6 +480,7 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->sfd = sfd;
     c->state = init_state;
     c->rlbytes = 0;
+    c->rlrest = 0;
     c->cmd = -1;
     c->rbytes = c->wbytes = 0;
     c->wcurr = c->wbuf;
@@ -449,6 +499,8 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->item = 0;
 
     c->noreply = false;
+    c->bin_prefetched = 0;
+    c->lat_hist = -1;
 
     event_set(&c->event, sfd, event_flags, event_handler, (void *)c);
     event_base_set(base, &c->event);
@@ -508,26 +560,79 @@ static void conn_cleanup(conn *c) {
     }
 }
 
+/*
+ * Takes the buffers of a connection with work to do from its thread's pools.
+ */
+static bool conn_buffers_get(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+
+    assert(c->rbuf == NULL);
+    c->wsize = DATA_BUFFER_SIZE;
+    c->isize = ITEM_LIST_INITIAL;
+    c->suffixsize = SUFFIX_LIST_INITIAL;
+    c->iovsize = IOV_LIST_INITIAL;
+    c->msgsize = MSG_LIST_INITIAL;
+
+    c->rbuf = (char *)conn_buf_alloc(t, c->rsize);
+    c->wbuf = (char *)conn_buf_alloc(t, c->wsize);
+    c->ilist = (item **)conn_buf_alloc(t, sizeof(item *) * c->isize);
+    c->suffixlist = (char **)conn_buf_alloc(t, sizeof(char *) * c->suffixsize);
+    c->iov = (struct iovec *)conn_buf_alloc(t, sizeof(struct iovec) * c->iovsize);
+    c->msglist = (struct msghdr *)conn_buf_alloc(t, sizeof(struct msghdr) * c->msgsize);
+
+    if (c->rbuf == 0 || c->wbuf == 0 || c->ilist == 0 || c->iov == 0 ||
+            c->msglist == 0 || c->suffixlist == 0) {
+        conn_buffers_put(c);
+        return false;
+    }
+
+    c->rcurr = c->rbuf;
+    c->wcurr = c->wbuf;
+    c->icurr = c->ilist;
+    c->suffixcurr = c->suffixlist;
+    return true;
+}
+
+/*
+ * Gives a connection's buffers back to its thread's pools. Nothing may be
+ * left in them: a connection only does so between requests, with its input
+ * drained, or when it is closed.
+ */
+static void conn_buffers_put(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+
+    if (c->rbuf)
+        conn_buf_free(t, c->rbuf, c->rsize);
+    if (c->wbuf)
+        conn_buf_free(t, c->wbuf, c->wsize);
+    if (c->ilist)
+        conn_buf_free(t, c->ilist, sizeof(item *) * c->isize);
+    if (c->suffixlist)
+        conn_buf_free(t, c->suffixlist, sizeof(char *) * c->suffixsize);
+    if (c->iov)
+        conn_buf_free(t, c->iov, sizeof(struct iovec) * c->iovsize);
+    if (c->msglist)
+        conn_buf_free(t, c->msglist, sizeof(struct msghdr) * c->msgsize);
+    c->rbuf = c->rcurr = c->wbuf = c->wcurr = NULL;
+    c->ilist = c->icurr = NULL;
+    c->suffixlist = c->suffixcurr = NULL;
+    c->iov = NULL;
+    c->msglist = NULL;
+    if (!IS_UDP(c->transport))
+        c->rsize = DATA_BUFFER_SIZE;
+}
+
 /*
  * Frees a connection.
  */
 void conn_free(conn *c) {
     if (c) {
         MEMCACHED_CONN_DESTROY(c);
+        memory_account(MEMORY_CONNECTIONS, -(int64_t)c->mem_accounted);
         if (c->hdrbuf)
             free(c->hdrbuf);
-        if (c->msglist)
-            free(c->msglist);
-        if (c->rbuf)
-            free(c->rbuf);
-        if (c->wbuf)
-            free(c->wbuf);
-        if (c->ilist)
-            free(c->ilist);
-        if (c->suffixlist)
-            free(c->suffixlist);
-        if (c->iov)
-            free(c->iov);
+        conn_buffers_put(c);
+        udp_batch_free(c);
         free(c);
     }
 }
@@ -543,13 +648,15 @@ static void conn_close(conn *c) {
 
     MEMCACHED_CONN_RELEASE(c->sfd);
     close(c->sfd);
+    if (c->thread != NULL)
+        thread_conn_closed(c->thread);
     pthread_mutex_lock(&conn_lock);
     allow_new_conns = true;
     pthread_mutex_unlock(&conn_lock);
     conn_cleanup(c);
+    conn_buffers_put(c);
 
-    /* if the connection has big buffers, just free it */
-    if (c->rsize > READ_BUFFER_HIGHWAT || conn_add_to_freelist(c)) {
+    if (conn_add_to_freelist(c)) {
         conn_free(c);
     }
 
@@ -580,7 +687,8 @@ static void conn_shrink(conn *c) {
         if (c->rcurr != c->rbuf)
             memmove(c->rbuf, c->rcurr, (size_t)c->rbytes);
 
-        newbuf = (char *)realloc((void *)c->rbuf, DATA_BUFFER_SIZE);
+        newbuf = (char *)conn_buf_realloc(c->thread, c->rbuf, c->rsize,
+                                          DATA_BUFFER_SIZE);
 
         if (newbuf) {
             c->rbuf = newbuf;
@@ -591,7 +699,9 @@ static void conn_shrink(conn *c) {
     }
 
     if (c->isize > ITEM_LIST_HIGHWAT) {
-        item **newbuf = (item**) realloc((void *)c->ilist, ITEM_LIST_INITIAL * sizeof(c->ilist[0]));
+        item **newbuf = (item**) conn_buf_realloc(c->thread, c->ilist,
+                c->isize * sizeof(c->ilist[0]),
+                ITEM_LIST_INITIAL * sizeof(c->ilist[0]));
         if (newbuf) {
             c->ilist = newbuf;
             c->isize = ITEM_LIST_INITIAL;
@@ -600,7 +710,9 @@ static void conn_shrink(conn *c) {
     }
 
     if (c->msgsize > MSG_LIST_HIGHWAT) {
-        struct msghdr *newbuf = (struct msghdr *) realloc((void *)c->msglist, MSG_LIST_INITIAL * sizeof(c->msglist[0]));
+        struct msghdr *newbuf = (struct msghdr *) conn_buf_realloc(c->thread,
+                c->msglist, c->msgsize * sizeof(c->msglist[0]),
+                MSG_LIST_INITIAL * sizeof(c->msglist[0]));
         if (newbuf) {
             c->msglist = newbuf;
             c->msgsize = MSG_LIST_INITIAL;
@@ -609,7 +721,9 @@ static void conn_shrink(conn *c) {
     }
 
     if (c->iovsize > IOV_LIST_HIGHWAT) {
-        struct iovec *newbuf = (struct iovec *) realloc((void *)c->iov, IOV_LIST_INITIAL * sizeof(c->iov[0]));
+        struct iovec *newbuf = (struct iovec *) conn_buf_realloc(c->thread,
+                c->iov, c->iovsize * sizeof(c->iov[0]),
+                IOV_LIST_INITIAL * sizeof(c->iov[0]));
         if (newbuf) {
             c->iov = newbuf;
             c->iovsize = IOV_LIST_INITIAL;
@@ -656,6 +770,8 @@ static void conn_set_state(conn *c, enum conn_states state) {
         }
         c->state = state;
     }
+    /* buffers grow while a command is handled; settle the count here */
+    conn_account(c);
 }
 
 /*
@@ -669,7 +785,8 @@ static int ensure_iov_space(conn *c) {
 
     if (c->iovused >= c->iovsize) {
         int i, iovnum;
-        struct iovec *new_iov = (struct iovec *)realloc(c->iov,
+        struct iovec *new_iov = (struct iovec *)conn_buf_realloc(c->thread,
+                                c->iov, c->iovsize * sizeof(struct iovec),
                                 (c->iovsize * 2) * sizeof(struct iovec));
         if (! new_iov)
             return -1;
@@ -743,6 +860,46 @@ static int add_iov(conn *c, const void *buf, int len) {
     return 0;
 }
 
+/* Adds the first len bytes of an item's value, a chunked one's piece by
+ * piece */
+static int add_iov_value(conn *c, item *it, int len) {
+    item_chunks *chunks;
+    item_chunk *ch;
+    int n;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0)
+        return add_iov(c, ITEM_data(it), len);
+
+    chunks = ITEM_chunks(it);
+    n = chunks->used < len ? chunks->used : len;
+    if (add_iov(c, chunks + 1, n) != 0)
+        return -1;
+    for (ch = chunks->first, len -= n; ch != NULL && len > 0; ch = ch->next) {
+        n = ch->used < len ? ch->used : len;
+        if (add_iov(c, ch->data, n) != 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Has the next len bytes read go into the value of an item; when it's
+ * chunked, conn_nread moves on from piece to piece */
+static void conn_read_item(conn *c, item *it, const int len) {
+    if (it->it_flags & ITEM_CHUNKED) {
+        item_chunks *chunks = ITEM_chunks(it);
+        c->ritem = (char *)(chunks + 1);
+        c->rlbytes = chunks->used < len ? chunks->used : len;
+        c->rchunk = chunks->first;
+        c->rlrest = len - c->rlbytes;
+    } else {
+        c->ritem = ITEM_data(it);
+        c->rlbytes = len;
+        c->rchunk = NULL;
+        c->rlrest = 0;
+    }
+}
+
 
 /*
  * Constructs a set of UDP headers and attaches them to the outgoing messages.
@@ -823,6 +980,45 @@ static void out_string(conn *c, const char *str) {
     return;
 }
 
+/*
+ * Swaps c->item for a compressed copy when the value is long enough and
+ * that makes it smaller. Appends and prepends are stored as they come.
+ */
+static item *compress_stored_item(conn *c) {
+    item *it = c->item, *packed;
+
+    if (settings.compress_threshold == 0 ||
+        it->nbytes - 2 < settings.compress_threshold ||
+        (it->it_flags & ITEM_CHUNKED) ||
+        c->cmd == NREAD_APPEND || c->cmd == NREAD_PREPEND)
+        return it;
+    if ((packed = item_compress(c->thread, it)) != NULL) {
+        item_remove(it);
+        c->item = packed;
+        it = packed;
+    }
+    return it;
+}
+
+/*
+ * A hit on a compressed item is sent from an uncompressed copy, freed with
+ * the reply. The stored item gives up the reference item_get() took. NULL
+ * when there's no memory for the copy; callers report that as out of memory,
+ * not as a miss, since the key does exist.
+ */
+static item *uncompressed_item(conn *c, item *it) {
+    item *raw;
+
+    if ((it->it_flags & ITEM_COMPRESSED) == 0)
+        return it;
+    item_update(it);
+    raw = item_decompress(c->thread, it);
+    item_remove(it);
+    if (raw == NULL)
+        THREAD_STATS_INCR(c->thread, decompress_nomem);
+    return raw;
+}
+
 /*
  * we get here after reading the value in set/add/replace commands. The command
  * has been stored in c->cmd, and the item is ready in c->item.
@@ -834,13 +1030,12 @@ static void complete_nread_ascii(conn *c) {
     int comm = c->cmd;
     enum store_item_type ret;
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].set_cmds);
 
-    if (strncmp(ITEM_data(it) + it->nbytes - 2, "\r\n", 2) != 0) {
+    if (strncmp(item_crlf(it), "\r\n", 2) != 0) {
         out_string(c, "CLIENT_ERROR bad data chunk");
     } else {
+      it = compress_stored_item(c);
       ret = store_item(it, comm, c);
 
 #ifdef ENABLE_DTRACE
@@ -1105,13 +1300,11 @@ static void complete_incr_bin(conn *c) {
                 write_bin_error(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
             }
         } else {
-            pthread_mutex_lock(&c->thread->stats.mutex);
             if (c->cmd == PROTOCOL_BINARY_CMD_INCREMENT) {
-                c->thread->stats.incr_misses++;
+                THREAD_STATS_INCR(c->thread, incr_misses);
             } else {
-                c->thread->stats.decr_misses++;
+                THREAD_STATS_INCR(c->thread, decr_misses);
             }
-            pthread_mutex_unlock(&c->thread->stats.mutex);
 
             write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0);
         }
@@ -1129,15 +1322,13 @@ static void complete_update_bin(conn *c) {
 
     item *it = c->item;
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].set_cmds);
 
     /* We don't actually receive the trailing two characters in the bin
      * protocol, so we're going to just set them here */
-    *(ITEM_data(it) + it->nbytes - 2) = '\r';
-    *(ITEM_data(it) + it->nbytes - 1) = '\n';
+    memcpy(item_crlf(it), "\r\n", 2);
 
+    it = compress_stored_item(c);
     ret = store_item(it, c->cmd, c);
 
 #ifdef ENABLE_DTRACE
@@ -1212,6 +1403,11 @@ static void process_bin_touch(conn *c) {
     }
 
     it = item_touch(key, nkey, realtime(exptime));
+    if (it && c->cmd != PROTOCOL_BINARY_CMD_TOUCH
+        && (it = uncompressed_item(c, it)) == NULL) {
+        write_bin_error(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
+        return;
+    }
 
     if (it) {
         /* the length has two unnecessary bytes ("\r\n") */
@@ -1219,10 +1415,8 @@ static void process_bin_touch(conn *c) {
         uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
 
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.slab_stats[it->slabs_clsid].touch_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, touch_cmds);
+        THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].touch_hits);
 
         MEMCACHED_COMMAND_TOUCH(c->sfd, ITEM_key(it), it->nkey,
                                 it->nbytes, ITEM_get_cas(it));
@@ -1247,7 +1441,7 @@ static void process_bin_touch(conn *c) {
 
         /* Add the data minus the CRLF */
         if (c->cmd != PROTOCOL_BINARY_CMD_TOUCH) {
-            add_iov(c, ITEM_data(it), it->nbytes - 2);
+            add_iov_value(c, it, it->nbytes - 2);
         }
 
         conn_set_state(c, conn_mwrite);
@@ -1255,10 +1449,8 @@ static void process_bin_touch(conn *c) {
         /* Remember this command so we can garbage collect it later */
         c->item = it;
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.touch_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, touch_cmds);
+        THREAD_STATS_INCR(c->thread, touch_misses);
 
         MEMCACHED_COMMAND_TOUCH(c->sfd, key, nkey, -1, 0);
 
@@ -1284,6 +1476,40 @@ static void process_bin_touch(conn *c) {
     }
 }
 
+/*
+ * Binary clients multiget with a run of quiet gets. When the first of a run
+ * comes up, hash the keys of the ones behind it that are already in the
+ * input buffer and prefetch their buckets, so their misses overlap.
+ */
+static void bin_prefetch_gets(conn *c) {
+    protocol_binary_request_header req;
+    char *p = c->rcurr;
+    size_t left = c->rbytes;
+    uint16_t keylen;
+    int n;
+
+    if (c->bin_prefetched > 0) {
+        c->bin_prefetched--;
+        return;
+    }
+    for (n = 0; n < GET_BATCH && left >= sizeof(req); n++) {
+        memcpy(&req, p, sizeof(req));
+        if (req.request.magic != PROTOCOL_BINARY_REQ ||
+            (req.request.opcode != PROTOCOL_BINARY_CMD_GETQ &&
+             req.request.opcode != PROTOCOL_BINARY_CMD_GETKQ))
+            break;
+        keylen = ntohs(req.request.keylen);
+        if (req.request.extlen != 0 || ntohl(req.request.bodylen) != keylen ||
+            keylen == 0 || keylen > KEY_MAX_LENGTH ||
+            left < sizeof(req) + keylen)
+            break;
+        assoc_prefetch(hash(p + sizeof(req), keylen));
+        p += sizeof(req) + keylen;
+        left -= sizeof(req) + keylen;
+    }
+    c->bin_prefetched = n;
+}
+
 static void process_bin_get(conn *c) {
     item *it;
 
@@ -1300,17 +1526,21 @@ static void process_bin_get(conn *c) {
         fprintf(stderr, "\n");
     }
 
+    if (c->noreply)
+        bin_prefetch_gets(c);
     it = item_get(key, nkey);
+    if (it && (it = uncompressed_item(c, it)) == NULL) {
+        write_bin_error(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
+        return;
+    }
     if (it) {
         /* the length has two unnecessary bytes ("\r\n") */
         uint16_t keylen = 0;
         uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
 
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.get_cmds++;
-        c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, get_cmds);
+        THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].get_hits);
 
         MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
                               it->nbytes, ITEM_get_cas(it));
@@ -1331,16 +1561,14 @@ static void process_bin_get(conn *c) {
         }
 
         /* Add the data minus the CRLF */
-        add_iov(c, ITEM_data(it), it->nbytes - 2);
+        add_iov_value(c, it, it->nbytes - 2);
         conn_set_state(c, conn_mwrite);
         c->write_and_go = conn_new_cmd;
         /* Remember this command so we can garbage collect it later */
         c->item = it;
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.get_cmds++;
-        c->thread->stats.get_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, get_cmds);
+        THREAD_STATS_INCR(c->thread, get_misses);
 
         MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
 
@@ -1558,7 +1786,7 @@ static void bin_read_key(conn *c, enum bin_substates next_substate, int extra) {
                 fprintf(stderr, "%d: Need to grow buffer from %lu to %lu\n",
                         c->sfd, (unsigned long)c->rsize, (unsigned long)nsize);
             }
-            char *newm = realloc(c->rbuf, nsize);
+            char *newm = conn_buf_realloc(c->thread, c->rbuf, c->rsize, nsize);
             if (newm == NULL) {
                 if (settings.verbose) {
                     fprintf(stderr, "%d: Failed to grow buffer.. closing connection\n",
@@ -1672,6 +1900,11 @@ static void process_bin_sasl_auth(conn *c) {
 
     item *it = item_alloc(key, nkey, 0, 0, vlen);
 
+    /* The auth data is read as one piece */
+    if (it != 0 && (it->it_flags & ITEM_CHUNKED)) {
+        item_remove(it);
+        it = 0;
+    }
     if (it == 0) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, vlen);
         c->write_and_go = conn_swallow;
@@ -1738,9 +1971,7 @@ static void process_bin_complete_sasl_auth(conn *c) {
     switch(result) {
     case SASL_OK:
         write_bin_response(c, "Authenticated", 0, 0, strlen("Authenticated"));
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.auth_cmds++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, auth_cmds);
         break;
     case SASL_CONTINUE:
         add_bin_header(c, PROTOCOL_BINARY_RESPONSE_AUTH_CONTINUE, 0, 0, outlen);
@@ -1754,10 +1985,8 @@ static void process_bin_complete_sasl_auth(conn *c) {
         if (settings.verbose)
             fprintf(stderr, "Unknown sasl response:  %d\n", result);
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_AUTH_ERROR, 0);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.auth_cmds++;
-        c->thread->stats.auth_errors++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, auth_cmds);
+        THREAD_STATS_INCR(c->thread, auth_errors);
     }
 }
 
@@ -1788,6 +2017,27 @@ static bool authenticated(conn *c) {
     return rv;
 }
 
+/* Starts timing the command just parsed, for "stats latency" */
+static void latency_begin(conn *c, const enum latency_cmd cmd) {
+    if (!settings.latency_stats)
+        return;
+    c->lat_hist = LATENCY_HIST(cmd, c->protocol == binary_prot);
+    c->lat_spent = 0;
+    c->lat_start = latency_now();
+}
+
+/* Ends a stretch of work on the timed command. It is done unless it went
+ * on to read more of the request, which isn't counted. */
+static void latency_end(conn *c) {
+    if (c->lat_hist < 0)
+        return;
+    c->lat_spent += latency_now() - c->lat_start;
+    if (c->state != conn_nread) {
+        latency_record(c->lat_hist, c->lat_spent);
+        c->lat_hist = -1;
+    }
+}
+
 static void dispatch_bin_command(conn *c) {
     int protocol_error = 0;
 
@@ -1857,6 +2107,33 @@ static void dispatch_bin_command(conn *c) {
         c->noreply = false;
     }
 
+    switch (c->cmd) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETK:
+        /* runs of quiet gets are the binary multiget */
+        latency_begin(c, c->noreply ? LATENCY_MULTIGET : LATENCY_GET);
+        break;
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+        latency_begin(c, LATENCY_SET);
+        break;
+    case PROTOCOL_BINARY_CMD_DELETE:
+        latency_begin(c, LATENCY_DELETE);
+        break;
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+        latency_begin(c, LATENCY_INCRDECR);
+        break;
+    case PROTOCOL_BINARY_CMD_TOUCH:
+    case PROTOCOL_BINARY_CMD_GAT:
+    case PROTOCOL_BINARY_CMD_GATK:
+        latency_begin(c, LATENCY_TOUCH);
+        break;
+    }
+
     switch (c->cmd) {
         case PROTOCOL_BINARY_CMD_VERSION:
             if (extlen == 0 && keylen == 0 && bodylen == 0) {
@@ -2058,8 +2335,7 @@ static void process_bin_update(conn *c) {
     }
 
     c->item = it;
-    c->ritem = ITEM_data(it);
-    c->rlbytes = vlen;
+    conn_read_item(c, it, vlen);
     conn_set_state(c, conn_nread);
     c->substate = bin_read_set_value;
 }
@@ -2111,8 +2387,7 @@ static void process_bin_append_prepend(conn *c) {
     }
 
     c->item = it;
-    c->ritem = ITEM_data(it);
-    c->rlbytes = vlen;
+    conn_read_item(c, it, vlen);
     conn_set_state(c, conn_nread);
     c->substate = bin_read_set_value;
 }
@@ -2132,9 +2407,7 @@ static void process_bin_flush(conn *c) {
     }
     item_flush_expired();
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.flush_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THREAD_STATS_INCR(c->thread, flush_cmds);
 
     write_bin_response(c, NULL, 0, 0, 0);
 }
@@ -2162,9 +2435,7 @@ static void process_bin_delete(conn *c) {
         uint64_t cas = ntohll(req->message.header.request.cas);
         if (cas == 0 || cas == ITEM_get_cas(it)) {
             MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[it->slabs_clsid].delete_hits++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].delete_hits);
             item_unlink(it);
             write_bin_response(c, NULL, 0, 0, 0);
         } else {
@@ -2173,9 +2444,7 @@ static void process_bin_delete(conn *c) {
         item_remove(it);      /* release our reference */
     } else {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.delete_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, delete_misses);
     }
 }
 
@@ -2264,6 +2533,7 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
     enum store_item_type stored = NOT_STORED;
 
     item *new_it = NULL;
+    item *old_data = old_it; /* old_it, or its value uncompressed */
     int flags;
 
     if (old_it != NULL && comm == NREAD_ADD) {
@@ -2278,24 +2548,18 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
         if(old_it == NULL) {
             // LRU expired
             stored = NOT_FOUND;
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.cas_misses++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THREAD_STATS_INCR(c->thread, cas_misses);
         }
         else if (ITEM_get_cas(it) == ITEM_get_cas(old_it)) {
             // cas validates
             // it and old_it may belong to different classes.
             // I'm updating the stats for the one that's getting pushed out
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[old_it->slabs_clsid].cas_hits++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THREAD_STATS_INCR(c->thread, slab_stats[old_it->slabs_clsid].cas_hits);
 
             item_replace(old_it, it, hv);
             stored = STORED;
         } else {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[old_it->slabs_clsid].cas_badval++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THREAD_STATS_INCR(c->thread, slab_stats[old_it->slabs_clsid].cas_badval);
 
             if(settings.verbose > 1) {
                 fprintf(stderr, "CAS:  failure: expected %llu, got %llu\n",
@@ -2326,10 +2590,15 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
 
                 flags = (int) strtol(ITEM_suffix(old_it), (char **) NULL, 10);
 
-                new_it = item_alloc(key, it->nkey, flags, old_it->exptime, it->nbytes + old_it->nbytes - 2 /* CRLF */);
+                if (old_it->it_flags & ITEM_COMPRESSED)
+                    old_data = item_decompress(c->thread, old_it);
+                if (old_data != NULL)
+                    new_it = item_alloc(key, it->nkey, flags, old_it->exptime, it->nbytes + old_data->nbytes - 2 /* CRLF */);
 
                 if (new_it == NULL) {
                     /* SERVER_ERROR out of memory */
+                    if (old_data != NULL && old_data != old_it)
+                        do_item_remove(old_data);
                     if (old_it != NULL)
                         do_item_remove(old_it);
 
@@ -2339,12 +2608,12 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
                 /* copy data from it and old_it to new_it */
 
                 if (comm == NREAD_APPEND) {
-                    memcpy(ITEM_data(new_it), ITEM_data(old_it), old_it->nbytes);
-                    memcpy(ITEM_data(new_it) + old_it->nbytes - 2 /* CRLF */, ITEM_data(it), it->nbytes);
+                    item_copy_value(new_it, 0, old_data, old_data->nbytes);
+                    item_copy_value(new_it, old_data->nbytes - 2 /* CRLF */, it, it->nbytes);
                 } else {
                     /* NREAD_PREPEND */
-                    memcpy(ITEM_data(new_it), ITEM_data(it), it->nbytes);
-                    memcpy(ITEM_data(new_it) + it->nbytes - 2 /* CRLF */, ITEM_data(old_it), old_it->nbytes);
+                    item_copy_value(new_it, 0, it, it->nbytes);
+                    item_copy_value(new_it, it->nbytes - 2 /* CRLF */, old_data, old_data->nbytes);
                 }
 
                 it = new_it;
@@ -2363,6 +2632,8 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
         }
     }
 
+    if (old_data != NULL && old_data != old_it)
+        do_item_remove(old_data);
     if (old_it != NULL)
         do_item_remove(old_it);         /* release our reference */
     if (new_it != NULL)
@@ -2586,15 +2857,27 @@ static void server_stats(ADD_STAT add_stats, conn *c) {
     APPEND_STAT("hash_power_level", "%u", stats.hash_power_level);
     APPEND_STAT("hash_bytes", "%llu", (unsigned long long)stats.hash_bytes);
     APPEND_STAT("hash_is_expanding", "%u", stats.hash_is_expanding);
-    APPEND_STAT("expired_unfetched", "%llu", stats.expired_unfetched);
-    APPEND_STAT("evicted_unfetched", "%llu", stats.evicted_unfetched);
+    APPEND_STAT("hash_is_shrinking", "%u", stats.hash_is_shrinking);
+    APPEND_STAT("expired_unfetched", "%llu", (unsigned long long)
+                (stats.expired_unfetched + thread_stats.expired_unfetched));
+    APPEND_STAT("evicted_unfetched", "%llu", (unsigned long long)
+                (stats.evicted_unfetched + thread_stats.evicted_unfetched));
     if (settings.slab_reassign) {
         APPEND_STAT("slab_reassign_running", "%u", stats.slab_reassign_running);
         APPEND_STAT("slabs_moved", "%llu", stats.slabs_moved);
         APPEND_STAT("slabs_shrunk", "%llu", stats.slabs_shrunk);
-
+        APPEND_STAT("slab_items_rescued", "%llu", stats.slab_items_rescued);
+        APPEND_STAT("slab_items_evicted", "%llu", stats.slab_items_evicted);
+    }
+    if (settings.lru_crawler) {
+        APPEND_STAT("crawler_passes", "%llu", stats.crawler_passes);
+        APPEND_STAT("crawler_reclaimed", "%llu", stats.crawler_reclaimed);
     }
     STATS_UNLOCK();
+    if (settings.slab_reassign)
+        slabs_shrink_stats(add_stats, c);
+    if (strcmp(settings.balloon, "off") != 0)
+        balloon_stats(add_stats, c);
 }
 
 static void process_stat_settings(ADD_STAT add_stats, void *c) {
@@ -2624,10 +2907,36 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
                 prot_text(settings.binding_protocol));
     APPEND_STAT("auth_enabled_sasl", "%s", settings.sasl ? "yes" : "no");
     APPEND_STAT("item_size_max", "%d", settings.item_size_max);
+    APPEND_STAT("slab_page_size", "%d", settings.slab_page_size);
     APPEND_STAT("maxconns_fast", "%s", settings.maxconns_fast ? "yes" : "no");
     APPEND_STAT("hashpower_init", "%d", settings.hashpower_init);
     APPEND_STAT("slab_reassign", "%s", settings.slab_reassign ? "yes" : "no");
     APPEND_STAT("slab_automove", "%d", settings.slab_automove);
+    APPEND_STAT("slab_rescue", "%s", settings.slab_rescue ? "yes" : "no");
+    APPEND_STAT("shrink_rate", "%d", settings.shrink_rate);
+    APPEND_STAT("shrink_adaptive", "%s", settings.shrink_adaptive ? "yes" : "no");
+    APPEND_STAT("mrc_samples", "%d", settings.mrc_samples);
+    APPEND_STAT("limit_total_memory", "%s",
+                settings.limit_total_memory ? "yes" : "no");
+    APPEND_STAT("hash_index", "%s", settings.hash_tagged ? "tagged" : "chained");
+    APPEND_STAT("hash_algorithm", "%s", settings.hash_algorithm);
+    APPEND_STAT("hash_move_threads", "%d", settings.hash_move_threads);
+    APPEND_STAT("lru_shards", "%d", settings.lru_shards);
+    APPEND_STAT("reuseport", "%s", settings.reuseport ? "yes" : "no");
+    APPEND_STAT("conn_dispatch", "%s",
+                settings.dispatch_leastconn ? "leastconn" : "roundrobin");
+    APPEND_STAT("udp_batch", "%d", settings.udp_batch);
+    APPEND_STAT("latency_stats", "%s", settings.latency_stats ? "yes" : "no");
+    APPEND_STAT("page_pool", "%d", settings.page_pool);
+    APPEND_STAT("balloon", "%s", settings.balloon);
+    APPEND_STAT("balloon_min", "%llu", (unsigned long long)settings.balloon_min);
+    APPEND_STAT("balloon_max", "%llu", (unsigned long long)settings.balloon_max);
+    APPEND_STAT("balloon_step", "%llu", (unsigned long long)settings.balloon_step);
+    APPEND_STAT("slab_adaptive", "%d", settings.slab_adaptive);
+    APPEND_STAT("lru_crawler", "%s", settings.lru_crawler ? "yes" : "no");
+    APPEND_STAT("lru_crawler_sleep", "%d", settings.lru_crawler_sleep);
+    APPEND_STAT("numa", "%s", settings.numa ? "yes" : "no");
+    APPEND_STAT("compress_threshold", "%d", settings.compress_threshold);
 }
 
 static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
@@ -2707,33 +3016,52 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
 }
 
 /* ntokens is overwritten here... shrug.. */
+/*
+ * Multigets are looked up GET_BATCH keys at a time: all the keys of a batch
+ * are hashed and their buckets prefetched before the first lookup, so the
+ * cache misses of the batch overlap instead of following one another.
+ */
 static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool return_cas) {
     char *key;
     size_t nkey;
     int i = 0;
+    int k;
     item *it;
     token_t *key_token = &tokens[KEY_TOKEN];
+    token_t batch[GET_BATCH + 1];
+    uint32_t hvs[GET_BATCH];
     char *suffix;
+    bool nomem = false;
     assert(c != NULL);
 
     do {
-        while(key_token->length != 0) {
+        for (k = 0; key_token[k].length != 0; k++) {
+            if (key_token[k].length > KEY_MAX_LENGTH) {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+            hvs[k] = hash(key_token[k].value, key_token[k].length);
+            assoc_prefetch(hvs[k]);
+        }
+
+        for (k = 0; key_token->length != 0; k++) {
 
             key = key_token->value;
             nkey = key_token->length;
 
-            if(nkey > KEY_MAX_LENGTH) {
-                out_string(c, "CLIENT_ERROR bad command line format");
-                return;
+            it = item_get_hv(key, nkey, hvs[k]);
+            if (it && (it = uncompressed_item(c, it)) == NULL) {
+                nomem = true;
+                break;
             }
-
-            it = item_get(key, nkey);
             if (settings.detail_enabled) {
                 stats_prefix_record_get(key, nkey, NULL != it);
             }
             if (it) {
                 if (i >= c->isize) {
-                    item **new_list = realloc(c->ilist, sizeof(item *) * c->isize * 2);
+                    item **new_list = conn_buf_realloc(c->thread, c->ilist,
+                                                       sizeof(item *) * c->isize,
+                                                       sizeof(item *) * c->isize * 2);
                     if (new_list) {
                         c->isize *= 2;
                         c->ilist = new_list;
@@ -2757,7 +3085,9 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                                         it->nbytes, ITEM_get_cas(it));
                   /* Goofy mid-flight realloc. */
                   if (i >= c->suffixsize) {
-                    char **new_suffix_list = realloc(c->suffixlist,
+                    char **new_suffix_list = conn_buf_realloc(c->thread,
+                                           c->suffixlist,
+                                           sizeof(char *) * c->suffixsize,
                                            sizeof(char *) * c->suffixsize * 2);
                     if (new_suffix_list) {
                         c->suffixsize *= 2;
@@ -2782,7 +3112,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                       add_iov(c, ITEM_key(it), it->nkey) != 0 ||
                       add_iov(c, ITEM_suffix(it), it->nsuffix - 2) != 0 ||
                       add_iov(c, suffix, suffix_len) != 0 ||
-                      add_iov(c, ITEM_data(it), it->nbytes) != 0)
+                      add_iov_value(c, it, it->nbytes) != 0)
                       {
                           item_remove(it);
                           break;
@@ -2794,7 +3124,10 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                                         it->nbytes, ITEM_get_cas(it));
                   if (add_iov(c, "VALUE ", 6) != 0 ||
                       add_iov(c, ITEM_key(it), it->nkey) != 0 ||
-                      add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) != 0)
+                      ((it->it_flags & ITEM_CHUNKED) ?
+                       add_iov(c, ITEM_suffix(it), it->nsuffix) != 0 ||
+                       add_iov_value(c, it, it->nbytes) != 0 :
+                       add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) != 0))
                       {
                           item_remove(it);
                           break;
@@ -2806,32 +3139,32 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                     fprintf(stderr, ">%d sending key %s\n", c->sfd, ITEM_key(it));
 
                 /* item_get() has incremented it->refcount for us */
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
-                c->thread->stats.get_cmds++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].get_hits);
+                THREAD_STATS_INCR(c->thread, get_cmds);
                 item_update(it);
                 *(c->ilist + i) = it;
                 i++;
 
             } else {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.get_misses++;
-                c->thread->stats.get_cmds++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THREAD_STATS_INCR(c->thread, get_misses);
+                THREAD_STATS_INCR(c->thread, get_cmds);
                 MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
             }
 
             key_token++;
         }
 
+        /* Retrying the key would only fail to decompress it again */
+        if (nomem)
+            break;
+
         /*
          * If the command string hasn't been fully processed, get the next set
          * of tokens.
          */
         if(key_token->value != NULL) {
-            ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
-            key_token = tokens;
+            ntokens = tokenize_command(key_token->value, batch, GET_BATCH + 1);
+            key_token = batch;
         }
 
     } while(key_token->value != NULL);
@@ -2945,8 +3278,7 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
     ITEM_set_cas(it, req_cas_id);
 
     c->item = it;
-    c->ritem = ITEM_data(it);
-    c->rlbytes = it->nbytes;
+    conn_read_item(c, it, it->nbytes);
     c->cmd = comm;
     conn_set_state(c, conn_nread);
 }
@@ -2977,18 +3309,14 @@ static void process_touch_command(conn *c, token_t *tokens, const size_t ntokens
     it = item_touch(key, nkey, realtime(exptime_int));
     if (it) {
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.slab_stats[it->slabs_clsid].touch_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, touch_cmds);
+        THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].touch_hits);
 
         out_string(c, "TOUCHED");
         item_remove(it);
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.touch_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, touch_cmds);
+        THREAD_STATS_INCR(c->thread, touch_misses);
 
         out_string(c, "NOT_FOUND");
     }
@@ -3028,13 +3356,11 @@ static void process_arithmetic_command(conn *c, token_t *tokens, const size_t nt
         out_string(c, "SERVER_ERROR out of memory");
         break;
     case DELTA_ITEM_NOT_FOUND:
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (incr) {
-            c->thread->stats.incr_misses++;
+            THREAD_STATS_INCR(c->thread, incr_misses);
         } else {
-            c->thread->stats.decr_misses++;
+            THREAD_STATS_INCR(c->thread, decr_misses);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
 
         out_string(c, "NOT_FOUND");
         break;
@@ -3075,7 +3401,8 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
 
     ptr = ITEM_data(it);
 
-    if (!safe_strtoull(ptr, &value)) {
+    if ((it->it_flags & (ITEM_CHUNKED | ITEM_COMPRESSED)) != 0 ||
+        !safe_strtoull(ptr, &value)) {
         do_item_remove(it);
         return NON_NUMERIC;
     }
@@ -3092,13 +3419,11 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
         MEMCACHED_COMMAND_DECR(c->sfd, ITEM_key(it), it->nkey, value);
     }
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
     if (incr) {
-        c->thread->stats.slab_stats[it->slabs_clsid].incr_hits++;
+        THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].incr_hits);
     } else {
-        c->thread->stats.slab_stats[it->slabs_clsid].decr_hits++;
+        THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].decr_hits);
     }
-    pthread_mutex_unlock(&c->thread->stats.mutex);
 
     snprintf(buf, INCR_MAX_STORAGE_LEN, "%llu", (unsigned long long)value);
     res = strlen(buf);
@@ -3119,7 +3444,7 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
     } else { /* replace in-place */
         /* When changing the value without replacing the item, we
            need to update the CAS on the existing item. */
-        mutex_lock(&cache_lock); /* FIXME */
+        latency_lock(&cache_lock, LATENCY_CACHE_LOCK, mutex_lock);
         ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
         mutex_unlock(&cache_lock);
 
@@ -3171,17 +3496,13 @@ static void process_delete_command(conn *c, token_t *tokens, const size_t ntoken
     if (it) {
         MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
 
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.slab_stats[it->slabs_clsid].delete_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, slab_stats[it->slabs_clsid].delete_hits);
 
         item_unlink(it);
         item_remove(it);      /* release our reference */
         out_string(c, "DELETED");
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.delete_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, delete_misses);
 
         out_string(c, "NOT_FOUND");
     }
@@ -3229,15 +3550,16 @@ static void process_maxmegabytes_command(conn *c, token_t *tokens, const size_t
     unsigned long newmaxbytes = (unsigned long) strtol(tokens[COMMAND_TOKEN + 1].value,
             NULL, 10) * (1UL << 20);
 
+    memory_limit_lock();
     long long ret = memory_shrink_expand(newmaxbytes);
     switch (ret) {
     case -1:
         out_string(c, "ERROR: Could not change memory to new value; "
-                "Using a preallocated memory chunk, memory cannot be changed at run time.");
+                "Using a preallocated memory chunk, memory cannot grow beyond its initial size.");
         break;
     case -2:
         out_string(c, "ERROR: Could not change memory to new value; "
-                "Requested change is smaller than item_size_max (one slab)");
+                "Requested change is smaller than slab_page_size (one slab)");
         break;
     default: {
         if (newmaxbytes < settings.maxbytes) {
@@ -3257,8 +3579,11 @@ static void process_maxmegabytes_command(conn *c, token_t *tokens, const size_t
             out_string(c, "OK"); /*Increasing memory limitation, nothing to check*/
 
         settings.maxbytes = newmaxbytes; /*note that this does not set mem_limit*/
+        if (strcmp(settings.balloon, "off") != 0)
+            balloon_limit_set(newmaxbytes);
     }
     }
+    memory_limit_unlock();
     return;
 }
 
@@ -3294,6 +3619,7 @@ static void process_command(conn *c, char *command) {
         ((strcmp(tokens[COMMAND_TOKEN].value, "get") == 0) ||
          (strcmp(tokens[COMMAND_TOKEN].value, "bget") == 0))) {
 
+        latency_begin(c, ntokens > 3 ? LATENCY_MULTIGET : LATENCY_GET);
         process_get_command(c, tokens, ntokens, false);
 
     } else if ((ntokens == 6 || ntokens == 7) &&
@@ -3303,30 +3629,37 @@ static void process_command(conn *c, char *command) {
                 (strcmp(tokens[COMMAND_TOKEN].value, "prepend") == 0 && (comm = NREAD_PREPEND)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "append") == 0 && (comm = NREAD_APPEND)) )) {
 
+        latency_begin(c, LATENCY_SET);
         process_update_command(c, tokens, ntokens, comm, false);
 
     } else if ((ntokens == 7 || ntokens == 8) && (strcmp(tokens[COMMAND_TOKEN].value, "cas") == 0 && (comm = NREAD_CAS))) {
 
+        latency_begin(c, LATENCY_SET);
         process_update_command(c, tokens, ntokens, comm, true);
 
     } else if ((ntokens == 4 || ntokens == 5) && (strcmp(tokens[COMMAND_TOKEN].value, "incr") == 0)) {
 
+        latency_begin(c, LATENCY_INCRDECR);
         process_arithmetic_command(c, tokens, ntokens, 1);
 
     } else if (ntokens >= 3 && (strcmp(tokens[COMMAND_TOKEN].value, "gets") == 0)) {
 
+        latency_begin(c, ntokens > 3 ? LATENCY_MULTIGET : LATENCY_GET);
         process_get_command(c, tokens, ntokens, true);
 
     } else if ((ntokens == 4 || ntokens == 5) && (strcmp(tokens[COMMAND_TOKEN].value, "decr") == 0)) {
 
+        latency_begin(c, LATENCY_INCRDECR);
         process_arithmetic_command(c, tokens, ntokens, 0);
 
     } else if (ntokens >= 3 && ntokens <= 5 && (strcmp(tokens[COMMAND_TOKEN].value, "delete") == 0)) {
 
+        latency_begin(c, LATENCY_DELETE);
         process_delete_command(c, tokens, ntokens);
 
     } else if ((ntokens == 4 || ntokens == 5) && (strcmp(tokens[COMMAND_TOKEN].value, "touch") == 0)) {
 
+        latency_begin(c, LATENCY_TOUCH);
         process_touch_command(c, tokens, ntokens);
 
     } else if (ntokens >= 2 && (strcmp(tokens[COMMAND_TOKEN].value, "stats") == 0)) {
@@ -3338,9 +3671,7 @@ static void process_command(conn *c, char *command) {
 
         set_noreply_maybe(c, tokens, ntokens);
 
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.flush_cmds++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_INCR(c->thread, flush_cmds);
 
         if(ntokens == (c->noreply ? 3 : 2)) {
             settings.oldest_live = current_time - 1;
@@ -3577,6 +3908,211 @@ static int try_read_command(conn *c) {
     return 1;
 }
 
+#ifdef HAVE_MMSG
+/*
+ * With -o udp_batch, a UDP connection reads up to settings.udp_batch
+ * datagrams with one recvmmsg, and handles them one after the other as
+ * usual. Responses are copied out of the msglist into send slots instead of
+ * being written right away, and all go out with one sendmmsg once the
+ * datagrams read are done with, or the slots are full.
+ *
+ * The msglist can't be handed to sendmmsg as it is: its iovecs point into
+ * the items of the request and the connection's UDP header buffer, and
+ * those are released and rewritten as soon as the next datagram of the
+ * batch is handled. Copying each datagram, at most UDP_MAX_PAYLOAD_SIZE
+ * bytes, keeps the responses of the whole batch without holding on to
+ * items or sending one syscall per request.
+ */
+struct udp_batch {
+    int nread;                  /* datagrams in the receive slots */
+    int next;                   /* next one to handle */
+    int nsend;                  /* responses waiting in the send slots */
+    struct mmsghdr *rmsgs;
+    struct iovec *riov;
+    struct sockaddr *raddrs;
+    char *rbufs;                /* UDP_READ_BUFFER_SIZE each */
+    struct mmsghdr *smsgs;
+    struct iovec *siov;
+    struct sockaddr *saddrs;
+    char *sbufs;                /* UDP_MAX_PAYLOAD_SIZE each */
+};
+
+static size_t udp_batch_bytes(void) {
+    return sizeof(struct udp_batch) +
+        settings.udp_batch * (UDP_READ_BUFFER_SIZE + UDP_MAX_PAYLOAD_SIZE +
+                              2 * (sizeof(struct mmsghdr) +
+                                   sizeof(struct iovec) +
+                                   sizeof(struct sockaddr)));
+}
+
+static void udp_batch_free(conn *c) {
+    struct udp_batch *b = c->udp_batch;
+
+    if (b == NULL)
+        return;
+    free(b->rmsgs);
+    free(b->riov);
+    free(b->raddrs);
+    free(b->rbufs);
+    free(b->smsgs);
+    free(b->siov);
+    free(b->saddrs);
+    free(b->sbufs);
+    free(b);
+    c->udp_batch = NULL;
+}
+
+static bool udp_batch_init(conn *c) {
+    const int n = settings.udp_batch;
+    struct udp_batch *b;
+    int i;
+
+    if (c->udp_batch != NULL)
+        return true;
+    if ((b = calloc(1, sizeof(*b))) == NULL)
+        return false;
+    c->udp_batch = b;
+    b->rmsgs = calloc(n, sizeof(struct mmsghdr));
+    b->riov = calloc(n, sizeof(struct iovec));
+    b->raddrs = calloc(n, sizeof(struct sockaddr));
+    b->rbufs = malloc((size_t)n * UDP_READ_BUFFER_SIZE);
+    b->smsgs = calloc(n, sizeof(struct mmsghdr));
+    b->siov = calloc(n, sizeof(struct iovec));
+    b->saddrs = calloc(n, sizeof(struct sockaddr));
+    b->sbufs = malloc((size_t)n * UDP_MAX_PAYLOAD_SIZE);
+    if (b->rmsgs == NULL || b->riov == NULL || b->raddrs == NULL ||
+        b->rbufs == NULL || b->smsgs == NULL || b->siov == NULL ||
+        b->saddrs == NULL || b->sbufs == NULL) {
+        udp_batch_free(c);
+        return false;
+    }
+
+    for (i = 0; i < n; i++) {
+        b->riov[i].iov_base = b->rbufs + (size_t)i * UDP_READ_BUFFER_SIZE;
+        b->riov[i].iov_len = UDP_READ_BUFFER_SIZE;
+        b->rmsgs[i].msg_hdr.msg_iov = &b->riov[i];
+        b->rmsgs[i].msg_hdr.msg_iovlen = 1;
+        b->rmsgs[i].msg_hdr.msg_name = &b->raddrs[i];
+        b->siov[i].iov_base = b->sbufs + (size_t)i * UDP_MAX_PAYLOAD_SIZE;
+        b->smsgs[i].msg_hdr.msg_iov = &b->siov[i];
+        b->smsgs[i].msg_hdr.msg_iovlen = 1;
+        b->smsgs[i].msg_hdr.msg_name = &b->saddrs[i];
+    }
+    return true;
+}
+
+static bool udp_batch_pending(const conn *c) {
+    return c->udp_batch != NULL && c->udp_batch->next < c->udp_batch->nread;
+}
+
+/*
+ * Hands out the next datagram of the batch, copied into the read buffer,
+ * reading a new batch if they have all been handled. Returns its length,
+ * or -1 if there is none.
+ */
+static int udp_batch_read(conn *c) {
+    struct udp_batch *b = c->udp_batch;
+    struct msghdr *m;
+    int i, len;
+
+    if (b->next == b->nread) {
+        for (i = 0; i < settings.udp_batch; i++)
+            b->rmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr);
+        b->next = b->nread = 0;
+        if ((len = recvmmsg(c->sfd, b->rmsgs, settings.udp_batch,
+                            MSG_DONTWAIT, NULL)) <= 0)
+            return -1;
+        b->nread = len;
+    }
+
+    m = &b->rmsgs[b->next].msg_hdr;
+    len = b->rmsgs[b->next].msg_len;
+    memcpy(&c->request_addr, m->msg_name, m->msg_namelen);
+    c->request_addr_size = m->msg_namelen;
+    memcpy(c->rbuf, m->msg_iov->iov_base, len);
+    b->next++;
+    return len;
+}
+
+/* Sends every queued response with one sendmmsg. UDP may drop them anyway,
+ * so a full socket buffer drops the rest rather than waiting. */
+static void udp_batch_flush(conn *c) {
+    struct udp_batch *b = c->udp_batch;
+    int sent = 0, res, i;
+    uint64_t bytes = 0;
+
+    if (b == NULL || b->nsend == 0)
+        return;
+    while (sent < b->nsend) {
+        res = sendmmsg(c->sfd, b->smsgs + sent, b->nsend - sent, 0);
+        if (res <= 0) {
+            if (settings.verbose > 0)
+                perror("Failed to write UDP batch");
+            break;
+        }
+        for (i = sent; i < sent + res; i++)
+            bytes += b->smsgs[i].msg_len;
+        sent += res;
+    }
+    b->nsend = 0;
+
+    THREAD_STATS_ADD(c->thread, bytes_written, bytes);
+}
+
+/* Copies the remaining messages of the response into the send slots */
+static void udp_batch_queue(conn *c) {
+    struct udp_batch *b = c->udp_batch;
+
+    for (; c->msgcurr < c->msgused; c->msgcurr++) {
+        struct msghdr *m = &c->msglist[c->msgcurr];
+        struct msghdr *out;
+        char *dst;
+        size_t len = 0;
+        int i;
+
+        if (b->nsend == settings.udp_batch)
+            udp_batch_flush(c);
+        out = &b->smsgs[b->nsend].msg_hdr;
+        dst = out->msg_iov->iov_base;
+        for (i = 0; i < m->msg_iovlen; i++) {
+            assert(len + m->msg_iov[i].iov_len <= UDP_MAX_PAYLOAD_SIZE);
+            memcpy(dst + len, m->msg_iov[i].iov_base, m->msg_iov[i].iov_len);
+            len += m->msg_iov[i].iov_len;
+        }
+        out->msg_iov->iov_len = len;
+        memcpy(out->msg_name, m->msg_name, m->msg_namelen);
+        out->msg_namelen = m->msg_namelen;
+        m->msg_iovlen = 0;
+        b->nsend++;
+    }
+}
+#else
+static size_t udp_batch_bytes(void) {
+    return 0;
+}
+
+static bool udp_batch_init(conn *c) {
+    return false;
+}
+
+static int udp_batch_read(conn *c) {
+    return -1;
+}
+
+static void udp_batch_free(conn *c) {
+}
+
+static bool udp_batch_pending(const conn *c) {
+    return false;
+}
+
+static void udp_batch_flush(conn *c) {
+}
+
+static void udp_batch_queue(conn *c) {
+}
+#endif
+
 /*
  * read a UDP request.
  */
@@ -3585,14 +4121,16 @@ static enum try_read_result try_read_udp(conn *c) {
 
     assert(c != NULL);
 
-    c->request_addr_size = sizeof(c->request_addr);
-    res = recvfrom(c->sfd, c->rbuf, c->rsize,
-                   0, &c->request_addr, &c->request_addr_size);
+    if (c->udp_batch != NULL) {
+        res = udp_batch_read(c);
+    } else {
+        c->request_addr_size = sizeof(c->request_addr);
+        res = recvfrom(c->sfd, c->rbuf, c->rsize,
+                       0, &c->request_addr, &c->request_addr_size);
+    }
     if (res > 8) {
         unsigned char *buf = (unsigned char *)c->rbuf;
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.bytes_read += res;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THREAD_STATS_ADD(c->thread, bytes_read, res);
 
         /* Beginning of UDP packet is the request ID; save it. */
         c->request_id = buf[0] * 256 + buf[1];
@@ -3644,7 +4182,8 @@ static enum try_read_result try_read_network(conn *c) {
                 return gotdata;
             }
             ++num_allocs;
-            char *new_rbuf = realloc(c->rbuf, c->rsize * 2);
+            char *new_rbuf = conn_buf_realloc(c->thread, c->rbuf, c->rsize,
+                                              c->rsize * 2);
             if (!new_rbuf) {
                 if (settings.verbose > 0)
                     fprintf(stderr, "Couldn't realloc input buffer\n");
@@ -3660,9 +4199,7 @@ static enum try_read_result try_read_network(conn *c) {
         int avail = c->rsize - c->rbytes;
         res = read(c->sfd, c->rbuf + c->rbytes, avail);
         if (res > 0) {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.bytes_read += res;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THREAD_STATS_ADD(c->thread, bytes_read, res);
             gotdata = READ_DATA_RECEIVED;
             c->rbytes += res;
             if (res == avail) {
@@ -3733,6 +4270,33 @@ void do_accept_new_conns(const bool do_accept) {
     }
 }
 
+static void worker_accept_resume(const int fd, const short which, void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    conn *next;
+
+    for (next = me->listen_conns; next; next = next->next)
+        update_event(next, EV_READ | EV_PERSIST);
+}
+
+/*
+ * Stops a worker accepting on its own listeners after it ran out of file
+ * descriptors, and has it try again in 10ms.
+ */
+static void worker_accept_pause(LIBEVENT_THREAD *me) {
+    struct timeval t = {.tv_sec = 0, .tv_usec = 10000};
+    conn *next;
+
+    for (next = me->listen_conns; next; next = next->next)
+        update_event(next, 0);
+    evtimer_set(&me->accept_retry, worker_accept_resume, me);
+    event_base_set(me->base, &me->accept_retry);
+    evtimer_add(&me->accept_retry, &t);
+
+    STATS_LOCK();
+    stats.listen_disabled_num++;
+    STATS_UNLOCK();
+}
+
 /*
  * Transmit the next chunk of data from our list of msgbuf structures.
  *
@@ -3745,6 +4309,11 @@ void do_accept_new_conns(const bool do_accept) {
 static enum transmit_result transmit(conn *c) {
     assert(c != NULL);
 
+    if (c->udp_batch != NULL) {
+        udp_batch_queue(c);
+        return TRANSMIT_COMPLETE;
+    }
+
     if (c->msgcurr < c->msgused &&
             c->msglist[c->msgcurr].msg_iovlen == 0) {
         /* Finished writing the current msg; advance to the next. */
@@ -3756,9 +4325,7 @@ static enum transmit_result transmit(conn *c) {
 
         res = sendmsg(c->sfd, m, 0);
         if (res > 0) {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.bytes_written += res;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THREAD_STATS_ADD(c->thread, bytes_written, res);
 
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
@@ -3811,6 +4378,16 @@ static void drive_machine(conn *c) {
 
     assert(c != NULL);
 
+    if (c->rbuf == NULL && c->state != conn_listening &&
+        !conn_buffers_get(c)) {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Failed to get connection buffers\n");
+        /* A UDP socket tries again on its next datagram */
+        if (IS_UDP(c->transport))
+            return;
+        conn_set_state(c, conn_closing);
+    }
+
     while (!stop) {
 
         switch(c->state) {
@@ -3823,7 +4400,10 @@ static void drive_machine(conn *c) {
                 } else if (errno == EMFILE) {
                     if (settings.verbose > 0)
                         fprintf(stderr, "Too many open connections\n");
-                    accept_new_conns(false);
+                    if (is_listen_thread())
+                        accept_new_conns(false);
+                    else
+                        worker_accept_pause(c->thread);
                     stop = true;
                 } else {
                     perror("accept()");
@@ -3855,6 +4435,12 @@ static void drive_machine(conn *c) {
             break;
 
         case conn_waiting:
+            /* Datagrams already read in don't wake the socket up again */
+            if (udp_batch_pending(c)) {
+                conn_set_state(c, conn_read);
+                break;
+            }
+            udp_batch_flush(c);
             if (!update_event(c, EV_READ | EV_PERSIST)) {
                 if (settings.verbose > 0)
                     fprintf(stderr, "Couldn't update event\n");
@@ -3862,6 +4448,10 @@ static void drive_machine(conn *c) {
                 break;
             }
 
+            /* Idle between requests, so the buffers go back to the pools
+               until the client sends more */
+            if (c->rbytes == 0 && !IS_UDP(c->transport))
+                conn_buffers_put(c);
             conn_set_state(c, conn_read);
             stop = true;
             break;
@@ -3890,6 +4480,7 @@ static void drive_machine(conn *c) {
                 /* wee need more data! */
                 conn_set_state(c, conn_waiting);
             }
+            latency_end(c);
 
             break;
 
@@ -3901,10 +4492,9 @@ static void drive_machine(conn *c) {
             if (nreqs >= 0) {
                 reset_cmd_handler(c);
             } else {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.conn_yields++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
-                if (c->rbytes > 0) {
+                THREAD_STATS_INCR(c->thread, conn_yields);
+                udp_batch_flush(c);
+                if (c->rbytes > 0 || udp_batch_pending(c)) {
                     /* We have already read in data into the input buffer,
                        so libevent will most likely not signal read events
                        on the socket (unless more data is available. As a
@@ -3922,8 +4512,18 @@ static void drive_machine(conn *c) {
             break;
 
         case conn_nread:
+            if (c->rlbytes == 0 && c->rlrest > 0) {
+                c->ritem = c->rchunk->data;
+                c->rlbytes = c->rchunk->used < c->rlrest ? c->rchunk->used
+                                                         : c->rlrest;
+                c->rlrest -= c->rlbytes;
+                c->rchunk = c->rchunk->next;
+            }
             if (c->rlbytes == 0) {
+                if (c->lat_hist >= 0)
+                    c->lat_start = latency_now();
                 complete_nread(c);
+                latency_end(c);
                 break;
             }
             /* first check if we have leftovers in the conn_read buffer */
@@ -3944,9 +4544,7 @@ static void drive_machine(conn *c) {
             /*  now try reading from the socket */
             res = read(c->sfd, c->ritem, c->rlbytes);
             if (res > 0) {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.bytes_read += res;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THREAD_STATS_ADD(c->thread, bytes_read, res);
                 if (c->rcurr == c->ritem) {
                     c->rcurr += res;
                 }
@@ -3999,9 +4597,7 @@ static void drive_machine(conn *c) {
             /*  now try reading from the socket */
             res = read(c->sfd, c->rbuf, c->rsize > c->sbytes ? c->sbytes : c->rsize);
             if (res > 0) {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.bytes_read += res;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THREAD_STATS_ADD(c->thread, bytes_read, res);
                 c->sbytes -= res;
                 break;
             }
@@ -4128,6 +4724,7 @@ void event_handler(const int fd, const short which, void *arg) {
     }
 
     drive_machine(c);
+    item_update_flush();
 
     /* wait for next event */
     return;
@@ -4185,6 +4782,58 @@ static void maximize_sndbuf(const int sfd) {
         fprintf(stderr, "<%d send buffer was %d, now %d\n", sfd, old_size, last_good);
 }
 
+static void tcp_socket_options(const int sfd) {
+    struct linger ling = {0, 0};
+    int flags = 1;
+    int error;
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+}
+
+#ifdef SO_REUSEPORT
+/*
+ * Opens another listening socket on the address sfd is bound to, for one
+ * more worker to accept on. Returns -1 on failure.
+ */
+static int reuseport_socket(struct addrinfo *ai, const int sfd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int flags = 1;
+    int s;
+
+    if (getsockname(sfd, (struct sockaddr *)&addr, &len) != 0 ||
+        (s = new_socket(ai)) == -1) {
+        perror("reuseport socket");
+        return -1;
+    }
+#ifdef IPV6_V6ONLY
+    if (ai->ai_family == AF_INET6)
+        setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &flags, sizeof(flags));
+#endif
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+    tcp_socket_options(s);
+
+    if (bind(s, (struct sockaddr *)&addr, len) == -1 ||
+        listen(s, settings.backlog) == -1) {
+        perror("reuseport bind()");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+#endif
+
 /**
  * Create a socket and bind it to a specific port number
  * @param interface the interface to bind to
@@ -4199,7 +4848,6 @@ static int server_socket(const char *interface,
                          enum network_transport transport,
                          FILE *portnumber_file) {
     int sfd;
-    struct linger ling = {0, 0};
     struct addrinfo *ai;
     struct addrinfo *next;
     struct addrinfo hints = { .ai_flags = AI_PASSIVE,
@@ -4253,17 +4901,11 @@ static int server_socket(const char *interface,
         if (IS_UDP(transport)) {
             maximize_sndbuf(sfd);
         } else {
-            error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
+            tcp_socket_options(sfd);
+#ifdef SO_REUSEPORT
+            if (settings.reuseport)
+                setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+#endif
         }
 
         if (bind(sfd, next->ai_addr, next->ai_addrlen) == -1) {
@@ -4306,13 +4948,35 @@ static int server_socket(const char *interface,
         }
 
         if (IS_UDP(transport)) {
+            /* Carries on across listeners, so that with one thread per
+             * UDP socket the interfaces still go round the workers */
+            static int udp_thread = 0;
             int c;
 
             for (c = 0; c < settings.num_threads_per_udp; c++) {
-                /* this is guaranteed to hit all threads because we round-robin */
-                dispatch_conn_new(sfd, conn_read, EV_READ | EV_PERSIST,
-                                  UDP_READ_BUFFER_SIZE, transport);
+                dispatch_conn_thread(udp_thread, sfd, conn_read,
+                                     EV_READ | EV_PERSIST,
+                                     UDP_READ_BUFFER_SIZE, transport);
+                udp_thread = (udp_thread + 1) % settings.num_threads;
+            }
+#ifdef SO_REUSEPORT
+        } else if (settings.reuseport) {
+            int t;
+
+            /* Every worker accepts on a socket of its own for this address,
+             * and the kernel spreads the connections between them. */
+            dispatch_conn_thread(0, sfd, conn_listening, EV_READ | EV_PERSIST,
+                                 1, transport);
+            for (t = 1; t < settings.num_threads; t++) {
+                int s = reuseport_socket(next, sfd);
+                if (s == -1) {
+                    freeaddrinfo(ai);
+                    return 1;
+                }
+                dispatch_conn_thread(t, s, conn_listening,
+                                     EV_READ | EV_PERSIST, 1, transport);
             }
+#endif
         } else {
             if (!(listen_conn_add = conn_new(sfd, conn_listening,
                                              EV_READ | EV_PERSIST, 1,
@@ -4541,7 +5205,8 @@ static void usage(void) {
            "              the memory page size could reduce the number of TLB misses\n"
            "              and improve the performance. In order to get large pages\n"
            "              from the OS, memcached will allocate the total item-cache\n"
-           "              in one large chunk.\n");
+           "              in one large chunk. The memory limit can still be lowered\n"
+           "              at run time, and raised again up to its initial value.\n");
     printf("-D <char>     Use <char> as the delimiter between key prefixes and IDs.\n"
            "              This is used for per-prefix stats reporting. The default is\n"
            "              \":\" (colon). If this option is specified, stats collection\n"
@@ -4554,8 +5219,9 @@ static void usage(void) {
     printf("-C            Disable use of CAS\n");
     printf("-b            Set the backlog queue limit (default: 1024)\n");
     printf("-B            Binding protocol - one of ascii, binary, or auto (default)\n");
-    printf("-I            Override the size of each slab page. Adjusts max item size\n"
-           "              (default: 1mb, min: 1k, max: 128m)\n");
+    printf("-I            Override the max item size (default: 1mb, min: 1k,\n"
+           "              max: 128m). Items larger than a slab page are stored\n"
+           "              in pieces.\n");
 #ifdef ENABLE_SASL
     printf("-S            Turn on Sasl authentication\n");
 #endif
@@ -4566,6 +5232,70 @@ static void usage(void) {
            "                table should be. Can be grown at runtime if not big enough.\n"
            "                Set this based on \"STAT hash_power_level\" before a \n"
            "                restart.\n"
+           "              - slab_rescue: when a slab page is moved or shrunk, copy\n"
+           "                its live items into free chunks of the class (or over\n"
+           "                the LRU tail) instead of evicting them.\n"
+           "              - shrink_rate: empty slab pages no faster than this many\n"
+           "                MB/s when the memory limit is lowered (default: no limit).\n"
+           "              - shrink_adaptive: slow a shrink down while workers wait\n"
+           "                on the cache lock, and speed it up again when they don't.\n"
+           "              - mrc_samples: track up to this many sampled keys to\n"
+           "                estimate the hit ratio per cache size (\"stats mrc\").\n"
+           "                0 (the default) turns the estimation off.\n"
+           "              - limit_total_memory: hold connections, threads and\n"
+           "                other accounted memory (\"stats memory\") against -m,\n"
+           "                shrinking slabs to make room for them.\n"
+           "              - hash_index: \"chained\" (default) or \"tagged\", which\n"
+           "                keeps the hash table in cache line sized groups and\n"
+           "                compares a byte of the hash before touching items.\n"
+           "              - hash_algorithm: the key hash, \"jenkins\" (default),\n"
+           "                \"murmur3\", or \"crc32c\" (in hardware where the CPU\n"
+           "                has it).\n"
+           "              - hash_move_threads: threads moving items to the new\n"
+           "                table when the hash table grows or shrinks\n"
+           "                (default: 1).\n"
+           "              - lru_shards: split each slab class LRU into this many\n"
+           "                lists (a power of two up to 16), and move hits up the\n"
+           "                LRU in per-thread batches (default: 1).\n"
+           "              - reuseport: have every worker thread accept TCP\n"
+           "                connections on its own SO_REUSEPORT socket.\n"
+           "              - conn_dispatch: how the listening thread hands out\n"
+           "                connections, \"roundrobin\" (default) or \"leastconn\"\n"
+           "                to the worker with the fewest open ones.\n"
+           );
+    printf("              - udp_batch: read up to this many UDP datagrams with\n"
+           "                one recvmmsg, and send their responses with one\n"
+           "                sendmmsg (default: 0, off; at most 64).\n"
+           "              - latency_stats: keep histograms of command latency\n"
+           "                and lock waits (\"stats latency\").\n"
+           "              - page_pool: keep up to this many slab pages allocated\n"
+           "                and faulted in ahead of demand, while there is room\n"
+           "                under the memory limit (default: 0, off; needs\n"
+           "                slab_reassign).\n"
+           "              - balloon: lower the memory limit under memory pressure\n"
+           "                and raise it again once it is gone, reading \"psi\"\n"
+           "                (/proc/pressure/memory) or \"cgroup\" (memory.current\n"
+           "                against memory.high). Needs slab_reassign.\n"
+           "              - balloon_min, balloon_max, balloon_step: the bounds of\n"
+           "                the limit, and how far it moves at a time, in MB\n"
+           "                (default: -m/4, -m and -m/16).\n"
+           "              - slab_adaptive: every this many seconds, fit the slab\n"
+           "                class chunk sizes to the sizes of the stored items,\n"
+           "                and move pages over to the new classes when that\n"
+           "                saves memory (default: 0, off). Needs slab_reassign.\n"
+           "              - lru_crawler: free expired and flushed items in the\n"
+           "                background, without waiting for them to reach the\n"
+           "                LRU tail; without pauses while memory is over the limit.\n"
+           "              - lru_crawler_sleep: microseconds the crawler rests\n"
+           "                between batches of items (default: 100).\n"
+           "              - numa: pin worker threads round robin to the NUMA\n"
+           "                nodes, and allocate slab pages on the node of the\n"
+           "                worker that stores items in them. Not with -L.\n"
+           "              - compress_threshold: store values of at least this\n"
+           "                many bytes compressed, when that makes them smaller\n"
+           "                (default: 0, off; else at least 64).\n"
+           "              - slab_page_size: bytes of a slab page, at most -I\n"
+           "                (default: 1m). Larger items are stored in pieces.\n"
            );
     return;
 }
@@ -4732,6 +5462,9 @@ static int enable_large_pages(void) {
     }
 
     return ret;
+#elif defined(MADV_HUGEPAGE)
+    /* The item-cache chunk is advised to use transparent huge pages */
+    return 0;
 #else
     return -1;
 #endif
@@ -4759,6 +5492,33 @@ static bool sanitycheck(void) {
     return true;
 }
 
+/* Parse a -o size given in megabytes into bytes */
+static bool parse_megabytes(const char *name, const char *value, size_t *out) {
+    int mb;
+
+    if (value == NULL || (mb = atoi(value)) <= 0) {
+        fprintf(stderr, "%s takes a size in MB\n", name);
+        return false;
+    }
+    *out = (size_t)mb * 1024 * 1024;
+    return true;
+}
+
+/* Parse a size in bytes, or in kilobytes or megabytes with a k or m
+ * suffix, as -I takes it */
+static int parse_size_suffix(const char *value) {
+    char *end;
+    long size = strtol(value, &end, 10);
+
+    if (*end == 'k' || *end == 'K')
+        size *= 1024;
+    else if (*end == 'm' || *end == 'M')
+        size *= 1024 * 1024;
+    if (size > INT_MAX)
+        return INT_MAX;
+    return size;
+}
+
 int main (int argc, char **argv) {
     int c;
     bool lock_memory = false;
@@ -4769,8 +5529,6 @@ int main (int argc, char **argv) {
     char *pid_file = NULL;
     struct passwd *pw;
     struct rlimit rlim;
-    char unit = '\0';
-    int size_max = 0;
     int retval = EXIT_SUCCESS;
     /* listening sockets */
     static int *l_socket = NULL;
@@ -4780,6 +5538,7 @@ int main (int argc, char **argv) {
     bool protocol_specified = false;
     bool tcp_specified = false;
     bool udp_specified = false;
+    enum hashfunc_type hash_type = JENKINS_HASH;
 
     char *subopts;
     char *subopts_value;
@@ -4787,13 +5546,61 @@ int main (int argc, char **argv) {
         MAXCONNS_FAST = 0,
         HASHPOWER_INIT,
         SLAB_REASSIGN,
-        SLAB_AUTOMOVE
+        SLAB_AUTOMOVE,
+        SLAB_RESCUE,
+        SHRINK_RATE,
+        SHRINK_ADAPTIVE,
+        MRC_SAMPLES,
+        LIMIT_TOTAL_MEMORY,
+        HASH_INDEX,
+        HASH_ALGORITHM,
+        HASH_MOVE_THREADS,
+        LRU_SHARDS,
+        REUSEPORT,
+        CONN_DISPATCH,
+        UDP_BATCH,
+        LATENCY_STATS,
+        PAGE_POOL,
+        BALLOON,
+        BALLOON_MIN,
+        BALLOON_MAX,
+        BALLOON_STEP,
+        SLAB_ADAPTIVE,
+        LRU_CRAWLER,
+        LRU_CRAWLER_SLEEP,
+        NUMA,
+        COMPRESS_THRESHOLD,
+        SLAB_PAGE_SIZE
     };
     char *const subopts_tokens[] = {
         [MAXCONNS_FAST] = "maxconns_fast",
         [HASHPOWER_INIT] = "hashpower",
         [SLAB_REASSIGN] = "slab_reassign",
         [SLAB_AUTOMOVE] = "slab_automove",
+        [SLAB_RESCUE] = "slab_rescue",
+        [SHRINK_RATE] = "shrink_rate",
+        [SHRINK_ADAPTIVE] = "shrink_adaptive",
+        [MRC_SAMPLES] = "mrc_samples",
+        [LIMIT_TOTAL_MEMORY] = "limit_total_memory",
+        [HASH_INDEX] = "hash_index",
+        [HASH_ALGORITHM] = "hash_algorithm",
+        [HASH_MOVE_THREADS] = "hash_move_threads",
+        [LRU_SHARDS] = "lru_shards",
+        [REUSEPORT] = "reuseport",
+        [CONN_DISPATCH] = "conn_dispatch",
+        [UDP_BATCH] = "udp_batch",
+        [LATENCY_STATS] = "latency_stats",
+        [PAGE_POOL] = "page_pool",
+        [BALLOON] = "balloon",
+        [BALLOON_MIN] = "balloon_min",
+        [BALLOON_MAX] = "balloon_max",
+        [BALLOON_STEP] = "balloon_step",
+        [SLAB_ADAPTIVE] = "slab_adaptive",
+        [LRU_CRAWLER] = "lru_crawler",
+        [LRU_CRAWLER_SLEEP] = "lru_crawler_sleep",
+        [NUMA] = "numa",
+        [COMPRESS_THRESHOLD] = "compress_threshold",
+        [SLAB_PAGE_SIZE] = "slab_page_size",
         NULL
     };
 
@@ -4982,19 +5789,7 @@ int main (int argc, char **argv) {
             }
             break;
         case 'I':
-            unit = optarg[strlen(optarg)-1];
-            if (unit == 'k' || unit == 'm' ||
-                unit == 'K' || unit == 'M') {
-                optarg[strlen(optarg)-1] = '\0';
-                size_max = atoi(optarg);
-                if (unit == 'k' || unit == 'K')
-                    size_max *= 1024;
-                if (unit == 'm' || unit == 'M')
-                    size_max *= 1024 * 1024;
-                settings.item_size_max = size_max;
-            } else {
-                settings.item_size_max = atoi(optarg);
-            }
+            settings.item_size_max = parse_size_suffix(optarg);
             if (settings.item_size_max < 1024) {
                 fprintf(stderr, "Item max size cannot be less than 1024 bytes.\n");
                 return 1;
@@ -5003,13 +5798,6 @@ int main (int argc, char **argv) {
                 fprintf(stderr, "Cannot set item size limit higher than 128 mb.\n");
                 return 1;
             }
-            if (settings.item_size_max > 1024 * 1024) {
-                fprintf(stderr, "WARNING: Setting item max size above 1MB is not"
-                    " recommended!\n"
-                    " Raising this limit increases the minimum memory requirements\n"
-                    " and will decrease your memory efficiency.\n"
-                );
-            }
             break;
         case 'S': /* set Sasl authentication to true. Default is false */
 #ifndef ENABLE_SASL
@@ -5058,6 +5846,224 @@ int main (int argc, char **argv) {
                     return 1;
                 }
                 break;
+            case SLAB_RESCUE:
+                settings.slab_rescue = true;
+                break;
+            case SHRINK_RATE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for shrink_rate\n");
+                    return 1;
+                }
+                settings.shrink_rate = atoi(subopts_value);
+                if (settings.shrink_rate < 0) {
+                    fprintf(stderr, "shrink_rate must not be negative\n");
+                    return 1;
+                }
+                break;
+            case SHRINK_ADAPTIVE:
+                settings.shrink_adaptive = true;
+                break;
+            case MRC_SAMPLES:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for mrc_samples\n");
+                    return 1;
+                }
+                settings.mrc_samples = atoi(subopts_value);
+                if (settings.mrc_samples < 0) {
+                    fprintf(stderr, "mrc_samples must not be negative\n");
+                    return 1;
+                }
+                break;
+            case LIMIT_TOTAL_MEMORY:
+                settings.limit_total_memory = true;
+                break;
+            case HASH_INDEX:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing argument for hash_index\n");
+                    return 1;
+                }
+                if (strcmp(subopts_value, "tagged") == 0) {
+                    settings.hash_tagged = true;
+                } else if (strcmp(subopts_value, "chained") == 0) {
+                    settings.hash_tagged = false;
+                } else {
+                    fprintf(stderr, "hash_index must be chained or tagged\n");
+                    return 1;
+                }
+                break;
+            case HASH_ALGORITHM:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hash_algorithm argument\n");
+                    return 1;
+                }
+                if (strcmp(subopts_value, "jenkins") == 0) {
+                    hash_type = JENKINS_HASH;
+                    settings.hash_algorithm = "jenkins";
+                } else if (strcmp(subopts_value, "murmur3") == 0) {
+                    hash_type = MURMUR3_HASH;
+                    settings.hash_algorithm = "murmur3";
+                } else if (strcmp(subopts_value, "crc32c") == 0) {
+                    hash_type = CRC32C_HASH;
+                    settings.hash_algorithm = "crc32c";
+                } else {
+                    fprintf(stderr, "Unknown hash_algorithm option (jenkins, murmur3, crc32c)\n");
+                    return 1;
+                }
+                break;
+            case HASH_MOVE_THREADS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing hash_move_threads argument\n");
+                    return 1;
+                }
+                settings.hash_move_threads = atoi(subopts_value);
+                if (settings.hash_move_threads < 1 ||
+                    settings.hash_move_threads > 64) {
+                    fprintf(stderr, "hash_move_threads must be 1 to 64\n");
+                    return 1;
+                }
+                break;
+            case LRU_SHARDS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing lru_shards argument\n");
+                    return 1;
+                }
+                settings.lru_shards = atoi(subopts_value);
+                if (settings.lru_shards < 1 ||
+                    settings.lru_shards > LRU_SHARDS_MAX ||
+                    (settings.lru_shards & (settings.lru_shards - 1)) != 0) {
+                    fprintf(stderr, "lru_shards must be a power of two, 1 to %d\n",
+                            LRU_SHARDS_MAX);
+                    return 1;
+                }
+                break;
+            case REUSEPORT:
+#ifdef SO_REUSEPORT
+                settings.reuseport = true;
+#else
+                fprintf(stderr, "reuseport is not supported on this platform\n");
+                return 1;
+#endif
+                break;
+            case CONN_DISPATCH:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing conn_dispatch argument\n");
+                    return 1;
+                }
+                if (strcmp(subopts_value, "leastconn") == 0) {
+                    settings.dispatch_leastconn = true;
+                } else if (strcmp(subopts_value, "roundrobin") == 0) {
+                    settings.dispatch_leastconn = false;
+                } else {
+                    fprintf(stderr, "conn_dispatch must be roundrobin or leastconn\n");
+                    return 1;
+                }
+                break;
+            case UDP_BATCH:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing udp_batch argument\n");
+                    return 1;
+                }
+#ifdef HAVE_MMSG
+                settings.udp_batch = atoi(subopts_value);
+                if (settings.udp_batch < 0 ||
+                    settings.udp_batch > UDP_BATCH_MAX) {
+                    fprintf(stderr, "udp_batch must be 0 to %d\n", UDP_BATCH_MAX);
+                    return 1;
+                }
+#else
+                fprintf(stderr, "udp_batch needs recvmmsg and sendmmsg\n");
+                return 1;
+#endif
+                break;
+            case LATENCY_STATS:
+                settings.latency_stats = true;
+                break;
+            case PAGE_POOL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing page_pool argument\n");
+                    return 1;
+                }
+                settings.page_pool = atoi(subopts_value);
+                if (settings.page_pool < 0) {
+                    fprintf(stderr, "page_pool must not be negative\n");
+                    return 1;
+                }
+                break;
+            case BALLOON:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing balloon argument\n");
+                    return 1;
+                }
+                settings.balloon = strdup(subopts_value);
+                break;
+            case BALLOON_MIN:
+                if (!parse_megabytes("balloon_min", subopts_value,
+                                     &settings.balloon_min))
+                    return 1;
+                break;
+            case BALLOON_MAX:
+                if (!parse_megabytes("balloon_max", subopts_value,
+                                     &settings.balloon_max))
+                    return 1;
+                break;
+            case BALLOON_STEP:
+                if (!parse_megabytes("balloon_step", subopts_value,
+                                     &settings.balloon_step))
+                    return 1;
+                break;
+            case SLAB_ADAPTIVE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_adaptive argument\n");
+                    return 1;
+                }
+                settings.slab_adaptive = atoi(subopts_value);
+                if (settings.slab_adaptive < 0) {
+                    fprintf(stderr, "slab_adaptive must not be negative\n");
+                    return 1;
+                }
+                break;
+            case LRU_CRAWLER:
+                settings.lru_crawler = true;
+                break;
+            case LRU_CRAWLER_SLEEP:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing lru_crawler_sleep argument\n");
+                    return 1;
+                }
+                settings.lru_crawler_sleep = atoi(subopts_value);
+                if (settings.lru_crawler_sleep < 0 ||
+                    settings.lru_crawler_sleep > 1000000) {
+                    fprintf(stderr, "lru_crawler_sleep must be 0 to 1000000\n");
+                    return 1;
+                }
+                break;
+            case NUMA:
+                settings.numa = true;
+                break;
+            case COMPRESS_THRESHOLD:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing compress_threshold argument\n");
+                    return 1;
+                }
+                settings.compress_threshold = atoi(subopts_value);
+                if (settings.compress_threshold != 0 &&
+                    settings.compress_threshold < 64) {
+                    fprintf(stderr, "compress_threshold must be 0 or at least 64\n");
+                    return 1;
+                }
+                break;
+            case SLAB_PAGE_SIZE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_page_size argument\n");
+                    return 1;
+                }
+                settings.slab_page_size = parse_size_suffix(subopts_value);
+                if (settings.slab_page_size < 1024 ||
+                    settings.slab_page_size > 1024 * 1024 * 128) {
+                    fprintf(stderr, "slab_page_size must be 1024 to 128m\n");
+                    return 1;
+                }
+                break;
             default:
                 printf("Illegal suboption \"%s\"\n", subopts_value);
                 return 1;
@@ -5071,6 +6077,54 @@ int main (int argc, char **argv) {
         }
     }
 
+    if (strcmp(settings.balloon, "off") != 0) {
+        if (!settings.slab_reassign) {
+            fprintf(stderr, "balloon needs slab_reassign\n");
+            exit(EX_USAGE);
+        }
+        if (!balloon_init())
+            exit(EX_USAGE);
+    }
+
+    if (settings.slab_adaptive > 0 && !settings.slab_reassign) {
+        fprintf(stderr, "slab_adaptive needs slab_reassign\n");
+        exit(EX_USAGE);
+    }
+
+    /* Only whole pages can be pooled, and those are only used by every
+     * class with slab_reassign */
+    if (settings.page_pool > 0 && !settings.slab_reassign) {
+        fprintf(stderr, "page_pool needs slab_reassign\n");
+        exit(EX_USAGE);
+    }
+
+    if (settings.numa) {
+        if (preallocate) {
+            fprintf(stderr, "numa can't be used with -L\n");
+            exit(EX_USAGE);
+        }
+        if (!numa_mode_init())
+            exit(EX_USAGE);
+    }
+
+    if (settings.compress_threshold > 0 && !compression_init())
+        exit(EX_USAGE);
+
+    if (settings.slab_page_size > settings.item_size_max)
+        settings.slab_page_size = settings.item_size_max;
+    if (settings.slab_page_size > 1024 * 1024) {
+        fprintf(stderr, "WARNING: Setting the slab page size above 1MB is not"
+            " recommended!\n"
+            " Raising it increases the minimum memory requirements\n"
+            " and will decrease your memory efficiency.\n"
+        );
+    }
+
+    if (hash_init(hash_type) != 0) {
+        fprintf(stderr, "Failed to initialize hash_algorithm!\n");
+        exit(EX_USAGE);
+    }
+
     /*
      * Use one workerthread to serve each UDP port if the user specified
      * multiple ports
@@ -5193,8 +6247,11 @@ int main (int argc, char **argv) {
     /* initialize other stuff */
     stats_init();
     assoc_init(settings.hashpower_init);
+    items_init();
     conn_init();
     slabs_init(settings.maxbytes, settings.factor, preallocate);
+    if (settings.mrc_samples > 0)
+        mrc_init(settings.mrc_samples);
 
     /*
      * ignore SIGPIPE signals; we can use errno == EPIPE if we
@@ -5216,6 +6273,19 @@ int main (int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (settings.page_pool > 0 && start_page_pool_thread() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(settings.balloon, "off") != 0 &&
+        start_balloon_thread() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (settings.lru_crawler && start_item_crawler_thread() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
     /* initialise clock event */
     clock_handler(0, 0, 0);
 
@@ -5296,6 +6366,8 @@ int main (int argc, char **argv) {
     }
 
     stop_assoc_maintenance_thread();
+    if (settings.page_pool > 0)
+        stop_page_pool_thread();
 
     /* remove the PID file if we're a daemon */
     if (do_daemonize)
@@ -21,6 +21,10 @@
 #include <unistd.h>
 #include <stdbool.h>
 
+#ifdef __sun
+#include <atomic.h>
+#endif
+
 #include "protocol_binary.h"
 #include "cache.h"
 
@@ -36,6 +40,12 @@
 #define UDP_READ_BUFFER_SIZE 65536
 #define UDP_MAX_PAYLOAD_SIZE 1400
 #define UDP_HEADER_SIZE 8
+/* Most datagrams -o udp_batch reads or sends per system call */
+#define UDP_BATCH_MAX 64
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+#define HAVE_MMSG 1
+#endif
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
 /* I'm told the max length of a 64-bit num converted to string is 20 bytes.
  * Plus a few for spaces, \r\n, \0 */
@@ -59,6 +69,11 @@
 #define IOV_LIST_HIGHWAT 600
 #define MSG_LIST_HIGHWAT 100
 
+/** Connection buffers come from per-thread pools in power of two classes,
+ *  CONN_BUF_MIN bytes up to a UDP read buffer; larger ones are malloced. */
+#define CONN_BUF_MIN 256
+#define CONN_BUF_CLASSES 9
+
 /* Binary protocol stuff */
 #define MIN_BIN_PKT_LENGTH 16
 #define BIN_PKT_HDR_WORDS (MIN_BIN_PKT_LENGTH/sizeof(uint32_t))
@@ -81,6 +96,16 @@
     harvesting it on a low memory condition. */
 #define TAIL_REPAIR_TIME (3 * 3600)
 
+/* Most lists a class LRU may be split into, by -o lru_shards */
+#define LRU_SHARDS_MAX 16
+/* LRU bumps a worker queues before applying them */
+#define LRU_BUMP_BATCH 32
+/* Keeps data written by different threads apart */
+#define CACHE_LINE_SIZE 64
+
+/* Keys of a multiget hashed and prefetched together */
+#define GET_BATCH 32
+
 /* warning: don't use these macros with a function, as it evals its arg twice */
 #define ITEM_get_cas(i) (((i)->it_flags & ITEM_CAS) ? \
         (i)->data->cas : (uint64_t)0)
@@ -101,10 +126,19 @@
          + (item)->nsuffix \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
-#define ITEM_ntotal(item) (sizeof(struct _stritem) + (item)->nkey + 1 \
+/* Bytes of the item's own chunk. A chunked item's fills a page; the rest of
+ * its value is in its pieces. */
+#define ITEM_ntotal(item) (((item)->it_flags & ITEM_CHUNKED) ? \
+         (size_t)settings.slab_page_size : \
+         sizeof(struct _stritem) + (item)->nkey + 1 \
          + (item)->nsuffix + (item)->nbytes \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
+/* Where the value of a chunked item starts, after ITEM_data on a pointer
+ * boundary; the bytes of it kept in the item's own chunk follow */
+#define ITEM_chunks(item) ((item_chunks *)(((uintptr_t)ITEM_data(item) \
+         + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1)))
+
 #define STAT_KEY_LEN 128
 #define STAT_VAL_LEN 128
 
@@ -215,11 +249,31 @@ struct slab_stats {
     uint64_t  decr_hits;
 };
 
+/*
+ * Latency histograms (see latency.c): one per command family and protocol,
+ * then one per lock whose waits are timed.
+ */
+enum latency_cmd {
+    LATENCY_GET = 0,
+    LATENCY_MULTIGET,
+    LATENCY_SET,
+    LATENCY_DELETE,
+    LATENCY_INCRDECR,
+    LATENCY_TOUCH,
+    LATENCY_CMDS
+};
+#define LATENCY_HIST(cmd, binary) ((binary) ? LATENCY_CMDS + (cmd) : (cmd))
+#define LATENCY_CACHE_LOCK (2 * LATENCY_CMDS)
+#define LATENCY_SLABS_LOCK (2 * LATENCY_CMDS + 1)
+#define LATENCY_HISTS (2 * LATENCY_CMDS + 2)
+#define LATENCY_BUCKETS 128
+
 /**
- * Stats stored per-thread.
+ * Stats stored per-thread. Only the owning thread writes them, with
+ * THREAD_STATS_ADD, and aggregation reads them without a lock; they hold
+ * nothing but uint64_t counters so they can be walked as an array.
  */
 struct thread_stats {
-    pthread_mutex_t   mutex;
     uint64_t          get_cmds;
     uint64_t          get_misses;
     uint64_t          touch_cmds;
@@ -234,9 +288,42 @@ struct thread_stats {
     uint64_t          conn_yields; /* # of yields for connections (-R option)*/
     uint64_t          auth_cmds;
     uint64_t          auth_errors;
+    uint64_t          evictions;
+    uint64_t          reclaimed;
+    uint64_t          expired_unfetched;
+    uint64_t          evicted_unfetched;
+    uint64_t          compress_cmds;      /* values tried, -o compress_threshold */
+    uint64_t          compressed_items;   /* of them, stored compressed */
+    uint64_t          compress_bytes_in;  /* their lengths before */
+    uint64_t          compress_bytes_out; /* and after */
+    uint64_t          compress_time;      /* CPU ns spent compressing */
+    uint64_t          decompress_cmds;
+    uint64_t          decompress_time;
+    uint64_t          decompress_nomem;
     struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES];
+    uint64_t          latency[LATENCY_HISTS][LATENCY_BUCKETS];
 };
 
+/* Relaxed atomics keep the counters from tearing, at the cost of a plain
+ * load and store: there is no other writer to race with. Without them the
+ * update takes atomics_mutex, like the refcounts. */
+#if defined(HAVE_GCC_ATOMICS)
+#define THREAD_STATS_ADD(t, field, n) \
+    __atomic_store_n(&(t)->stats.field, (t)->stats.field + (n), \
+                     __ATOMIC_RELAXED)
+#elif defined(__sun)
+#define THREAD_STATS_ADD(t, field, n) \
+    atomic_add_64(&(t)->stats.field, (n))
+#else
+extern pthread_mutex_t atomics_mutex;
+#define THREAD_STATS_ADD(t, field, n) do { \
+    pthread_mutex_lock(&atomics_mutex); \
+    (t)->stats.field += (n); \
+    pthread_mutex_unlock(&atomics_mutex); \
+} while (0)
+#endif
+#define THREAD_STATS_INCR(t, field) THREAD_STATS_ADD(t, field, 1)
+
 /**
  * Global stats.
  */
@@ -265,11 +352,16 @@ struct stats {
     unsigned int  hash_power_level; /* Better hope it's not over 9000 */
     uint64_t      hash_bytes;       /* size used for hash tables */
     bool          hash_is_expanding; /* If the hash table is being expanded */
+    bool          hash_is_shrinking; /* If the hash table is being shrunk */
     uint64_t      expired_unfetched; /* items reclaimed but never touched */
     uint64_t      evicted_unfetched; /* items evicted but never touched */
     bool          slab_reassign_running; /* slab reassign in progress */
     uint64_t      slabs_moved;       /* times slabs were moved around */
     uint64_t      slabs_shrunk;      /* times slabs were shrunk */
+    uint64_t      slab_items_rescued; /* live items copied out of a killed page */
+    uint64_t      slab_items_evicted; /* live items lost to a killed page */
+    uint64_t      crawler_passes;    /* LRU crawler walks over all classes */
+    uint64_t      crawler_reclaimed; /* dead items freed by the crawler */
 };
 
 #define MAX_VERBOSITY_LEVEL 2
@@ -300,11 +392,35 @@ struct settings {
     bool use_cas;
     enum protocol binding_protocol;
     int backlog;
-    int item_size_max;        /* Maximum item size, and upper end for slabs */
+    int item_size_max;        /* Maximum item size */
+    int slab_page_size;       /* Size of a slab page, and upper end for slabs */
     bool sasl;              /* SASL on/off */
     bool maxconns_fast;     /* Whether or not to early close connections */
     bool slab_reassign;     /* Whether or not slab reassignment is allowed */
     int slab_automove;     /* Whether or not to automatically move slabs */
+    bool slab_rescue;       /* Copy live items out of pages being killed */
+    int shrink_rate;        /* MB/s a shrink may free, 0 for no limit */
+    bool shrink_adaptive;   /* Slow shrinks down under lock contention */
+    int mrc_samples;        /* Keys sampled for the miss ratio curve */
+    bool limit_total_memory; /* Count all accounted memory against -m */
+    bool hash_tagged;       /* Index items in tagged groups, not chains */
+    char *hash_algorithm;   /* Name of the key hash picked by hash_init */
+    int hash_move_threads;  /* Threads migrating buckets on a resize */
+    int lru_shards;         /* Lists each class LRU is split into */
+    bool reuseport;         /* Each worker accepts on its own TCP sockets */
+    bool dispatch_leastconn; /* New conns go to the least loaded worker */
+    int udp_batch;          /* Datagrams per recvmmsg/sendmmsg, 0 for off */
+    bool latency_stats;     /* Time commands and lock waits, "stats latency" */
+    int page_pool;          /* Slab pages kept allocated ahead of demand */
+    char *balloon;          /* Pressure source of balloon mode, or "off" */
+    size_t balloon_min;     /* Bounds of the limit balloon mode may set */
+    size_t balloon_max;
+    size_t balloon_step;    /* Bytes the limit moves by at a time */
+    int slab_adaptive;      /* Seconds between slab geometry fits, or 0 */
+    bool lru_crawler;       /* Reclaim dead items in the background */
+    int lru_crawler_sleep;  /* Microseconds between crawler batches */
+    bool numa;              /* Workers and slab pages placed on NUMA nodes */
+    int compress_threshold; /* Values at least this long are compressed, or 0 */
     int hashpower_init;     /* Starting hash power level */
 };
 
@@ -319,6 +435,14 @@ extern struct settings settings;
 #define ITEM_SLABBED 4
 
 #define ITEM_FETCHED 8
+/* value compressed, -o compress_threshold */
+#define ITEM_COMPRESSED 16
+/* value held partly in item_chunk pieces */
+#define ITEM_CHUNKED 32
+/* set on the pieces themselves */
+#define ITEM_CHUNK 64
+/* malloc'd rather than a slab chunk; see item_alloc_heap() */
+#define ITEM_HEAP 128
 
 /**
  * Structure for storing items within memcached.
@@ -335,6 +459,7 @@ typedef struct _stritem {
     uint8_t         it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
     uint8_t         nkey;       /* key length, w/terminating null and padding */
+    uint32_t        hv;         /* hash of the key, set at alloc */
     /* this odd type prevents type-punning issues when we do
      * the little shuffle to save space when not using CAS. */
     union {
@@ -347,15 +472,61 @@ typedef struct _stritem {
     /* then data with terminating \r\n (no terminating null; it's binary!) */
 } item;
 
+/**
+ * A piece of the value of a chunked item. An item too large for the
+ * largest slab class gets a chunk of it all the same, filled with its
+ * header and the start of its value, and the rest goes in a list of these.
+ * The fields up to hv are where they are in an item, so the slab code can
+ * tell what any chunk of a page holds.
+ */
+typedef struct _strchunk {
+    struct _strchunk *next;     /* next piece of the value, or NULL */
+    struct _strchunk *prev;     /* previous piece, or NULL for the first */
+    struct _stritem  *head;     /* the item the value belongs to */
+    int              size;      /* bytes data can hold */
+    int              used;      /* bytes of the value in it */
+    int              unused1;
+    unsigned short   refcount;  /* 1 while in use */
+    uint8_t          unused2;
+    uint8_t          it_flags;  /* ITEM_CHUNK, or ITEM_SLABBED once freed */
+    uint8_t          slabs_clsid;
+    uint8_t          unused3;
+    uint32_t         hv;        /* that of the head */
+    char             data[];
+} item_chunk;
+
+/* At ITEM_chunks of a chunked item */
+typedef struct {
+    item_chunk       *first;    /* first piece */
+    int              used;      /* bytes of the value held in the item */
+} item_chunks;
+
+enum item_lock_types {
+    ITEM_LOCK_GRANULAR = 0,
+    ITEM_LOCK_GLOBAL
+};
+
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
     struct event notify_event;  /* listen event for notify pipe */
     int notify_receive_fd;      /* receiving end of notify pipe */
     int notify_send_fd;         /* sending end of notify pipe */
-    struct thread_stats stats;  /* Stats generated by this thread */
+    /* Stats generated by this thread, on cache lines of their own */
+    struct thread_stats stats __attribute__((aligned(CACHE_LINE_SIZE)));
     struct conn_queue *new_conn_queue; /* queue of new connections to handle */
     cache_t *suffix_cache;      /* suffix cache */
+    cache_t *conn_buffers[CONN_BUF_CLASSES]; /* buffers of active conns */
+    enum item_lock_types item_lock_type; /* use fine-grained or global item lock */
+    item *lru_bumps[LRU_BUMP_BATCH]; /* hits not yet moved up the LRU */
+    int lru_nbumps;
+    /* client connections served, or on their way; the dispatcher writes it */
+    int open_conns __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct conn *listen_conns;  /* own SO_REUSEPORT listeners, -o reuseport */
+    struct event accept_retry;  /* resumes them after running out of fds */
+    int numa_node;              /* node it runs on with -o numa, or -1 */
+    char *compress_buf;         /* values are compressed into it first */
+    size_t compress_size;
 } LIBEVENT_THREAD;
 
 typedef struct {
@@ -391,6 +562,8 @@ struct conn {
 
     char   *ritem;  /** when we read in an item's value, it goes here */
     int    rlbytes;
+    item_chunk *rchunk; /** then, for a chunked item, in this piece and on */
+    int    rlrest;   /** the bytes that go there */
 
     /* data for the nread state */
 
@@ -435,8 +608,14 @@ struct conn {
     socklen_t request_addr_size;
     unsigned char *hdrbuf; /* udp packet headers */
     int    hdrsize;   /* number of headers' worth of space is allocated */
+    struct udp_batch *udp_batch; /* datagrams moved per syscall, -o udp_batch */
+    size_t mem_accounted; /* bytes last reported for this conn */
 
     bool   noreply;   /* True if the reply should not be sent. */
+    int    bin_prefetched; /* quiet gets ahead in rbuf already prefetched */
+    int    lat_hist;  /* histogram the current command is timed in, or -1 */
+    uint64_t lat_start; /* when the current part of it started, in ns */
+    uint64_t lat_spent; /* ns spent on it before that */
     /* current stats command */
     struct {
         char *buffer;
@@ -499,6 +678,11 @@ static inline int mutex_lock(pthread_mutex_t *mutex)
 #include "slabs.h"
 #include "assoc.h"
 #include "items.h"
+#include "mrc.h"
+#include "latency.h"
+#include "balloon.h"
+#include "numa_mode.h"
+#include "compression.h"
 #include "trace.h"
 #include "hash.h"
 #include "util.h"
@@ -513,6 +697,8 @@ static inline int mutex_lock(pthread_mutex_t *mutex)
 void thread_init(int nthreads, struct event_base *main_base);
 int  dispatch_event_add(int thread, conn *c);
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
+void dispatch_conn_thread(int tid, int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
+void thread_conn_closed(LIBEVENT_THREAD *t);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 enum delta_result_type add_delta(conn *c, const char *key,
@@ -527,6 +713,7 @@ item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbyt
 char *item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
 void  item_flush_expired(void);
 item *item_get(const char *key, const size_t nkey);
+item *item_get_hv(const char *key, const size_t nkey, const uint32_t hv);
 item *item_touch(const char *key, const size_t nkey, uint32_t exptime);
 int   item_link(item *it);
 void  item_remove(item *it);
@@ -535,17 +722,47 @@ void  item_stats(ADD_STAT add_stats, void *c);
 void  item_stats_sizes(ADD_STAT add_stats, void *c);
 void  item_unlink(item *it);
 void  item_update(item *it);
+void  item_update_flush(void);
 
+extern unsigned int item_lock_hashpower;
 void item_lock(uint32_t hv);
 void item_unlock(uint32_t hv);
+void *item_trylock(uint32_t hv);
+void item_trylock_unlock(void *arg);
+void item_lock_global(void);
+void item_unlock_global(void);
+void switch_item_lock_type(enum item_lock_types type);
 unsigned short refcount_incr(unsigned short *refcount);
 unsigned short refcount_decr(unsigned short *refcount);
+void memory_barrier(void);
 void STATS_LOCK(void);
 void STATS_UNLOCK(void);
+/** The calling worker thread, or NULL when called from any other */
+LIBEVENT_THREAD *worker_thread_self(void);
+/* Connection buffers from the pools of thread t (NULL: plain malloc). The
+ * size of a buffer must be passed back when it is resized or freed. */
+void *conn_buf_alloc(LIBEVENT_THREAD *t, const size_t size);
+void *conn_buf_realloc(LIBEVENT_THREAD *t, void *buf, const size_t size,
+                       const size_t new_size);
+void conn_buf_free(LIBEVENT_THREAD *t, void *buf, const size_t size);
 void threadlocal_stats_reset(void);
 void threadlocal_stats_aggregate(struct thread_stats *stats);
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out);
 
+/* Memory held outside the slab pages and the hash table */
+enum memory_category {
+    MEMORY_CONNECTIONS,  /* conn structures and their buffers, pools included,
+                            and uncompressed copies being sent */
+    MEMORY_SUFFIX,       /* per-thread suffix caches, counted by the caches */
+    MEMORY_THREADS,      /* thread descriptors, queues, lock tables, ghost
+                            lists and compression buffers */
+    MEMORY_MRC,          /* miss ratio curve sampler */
+    MEMORY_CATEGORIES
+};
+void memory_account(enum memory_category category, const int64_t delta);
+uint64_t memory_accounted(enum memory_category category);
+uint64_t memory_accounted_total(void);
+
 /* Stat processing functions */
 void append_stat(const char *name, ADD_STAT add_stats, conn *c,
                  const char *fmt, ...);
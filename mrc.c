@@ -0,0 +1,405 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Miss ratio curve estimation, after "Efficient MRC Construction with
+ * SHARDS" (Waldspurger et al., FAST '15).
+ *
+ * Keys are sampled by their hash: a key is tracked when its sampling value
+ * is below a threshold. The reuse distance of a lookup of a tracked key is
+ * the bytes of the keys referenced since its last one, scaled up by the
+ * sampling rate. An LRU cache hits exactly the lookups whose reuse distance
+ * is smaller than the cache, so a histogram of the distances gives the hit
+ * ratio for every cache size.
+ *
+ * The number of tracked keys is fixed. When a new key would not fit, the
+ * key with the largest sampling value is dropped and the threshold lowered
+ * to it, so the rate adapts to the size of the key space. Distances are
+ * kept both across all classes and within each slab class, the latter being
+ * the memory the class itself would need.
+ *
+ * Every sampled lookup costs O(log samples) under mrc_lock: the keys sit in
+ * two treaps ordered by the time of their last reference, one for all of
+ * them and one per class, each node holding the bytes of its subtree, so a
+ * distance is the sum along one path. A max-heap of the sampling values
+ * finds the key to drop.
+ */
+
+#include "memcached.h"
+#include "slabs.h"
+#include "mrc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Sampling values and the threshold live in [0, MRC_SPACE] */
+#define MRC_SPACE (1U << 24)
+
+/* Histogram buckets: 1 MB wide up to 4 MB, then four per power of two */
+#define MRC_BUCKETS 64
+
+/* The treaps: one over all the tracked keys, one per slab class */
+#define MRC_ALL 0
+#define MRC_CLASS 1
+
+typedef struct {
+    uint32_t hv;
+    uint32_t sval;
+    uint32_t size;      /* chunk size of the item */
+    int hnext;          /* hash chain, or free list */
+    unsigned int clsid;
+    uint32_t prio;      /* treap priority */
+    uint64_t time;      /* of the last reference, the treap key */
+    int child[2][2];    /* per treap, left and right */
+    uint64_t bytes[2];  /* per treap, sizes in the subtree */
+} mrc_entry;
+
+static mrc_entry *entries = NULL;
+static int *mrc_hash = NULL;
+static unsigned int mrc_hash_mask = 0;
+static unsigned int max_entries = 0;
+static unsigned int num_entries = 0;
+static int free_entries = -1;
+static uint32_t threshold = MRC_SPACE;
+
+static int all_root = -1;
+static int class_root[POWER_LARGEST];
+static uint64_t mrc_clock = 0;
+static uint32_t prio_state = 2463534242U;
+
+/* Max-heap of the tracked keys by sampling value */
+static int *sval_heap = NULL;
+static unsigned int heap_len = 0;
+
+/* Index 0 is the whole cache, the others are the slab classes */
+static uint64_t references[POWER_LARGEST];
+static uint64_t histogram[POWER_LARGEST][MRC_BUCKETS];
+
+static pthread_mutex_t mrc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void mrc_init(const unsigned int max_samples) {
+    unsigned int i, hash_size;
+
+    for (hash_size = 1; hash_size < max_samples; hash_size <<= 1)
+        ;
+    entries = calloc(max_samples, sizeof(mrc_entry));
+    mrc_hash = malloc(hash_size * sizeof(int));
+    sval_heap = malloc(max_samples * sizeof(int));
+    if (entries == NULL || mrc_hash == NULL || sval_heap == NULL) {
+        fprintf(stderr, "Failed to allocate the miss ratio curve sampler\n");
+        exit(EXIT_FAILURE);
+    }
+    memory_account(MEMORY_MRC, max_samples * (sizeof(mrc_entry) + sizeof(int)) +
+                   hash_size * sizeof(int));
+    for (i = 0; i < hash_size; i++)
+        mrc_hash[i] = -1;
+    for (i = 0; i < POWER_LARGEST; i++)
+        class_root[i] = -1;
+    for (i = 0; i < max_samples; i++)
+        entries[i].hnext = (i + 1 < max_samples) ? (int)i + 1 : -1;
+    mrc_hash_mask = hash_size - 1;
+    free_entries = 0;
+    max_entries = max_samples;
+}
+
+static inline uint32_t mrc_sval(const uint32_t hv) {
+    /* The low bits of hv pick the hash bucket; mix before sampling on it */
+    return (hv * 2654435761U) >> 8;
+}
+
+static int mrc_find(const uint32_t hv) {
+    int x;
+    for (x = mrc_hash[hv & mrc_hash_mask]; x != -1; x = entries[x].hnext) {
+        if (entries[x].hv == hv)
+            return x;
+    }
+    return -1;
+}
+
+static inline int *treap_root(const int t, const int x) {
+    return t == MRC_ALL ? &all_root : &class_root[entries[x].clsid];
+}
+
+static inline uint64_t treap_bytes(const int t, const int x) {
+    return x == -1 ? 0 : entries[x].bytes[t];
+}
+
+static inline void treap_fix(const int t, const int x) {
+    entries[x].bytes[t] = entries[x].size +
+        treap_bytes(t, entries[x].child[t][0]) +
+        treap_bytes(t, entries[x].child[t][1]);
+}
+
+/* Joins two treaps, the keys of a all before those of b */
+static int treap_merge(const int t, const int a, const int b) {
+    if (a == -1)
+        return b;
+    if (b == -1)
+        return a;
+    if (entries[a].prio > entries[b].prio) {
+        entries[a].child[t][1] = treap_merge(t, entries[a].child[t][1], b);
+        treap_fix(t, a);
+        return a;
+    }
+    entries[b].child[t][0] = treap_merge(t, a, entries[b].child[t][0]);
+    treap_fix(t, b);
+    return b;
+}
+
+/* Splits a treap into the keys before time and the rest */
+static void treap_split(const int t, const int x, const uint64_t time,
+                        int *lo, int *hi) {
+    if (x == -1) {
+        *lo = *hi = -1;
+        return;
+    }
+    if (entries[x].time < time) {
+        treap_split(t, entries[x].child[t][1], time, &entries[x].child[t][1], hi);
+        *lo = x;
+    } else {
+        treap_split(t, entries[x].child[t][0], time, lo, &entries[x].child[t][0]);
+        *hi = x;
+    }
+    treap_fix(t, x);
+}
+
+/* Bytes of the keys referenced after x was */
+static uint64_t treap_after(const int t, const int x) {
+    const uint64_t time = entries[x].time;
+    uint64_t sum = 0;
+    int n = *treap_root(t, x);
+
+    while (n != -1) {
+        if (entries[n].time > time) {
+            sum += entries[n].size + treap_bytes(t, entries[n].child[t][1]);
+            n = entries[n].child[t][0];
+        } else {
+            n = entries[n].child[t][1];
+        }
+    }
+    return sum;
+}
+
+static void mrc_untrack(const int x) {
+    int t, lo, mid, hi;
+
+    for (t = MRC_ALL; t <= MRC_CLASS; t++) {
+        int *root = treap_root(t, x);
+        treap_split(t, *root, entries[x].time, &lo, &hi);
+        treap_split(t, hi, entries[x].time + 1, &mid, &hi);
+        *root = treap_merge(t, lo, hi);
+    }
+}
+
+/* Make x the most recently referenced key */
+static void mrc_track(const int x) {
+    int t;
+
+    entries[x].time = ++mrc_clock;
+    for (t = MRC_ALL; t <= MRC_CLASS; t++) {
+        int *root = treap_root(t, x);
+        entries[x].child[t][0] = entries[x].child[t][1] = -1;
+        treap_fix(t, x);
+        *root = treap_merge(t, *root, x);
+    }
+}
+
+static void heap_push(const int x) {
+    unsigned int i = heap_len++;
+
+    while (i > 0 && entries[sval_heap[(i - 1) / 2]].sval < entries[x].sval) {
+        sval_heap[i] = sval_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sval_heap[i] = x;
+}
+
+static int heap_pop(void) {
+    const int top = sval_heap[0];
+    const int last = sval_heap[--heap_len];
+    unsigned int i = 0, c;
+
+    while ((c = 2 * i + 1) < heap_len) {
+        if (c + 1 < heap_len &&
+            entries[sval_heap[c + 1]].sval > entries[sval_heap[c]].sval)
+            c++;
+        if (entries[sval_heap[c]].sval <= entries[last].sval)
+            break;
+        sval_heap[i] = sval_heap[c];
+        i = c;
+    }
+    if (heap_len > 0)
+        sval_heap[i] = last;
+    return top;
+}
+
+static void mrc_remove(const int x) {
+    int *pos = &mrc_hash[entries[x].hv & mrc_hash_mask];
+
+    while (*pos != x)
+        pos = &entries[*pos].hnext;
+    *pos = entries[x].hnext;
+    mrc_untrack(x);
+    entries[x].hnext = free_entries;
+    free_entries = x;
+    num_entries--;
+}
+
+static void mrc_set_item(const int x, const item *it) {
+    entries[x].clsid = it->slabs_clsid;
+    entries[x].size = settings.slab_page_size / slabs_perslab(it->slabs_clsid);
+}
+
+/* Start tracking a key. When full, the key with the largest sampling value
+ * goes, and the threshold drops so it isn't sampled again. */
+static void mrc_insert(const uint32_t hv, const uint32_t sval, const item *it) {
+    int x;
+
+    if (num_entries == max_entries) {
+        if (heap_len == 0 || sval >= entries[sval_heap[0]].sval) {
+            threshold = sval;
+            return;
+        }
+        x = heap_pop();
+        threshold = entries[x].sval;
+        mrc_remove(x);
+    }
+
+    x = free_entries;
+    free_entries = entries[x].hnext;
+    entries[x].hv = hv;
+    entries[x].sval = sval;
+    /* xorshift32 */
+    prio_state ^= prio_state << 13;
+    prio_state ^= prio_state >> 17;
+    prio_state ^= prio_state << 5;
+    entries[x].prio = prio_state;
+    mrc_set_item(x, it);
+    entries[x].hnext = mrc_hash[hv & mrc_hash_mask];
+    mrc_hash[hv & mrc_hash_mask] = x;
+    mrc_track(x);
+    heap_push(x);
+    num_entries++;
+}
+
+static int mrc_bucket(const uint64_t bytes) {
+    uint64_t mb = bytes >> 20;
+    int k, b;
+
+    if (mb < 4)
+        return (int)mb;
+    k = 63 - __builtin_clzll(mb);
+    b = 4 + (k - 2) * 4 + (int)((mb >> (k - 2)) & 3);
+    return b < MRC_BUCKETS ? b : -1;
+}
+
+/* Smallest cache size, in MB, that falls in bucket b */
+static uint64_t mrc_bucket_mb(const int b) {
+    if (b < 4)
+        return b;
+    return (uint64_t)(4 + (b - 4) % 4) << ((b - 4) / 4);
+}
+
+static void mrc_count(const unsigned int clsid, const uint64_t sampled_bytes) {
+    /* Scale the bytes of the sampled keys up to the whole key space */
+    int b = mrc_bucket(sampled_bytes * MRC_SPACE / threshold);
+    if (b >= 0)
+        histogram[clsid][b]++;
+}
+
+void mrc_reference(const uint32_t hv, const item *it) {
+    uint32_t sval = mrc_sval(hv);
+    int x;
+
+    if (sval >= threshold)
+        return;
+    pthread_mutex_lock(&mrc_lock);
+    if (sval >= threshold) {
+        pthread_mutex_unlock(&mrc_lock);
+        return;
+    }
+
+    references[0]++;
+    if ((x = mrc_find(hv)) != -1) {
+        references[entries[x].clsid]++;
+        mrc_count(0, treap_after(MRC_ALL, x));
+        mrc_count(entries[x].clsid, treap_after(MRC_CLASS, x));
+        mrc_untrack(x);
+        if (it != NULL)
+            mrc_set_item(x, it);
+        mrc_track(x);
+    } else if (it != NULL) {
+        /* First lookup of a key stored before it was sampled */
+        references[it->slabs_clsid]++;
+        mrc_insert(hv, sval, it);
+    }
+    pthread_mutex_unlock(&mrc_lock);
+}
+
+void mrc_link(const uint32_t hv, const item *it) {
+    uint32_t sval = mrc_sval(hv);
+    int x;
+
+    if (sval >= threshold)
+        return;
+    pthread_mutex_lock(&mrc_lock);
+    if (sval < threshold) {
+        if ((x = mrc_find(hv)) != -1) {
+            mrc_untrack(x);
+            mrc_set_item(x, it);
+            mrc_track(x);
+        } else {
+            mrc_insert(hv, sval, it);
+        }
+    }
+    pthread_mutex_unlock(&mrc_lock);
+}
+
+void mrc_stats_reset(void) {
+    pthread_mutex_lock(&mrc_lock);
+    memset(references, 0, sizeof(references));
+    memset(histogram, 0, sizeof(histogram));
+    pthread_mutex_unlock(&mrc_lock);
+}
+
+void mrc_stats(ADD_STAT add_stats, void *c) {
+    char key[STAT_KEY_LEN];
+    char name[16];
+    unsigned int i;
+    int b, last;
+
+    if (max_entries == 0) {
+        add_stats(NULL, 0, NULL, 0, c);
+        return;
+    }
+
+    pthread_mutex_lock(&mrc_lock);
+    APPEND_STAT("mrc:sample_rate", "%.6f", (double)threshold / MRC_SPACE);
+    APPEND_STAT("mrc:samples", "%u", num_entries);
+    for (i = 0; i < POWER_LARGEST; i++) {
+        uint64_t hits = 0;
+
+        if (references[i] == 0)
+            continue;
+        if (i == 0)
+            snprintf(name, sizeof(name), "all");
+        else
+            snprintf(name, sizeof(name), "%u", i);
+
+        snprintf(key, sizeof(key), "mrc:%s:references", name);
+        APPEND_STAT(key, "%llu", (unsigned long long)references[i]);
+
+        /* The ratio stays flat past the last bucket with a hit */
+        for (last = MRC_BUCKETS - 1; last > 0 && histogram[i][last] == 0; last--)
+            ;
+        for (b = 0; b <= last; b++) {
+            hits += histogram[i][b];
+            snprintf(key, sizeof(key), "mrc:%s:%llu", name,
+                     (unsigned long long)mrc_bucket_mb(b + 1));
+            APPEND_STAT(key, "%.4f", (double)hits / references[i]);
+        }
+    }
+    pthread_mutex_unlock(&mrc_lock);
+
+    /* getting here means both ascii and binary terminators fit */
+    add_stats(NULL, 0, NULL, 0, c);
+}
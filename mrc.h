@@ -0,0 +1,19 @@
+#ifndef MRC_H
+#define MRC_H
+/* miss ratio curve estimation */
+
+/** Set up the sampler to track at most max_samples keys */
+void mrc_init(const unsigned int max_samples);
+
+/** Record a lookup of the key with hash hv. it is NULL on a miss. */
+void mrc_reference(const uint32_t hv, const item *it);
+
+/** Record that the key with hash hv was stored as it */
+void mrc_link(const uint32_t hv, const item *it);
+
+/** Forget the curves collected so far, keeping the sampled keys */
+void mrc_stats_reset(void);
+
+/** Fill buffer with the estimated hit ratio per cache size */
+void mrc_stats(ADD_STAT add_stats, void *c);
+#endif
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * MurmurHash3 was written by Austin Appleby, and is placed in the public
+ * domain. The author hereby disclaims copyright to this source code.
+ *
+ * This is the x86_32 variant, which produces the 32-bit value memcached
+ * needs. Blocks are read with memcpy so keys need not be aligned, and in
+ * little-endian byte order so the result is the same on every platform.
+ */
+#include "memcached.h"
+#include "murmur3_hash.h"
+#include <string.h>
+
+static inline uint32_t rotl32(uint32_t x, int8_t r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t getblock32(const uint8_t *p) {
+#if ENDIAN_BIG == 1
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+#else
+    uint32_t k;
+    memcpy(&k, p, sizeof(k));
+    return k;
+#endif
+}
+
+/* Finalization mix - force all bits of a hash block to avalanche */
+static inline uint32_t fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t MurmurHash3_x86_32(const void *key, size_t length) {
+    const uint8_t *data = (const uint8_t *)key;
+    const size_t nblocks = length / 4;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h1 = 0;
+    uint32_t k1;
+    size_t i;
+
+    /* body */
+    for (i = 0; i < nblocks; i++) {
+        k1 = getblock32(data + i * 4);
+
+        k1 *= c1;
+        k1 = rotl32(k1, 15);
+        k1 *= c2;
+
+        h1 ^= k1;
+        h1 = rotl32(h1, 13);
+        h1 = h1 * 5 + 0xe6546b64;
+    }
+
+    /* tail */
+    const uint8_t *tail = data + nblocks * 4;
+    k1 = 0;
+    switch (length & 3) {
+    case 3: k1 ^= tail[2] << 16;
+    case 2: k1 ^= tail[1] << 8;
+    case 1: k1 ^= tail[0];
+            k1 *= c1; k1 = rotl32(k1, 15); k1 *= c2; h1 ^= k1;
+    }
+
+    /* finalization */
+    h1 ^= (uint32_t)length;
+    return fmix32(h1);
+}
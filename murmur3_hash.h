@@ -0,0 +1,15 @@
+#ifndef MURMUR3_HASH_H
+#define    MURMUR3_HASH_H
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+uint32_t MurmurHash3_x86_32(const void *key, size_t length);
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif    /* MURMUR3_HASH_H */
+
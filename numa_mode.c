@@ -0,0 +1,115 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * NUMA mode (-o numa): worker threads are spread round robin over the nodes
+ * that have both CPUs and memory, and each stays on the CPUs of its node.
+ * slabs.c keeps an arena per node, bound here to the node's memory, and a
+ * worker takes the chunks for the items it stores from its own node, so
+ * its connections mostly touch local memory.
+ *
+ * Nodes are numbered 0 to numa_mode_nodes() - 1 here and in slabs.c; they
+ * map to the system's node numbers, which may have holes.
+ */
+
+#include "memcached.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+static unsigned int nodes = 1;
+static int node_ids[NUMA_NODES_MAX];
+
+#ifdef HAVE_LIBNUMA
+bool numa_mode_init(void) {
+    struct bitmask *cpus;
+    int n, max;
+
+    if (numa_available() < 0) {
+        fprintf(stderr, "NUMA is not available on this system\n");
+        return false;
+    }
+    if ((cpus = numa_allocate_cpumask()) == NULL) {
+        fprintf(stderr, "Failed to allocate a CPU mask\n");
+        return false;
+    }
+
+    nodes = 0;
+    max = numa_max_node();
+    for (n = 0; n <= max && nodes < NUMA_NODES_MAX; n++) {
+        if (numa_node_size64(n, NULL) <= 0 || numa_node_to_cpus(n, cpus) != 0 ||
+            numa_bitmask_weight(cpus) == 0)
+            continue;
+        node_ids[nodes++] = n;
+    }
+    numa_free_cpumask(cpus);
+
+    if (nodes == 0) {
+        fprintf(stderr, "No NUMA node has both CPUs and memory\n");
+        nodes = 1;
+        return false;
+    }
+    if (settings.verbose > 0) {
+        fprintf(stderr, "NUMA mode over %u node%s\n", nodes,
+                nodes > 1 ? "s" : "");
+    }
+    return true;
+}
+
+bool numa_mode_pin(const unsigned int node) {
+    if (numa_run_on_node(node_ids[node]) != 0) {
+        fprintf(stderr, "Failed to pin a thread to node %d: %s\n",
+                node_ids[node], strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool numa_mode_bind(void *addr, const size_t len, const unsigned int node) {
+    unsigned long mask[(NUMA_NUM_NODES + 8 * sizeof(long) - 1) / (8 * sizeof(long))];
+    const int id = node_ids[node];
+
+    memset(mask, 0, sizeof(mask));
+    mask[id / (8 * sizeof(long))] |= 1UL << (id % (8 * sizeof(long)));
+    /* Preferred rather than bound: a full node lends memory, it doesn't
+     * fail the allocation */
+    if (mbind(addr, len, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0) != 0) {
+        fprintf(stderr, "Failed to bind memory to node %d: %s\n",
+                id, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+size_t numa_mode_node_bytes(const unsigned int node) {
+    long long bytes = numa_node_size64(node_ids[node], NULL);
+    return bytes > 0 ? (size_t)bytes : 0;
+}
+
+#else
+
+bool numa_mode_init(void) {
+    fprintf(stderr, "This binary was built without libnuma\n");
+    return false;
+}
+
+bool numa_mode_pin(const unsigned int node) {
+    return false;
+}
+
+bool numa_mode_bind(void *addr, const size_t len, const unsigned int node) {
+    return false;
+}
+
+size_t numa_mode_node_bytes(const unsigned int node) {
+    return 0;
+}
+
+#endif
+
+unsigned int numa_mode_nodes(void) {
+    return nodes;
+}
@@ -0,0 +1,22 @@
+#ifndef NUMA_MODE_H
+#define NUMA_MODE_H
+/* NUMA mode: workers pinned to nodes, slab pages allocated on them */
+
+/** Most nodes NUMA mode spreads over; the rest go unused */
+#define NUMA_NODES_MAX 8
+
+/** Find the nodes with memory and CPUs; false if NUMA mode can't be used */
+bool numa_mode_init(void);
+
+/** Nodes in use, 1 when NUMA mode is off */
+unsigned int numa_mode_nodes(void);
+
+/** Keep the calling thread on the CPUs of a node */
+bool numa_mode_pin(const unsigned int node);
+
+/** Have the pages of a range be allocated on a node when first touched */
+bool numa_mode_bind(void *addr, const size_t len, const unsigned int node);
+
+/** Bytes of memory on a node */
+size_t numa_mode_node_bytes(const unsigned int node);
+#endif
@@ -14,6 +14,8 @@
 #include <sys/socket.h>
 #include <sys/signal.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <errno.h>
@@ -31,8 +33,8 @@ typedef struct {
     unsigned int size;      /* sizes of items */
     unsigned int perslab;   /* how many items per slab */
 
-    void *slots;           /* list of item ptrs */
-    unsigned int sl_curr;   /* total free items in list */
+    void *slots[NUMA_NODES_MAX]; /* free chunks, by the node of their page */
+    unsigned int sl_curr;   /* total free items in the lists */
 
     unsigned int slabs;     /* how many slabs were allocated for this class */
 
@@ -41,30 +43,143 @@ typedef struct {
 
     unsigned int killing;  /* index+1 of dying slab, or zero if none */
     size_t requested; /* The number of requested bytes */
+
+    unsigned int next;      /* next larger class in use, for slabs_clsid */
+    bool retired;           /* left out of the geometry, being drained */
+    uint64_t numa_remote;   /* chunks handed out from another node */
+
+    pthread_mutex_t lock;   /* guards everything above */
 } slabclass_t;
 
+/* Per worker thread stash of free chunks, so that most alloc/free calls
+ * don't touch the class lock at all. It is refilled and drained in batches.
+ * "requested" is a delta against slabclass_t.requested for the items handed
+ * out (or taken back) through this cache. In NUMA mode it only keeps chunks
+ * of the thread's node.
+ */
+#define SLAB_CACHE_BATCH 8
+#define SLAB_CACHE_MAX (SLAB_CACHE_BATCH * 2)
+
+typedef struct {
+    void *slots;            /* singly linked through item->next */
+    unsigned int count;
+    long long requested;
+} slab_cache_class_t;
+
+typedef struct _slab_thread_cache {
+    pthread_mutex_t lock;   /* only contended when the rebalancer flushes */
+    struct _slab_thread_cache *next;
+    int node;               /* NUMA node of the thread, or -1 */
+    slab_cache_class_t classes[MAX_NUMBER_OF_SLAB_CLASSES];
+} slab_thread_cache_t;
+
 static slabclass_t slabclass[MAX_NUMBER_OF_SLAB_CLASSES];
 static size_t mem_limit = 0;
 static size_t mem_malloced = 0;
 static size_t mem_malloced_slablist = 0;
 static int power_largest;
+static unsigned int power_smallest_used = POWER_SMALLEST;
+
+/* Size to class lookup: entry i is the class of the smallest size in
+ * ((i << clsid_shift), ((i + 1) << clsid_shift)]. The table is kept under
+ * CLSID_TABLE_MAX entries by widening the buckets for large slab pages.
+ * Sizes in the rest of a bucket are found by following the classes in use
+ * from there in size order, through slabclass_t.next. */
+#define CLSID_TABLE_MAX (1 << 16)
+static uint8_t *clsid_table = NULL;
+static unsigned int clsid_shift = 0;
 
 static void *mem_base = NULL;
 static void *mem_current = NULL;
 static size_t mem_avail = 0;
 
+/* Pages of the preallocated arena are given back to the OS in blocks of
+ * this size, so the rest of the arena keeps its huge page mappings. */
+#define MEM_BASE_RELEASE_ALIGN (2 * 1024 * 1024)
+
+/* Pages handed back by shrinkage, reused by a later expansion */
+static size_t mem_base_size = 0;
+static void **mem_base_pool = NULL;
+static unsigned int mem_base_pool_count = 0;
+static bool *mem_base_page_free = NULL;
+
 /**
- * Access to the slab allocator is protected by this lock
+ * Each slab class is protected by its own lock. This one only guards the
+ * global memory accounting (mem_limit, mem_malloced, mem_current...), and is
+ * always taken after the class lock.
  */
 static pthread_mutex_t slabs_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t slabs_rebalance_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Ready page pool (-o page_pool). A background thread allocates pages while
+ * there is room under the memory limit and writes them once, so they are
+ * faulted in and zeroed before a worker needs one; do_slabs_newslab then
+ * just pops a page instead of allocating and clearing it. Pooled pages are
+ * counted as malloced, and are the first thing given back when the limit
+ * is lowered. Guarded by slabs_lock.
+ */
+static void **page_pool = NULL;
+static unsigned int page_pool_count = 0;
+static unsigned int page_pool_filling = 0; /* allocated, being faulted in */
+static pthread_cond_t page_pool_cond = PTHREAD_COND_INITIALIZER;
+static volatile int do_run_page_pool_thread = 1;
+static pthread_t page_pool_tid;
+
+/*
+ * NUMA mode (-o numa). Pages come from one arena per node, each a
+ * reservation as large as the biggest node's memory and bound to its node,
+ * so the node of a chunk follows from its address. Like the preallocated
+ * arena, an arena is carved from its start, and pages handed back go to the
+ * node's free page pool after being released to the OS. The free chunks of
+ * a class are listed by node, and a worker takes them from its own node
+ * first, allocating a page there before falling back to another node.
+ * Guarded by slabs_lock.
+ */
+static char *numa_base = NULL;
+static size_t numa_stride = 0;
+static unsigned int numa_count = 1;
+static size_t numa_carved[NUMA_NODES_MAX];
+static size_t numa_malloced[NUMA_NODES_MAX];
+static void **numa_free_pages[NUMA_NODES_MAX];
+static unsigned int numa_free_count[NUMA_NODES_MAX];
+static uint64_t numa_remote_pages; /* pages taken from another node's memory */
+
+/*
+ * Adaptive class geometry (-o slab_adaptive). Every so many seconds the
+ * maintenance thread fits a set of chunk sizes to the item size histogram
+ * kept by items.c, with as many classes as the startup geometry had. When
+ * the fit saves enough memory, the new sizes get classes of their own and
+ * the classes left out are retired: slabs_clsid stops handing them out,
+ * they take no new pages, and the rebalancer moves their pages one by one
+ * to the class that now takes their sizes. The next fit waits until they
+ * are empty, and reuses their ids. In this mode the page-size class is
+ * always POWER_LARGEST - 1, so the classes added later sit below it.
+ * Guarded by slabs_lock.
+ */
+static unsigned int geometry_classes = 0;   /* classes at startup */
+static uint64_t geometry_changes = 0;
+static uint64_t geometry_slack = 0;         /* estimate, as of the last fit */
+static rel_time_t geometry_next_fit = 0;
+static unsigned int geometry_drain_to[POWER_LARGEST]; /* of retired classes */
+static unsigned int geometry_target[POWER_LARGEST];   /* pages, after a change */
+static bool geometry_balancing = false;
+
+static pthread_key_t slab_cache_key;
+static slab_thread_cache_t *slab_caches = NULL;
+static pthread_mutex_t slab_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Forward Declarations
  */
-static int do_slabs_newslab(const unsigned int id);
-static void *memory_allocate(size_t size);
+static int do_slabs_newslab(const unsigned int id, const int node);
+static void *memory_allocate(size_t size, const int node);
+static void *page_pool_take(const int node);
+static void numa_arenas_init(void);
+static void mem_base_release(void *ptr);
 static void do_slabs_free(void *ptr, const size_t size, unsigned int id);
+static void slab_cache_flush(const unsigned int id);
+static void slab_cache_aggregate(unsigned int *cached, long long *requested);
 
 /* Preallocate as many slab pages as possible (called from slabs_init)
    on start-up, so users don't get confused out-of-memory errors when
@@ -74,14 +189,16 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id);
    smaller ones will be made.  */
 static void slabs_preallocate (const unsigned int maxslabs);
 
-/*If we want to make the accounting more global,
-  we need to add more memory counters here.
-  The current accounting policy is to count many things,
+/*The current accounting policy is to count many things,
   but only reduce the number of slabs.
   The hash table might also requireshrinkage, but it should be
   of small consequence.
+  Connections, threads and the other memory_account() categories are
+  only held against the limit with -o limit_total_memory; shrinking
+  slabs then makes room for them.
 */
-#define TOTAL_MALLOCED (mem_malloced+mem_malloced_slablist+tell_hashsize())
+#define TOTAL_MALLOCED (mem_malloced+mem_malloced_slablist+tell_hashsize()+ \
+                        (settings.limit_total_memory ? memory_accounted_total() : 0))
 
 /*
  * Figures out which slab class (chunk size) is required to store an item of
@@ -122,16 +239,48 @@ static void print_statm(const char * const str){
 
 
 unsigned int slabs_clsid(const size_t size) {
-    int res = POWER_SMALLEST;
+    int res;
 
-    if (size == 0)
-        return 0;
+    if (size == 0 || size > slabclass[power_largest].size)
+        return 0;   /* won't fit in the biggest slab */
+    /* A bucket may span a class boundary; step past the smaller classes */
+    res = clsid_table[(size - 1) >> clsid_shift];
     while (size > slabclass[res].size)
-        if (res++ == power_largest)     /* won't fit in the biggest slab */
-            return 0;
+        res = slabclass[res].next;
     return res;
 }
 
+/* Points each table entry at the class in use for its smallest size. The
+ * entries are rewritten in place when the geometry changes; a reader that
+ * still sees an old entry ends up in a class just as able to hold it. */
+static void clsid_table_fill(void) {
+    size_t i, entries = ((slabclass[power_largest].size - 1) >> clsid_shift) + 1;
+    unsigned int res = power_smallest_used;
+
+    for (i = 0; i < entries; i++) {
+        while (((i << clsid_shift) + 1) > slabclass[res].size)
+            res = slabclass[res].next;
+        clsid_table[i] = res;
+    }
+}
+
+static void clsid_table_init(void) {
+    size_t max = slabclass[power_largest].size;
+
+    for (clsid_shift = 3; (max >> clsid_shift) > CLSID_TABLE_MAX; clsid_shift++)
+        ;
+    clsid_table = malloc(((max - 1) >> clsid_shift) + 1);
+    if (clsid_table == NULL) {
+        fprintf(stderr, "Failed to allocate the slab class lookup table\n");
+        exit(EXIT_FAILURE);
+    }
+    clsid_table_fill();
+}
+
+unsigned int slabs_perslab(const unsigned int id) {
+    return slabclass[id].perslab;
+}
+
 /**
  * Determines the chunk sizes and initializes the slab class descriptors
  * accordingly.
@@ -145,11 +294,23 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
     if (prealloc) {
         /* Allocate everything in a big chunk with malloc */
         print_statm("before init");
-        mem_base = malloc(mem_limit);
+        if (posix_memalign(&mem_base, MEM_BASE_RELEASE_ALIGN, mem_limit) != 0)
+            mem_base = NULL;
         print_statm("after init");
         if (mem_base != NULL) {
+            size_t npages = mem_limit / settings.slab_page_size;
+#ifdef MADV_HUGEPAGE
+            madvise(mem_base, mem_limit, MADV_HUGEPAGE);
+#endif
             mem_current = mem_base;
             mem_avail = mem_limit;
+            mem_base_size = mem_limit;
+            mem_base_pool = calloc(npages, sizeof(void *));
+            mem_base_page_free = calloc(npages, sizeof(bool));
+            if (mem_base_pool == NULL || mem_base_page_free == NULL) {
+                fprintf(stderr, "Failed to allocate the free page pool\n");
+                exit(EXIT_FAILURE);
+            }
         } else {
             fprintf(stderr, "Warning: Failed to allocate requested memory in"
                     " one large chunk.\nWill allocate in smaller chunks\n");
@@ -157,14 +318,20 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
     }
 
     memset(slabclass, 0, sizeof(slabclass));
+    for (i = 0; i < MAX_NUMBER_OF_SLAB_CLASSES; i++) {
+        pthread_mutex_init(&slabclass[i].lock, NULL);
+    }
+    i = POWER_SMALLEST - 1;
+    pthread_key_create(&slab_cache_key, NULL);
 
-    while (++i < POWER_LARGEST && size <= settings.item_size_max / factor) {
+    while (++i < POWER_LARGEST && size <= settings.slab_page_size / factor) {
         /* Make sure items are always n-byte aligned */
         if (size % CHUNK_ALIGN_BYTES)
             size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
 
         slabclass[i].size = size;
-        slabclass[i].perslab = settings.item_size_max / slabclass[i].size;
+        slabclass[i].perslab = settings.slab_page_size / slabclass[i].size;
+        slabclass[i].next = i + 1;
         size *= factor;
         if (settings.verbose > 1) {
             fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
@@ -172,12 +339,33 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
         }
     }
 
-    power_largest = i;
-    slabclass[power_largest].size = settings.item_size_max;
+    /* Adaptive geometry adds classes later on, below the largest one */
+    geometry_classes = i;
+    if (settings.slab_adaptive > 0) {
+        power_largest = POWER_LARGEST - 1;
+        if (i > POWER_SMALLEST)
+            slabclass[i - 1].next = power_largest;
+    } else {
+        power_largest = i;
+    }
+    slabclass[power_largest].size = settings.slab_page_size;
     slabclass[power_largest].perslab = 1;
     if (settings.verbose > 1) {
         fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
-                i, slabclass[i].size, slabclass[i].perslab);
+                power_largest, slabclass[power_largest].size,
+                slabclass[power_largest].perslab);
+    }
+    clsid_table_init();
+
+    if (settings.numa)
+        numa_arenas_init();
+
+    if (settings.page_pool > 0) {
+        page_pool = calloc(settings.page_pool, sizeof(void *));
+        if (page_pool == NULL) {
+            fprintf(stderr, "Failed to allocate the page pool\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     /* for the test suite:  faking of how much we've already malloc'd */
@@ -205,9 +393,11 @@ static void slabs_preallocate (const unsigned int maxslabs) {
        these three lines.  */
 
     for (i = POWER_SMALLEST; i <= POWER_LARGEST; i++) {
+        if (slabclass[i].size == 0)
+            continue;   /* an id kept for adaptive geometry */
         if (++prealloc > maxslabs)
             return;
-        if (do_slabs_newslab(i) == 0) {
+        if (do_slabs_newslab(i, -1) == 0) {
             fprintf(stderr, "Error while preallocating slab memory!\n"
                 "If using -L or other prealloc options, max memory must be "
                 "at least %d megabytes.\n", power_largest);
@@ -217,6 +407,7 @@ static void slabs_preallocate (const unsigned int maxslabs) {
 
 }
 
+/* Must be called with the class lock and slabs_lock held. */
 static int grow_slab_list (const unsigned int id) {
     slabclass_t *p = &slabclass[id];
     print_statm("before grow");
@@ -242,6 +433,24 @@ static int grow_slab_list (const unsigned int id) {
     return 1;
 }
 
+/* Must be called with the class lock and slabs_lock held.
+ * Halves the list once it is no more than a quarter full, so a class that
+ * lost most of its pages to shrinks or moves gives the pointers back; the
+ * gap to the doubling in grow_slab_list keeps the two from alternating. */
+static void shrink_slab_list(const unsigned int id) {
+    slabclass_t *p = &slabclass[id];
+
+    while (p->list_size > 16 && p->slabs <= p->list_size / 4) {
+        size_t new_size = p->list_size / 2;
+        void *new_list = realloc(p->slab_list, new_size * sizeof(void *));
+        if (new_list == NULL)
+            return;
+        mem_malloced_slablist -= (p->list_size - new_size) * sizeof(void *);
+        p->list_size = new_size;
+        p->slab_list = new_list;
+    }
+}
+
 static void split_slab_page_into_freelist(char *ptr, const unsigned int id) {
     slabclass_t *p = &slabclass[id];
     int x;
@@ -251,12 +460,72 @@ static void split_slab_page_into_freelist(char *ptr, const unsigned int id) {
     }
 }
 
-static int do_slabs_newslab(const unsigned int id) {
+/* NUMA node of a chunk or page; always 0 outside NUMA mode */
+static inline unsigned int chunk_node(const void *ptr) {
+    if (numa_base == NULL)
+        return 0;
+    return ((const char *)ptr - numa_base) / numa_stride;
+}
+
+/* NUMA node the calling thread takes chunks from first, or -1 */
+static inline int slab_thread_node(void) {
+    slab_thread_cache_t *tc;
+
+    if (numa_base == NULL)
+        return -1;
+    tc = pthread_getspecific(slab_cache_key);
+    return tc != NULL ? tc->node : -1;
+}
+
+/* Takes a free chunk off the class lists, from the node's own list when it
+ * has one. Called with the class lock held. */
+static item *slots_pop(slabclass_t *p, const int node) {
+    unsigned int n = node >= 0 ? node : 0;
+    unsigned int i;
+    item *it;
+
+    for (i = 0; i < numa_count && p->slots[n] == NULL; i++)
+        n = (n + 1) % numa_count;
+    if ((it = (item *)p->slots[n]) == NULL)
+        return NULL;
+    if (node >= 0 && n != (unsigned int)node)
+        p->numa_remote++;
+    assert(it->slabs_clsid == 0);
+    p->slots[n] = it->next;
+    if (it->next) it->next->prev = 0;
+    p->sl_curr--;
+    return it;
+}
+
+/* Takes a given free chunk off its list. Called with the class lock held. */
+static void slots_unlink(slabclass_t *p, item *it) {
+    const unsigned int n = chunk_node(it);
+
+    if (p->slots[n] == it)
+        p->slots[n] = it->next;
+    if (it->next) it->next->prev = it->prev;
+    if (it->prev) it->prev->next = it->next;
+    p->sl_curr--;
+}
+
+static int do_slabs_newslab(const unsigned int id, const int node) {
     slabclass_t *p = &slabclass[id];
-    int len = settings.slab_reassign ? settings.item_size_max
+    int len = settings.slab_reassign ? settings.slab_page_size
         : p->size * p->perslab;
-    char *ptr;
+    char *ptr = NULL;
+    size_t need = len;
+    bool pooled;
+
+    if (p->retired) {
+        MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
+        return 0;
+    }
 
+    latency_lock(&slabs_lock, LATENCY_SLABS_LOCK, pthread_mutex_lock);
+    /* A pooled page is already counted against the limit */
+    pooled = page_pool_count > 0 && len == settings.slab_page_size;
+    if (pooled)
+        need = 0;
     /*mem_limit>0 means we have a memory limitation.
       Only in this case we check that if we allocate the slab, we do not go over the top.
       p->slabs>0 if we already have some slabs of this class.
@@ -266,26 +535,34 @@ static int do_slabs_newslab(const unsigned int id) {
     /*Thus is a tentative evaluation, because we don't know
       yet if we would need to grow the slab list*/
     int not_enough_mem=(mem_limit &&
-                        (TOTAL_MALLOCED + len > mem_limit) &&
+                        (TOTAL_MALLOCED + need > mem_limit) &&
                         p->slabs > 0);
 
     int grow_slab_list_failed=not_enough_mem?1:(grow_slab_list(id) == 0);
     /*re-evaluate because the list might have grown*/
     if (!grow_slab_list_failed)
         not_enough_mem=(mem_limit &&
-                        ((TOTAL_MALLOCED + len) > mem_limit) &&
+                        ((TOTAL_MALLOCED + need) > mem_limit) &&
                         p->slabs > 0);
 
-    if (not_enough_mem ||
-        (grow_slab_list_failed) ||
-        ((ptr = memory_allocate((size_t)len)) == 0)) {
+    if (!not_enough_mem && !grow_slab_list_failed) {
+        if (pooled)
+            ptr = page_pool_take(node);
+        else
+            ptr = memory_allocate((size_t)len, node);
+    }
+    if (page_pool != NULL)
+        pthread_cond_signal(&page_pool_cond);
+    pthread_mutex_unlock(&slabs_lock);
 
+    if (ptr == NULL) {
         MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
         return 0;
     }
 
 
-    memset(ptr, 0, (size_t)len);
+    if (!pooled)
+        memset(ptr, 0, (size_t)len);
     split_slab_page_into_freelist(ptr, id);
 
     p->slab_list[p->slabs++] = ptr;
@@ -294,8 +571,17 @@ static int do_slabs_newslab(const unsigned int id) {
     return 1;
 }
 
+/* Whether a thread of the node should take a new page before a chunk of
+ * another node: only while the class has nothing free on the node. */
+static inline bool slab_wants_local_page(const slabclass_t *p, const int node) {
+    /* An unlocked peek at the limit; newslab checks it for real */
+    return node >= 0 && p->slots[node] == NULL && p->sl_curr != 0 &&
+        (!mem_limit || mem_malloced + settings.slab_page_size <= mem_limit);
+}
+
 /*@null@*/
-static void *do_slabs_alloc(const size_t size, unsigned int id) {
+static void *do_slabs_alloc(const size_t size, unsigned int id,
+                            const int node) {
     slabclass_t *p;
     void *ret = NULL;
     item *it = NULL;
@@ -306,19 +592,17 @@ static void *do_slabs_alloc(const size_t size, unsigned int id) {
     }
 
     p = &slabclass[id];
-    assert(p->sl_curr == 0 || ((item *)p->slots)->slabs_clsid == 0);
 
     /* fail unless we have space at the end of a recently allocated page,
        we have something on our freelist, or we could allocate a new page */
-    if (! (p->sl_curr != 0 || do_slabs_newslab(id) != 0)) {
+    if (slab_wants_local_page(p, node))
+        do_slabs_newslab(id, node);
+    if (! (p->sl_curr != 0 || do_slabs_newslab(id, node) != 0)) {
         /* We don't have more memory available */
         ret = NULL;
     } else if (p->sl_curr != 0) {
         /* return off our freelist */
-        it = (item *)p->slots;
-        p->slots = it->next;
-        if (it->next) it->next->prev = 0;
-        p->sl_curr--;
+        it = slots_pop(p, node);
         ret = (void *)it;
     }
 
@@ -335,6 +619,7 @@ static void *do_slabs_alloc(const size_t size, unsigned int id) {
 static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     slabclass_t *p;
     item *it;
+    unsigned int n;
 
     assert(((item *)ptr)->slabs_clsid == 0);
     assert(id >= POWER_SMALLEST && id <= power_largest);
@@ -343,13 +628,14 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
 
     MEMCACHED_SLABS_FREE(size, id, ptr);
     p = &slabclass[id];
+    n = chunk_node(ptr);
 
     it = (item *)ptr;
     it->it_flags |= ITEM_SLABBED;
     it->prev = 0;
-    it->next = p->slots;
+    it->next = p->slots[n];
     if (it->next) it->next->prev = it;
-    p->slots = it;
+    p->slots[n] = it;
 
     p->sl_curr++;
     p->requested -= size;
@@ -368,14 +654,18 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
     if (add_stats != NULL) {
         if (!stat_type) {
             /* prepare general statistics for the engine */
+            struct thread_stats thread_stats;
+            threadlocal_stats_aggregate(&thread_stats);
             STATS_LOCK();
             APPEND_STAT("bytes", "%llu", (unsigned long long)stats.curr_bytes);
             APPEND_STAT("curr_items", "%u", stats.curr_items);
             APPEND_STAT("total_items", "%u", stats.total_items);
             APPEND_STAT("evictions", "%llu",
-                        (unsigned long long)stats.evictions);
+                        (unsigned long long)(stats.evictions +
+                                             thread_stats.evictions));
             APPEND_STAT("reclaimed", "%llu",
-                        (unsigned long long)stats.reclaimed);
+                        (unsigned long long)(stats.reclaimed +
+                                             thread_stats.reclaimed));
             STATS_UNLOCK();
         } else if (nz_strcmp(nkey, stat_type, "items") == 0) {
             item_stats(add_stats, c);
@@ -383,6 +673,14 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
             slabs_stats(add_stats, c);
         } else if (nz_strcmp(nkey, stat_type, "sizes") == 0) {
             item_stats_sizes(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "mrc") == 0) {
+            mrc_stats(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "latency") == 0) {
+            latency_stats(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "memory") == 0) {
+            slabs_memory_stats(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "rebalance") == 0) {
+            slabs_rebalance_stats(add_stats, c);
         } else {
             ret = false;
         }
@@ -398,15 +696,25 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
     int i, total;
     /* Get the per-thread stats which contain some interesting aggregates */
     struct thread_stats thread_stats;
+    unsigned int cached[MAX_NUMBER_OF_SLAB_CLASSES];
+    long long cached_requested[MAX_NUMBER_OF_SLAB_CLASSES];
     threadlocal_stats_aggregate(&thread_stats);
+    slab_cache_aggregate(cached, cached_requested);
 
     total = 0;
     for(i = POWER_SMALLEST; i <= power_largest; i++) {
         slabclass_t *p = &slabclass[i];
-        if (p->slabs != 0) {
-            uint32_t perslab, slabs;
-            slabs = p->slabs;
-            perslab = p->perslab;
+        uint32_t perslab, slabs, sl_curr;
+        unsigned long long requested;
+
+        pthread_mutex_lock(&p->lock);
+        slabs = p->slabs;
+        perslab = p->perslab;
+        sl_curr = p->sl_curr + cached[i];
+        requested = p->requested + cached_requested[i];
+        pthread_mutex_unlock(&p->lock);
+
+        if (slabs != 0) {
 
             char key_str[STAT_KEY_LEN];
             char val_str[STAT_VAL_LEN];
@@ -417,12 +725,11 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
             APPEND_NUM_STAT(i, "total_pages", "%u", slabs);
             APPEND_NUM_STAT(i, "total_chunks", "%u", slabs * perslab);
             APPEND_NUM_STAT(i, "used_chunks", "%u",
-                            slabs*perslab - p->sl_curr);
-            APPEND_NUM_STAT(i, "free_chunks", "%u", p->sl_curr);
+                            slabs*perslab - sl_curr);
+            APPEND_NUM_STAT(i, "free_chunks", "%u", sl_curr);
             /* Stat is dead, but displaying zero instead of removing it. */
             APPEND_NUM_STAT(i, "free_chunks_end", "%u", 0);
-            APPEND_NUM_STAT(i, "mem_requested", "%llu",
-                            (unsigned long long)p->requested);
+            APPEND_NUM_STAT(i, "mem_requested", "%llu", requested);
             APPEND_NUM_STAT(i, "get_hits", "%llu",
                     (unsigned long long)thread_stats.slab_stats[i].get_hits);
             APPEND_NUM_STAT(i, "cmd_set", "%llu",
@@ -447,13 +754,170 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
 
     APPEND_STAT("active_slabs", "%d", total);
     APPEND_STAT("total_malloced", "%llu", (unsigned long long)mem_malloced);
+    if (mem_base != NULL) {
+        APPEND_STAT("prealloc_free_pages", "%u", mem_base_pool_count);
+    }
+    if (page_pool != NULL) {
+        APPEND_STAT("page_pool_pages", "%u", page_pool_count);
+    }
+    if (numa_base != NULL) {
+        uint64_t remote = 0;
+        char key[STAT_KEY_LEN];
+
+        for (i = POWER_SMALLEST; i <= power_largest; i++) {
+            pthread_mutex_lock(&slabclass[i].lock);
+            remote += slabclass[i].numa_remote;
+            pthread_mutex_unlock(&slabclass[i].lock);
+        }
+        APPEND_STAT("numa_nodes", "%u", numa_count);
+        APPEND_STAT("numa_remote_chunks", "%llu", (unsigned long long)remote);
+        pthread_mutex_lock(&slabs_lock);
+        APPEND_STAT("numa_remote_pages", "%llu",
+                    (unsigned long long)numa_remote_pages);
+        for (i = 0; i < numa_count; i++) {
+            snprintf(key, sizeof(key), "numa:%d:malloced", i);
+            APPEND_STAT(key, "%llu", (unsigned long long)numa_malloced[i]);
+            snprintf(key, sizeof(key), "numa:%d:free_pages", i);
+            APPEND_STAT(key, "%u", numa_free_count[i]);
+        }
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    if (settings.slab_adaptive > 0) {
+        unsigned int retired_pages = 0;
+        uint64_t changes, slack;
+
+        for (i = POWER_SMALLEST; i < power_largest; i++) {
+            if (slabclass[i].retired)
+                retired_pages += slabclass[i].slabs;
+        }
+        pthread_mutex_lock(&slabs_lock);
+        changes = geometry_changes;
+        slack = geometry_slack;
+        pthread_mutex_unlock(&slabs_lock);
+        APPEND_STAT("geometry_changes", "%llu", (unsigned long long)changes);
+        APPEND_STAT("geometry_retired_pages", "%u", retired_pages);
+        APPEND_STAT("geometry_slack", "%llu", (unsigned long long)slack);
+    }
+    if (settings.compress_threshold > 0) {
+        uint64_t in = thread_stats.compress_bytes_in;
+        uint64_t out = thread_stats.compress_bytes_out;
+
+        APPEND_STAT("compress_codec", "%s", compression_codec());
+        APPEND_STAT("compress_cmds", "%llu",
+                    (unsigned long long)thread_stats.compress_cmds);
+        APPEND_STAT("compressed_items", "%llu",
+                    (unsigned long long)thread_stats.compressed_items);
+        APPEND_STAT("compress_bytes_in", "%llu", (unsigned long long)in);
+        APPEND_STAT("compress_bytes_out", "%llu", (unsigned long long)out);
+        APPEND_STAT("compress_ratio", "%.2f", out > 0 ? (double)in / out : 0.0);
+        APPEND_STAT("compress_usec", "%llu",
+                    (unsigned long long)thread_stats.compress_time / 1000);
+        APPEND_STAT("decompress_cmds", "%llu",
+                    (unsigned long long)thread_stats.decompress_cmds);
+        APPEND_STAT("decompress_usec", "%llu",
+                    (unsigned long long)thread_stats.decompress_time / 1000);
+        APPEND_STAT("decompress_nomem", "%llu",
+                    (unsigned long long)thread_stats.decompress_nomem);
+    }
     add_stats(NULL, 0, NULL, 0, c);
 }
 
-static void *memory_allocate(size_t size) {
+/* Carves a page out of a node's arena, or takes one of its free pages.
+ * A node of -1 means the one holding the least. */
+static void *numa_page_allocate(size_t size, const int node) {
+    unsigned int n = 0, i;
+    void *ret = NULL;
+
+    if (node >= 0) {
+        n = node;
+    } else {
+        for (i = 1; i < numa_count; i++) {
+            if (numa_malloced[i] < numa_malloced[n])
+                n = i;
+        }
+    }
+    if (size % CHUNK_ALIGN_BYTES)
+        size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+
+    /* The other nodes in turn, when this one is out of room */
+    for (i = 0; i < numa_count && ret == NULL; i++, n = (n + 1) % numa_count) {
+        if (size == settings.slab_page_size && numa_free_count[n] > 0) {
+            ret = numa_free_pages[n][--numa_free_count[n]];
+        } else if (numa_carved[n] + size <= numa_stride) {
+            ret = numa_base + n * numa_stride + numa_carved[n];
+            numa_carved[n] += size;
+        } else {
+            continue;
+        }
+        numa_malloced[n] += size;
+        mem_malloced += size;
+        if (node >= 0 && n != (unsigned int)node)
+            numa_remote_pages++;
+    }
+    return ret;
+}
+
+/* Hands a page back to its node's free pool, and its memory to the OS */
+static void numa_page_release(void *ptr) {
+    const size_t page = settings.slab_page_size;
+    const size_t os_page = sysconf(_SC_PAGESIZE);
+    const unsigned int n = chunk_node(ptr);
+    uintptr_t first = ((uintptr_t)ptr + os_page - 1) / os_page * os_page;
+    uintptr_t last = ((uintptr_t)ptr + page) / os_page * os_page;
+
+    numa_free_pages[n][numa_free_count[n]++] = ptr;
+    numa_malloced[n] -= page;
+    mem_malloced -= page;
+    if (first < last &&
+        madvise((void *)first, last - first, MADV_DONTNEED) != 0 &&
+        settings.verbose > 0) {
+        fprintf(stderr, "Failed to release node memory: %s\n",
+                strerror(errno));
+    }
+}
+
+/* Reserves the arenas of NUMA mode and binds them to their nodes */
+static void numa_arenas_init(void) {
+    const size_t page = settings.slab_page_size;
+    unsigned int n;
+
+    numa_count = numa_mode_nodes();
+    for (n = 0; n < numa_count; n++) {
+        if (numa_mode_node_bytes(n) > numa_stride)
+            numa_stride = numa_mode_node_bytes(n);
+    }
+    /* Whole pages of the largest node, and as much as the limit asks */
+    numa_stride = numa_stride / page * page;
+    if (numa_stride < mem_limit)
+        numa_stride = (mem_limit + page - 1) / page * page;
+
+    numa_base = mmap(NULL, numa_stride * numa_count, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (numa_base == MAP_FAILED) {
+        fprintf(stderr, "Failed to reserve the NUMA arenas: %s\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(numa_base, numa_stride * numa_count, MADV_HUGEPAGE);
+#endif
+    for (n = 0; n < numa_count; n++) {
+        if (!numa_mode_bind(numa_base + n * numa_stride, numa_stride, n))
+            exit(EXIT_FAILURE);
+        numa_free_pages[n] = calloc(numa_stride / page, sizeof(void *));
+        if (numa_free_pages[n] == NULL) {
+            fprintf(stderr, "Failed to allocate the node page pools\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void *memory_allocate(size_t size, const int node) {
     void *ret;
 
-    if (mem_base == NULL) {
+    if (numa_base != NULL) {
+        ret = numa_page_allocate(size, node);
+    } else if (mem_base == NULL) {
         print_statm("before memory allocate");
         /* We are not using a preallocated large memory chunk */
         ret = malloc(size);
@@ -461,6 +925,11 @@ static void *memory_allocate(size_t size) {
             mem_malloced+=size;
         print_statm("after memory allocate");
 
+    } else if (mem_base_pool_count > 0 && size == settings.slab_page_size) {
+        /* Reuse a page that was given back by an earlier shrink */
+        ret = mem_base_pool[--mem_base_pool_count];
+        mem_base_page_free[((char *)ret - (char *)mem_base) / size] = false;
+        mem_malloced += size;
     } else {
         ret = mem_current;
 
@@ -479,35 +948,346 @@ static void *memory_allocate(size_t size) {
         } else {
             mem_avail = 0;
         }
+        mem_malloced += size;
     }
 
     return ret;
 }
 
-void *slabs_alloc(size_t size, unsigned int id) {
-    void *ret;
+/* Put a page of the preallocated arena in the free pool, and hand back to
+ * the OS every release block around it that is now completely free.
+ * Must be called with slabs_lock held. */
+static void mem_base_release(void *ptr) {
+    const size_t page = settings.slab_page_size;
+    const size_t used = (char *)mem_current - (char *)mem_base;
+    size_t off = (char *)ptr - (char *)mem_base;
+    size_t first, last, x;
+
+    mem_base_page_free[off / page] = true;
+    mem_base_pool[mem_base_pool_count++] = ptr;
+    mem_malloced -= page;
+
+    /* Grow the free run around this page over the release blocks it
+     * touches, then release the aligned blocks inside that run. */
+    first = off / MEM_BASE_RELEASE_ALIGN * MEM_BASE_RELEASE_ALIGN;
+    last = (off + page + MEM_BASE_RELEASE_ALIGN - 1)
+        / MEM_BASE_RELEASE_ALIGN * MEM_BASE_RELEASE_ALIGN;
+    if (last > used)
+        last = used;
+    for (x = off / page; x > 0 && x * page > first; x--) {
+        if (!mem_base_page_free[x - 1])
+            break;
+    }
+    first = x * page;
+    for (x = off / page + 1; x * page < last; x++) {
+        if (!mem_base_page_free[x])
+            break;
+    }
+    if (x * page < last)
+        last = x * page;
+
+    first = (first + MEM_BASE_RELEASE_ALIGN - 1)
+        / MEM_BASE_RELEASE_ALIGN * MEM_BASE_RELEASE_ALIGN;
+    last = last / MEM_BASE_RELEASE_ALIGN * MEM_BASE_RELEASE_ALIGN;
+    if (first < last &&
+        madvise((char *)mem_base + first, last - first, MADV_DONTNEED) != 0 &&
+        settings.verbose > 0) {
+        fprintf(stderr, "Failed to release preallocated memory: %s\n",
+                strerror(errno));
+    }
+}
 
+/* Give a page back to the OS, or to the arena when preallocated.
+ * Must be called with slabs_lock held. */
+static void page_release(void *ptr) {
+    if (numa_base != NULL) {
+        numa_page_release(ptr);
+    } else if (mem_base == NULL) {
+        free(ptr);
+        mem_malloced -= settings.slab_page_size;
+    } else {
+        mem_base_release(ptr);
+    }
+}
+
+/* Takes a ready page, one on the node if there is one. Must be called with
+ * slabs_lock held and the pool not empty. */
+static void *page_pool_take(const int node) {
+    unsigned int i = page_pool_count - 1;
+    void *ptr;
+
+    if (node >= 0) {
+        while (i > 0 && chunk_node(page_pool[i]) != (unsigned int)node)
+            i--;
+    }
+    ptr = page_pool[i];
+    page_pool[i] = page_pool[--page_pool_count];
+    if (node >= 0 && chunk_node(ptr) != (unsigned int)node)
+        numa_remote_pages++;
+    return ptr;
+}
+
+/* Drop pooled pages until we are back under the limit. Must be called with
+ * slabs_lock held; returns how many pages were released. */
+static unsigned int page_pool_trim(void) {
+    unsigned int released = 0;
+
+    while (page_pool_count > 0 && mem_limit && TOTAL_MALLOCED > mem_limit) {
+        page_release(page_pool[--page_pool_count]);
+        released++;
+    }
+    return released;
+}
+
+static void *page_pool_thread(void *arg) {
+    const size_t len = settings.slab_page_size;
+
+    pthread_mutex_lock(&slabs_lock);
+    while (do_run_page_pool_thread) {
+        void *ptr = NULL;
+
+        if (page_pool_trim() > 0 && mem_base == NULL && numa_base == NULL) {
+            pthread_mutex_unlock(&slabs_lock);
+            malloc_trim(len);
+            pthread_mutex_lock(&slabs_lock);
+        }
+        if (page_pool_count + page_pool_filling < settings.page_pool &&
+            (!mem_limit || TOTAL_MALLOCED + len <= mem_limit))
+            ptr = memory_allocate(len, -1);
+        if (ptr == NULL) {
+            /* Full, no room, or out of memory: wait for a page to be taken
+             * or the limit to change */
+            pthread_cond_wait(&page_pool_cond, &slabs_lock);
+            continue;
+        }
+
+        page_pool_filling++;
+        pthread_mutex_unlock(&slabs_lock);
+        /* Faults the whole page in, so the worker doesn't */
+        memset(ptr, 0, len);
+        pthread_mutex_lock(&slabs_lock);
+        page_pool_filling--;
+        page_pool[page_pool_count++] = ptr;
+    }
+    pthread_mutex_unlock(&slabs_lock);
+    return NULL;
+}
+
+int start_page_pool_thread(void) {
+    int ret;
+
+    if ((ret = pthread_create(&page_pool_tid, NULL, page_pool_thread,
+                              NULL)) != 0) {
+        fprintf(stderr, "Can't create page pool thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void stop_page_pool_thread(void) {
     pthread_mutex_lock(&slabs_lock);
-    ret = do_slabs_alloc(size, id);
+    do_run_page_pool_thread = 0;
+    pthread_cond_signal(&page_pool_cond);
     pthread_mutex_unlock(&slabs_lock);
+
+    pthread_join(page_pool_tid, NULL);
+}
+
+/* The thread cache is only used for classes with plenty of chunks per page,
+ * so it can't hold a large share of the memory of big item classes. */
+static inline bool slab_cache_usable(const unsigned int id) {
+    return id >= POWER_SMALLEST && id <= power_largest &&
+        slabclass[id].perslab >= SLAB_CACHE_MAX * 2;
+}
+
+/* Pull a batch of chunks from the class into the calling thread's cache.
+ * Called with the thread cache lock held. */
+static void slab_cache_refill(slab_cache_class_t *cc, const unsigned int id,
+                              const int node) {
+    slabclass_t *p = &slabclass[id];
+    int x;
+
+    latency_lock(&p->lock, LATENCY_SLABS_LOCK, pthread_mutex_lock);
+    if (!p->killing && slab_wants_local_page(p, node))
+        do_slabs_newslab(id, node);
+    /* Never stash chunks of a class whose page is being killed */
+    if (!p->killing && (p->sl_curr != 0 || do_slabs_newslab(id, node) != 0)) {
+        for (x = 0; x < SLAB_CACHE_BATCH && p->sl_curr != 0; x++) {
+            item *it = slots_pop(p, node);
+            it->next = cc->slots;
+            cc->slots = it;
+            cc->count++;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Give the first n chunks of a detached list back to their class. */
+static void slab_cache_release(item *it, unsigned int n, const unsigned int id) {
+    slabclass_t *p = &slabclass[id];
+
+    latency_lock(&p->lock, LATENCY_SLABS_LOCK, pthread_mutex_lock);
+    while (it != NULL && n-- > 0) {
+        item *next = it->next;
+        do_slabs_free(it, 0, id);
+        it = next;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void *slabs_alloc(size_t size, unsigned int id) {
+    slab_thread_cache_t *tc = pthread_getspecific(slab_cache_key);
+    void *ret = NULL;
+
+    if (tc != NULL && slab_cache_usable(id)) {
+        slab_cache_class_t *cc = &tc->classes[id];
+        pthread_mutex_lock(&tc->lock);
+        if (cc->count == 0)
+            slab_cache_refill(cc, id, tc->node);
+        if (cc->count != 0) {
+            item *it = (item *)cc->slots;
+            cc->slots = it->next;
+            cc->count--;
+            cc->requested += size;
+            it->next = 0;
+            ret = it;
+        }
+        pthread_mutex_unlock(&tc->lock);
+        if (ret != NULL) {
+            MEMCACHED_SLABS_ALLOCATE(size, id, slabclass[id].size, ret);
+            return ret;
+        }
+    }
+
+    if (id >= POWER_SMALLEST && id <= power_largest) {
+        latency_lock(&slabclass[id].lock, LATENCY_SLABS_LOCK,
+                     pthread_mutex_lock);
+        ret = do_slabs_alloc(size, id, tc != NULL ? tc->node : -1);
+        pthread_mutex_unlock(&slabclass[id].lock);
+    } else {
+        ret = do_slabs_alloc(size, id, -1);
+    }
     return ret;
 }
 
 void slabs_free(void *ptr, size_t size, unsigned int id) {
-    pthread_mutex_lock(&slabs_lock);
+    slab_thread_cache_t *tc = pthread_getspecific(slab_cache_key);
+
+    if (tc != NULL && slab_cache_usable(id)) {
+        slab_cache_class_t *cc = &tc->classes[id];
+        bool cached = false;
+        pthread_mutex_lock(&tc->lock);
+        /* killing is only raised before the rebalancer flushes every cache
+         * under its lock, so anything we stash here will be collected. */
+        /* Chunks of another node go back to the class, so that the cache
+         * only ever hands out local ones */
+        if (!slabclass[id].killing &&
+            (tc->node < 0 || chunk_node(ptr) == (unsigned int)tc->node)) {
+            item *it = (item *)ptr;
+            assert(it->slabs_clsid == 0);
+            MEMCACHED_SLABS_FREE(size, id, ptr);
+            it->it_flags |= ITEM_SLABBED;
+            it->prev = 0;
+            it->next = cc->slots;
+            cc->slots = it;
+            cc->count++;
+            cc->requested -= size;
+            if (cc->count > SLAB_CACHE_MAX) {
+                item *batch = (item *)cc->slots;
+                item *keep = batch;
+                int x;
+                for (x = 0; x < SLAB_CACHE_BATCH; x++)
+                    keep = keep->next;
+                cc->slots = keep;
+                cc->count -= SLAB_CACHE_BATCH;
+                slab_cache_release(batch, SLAB_CACHE_BATCH, id);
+            }
+            cached = true;
+        }
+        pthread_mutex_unlock(&tc->lock);
+        if (cached)
+            return;
+    }
+
+    if (id < POWER_SMALLEST || id > power_largest) {
+        do_slabs_free(ptr, size, id);
+        return;
+    }
+    latency_lock(&slabclass[id].lock, LATENCY_SLABS_LOCK, pthread_mutex_lock);
     do_slabs_free(ptr, size, id);
-    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&slabclass[id].lock);
+}
+
+/* Return every chunk of the given class stashed in a thread cache to the
+ * class freelist. The class must already be marked as killing. */
+static void slab_cache_flush(const unsigned int id) {
+    slab_thread_cache_t *tc;
+
+    pthread_mutex_lock(&slab_caches_lock);
+    for (tc = slab_caches; tc != NULL; tc = tc->next) {
+        slab_cache_class_t *cc = &tc->classes[id];
+        item *list;
+        unsigned int count;
+
+        pthread_mutex_lock(&tc->lock);
+        list = (item *)cc->slots;
+        count = cc->count;
+        cc->slots = NULL;
+        cc->count = 0;
+        pthread_mutex_unlock(&tc->lock);
+
+        if (count)
+            slab_cache_release(list, count, id);
+    }
+    pthread_mutex_unlock(&slab_caches_lock);
+}
+
+/* Sum up what the thread caches hold for each class. */
+static void slab_cache_aggregate(unsigned int *cached, long long *requested) {
+    slab_thread_cache_t *tc;
+    int i;
+
+    memset(cached, 0, sizeof(unsigned int) * MAX_NUMBER_OF_SLAB_CLASSES);
+    memset(requested, 0, sizeof(long long) * MAX_NUMBER_OF_SLAB_CLASSES);
+    pthread_mutex_lock(&slab_caches_lock);
+    for (tc = slab_caches; tc != NULL; tc = tc->next) {
+        pthread_mutex_lock(&tc->lock);
+        for (i = POWER_SMALLEST; i <= power_largest; i++) {
+            cached[i] += tc->classes[i].count;
+            requested[i] += tc->classes[i].requested;
+        }
+        pthread_mutex_unlock(&tc->lock);
+    }
+    pthread_mutex_unlock(&slab_caches_lock);
+}
+
+void slabs_thread_cache_init(const int node) {
+    slab_thread_cache_t *tc = calloc(1, sizeof(slab_thread_cache_t));
+    if (tc == NULL) {
+        /* Not fatal; this thread just goes to the class locks directly */
+        fprintf(stderr, "Failed to allocate slab thread cache\n");
+        return;
+    }
+    pthread_mutex_init(&tc->lock, NULL);
+    tc->node = numa_base != NULL ? node : -1;
+    memory_account(MEMORY_THREADS, sizeof(slab_thread_cache_t));
+
+    pthread_mutex_lock(&slab_caches_lock);
+    tc->next = slab_caches;
+    slab_caches = tc;
+    pthread_mutex_unlock(&slab_caches_lock);
+
+    pthread_setspecific(slab_cache_key, tc);
 }
 
 void slabs_stats(ADD_STAT add_stats, void *c) {
-    pthread_mutex_lock(&slabs_lock);
     do_slabs_stats(add_stats, c);
-    pthread_mutex_unlock(&slabs_lock);
 }
 
-void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal)
+void slabs_adjust_mem_requested(unsigned int id, const void *ptr, size_t old,
+                                size_t ntotal)
 {
-    pthread_mutex_lock(&slabs_lock);
+    const int node = slab_thread_node();
     slabclass_t *p;
     if (id < POWER_SMALLEST || id > power_largest) {
         fprintf(stderr, "Internal error! Invalid slab class\n");
@@ -515,8 +1295,12 @@ void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal)
     }
 
     p = &slabclass[id];
+    pthread_mutex_lock(&p->lock);
     p->requested = p->requested - old + ntotal;
-    pthread_mutex_unlock(&slabs_lock);
+    /* The LRU tail's chunk is reused wherever it is */
+    if (node >= 0 && chunk_node(ptr) != (unsigned int)node)
+        p->numa_remote++;
+    pthread_mutex_unlock(&p->lock);
 }
 
 static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
@@ -527,28 +1311,352 @@ static volatile int do_run_slab_rebalance_thread = 1;
 #define DEFAULT_SLAB_BULK_CHECK 1
 int slab_bulk_check = DEFAULT_SLAB_BULK_CHECK;
 
+/*
+ * Shrink pacing. With -o shrink_rate the rebalancer empties pages no faster
+ * than that many MB/s, sleeping between move batches. With -o shrink_adaptive
+ * the rate also follows an AIMD controller: it is halved when the rebalancer
+ * had to wait on cache_lock for more than SHRINK_LOCK_WAIT_MAX (workers are
+ * busy with it), and grows back by a sixteenth of the ceiling otherwise.
+ */
+#define SHRINK_ADAPTIVE_CEILING (64 * 1024 * 1024) /* bytes/s, without shrink_rate */
+#define SHRINK_LOCK_WAIT_MAX 100        /* usec */
+#define SHRINK_CONTROL_INTERVAL 100000  /* usec between controller steps */
+#define SHRINK_MAX_SLEEP 1000000        /* usec */
+
+static uint64_t shrink_rate_ceiling = 0;   /* bytes/s, 0 when unpaced */
+static uint64_t shrink_rate_current = 0;
+static uint64_t shrink_next_batch = 0;     /* usec */
+static uint64_t shrink_control_next = 0;
+static uint64_t shrink_lock_wait = 0;      /* worst cache_lock wait, usec */
+static uint64_t shrink_started = 0;        /* usec, 0 when not shrinking */
+static uint64_t shrink_bytes_done = 0;
+
+static uint64_t usec_now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Called by the rebalancer when it starts killing pages to meet a lower
+ * limit. */
+static void slab_shrink_begin(void) {
+    if (shrink_started != 0)
+        return;
+    shrink_started = usec_now();
+    shrink_bytes_done = 0;
+    shrink_rate_ceiling = (uint64_t)settings.shrink_rate * 1024 * 1024;
+    if (settings.shrink_adaptive && shrink_rate_ceiling == 0)
+        shrink_rate_ceiling = SHRINK_ADAPTIVE_CEILING;
+    shrink_rate_current = shrink_rate_ceiling;
+    shrink_next_batch = shrink_started;
+    shrink_control_next = shrink_started + SHRINK_CONTROL_INTERVAL;
+    shrink_lock_wait = 0;
+}
+
+/* Take cache_lock, noting how long the rebalancer had to wait for it. */
+static void slab_rebalance_lock(void) {
+    uint64_t start, waited;
+
+    if (pthread_mutex_trylock(&cache_lock) == 0)
+        return;
+    start = usec_now();
+    pthread_mutex_lock(&cache_lock);
+    waited = usec_now() - start;
+    if (waited > shrink_lock_wait)
+        shrink_lock_wait = waited;
+}
+
+/* Sleep long enough after a batch of bytes for the shrink to keep to its
+ * rate. */
+static void slab_shrink_pace(const uint64_t bytes) {
+    uint64_t now;
+
+    if (shrink_rate_current == 0)
+        return;
+    now = usec_now();
+
+    if (settings.shrink_adaptive && now >= shrink_control_next) {
+        if (shrink_lock_wait > SHRINK_LOCK_WAIT_MAX) {
+            shrink_rate_current /= 2;
+            if (shrink_rate_current < shrink_rate_ceiling / 64)
+                shrink_rate_current = shrink_rate_ceiling / 64;
+        } else {
+            shrink_rate_current += shrink_rate_ceiling / 16;
+            if (shrink_rate_current > shrink_rate_ceiling)
+                shrink_rate_current = shrink_rate_ceiling;
+        }
+        shrink_lock_wait = 0;
+        shrink_control_next = now + SHRINK_CONTROL_INTERVAL;
+    }
+
+    /* No credit for time spent idle: a long pause doesn't allow a burst */
+    if (shrink_next_batch < now)
+        shrink_next_batch = now;
+    shrink_next_batch += bytes * 1000000 / shrink_rate_current;
+    if (shrink_next_batch > now) {
+        uint64_t delay = shrink_next_batch - now;
+        usleep(delay < SHRINK_MAX_SLEEP ? delay : SHRINK_MAX_SLEEP);
+    }
+}
+
+void slabs_shrink_stats(ADD_STAT add_stats, void *c) {
+    uint64_t total = TOTAL_MALLOCED;
+    uint64_t remaining = (mem_limit && total > mem_limit) ? total - mem_limit : 0;
+    uint64_t started = shrink_started;
+    uint64_t eta = 0;
+
+    if (remaining && started) {
+        uint64_t elapsed = usec_now() - started;
+        uint64_t done = shrink_bytes_done;
+        if (done > 0 && elapsed > 0)
+            eta = remaining * elapsed / done / 1000000;
+        else if (shrink_rate_current)
+            eta = remaining / shrink_rate_current;
+    }
+    APPEND_STAT("shrink_bytes_remaining", "%llu", (unsigned long long)remaining);
+    APPEND_STAT("shrink_rate", "%llu",
+                (unsigned long long)(started ? shrink_rate_current : 0));
+    APPEND_STAT("shrink_eta_seconds", "%llu", (unsigned long long)eta);
+}
+
+/* Resident set size in bytes, or 0 where /proc isn't there */
+static uint64_t process_rss(void) {
+    unsigned long long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "%llu %llu", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void slabs_memory_stats(ADD_STAT add_stats, void *c) {
+    static const char *names[MEMORY_CATEGORIES] = {
+        "connections", "suffix_caches", "threads", "mrc"
+    };
+    char key[STAT_KEY_LEN];
+    uint64_t pages, lists, total;
+    int i;
+
+    pthread_mutex_lock(&slabs_lock);
+    pages = mem_malloced;
+    lists = mem_malloced_slablist;
+    pthread_mutex_unlock(&slabs_lock);
+    total = pages + lists + tell_hashsize();
+
+    APPEND_STAT("memory:slab_pages", "%llu", (unsigned long long)pages);
+    APPEND_STAT("memory:slab_lists", "%llu", (unsigned long long)lists);
+    APPEND_STAT("memory:hash_table", "%llu",
+                (unsigned long long)tell_hashsize());
+    for (i = 0; i < MEMORY_CATEGORIES; i++) {
+        uint64_t bytes = memory_accounted(i);
+        snprintf(key, sizeof(key), "memory:%s", names[i]);
+        APPEND_STAT(key, "%llu", (unsigned long long)bytes);
+        total += bytes;
+    }
+    APPEND_STAT("memory:total", "%llu", (unsigned long long)total);
+    APPEND_STAT("memory:limit", "%llu", (unsigned long long)mem_limit);
+    APPEND_STAT("memory:limit_usage", "%llu",
+                (unsigned long long)TOTAL_MALLOCED);
+    if ((total = process_rss()) > 0)
+        APPEND_STAT("memory:rss", "%llu", (unsigned long long)total);
+
+    add_stats(NULL, 0, NULL, 0, c);
+}
+
+/*
+ * Rebalance tracing. The mover fills in a record for the page it is
+ * killing as it goes; once the page is done the record joins the last
+ * REBALANCE_HISTORY ones kept for "stats rebalance", and the totals.
+ * Times are in microseconds. Lock hold time is how long the mover kept
+ * cache_lock, which is what stalls the workers.
+ */
+#define REBALANCE_HISTORY 16
+
+typedef struct {
+    rel_time_t when;            /* when the page was done */
+    int s_clsid;
+    int d_clsid;                /* 0 for a shrink */
+    uint64_t start_us;
+    uint64_t move_us;
+    uint64_t finish_us;
+    uint64_t total_us;          /* wall time, pauses between passes too */
+    uint64_t move_passes;
+    uint64_t busy_restarts;     /* times the page was walked again */
+    uint64_t busy_items;
+    uint64_t rescued;
+    uint64_t evicted;
+    uint64_t lock_hold_us;
+    uint64_t lock_hold_max_us;
+    int64_t bytes_released;     /* RSS drop across free/malloc_trim */
+} rebalance_record;
+
+static rebalance_record rebal_trace;    /* page being killed, mover only */
+static uint64_t rebal_trace_began = 0;  /* ns */
+static uint64_t rebal_trace_last_hold = 0;
+static pthread_mutex_t rebal_history_lock = PTHREAD_MUTEX_INITIALIZER;
+static rebalance_record rebal_history[REBALANCE_HISTORY];
+static rebalance_record rebal_totals;
+static uint64_t rebal_pages = 0;
+
+/* Add a cache_lock hold that started at ns */
+static void rebal_trace_hold(const uint64_t since) {
+    uint64_t held = (latency_now() - since) / 1000;
+
+    rebal_trace_last_hold = held;
+    rebal_trace.lock_hold_us += held;
+    if (held > rebal_trace.lock_hold_max_us)
+        rebal_trace.lock_hold_max_us = held;
+}
+
+static void rebal_trace_done(void) {
+    rebalance_record *r = &rebal_trace;
+
+    r->when = current_time;
+    r->total_us = (latency_now() - rebal_trace_began) / 1000;
+
+    pthread_mutex_lock(&rebal_history_lock);
+    rebal_history[rebal_pages % REBALANCE_HISTORY] = *r;
+    rebal_pages++;
+    rebal_totals.start_us += r->start_us;
+    rebal_totals.move_us += r->move_us;
+    rebal_totals.finish_us += r->finish_us;
+    rebal_totals.total_us += r->total_us;
+    rebal_totals.move_passes += r->move_passes;
+    rebal_totals.busy_restarts += r->busy_restarts;
+    rebal_totals.busy_items += r->busy_items;
+    rebal_totals.rescued += r->rescued;
+    rebal_totals.evicted += r->evicted;
+    rebal_totals.lock_hold_us += r->lock_hold_us;
+    if (r->lock_hold_max_us > rebal_totals.lock_hold_max_us)
+        rebal_totals.lock_hold_max_us = r->lock_hold_max_us;
+    rebal_totals.bytes_released += r->bytes_released;
+    pthread_mutex_unlock(&rebal_history_lock);
+
+    MEMCACHED_SLABS_REBALANCE_FINISH(r->s_clsid, r->d_clsid,
+                                     (int64_t)r->total_us, r->bytes_released);
+}
+
+static void rebal_record_stats(ADD_STAT add_stats, void *c, const char *prefix,
+                               const rebalance_record *r) {
+    char key[STAT_KEY_LEN];
+
+#define APPEND_REBAL_STAT(name, fmt, val) \
+    snprintf(key, sizeof(key), "%s:%s", prefix, name); \
+    APPEND_STAT(key, fmt, val);
+
+    APPEND_REBAL_STAT("start_us", "%llu", (unsigned long long)r->start_us);
+    APPEND_REBAL_STAT("move_us", "%llu", (unsigned long long)r->move_us);
+    APPEND_REBAL_STAT("finish_us", "%llu", (unsigned long long)r->finish_us);
+    APPEND_REBAL_STAT("total_us", "%llu", (unsigned long long)r->total_us);
+    APPEND_REBAL_STAT("move_passes", "%llu",
+                      (unsigned long long)r->move_passes);
+    APPEND_REBAL_STAT("busy_restarts", "%llu",
+                      (unsigned long long)r->busy_restarts);
+    APPEND_REBAL_STAT("busy_items", "%llu", (unsigned long long)r->busy_items);
+    APPEND_REBAL_STAT("rescued", "%llu", (unsigned long long)r->rescued);
+    APPEND_REBAL_STAT("evicted", "%llu", (unsigned long long)r->evicted);
+    APPEND_REBAL_STAT("lock_hold_us", "%llu",
+                      (unsigned long long)r->lock_hold_us);
+    APPEND_REBAL_STAT("lock_hold_max_us", "%llu",
+                      (unsigned long long)r->lock_hold_max_us);
+    APPEND_REBAL_STAT("bytes_released", "%lld",
+                      (long long)r->bytes_released);
+#undef APPEND_REBAL_STAT
+}
+
+void slabs_rebalance_stats(ADD_STAT add_stats, void *c) {
+    rebalance_record history[REBALANCE_HISTORY];
+    rebalance_record totals;
+    char prefix[32];
+    char key[STAT_KEY_LEN];
+    uint64_t pages;
+    int kept, i;
+
+    pthread_mutex_lock(&rebal_history_lock);
+    memcpy(history, rebal_history, sizeof(history));
+    totals = rebal_totals;
+    pages = rebal_pages;
+    pthread_mutex_unlock(&rebal_history_lock);
+
+    APPEND_STAT("rebalance:pages", "%llu", (unsigned long long)pages);
+    rebal_record_stats(add_stats, c, "rebalance:total", &totals);
+
+    /* Most recent first */
+    kept = pages < REBALANCE_HISTORY ? (int)pages : REBALANCE_HISTORY;
+    for (i = 0; i < kept; i++) {
+        const rebalance_record *r =
+            &history[(pages - 1 - i) % REBALANCE_HISTORY];
+
+        snprintf(prefix, sizeof(prefix), "rebalance:%d", i);
+        snprintf(key, sizeof(key), "%s:ago", prefix);
+        APPEND_STAT(key, "%u", current_time - r->when);
+        snprintf(key, sizeof(key), "%s:source", prefix);
+        APPEND_STAT(key, "%d", r->s_clsid);
+        snprintf(key, sizeof(key), "%s:dest", prefix);
+        APPEND_STAT(key, "%d", r->d_clsid);
+        rebal_record_stats(add_stats, c, prefix, r);
+    }
+
+    add_stats(NULL, 0, NULL, 0, c);
+}
+
+/* The page of a class to kill next: in NUMA mode one on the node holding
+ * the most memory, so that shrinks keep the nodes even. Called with the
+ * class lock held. */
+static unsigned int slab_victim(const slabclass_t *p) {
+    unsigned int i, n, heaviest = 0;
+    size_t most = 0;
+
+    if (numa_base == NULL)
+        return 0;
+    pthread_mutex_lock(&slabs_lock);
+    for (i = 0; i < p->slabs; i++) {
+        n = chunk_node(p->slab_list[i]);
+        if (numa_malloced[n] > most) {
+            most = numa_malloced[n];
+            heaviest = i;
+        }
+    }
+    pthread_mutex_unlock(&slabs_lock);
+    return heaviest;
+}
+
 static int slab_rebalance_start(void) {
     slabclass_t *s_cls;
+    slabclass_t *d_cls = NULL;
     int no_go = 0;
     bool shrink=(slab_rebal.d_clsid==0);
+    uint64_t began = latency_now();
+    uint64_t locked;
 
 
     pthread_mutex_lock(&cache_lock);
-    pthread_mutex_lock(&slabs_lock);
+    locked = latency_now();
 
     if (slab_rebal.s_clsid < POWER_SMALLEST ||
         slab_rebal.s_clsid > power_largest  ||
         (!shrink && (
                      slab_rebal.d_clsid < POWER_SMALLEST ||
                      slab_rebal.d_clsid > power_largest  ) )||
-        slab_rebal.s_clsid == slab_rebal.d_clsid)
-        no_go = -2;
+        slab_rebal.s_clsid == slab_rebal.d_clsid) {
+        pthread_mutex_unlock(&cache_lock);
+        return -2;
+    }
 
     s_cls = &slabclass[slab_rebal.s_clsid];
+    pthread_mutex_lock(&s_cls->lock);
 
     /* check only when reasigning, not when shrinking*/
-    if (slab_rebal.d_clsid && (!grow_slab_list(slab_rebal.d_clsid))) {
-        no_go = -1;
+    if (!shrink) {
+        d_cls = &slabclass[slab_rebal.d_clsid];
+        pthread_mutex_lock(&d_cls->lock);
+        pthread_mutex_lock(&slabs_lock);
+        if (!grow_slab_list(slab_rebal.d_clsid))
+            no_go = -1;
+        pthread_mutex_unlock(&slabs_lock);
     }
 
     /*If we take more than 1, we make the decision once, but run
@@ -556,12 +1664,15 @@ static int slab_rebalance_start(void) {
       If the mechanism changes to actually changing several slabs each time,
       this check should be
       if (s_cls->slabs < 1 + slab_rebal.num_slabs)
+      A retired class gives up its last page too.
     */
-    if (s_cls->slabs < 2)
+    if (s_cls->slabs < (s_cls->retired ? 1 : 2))
         no_go = -3;
 
     if (no_go != 0) {
-        pthread_mutex_unlock(&slabs_lock);
+        if (d_cls)
+            pthread_mutex_unlock(&d_cls->lock);
+        pthread_mutex_unlock(&s_cls->lock);
         pthread_mutex_unlock(&cache_lock);
         return no_go; /* Should use a wrapper function... */
     }
@@ -569,8 +1680,10 @@ static int slab_rebalance_start(void) {
     /*If controlling several slabs at once is supported, this should be
       s_cls->killing = slab_rebal.num_slabs;
     */
-    s_cls->killing = 1;
+    s_cls->killing = slab_victim(s_cls) + 1;
     --slab_rebal.num_slabs;
+    if (shrink)
+        slab_shrink_begin();
 
     /*Can several slabs be supported at once?*/
     slab_rebal.slab_start = s_cls->slab_list[s_cls->killing - 1];
@@ -579,6 +1692,14 @@ static int slab_rebalance_start(void) {
     slab_rebal.slab_pos   = slab_rebal.slab_start;
     slab_rebal.done       = 0;
 
+    if (d_cls)
+        pthread_mutex_unlock(&d_cls->lock);
+    pthread_mutex_unlock(&s_cls->lock);
+
+    /* Free chunks stashed by the workers must be back on the class freelist
+     * before we start walking the page. */
+    slab_cache_flush(slab_rebal.s_clsid);
+
     /* Also tells do_item_get to search for items in this slab */
     slab_rebalance_signal = 2;
 
@@ -586,8 +1707,14 @@ static int slab_rebalance_start(void) {
         fprintf(stderr, "Started a slab %s\n",slab_rebal.d_clsid?"rebalance":"shrink");
     }
 
-    pthread_mutex_unlock(&slabs_lock);
+    memset(&rebal_trace, 0, sizeof(rebal_trace));
+    rebal_trace.s_clsid = slab_rebal.s_clsid;
+    rebal_trace.d_clsid = slab_rebal.d_clsid;
+    rebal_trace_began = began;
+    rebal_trace_hold(locked);
     pthread_mutex_unlock(&cache_lock);
+    rebal_trace.start_us = (latency_now() - began) / 1000;
+    MEMCACHED_SLABS_REBALANCE_START(rebal_trace.s_clsid, rebal_trace.d_clsid);
 
     STATS_LOCK();
     stats.slab_reassign_running = true;
@@ -597,9 +1724,166 @@ static int slab_rebalance_start(void) {
 }
 
 enum move_status {
-    MOVE_PASS=0, MOVE_DONE, MOVE_BUSY
+    MOVE_PASS=0, MOVE_DONE, MOVE_BUSY, MOVE_LOCKED
 };
 
+/* Takes a free chunk of the class that isn't in the page being killed off
+ * the freelist. A class an item moves to since a geometry change may also
+ * grab a fresh page if the memory limit allows it; the class giving up the
+ * page may not, or the move would grow it instead of paying for the
+ * destination. Called with the class lock held. */
+static item *slab_rescue_chunk(const unsigned int id) {
+    slabclass_t *p = &slabclass[id];
+    /* Keep the items on the node they were on */
+    const unsigned int node = chunk_node(slab_rebal.slab_start);
+    unsigned int i, n;
+    item *it;
+
+    /* At most perslab chunks of the dying page can sit ahead of a good one */
+    for (i = 0, n = node; i < numa_count; i++, n = (n + 1) % numa_count) {
+        for (it = p->slots[n]; it != NULL; it = it->next) {
+            if ((void *)it >= slab_rebal.slab_start &&
+                (void *)it < slab_rebal.slab_end)
+                continue;
+            slots_unlink(p, it);
+            return it;
+        }
+    }
+
+    if (slab_rebal.d_clsid != 0 && id != slab_rebal.s_clsid &&
+        do_slabs_newslab(id, node))
+        return slots_pop(p, node);
+    return NULL;
+}
+
+/* Copies a linked item of the page being killed into another chunk of its
+ * class, so hot data survives page moves and shrinks. When the class has
+ * no free chunk left, an item at the LRU tail that is colder than this one
+ * gives up its chunk instead, so evictions still follow the LRU rather than
+ * page placement. An item that belongs to another class since a geometry
+ * change goes there if it has room, even without -o slab_rescue.
+ * Called with cache_lock, the class lock and the item lock held; the class
+ * lock of the destination is taken after it, as slab_rebalance_start does. */
+static bool slab_rescue_item(const unsigned int id, item *it, const uint32_t hv) {
+    slabclass_t *p = &slabclass[id];
+    unsigned int to = slabs_clsid(ITEM_ntotal(it));
+    item *new_it = NULL;
+
+    /* Since a geometry change, the item may belong to another class */
+    if (to != 0 && to != id) {
+        pthread_mutex_lock(&slabclass[to].lock);
+        new_it = slab_rescue_chunk(to);
+        if (new_it != NULL)
+            slabclass[to].requested += ITEM_ntotal(it);
+        pthread_mutex_unlock(&slabclass[to].lock);
+    }
+    if (new_it != NULL) {
+        p->requested -= ITEM_ntotal(it);
+    } else {
+        to = id;
+        if (!settings.slab_rescue)
+            return false;
+        new_it = slab_rescue_chunk(id);
+    }
+    if (new_it == NULL) {
+        new_it = do_item_evict_tail(id, slab_rebal.slab_start,
+                                    slab_rebal.slab_end, it->time);
+        if (new_it == NULL)
+            return false;
+        p->requested -= ITEM_ntotal(new_it);
+    }
+
+    memcpy(new_it, it, ITEM_ntotal(it));
+    new_it->refcount = 1;
+    new_it->it_flags &= ~ITEM_SLABBED;
+    new_it->slabs_clsid = to;
+    if (new_it->it_flags & ITEM_CHUNKED) {
+        item_chunk *ch;
+        for (ch = ITEM_chunks(new_it)->first; ch != NULL; ch = ch->next)
+            ch->head = new_it;
+    }
+    do_item_relink(it, new_it, hv);
+    return true;
+}
+
+/* Frees a chunk for the rebalancer, which holds the lock of the class it
+ * moves from; that of another class is taken after it. */
+static void slab_rebalance_free(void *ptr, const size_t size,
+                                const unsigned int id) {
+    if (id == slab_rebal.s_clsid) {
+        do_slabs_free(ptr, size, id);
+        return;
+    }
+    pthread_mutex_lock(&slabclass[id].lock);
+    do_slabs_free(ptr, size, id);
+    pthread_mutex_unlock(&slabclass[id].lock);
+}
+
+/* Evicts a linked chunked item for one of its chunks in the page being
+ * killed, and frees the rest of them. The caller claims that one, and holds
+ * the item lock and a reference besides the link. */
+static void slab_evict_chunked(item *head, const uint32_t hv, void *keep) {
+    item_chunk *ch, *next;
+    unsigned int id;
+
+    item_ghost_add(head->slabs_clsid, hv);
+    do_item_unlink_nolock(head, hv);
+    for (ch = ITEM_chunks(head)->first; ch != NULL; ch = next) {
+        next = ch->next;
+        if ((void *)ch == keep)
+            continue;
+        id = ch->slabs_clsid;
+        ch->refcount = 0;
+        ch->it_flags = 0;
+        ch->slabs_clsid = 0;
+        slab_rebalance_free(ch, sizeof(item_chunk) + ch->size, id);
+    }
+    if ((void *)head != keep) {
+        id = head->slabs_clsid;
+        head->refcount = 0;
+        head->it_flags = 0;
+        head->slabs_clsid = 0;
+        slab_rebalance_free(head, settings.slab_page_size, id);
+    }
+}
+
+/* Moves a piece of a chunked item out of the page being killed: copied to
+ * another chunk of its class with -o slab_rescue, else by evicting its
+ * item. The piece carries the item's hash, so the caller holds its lock. */
+static enum move_status slab_rebalance_piece(item_chunk *ch, const uint32_t hv,
+                                             int *rescued, int *evicted) {
+    item *head = ch->head;
+    item_chunk *new_ch = NULL;
+
+    if ((head->it_flags & ITEM_LINKED) == 0 ||
+        refcount_incr(&head->refcount) != 2) {
+        if (head->it_flags & ITEM_LINKED)
+            refcount_decr(&head->refcount);
+        /* Being uploaded to, read from or freed */
+        return MOVE_BUSY;
+    }
+
+    if (settings.slab_rescue)
+        new_ch = (item_chunk *)slab_rescue_chunk(slab_rebal.s_clsid);
+    if (new_ch != NULL) {
+        memcpy(new_ch, ch, sizeof(item_chunk) + ch->size);
+        new_ch->refcount = 1;
+        new_ch->it_flags = ITEM_CHUNK;
+        if (new_ch->prev != NULL)
+            new_ch->prev->next = new_ch;
+        else
+            ITEM_chunks(head)->first = new_ch;
+        if (new_ch->next != NULL)
+            new_ch->next->prev = new_ch;
+        refcount_decr(&head->refcount);
+        (*rescued)++;
+    } else {
+        slab_evict_chunked(head, hv, ch);
+        (*evicted)++;
+    }
+    return MOVE_DONE;
+}
+
 /* refcount == 0 is safe since nobody can incr while cache_lock is held.
  * refcount != 0 is impossible since flags/etc can be modified in other
  * threads. instead, note we found a busy one and bail. logic in do_item_get
@@ -610,47 +1894,69 @@ static int slab_rebalance_move(void) {
     int x;
     int was_busy = 0;
     int refcount = 0;
+    int rescued = 0;
+    int evicted = 0;
     enum move_status status = MOVE_PASS;
+    uint64_t began = latency_now();
+    uint64_t locked;
 
-    pthread_mutex_lock(&cache_lock);
-    pthread_mutex_lock(&slabs_lock);
-
+    slab_rebalance_lock();
+    locked = latency_now();
     s_cls = &slabclass[slab_rebal.s_clsid];
+    pthread_mutex_lock(&s_cls->lock);
 
     for (x = 0; x < slab_bulk_check; x++) {
         item *it = slab_rebal.slab_pos;
+        void *hold_lock = NULL;
+        uint32_t hv = 0;
         status = MOVE_PASS;
         if (it->slabs_clsid != 255) {
-            refcount = refcount_incr(&it->refcount);
-            if (refcount == 1) { /* item is unlinked, unused */
-                if (it->it_flags & ITEM_SLABBED) {
-                    /* remove from slab freelist */
-                    if (s_cls->slots == it) {
-                        s_cls->slots = it->next;
+            /* Lookups only hold the item lock, so we have to own it before
+             * unlinking. A free chunk just hashes to some arbitrary lock. */
+            hv = it->hv;
+            if ((hold_lock = item_trylock(hv)) == NULL) {
+                status = MOVE_LOCKED;
+            } else {
+                refcount = refcount_incr(&it->refcount);
+                if (refcount == 1) { /* item is unlinked, unused */
+                    if (it->it_flags & ITEM_SLABBED) {
+                        /* remove from slab freelist */
+                        slots_unlink(s_cls, it);
+                        status = MOVE_DONE;
+                    } else {
+                        status = MOVE_BUSY;
+                    }
+                } else if (refcount == 2) { /* item is linked but not busy */
+                    if (it->it_flags & ITEM_CHUNK) {
+                        status = slab_rebalance_piece((item_chunk *)it, hv,
+                                                      &rescued, &evicted);
+                    } else if ((it->it_flags & ITEM_LINKED) != 0) {
+                        if ((settings.slab_rescue ||
+                             slabs_clsid(ITEM_ntotal(it)) != slab_rebal.s_clsid) &&
+                            slab_rescue_item(slab_rebal.s_clsid, it, hv)) {
+                            rescued++;
+                        } else if (it->it_flags & ITEM_CHUNKED) {
+                            slab_evict_chunked(it, hv, it);
+                            evicted++;
+                        } else {
+                            item_ghost_add(slab_rebal.s_clsid, hv);
+                            do_item_unlink_nolock(it, hv);
+                            evicted++;
+                        }
+                        status = MOVE_DONE;
+                    } else {
+                        /* refcount == 1 + !ITEM_LINKED means the item is being
+                         * uploaded to, or was just unlinked but hasn't been freed
+                         * yet. Let it bleed off on its own and try again later */
+                        status = MOVE_BUSY;
                     }
-                    if (it->next) it->next->prev = it->prev;
-                    if (it->prev) it->prev->next = it->next;
-                    s_cls->sl_curr--;
-                    status = MOVE_DONE;
-                } else {
-                    status = MOVE_BUSY;
-                }
-            } else if (refcount == 2) { /* item is linked but not busy */
-                if ((it->it_flags & ITEM_LINKED) != 0) {
-                    do_item_unlink_nolock(it, hash(ITEM_key(it), it->nkey, 0));
-                    status = MOVE_DONE;
                 } else {
-                    /* refcount == 1 + !ITEM_LINKED means the item is being
-                     * uploaded to, or was just unlinked but hasn't been freed
-                     * yet. Let it bleed off on its own and try again later */
+                    if (settings.verbose > 2) {
+                        fprintf(stderr, "Slab reassign hit a busy item: refcount: %d (%d -> %d)\n",
+                            it->refcount, slab_rebal.s_clsid, slab_rebal.d_clsid);
+                    }
                     status = MOVE_BUSY;
                 }
-            } else {
-                if (settings.verbose > 2) {
-                    fprintf(stderr, "Slab reassign hit a busy item: refcount: %d (%d -> %d)\n",
-                        it->refcount, slab_rebal.s_clsid, slab_rebal.d_clsid);
-                }
-                status = MOVE_BUSY;
             }
         }
 
@@ -661,14 +1967,19 @@ static int slab_rebalance_move(void) {
                 it->slabs_clsid = 255;
                 break;
             case MOVE_BUSY:
+                refcount_decr(&it->refcount);
+                /* fall through */
+            case MOVE_LOCKED:
                 slab_rebal.busy_items++;
                 was_busy++;
-                refcount_decr(&it->refcount);
                 break;
             case MOVE_PASS:
                 break;
         }
 
+        if (hold_lock)
+            item_trylock_unlock(hold_lock);
+
         slab_rebal.slab_pos = (char *)slab_rebal.slab_pos + s_cls->size;
         if (slab_rebal.slab_pos >= slab_rebal.slab_end)
             break;
@@ -679,14 +1990,31 @@ static int slab_rebalance_move(void) {
         if (slab_rebal.busy_items) {
             slab_rebal.slab_pos = slab_rebal.slab_start;
             slab_rebal.busy_items = 0;
+            rebal_trace.busy_restarts++;
         } else {
             slab_rebal.done++;
         }
     }
 
-    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&s_cls->lock);
+    rebal_trace_hold(locked);
     pthread_mutex_unlock(&cache_lock);
 
+    rebal_trace.move_passes++;
+    rebal_trace.busy_items += was_busy;
+    rebal_trace.rescued += rescued;
+    rebal_trace.evicted += evicted;
+    rebal_trace.move_us += (latency_now() - began) / 1000;
+    MEMCACHED_SLABS_REBALANCE_MOVE(slab_rebal.s_clsid, was_busy, rescued,
+                                   evicted, (int)rebal_trace_last_hold);
+
+    if (rescued || evicted) {
+        STATS_LOCK();
+        stats.slab_items_rescued += rescued;
+        stats.slab_items_evicted += evicted;
+        STATS_UNLOCK();
+    }
+
     return was_busy;
 }
 
@@ -694,37 +2022,51 @@ static void slab_rebalance_finish(void) {
     slabclass_t *s_cls;
     slabclass_t *d_cls;
     bool shrink=(slab_rebal.d_clsid==0);
+    uint64_t began = latency_now();
+    uint64_t locked;
+    /* Read from /proc around the lock rather than under it */
+    const uint64_t rss = shrink ? process_rss() : 0;
 
     pthread_mutex_lock(&cache_lock);
-    pthread_mutex_lock(&slabs_lock);
-
+    locked = latency_now();
     s_cls = &slabclass[slab_rebal.s_clsid];
+    pthread_mutex_lock(&s_cls->lock);
 
     /* At this point the stolen slab is completely clear */
     s_cls->slab_list[s_cls->killing - 1] =
         s_cls->slab_list[s_cls->slabs - 1];
     s_cls->slabs--;
     s_cls->killing = 0;
-    /* Todo: The slab_list array seems to be growing indefinatelly.
-       It should be re-alloced from time to time, if many slabs were shrunk or reassigned.*/
+    pthread_mutex_lock(&slabs_lock);
+    shrink_slab_list(slab_rebal.s_clsid);
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&s_cls->lock);
 
     if (shrink){
         ((item *)(slab_rebal.slab_start))->slabs_clsid = 0;
         print_statm("before shrink");
-        if (mem_base==NULL){
+        if (mem_base==NULL && numa_base==NULL){
             free(slab_rebal.slab_start);
-            malloc_trim(settings.item_size_max);
-            mem_malloced -= settings.item_size_max;
-        print_statm("after shrink");
+            malloc_trim(settings.slab_page_size);
+            pthread_mutex_lock(&slabs_lock);
+            mem_malloced -= settings.slab_page_size;
+            pthread_mutex_unlock(&slabs_lock);
+        }else{
+            pthread_mutex_lock(&slabs_lock);
+            page_release(slab_rebal.slab_start);
+            pthread_mutex_unlock(&slabs_lock);
         }
+        print_statm("after shrink");
     }else{
 
-        memset(slab_rebal.slab_start, 0, (size_t)settings.item_size_max);
+        memset(slab_rebal.slab_start, 0, (size_t)settings.slab_page_size);
 
         d_cls   = &slabclass[slab_rebal.d_clsid];
+        pthread_mutex_lock(&d_cls->lock);
         d_cls->slab_list[d_cls->slabs++] = slab_rebal.slab_start;
         split_slab_page_into_freelist(slab_rebal.slab_start,
                                       slab_rebal.d_clsid);
+        pthread_mutex_unlock(&d_cls->lock);
     }
 
 
@@ -749,8 +2091,12 @@ static void slab_rebalance_finish(void) {
     slab_rebal.slab_end   = NULL;
     slab_rebal.slab_pos   = NULL;
 
-    pthread_mutex_unlock(&slabs_lock);
+    rebal_trace_hold(locked);
     pthread_mutex_unlock(&cache_lock);
+    if (rss > 0)
+        rebal_trace.bytes_released = (int64_t)rss - (int64_t)process_rss();
+    rebal_trace.finish_us = (latency_now() - began) / 1000;
+    rebal_trace_done();
 
     STATS_LOCK();
     stats.slab_reassign_running = false;
@@ -760,6 +2106,12 @@ static void slab_rebalance_finish(void) {
         stats.slabs_moved++;
     STATS_UNLOCK();
 
+    if (shrink) {
+        shrink_bytes_done += settings.slab_page_size;
+        if (!slabs_over_limit())
+            shrink_started = 0;
+    }
+
     if (settings.verbose > 1) {
         fprintf(stderr, "Finished a slab %s\n",shrink?"shrink":"move");
     }
@@ -783,6 +2135,8 @@ static unsigned long long ceil_divide(const unsigned long long a, const unsigned
 static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
                                   const bool shrink_now) {
     static uint64_t evicted_old[POWER_LARGEST];
+    static uint64_t ghost_old[POWER_LARGEST];
+    static uint64_t crawled_old[POWER_LARGEST];
 
     /*Record the number of consecutive times
       in which a slab had zero evictions*/
@@ -793,8 +2147,22 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
     uint64_t evicted_diff[POWER_LARGEST];
     uint64_t evicted_max  = 0;
     uint64_t evicted_min  = ULONG_MAX;
+    /* Ghost hits are misses on recently evicted keys, so the hits per
+       interval the class would gain with a few more pages. They
+       rank classes by the value of their marginal pages; evictions only
+       break ties. */
+    uint64_t ghost_new[POWER_LARGEST];
+    uint64_t ghost_diff[POWER_LARGEST];
+    uint64_t ghost_max = 0;
+    uint64_t ghost_min = ULONG_MAX;
+    /* Pages the LRU crawler just emptied of dead items cost nothing to
+       give away, so such a class goes first as a source. */
+    uint64_t crawled_new[POWER_LARGEST];
+    uint64_t crawled_max = 0;
+    int crawled_source = 0;
     unsigned int highest_slab = 0;
     unsigned int total_pages[POWER_LARGEST];
+    unsigned int free_chunks[POWER_LARGEST];
     int i;
     int source = 0;
     int emergency_source = 0;
@@ -813,16 +2181,41 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
     }
 
     item_stats_evictions(evicted_new);
+    item_stats_ghost_hits(ghost_new);
+    if (settings.lru_crawler)
+        item_stats_crawler_reclaimed(crawled_new);
     pthread_mutex_lock(&cache_lock);
-    for (i = POWER_SMALLEST; i < power_largest; i++) {
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        pthread_mutex_lock(&slabclass[i].lock);
         total_pages[i] = slabclass[i].slabs;
+        free_chunks[i] = slabclass[i].sl_curr;
+        pthread_mutex_unlock(&slabclass[i].lock);
     }
     pthread_mutex_unlock(&cache_lock);
 
     /* Find a candidate source; something with zero evicts 3+ times.
        This algorithm prefers larger powers as a source.  */
-    for (i = POWER_SMALLEST; i < power_largest; i++) {
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
         evicted_diff[i] = evicted_new[i] - evicted_old[i];
+        ghost_diff[i] = ghost_new[i] - ghost_old[i];
+        if (slabclass[i].retired) {
+            /* Neither a source nor a destination; being drained */
+            slab_zeroes[i] = 0;
+            evicted_old[i] = evicted_new[i];
+            ghost_old[i] = ghost_new[i];
+            if (settings.lru_crawler)
+                crawled_old[i] = crawled_new[i];
+            continue;
+        }
+        if (settings.lru_crawler) {
+            uint64_t crawled_diff = crawled_new[i] - crawled_old[i];
+            crawled_old[i] = crawled_new[i];
+            if (crawled_diff > crawled_max && total_pages[i] >= 2 &&
+                free_chunks[i] >= slabclass[i].perslab) {
+                crawled_max = crawled_diff;
+                crawled_source = i;
+            }
+        }
         if (evicted_diff[i] == 0 && total_pages[i] > 2) {
             slab_zeroes[i]++;
             if (source == 0 && slab_zeroes[i] >= 3)
@@ -830,7 +2223,9 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
         } else {/*Search for the best destination according
                   to the current statistics*/
             slab_zeroes[i] = 0;
-            if (evicted_diff[i] > evicted_max) {
+            if (ghost_diff[i] > ghost_max ||
+                (ghost_diff[i] == ghost_max && evicted_diff[i] > evicted_max)) {
+                ghost_max = ghost_diff[i];
                 evicted_max = evicted_diff[i];
                 highest_slab = i;
             }
@@ -838,14 +2233,16 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
 
         if (settings.verbose > 2 && total_pages[i]) {
             fprintf(stderr,
-                    "total pages: slab class %d diff %ld slabs %d\n",
-                    i,(long int)evicted_diff[i],total_pages[i]);
+                    "total pages: slab class %d diff %ld ghost hits %ld slabs %d\n",
+                    i,(long int)evicted_diff[i],(long int)ghost_diff[i],
+                    total_pages[i]);
         }
 
 
         /*prepare an emergency source for the aggressive mode*/
-        if ((settings.slab_automove>1) &&
-            evicted_diff[i] < evicted_min && (total_pages[i] >= 2)){
+        if ((settings.slab_automove>1) && (total_pages[i] >= 2) &&
+            (ghost_diff[i] < ghost_min ||
+             (ghost_diff[i] == ghost_min && evicted_diff[i] <= evicted_min))){
             /*We verify that there are enough slabs in the emergency source,
               otherwise we don't have anything to take from.
               If we wait to slab_reassign with this check we might hit a neverending loop.*/
@@ -855,9 +2252,10 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
               so we allow a tie breaker. this is not pure logic -
               one can insert any kind of
               weight function over total_pages and evicted_diff.*/
-            if (emergency_source==0 ||
+            if (emergency_source==0 || ghost_diff[i] < ghost_min ||
                 ( evicted_diff[i] < evicted_min) ||
                 ( /*evicted diff is equal and*/ total_pages[i] >total_pages[emergency_source])){
+                ghost_min=ghost_diff[i];
                 evicted_min=evicted_diff[i];
                 if (shrink_now) {
                     fprintf(stdout, "emergency source changed from %d to %d\n",
@@ -870,6 +2268,7 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
         }
 
         evicted_old[i] = evicted_new[i];
+        ghost_old[i] = ghost_new[i];
     }
 
     /* Pick a valid destination: a destination which won 3 times in a row */
@@ -886,6 +2285,10 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
     if ((settings.slab_automove>1) && !source)
         source=emergency_source;
 
+    /* Outside a shrink the crawler only fills in for the usual hysteresis */
+    if (crawled_source && crawled_source != dest && (shrink_now || !source))
+        source = crawled_source;
+
     if (source){/*Decide on num_slabs, currently only for shrinkage*/
     	unsigned long long total = TOTAL_MALLOCED;
 
@@ -898,7 +2301,7 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
              the shrinkage across slab classes*/
             unsigned long long mem_gap = TOTAL_MALLOCED - mem_limit;
             const unsigned int minimal_size_for_one_go = 1;
-            unsigned long long slabs_gap = ceil_divide(mem_gap, settings.item_size_max);
+            unsigned long long slabs_gap = ceil_divide(mem_gap, settings.slab_page_size);
             if (slabs_gap <= minimal_size_for_one_go)
                 *num_slabs = slabs_gap;
             else {
@@ -906,7 +2309,7 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
                 /*Count the active slab classes, to compute the minimal number of
                  slabs that will be taken from the leading candidate*/
                 unsigned int number_of_active_slab_classes = 0;
-                for (i = POWER_SMALLEST; i < power_largest; i++) {
+                for (i = POWER_SMALLEST; i <= power_largest; i++) {
                     if (total_pages[i] > 1)/*only those that are eligible*/
                         ++number_of_active_slab_classes;
                 }
@@ -951,6 +2354,405 @@ static int slab_automove_decision(int *src, int *dst, int *const num_slabs,
     return 0;
 }
 
+/* Bytes of page one chunk of this size takes up, its share of the page
+ * tail included. */
+static inline uint64_t chunk_footprint(const unsigned int size) {
+    return settings.slab_page_size / (settings.slab_page_size / size);
+}
+
+/* Last histogram bucket whose items fit in a chunk of this size */
+static inline unsigned int geometry_limit(const unsigned int size,
+                                          const unsigned int width,
+                                          const unsigned int buckets) {
+    unsigned int lim = size / width;
+    return lim < buckets ? lim : buckets - 1;
+}
+
+/* Bytes of page the items of the histogram take in these classes, given
+ * as ascending sizes. cum[] holds the running item count. */
+static uint64_t geometry_cost(const uint64_t *cum, const unsigned int buckets,
+                              const unsigned int width,
+                              const unsigned int *sizes, const int n) {
+    uint64_t cost = 0, below = 0;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        unsigned int lim = geometry_limit(sizes[j], width, buckets);
+        cost += (cum[lim] - below) * chunk_footprint(sizes[j]);
+        below = cum[lim];
+    }
+    return cost;
+}
+
+/* Finds the new class that would save the most, splitting the size range
+ * of class *at with a chunk of *size bytes. Returns the bytes it saves. */
+static uint64_t geometry_best_split(const uint64_t *cum,
+                                    const unsigned int buckets,
+                                    const unsigned int width,
+                                    const unsigned int *sizes, const int n,
+                                    int *at, unsigned int *size) {
+    uint64_t best = 0;
+    unsigned int below = 0, lim, t;
+    int j;
+
+    for (j = 0; j < n; j++, below = lim) {
+        uint64_t foot = chunk_footprint(sizes[j]);
+        lim = geometry_limit(sizes[j], width, buckets);
+        for (t = below + 1; t < lim; t++) {
+            uint64_t f = chunk_footprint(t * width);
+            uint64_t gain = (cum[t] - cum[below]) * (foot - f);
+            if (gain > best) {
+                best = gain;
+                *at = j;
+                *size = t * width;
+            }
+        }
+    }
+    return best;
+}
+
+/* Finds the class, other than the largest, that costs the least to merge
+ * into the next one up. Returns the bytes that would cost. */
+static uint64_t geometry_cheapest_merge(const uint64_t *cum,
+                                        const unsigned int buckets,
+                                        const unsigned int width,
+                                        const unsigned int *sizes,
+                                        const int n, int *at) {
+    uint64_t best = UINT64_MAX;
+    unsigned int below = 0, lim;
+    int j;
+
+    for (j = 0; j < n - 1; j++, below = lim) {
+        uint64_t cost;
+        lim = geometry_limit(sizes[j], width, buckets);
+        cost = (cum[lim] - cum[below]) *
+            (chunk_footprint(sizes[j + 1]) - chunk_footprint(sizes[j]));
+        if (cost < best) {
+            best = cost;
+            *at = j;
+        }
+    }
+    return best;
+}
+
+static void geometry_insert(unsigned int *sizes, int *n, const int at,
+                            const unsigned int size) {
+    memmove(&sizes[at + 1], &sizes[at], (*n - at) * sizeof(*sizes));
+    sizes[at] = size;
+    (*n)++;
+}
+
+static void geometry_remove(unsigned int *sizes, int *n, const int at) {
+    memmove(&sizes[at], &sizes[at + 1], (*n - at - 1) * sizeof(*sizes));
+    (*n)--;
+}
+
+/* Improves the given ascending class sizes for the histogram: drops the
+ * classes no item would use, adds the best split while there are fewer
+ * classes than at startup, then trades the cheapest merge for the best
+ * split for as long as that saves memory. The largest class always stays.
+ * Dropping unused classes is what retires a class whose items all fit a
+ * new, smaller one better. */
+static void geometry_fit(const uint64_t *cum, const unsigned int buckets,
+                         const unsigned int width, unsigned int *sizes,
+                         int *n) {
+    unsigned int saved[POWER_LARGEST];
+    unsigned int size = 0;
+    uint64_t gain, cost;
+    int iter, at = 0, merged = 0;
+
+    for (iter = 0; iter < (int)geometry_classes * 4; iter++) {
+        if (*n > 1 && geometry_cheapest_merge(cum, buckets, width, sizes, *n,
+                                              &merged) == 0) {
+            geometry_remove(sizes, n, merged);
+            continue;
+        }
+        if (*n < (int)geometry_classes) {
+            if (geometry_best_split(cum, buckets, width, sizes, *n,
+                                    &at, &size) == 0)
+                break;
+            geometry_insert(sizes, n, at, size);
+            continue;
+        }
+        if (*n < 2)
+            break;
+        memcpy(saved, sizes, *n * sizeof(*sizes));
+        cost = geometry_cheapest_merge(cum, buckets, width, sizes, *n, &merged);
+        geometry_remove(sizes, n, merged);
+        gain = geometry_best_split(cum, buckets, width, sizes, *n, &at, &size);
+        if (gain <= cost) {
+            memcpy(sizes, saved, (*n + 1) * sizeof(*sizes));
+            (*n)++;
+            break;
+        }
+        geometry_insert(sizes, n, at, size);
+    }
+}
+
+/* Sorts the ids of the classes in use by chunk size */
+static int geometry_active(unsigned int *ids) {
+    int i, j, n = 0;
+
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        if (slabclass[i].size == 0 || slabclass[i].retired)
+            continue;
+        for (j = n; j > 0 && slabclass[ids[j - 1]].size > slabclass[i].size; j--)
+            ids[j] = ids[j - 1];
+        ids[j] = i;
+        n++;
+    }
+    return n;
+}
+
+/* Of the classes of the given sizes, the one taking most of the items
+ * of the histogram buckets (lo, hi] */
+static int geometry_heir(const uint64_t *cum, const unsigned int buckets,
+                         const unsigned int width, const unsigned int *sizes,
+                         const int n, const unsigned int lo,
+                         const unsigned int hi) {
+    uint64_t most = 0;
+    unsigned int below = 0, lim;
+    int k, heir = -1;
+
+    for (k = 0; k < n; k++, below = lim) {
+        lim = geometry_limit(sizes[k], width, buckets);
+        if (heir < 0 && lim >= hi)
+            heir = k;   /* takes the largest of those sizes */
+        if (lim > lo && below < hi) {
+            uint64_t count = cum[lim < hi ? lim : hi] - cum[below > lo ? below : lo];
+            if (count > most) {
+                most = count;
+                heir = k;
+            }
+        }
+    }
+    return heir;
+}
+
+/* Switches to the given ascending class sizes, which keep the largest
+ * class. Sizes without a class take the ids of drained or unused classes;
+ * classes whose size isn't in the set are retired, and will give their
+ * pages to the class taking most of their items. Returns false, changing
+ * nothing, when there aren't enough free ids.
+ * Called with slabs_rebalance_lock held, so no page is being moved. */
+static bool geometry_apply(const uint64_t *cum, const unsigned int buckets,
+                           const unsigned int width, const unsigned int *sizes,
+                           const int n) {
+    unsigned int active[POWER_LARGEST], free_ids[POWER_LARGEST];
+    unsigned int ids[POWER_LARGEST];
+    int nactive, nfree = 0, needed = 0, i, j;
+
+    nactive = geometry_active(active);
+    for (i = 0, j = 0; i < n; i++) {
+        while (j < nactive && slabclass[active[j]].size < sizes[i])
+            j++;
+        if (j == nactive || slabclass[active[j]].size != sizes[i])
+            needed++;
+    }
+    for (i = POWER_SMALLEST; i < power_largest && nfree < needed; i++) {
+        if (slabclass[i].size == 0 ||
+            (slabclass[i].retired && slabclass[i].slabs == 0))
+            free_ids[nfree++] = i;
+    }
+    if (nfree < needed)
+        return false;
+
+    /* Give the new sizes their classes... */
+    for (i = 0, j = 0, nfree = 0; i < n; i++) {
+        while (j < nactive && slabclass[active[j]].size < sizes[i])
+            j++;
+        if (j < nactive && slabclass[active[j]].size == sizes[i]) {
+            ids[i] = active[j];
+        } else {
+            slabclass_t *p;
+            ids[i] = free_ids[nfree++];
+            p = &slabclass[ids[i]];
+            slab_cache_flush(ids[i]);
+            pthread_mutex_lock(&p->lock);
+            p->size = sizes[i];
+            p->perslab = settings.slab_page_size / sizes[i];
+            p->retired = false;
+            pthread_mutex_unlock(&p->lock);
+            if (settings.verbose > 1) {
+                fprintf(stderr, "slab class %3u: chunk size %9u perslab %7u\n",
+                        ids[i], p->size, p->perslab);
+            }
+        }
+    }
+
+    /* ...then retire what is left out. */
+    for (j = 0; j < nactive; j++) {
+        slabclass_t *p = &slabclass[active[j]];
+        unsigned int lo;
+        int heir;
+
+        for (i = 0; i < n && ids[i] != active[j]; i++)
+            ;
+        if (i < n)
+            continue;
+        lo = j > 0 ? geometry_limit(slabclass[active[j - 1]].size, width,
+                                    buckets) : 0;
+        heir = geometry_heir(cum, buckets, width, sizes, n, lo,
+                             geometry_limit(p->size, width, buckets));
+        geometry_drain_to[active[j]] = ids[heir];
+        pthread_mutex_lock(&p->lock);
+        p->retired = true;
+        pthread_mutex_unlock(&p->lock);
+        if (settings.verbose > 1) {
+            fprintf(stderr, "slab class %3u: retired, pages go to %u\n",
+                    active[j], ids[heir]);
+        }
+    }
+
+    /* Once the memory is full, pages follow the items: each class is to
+     * end up with the share of the pages its items took at the change. */
+    {
+        uint64_t bytes[POWER_LARGEST], all = 0;
+        unsigned int pages = 0, below = 0, lim;
+
+        for (i = POWER_SMALLEST; i <= power_largest; i++)
+            pages += slabclass[i].slabs;
+        memset(geometry_target, 0, sizeof(geometry_target));
+        for (i = 0; i < n; i++, below = lim) {
+            lim = geometry_limit(sizes[i], width, buckets);
+            bytes[i] = (cum[lim] - cum[below]) * chunk_footprint(sizes[i]);
+            all += bytes[i];
+        }
+        for (i = 0; i < n && all > 0; i++)
+            geometry_target[ids[i]] = pages * bytes[i] / all;
+        geometry_balancing = all > 0;
+    }
+
+    /* Chain the classes in use by size before pointing the lookup table at
+     * them. A retired class leads to the next larger class in use, so a
+     * lookup that still lands on it moves on to a live one. */
+    for (i = 0; i < n - 1; i++)
+        slabclass[ids[i]].next = ids[i + 1];
+    for (j = POWER_SMALLEST; j < power_largest; j++) {
+        if (!slabclass[j].retired)
+            continue;
+        for (i = 0; sizes[i] <= slabclass[j].size; i++)
+            ;
+        slabclass[j].next = ids[i];
+    }
+    /* slabs_clsid() takes no lock: the chain has to be in place before the
+     * table points at it */
+    memory_barrier();
+    power_smallest_used = ids[0];
+    clsid_table_fill();
+    return true;
+}
+
+/* Fits the geometry to the current item sizes, and moves to the new one if
+ * it saves at least a page and a tenth of the slack. */
+static void slab_geometry_refit(void) {
+    unsigned int ids[POWER_LARGEST], sizes[POWER_LARGEST];
+    unsigned int *hist, width, buckets, i;
+    uint64_t *cum, cost, best, data = 0;
+    int n, j;
+
+    buckets = item_size_hist(NULL, &width);
+    hist = malloc(buckets * sizeof(unsigned int));
+    cum = malloc(buckets * sizeof(uint64_t));
+    if (hist == NULL || cum == NULL) {
+        free(hist);
+        free(cum);
+        return;
+    }
+    item_size_hist(hist, &width);
+    for (i = 0; i < buckets; i++) {
+        cum[i] = (i > 0 ? cum[i - 1] : 0) + hist[i];
+        data += (uint64_t)hist[i] * i * width;
+    }
+
+    n = geometry_active(ids);
+    for (j = 0; j < n; j++)
+        sizes[j] = slabclass[ids[j]].size;
+    cost = geometry_cost(cum, buckets, width, sizes, n);
+    geometry_fit(cum, buckets, width, sizes, &n);
+    best = geometry_cost(cum, buckets, width, sizes, n);
+
+    pthread_mutex_lock(&slabs_lock);
+    geometry_slack = cost - data;
+    pthread_mutex_unlock(&slabs_lock);
+
+    if (best + settings.slab_page_size <= cost &&
+        (cost - best) * 10 >= cost - data &&
+        geometry_apply(cum, buckets, width, sizes, n)) {
+        pthread_mutex_lock(&slabs_lock);
+        geometry_changes++;
+        geometry_slack = best - data;
+        pthread_mutex_unlock(&slabs_lock);
+        if (settings.verbose > 0) {
+            fprintf(stderr, "slab geometry: %d classes, slack %llu -> %llu\n",
+                    n, (unsigned long long)(cost - data),
+                    (unsigned long long)(best - data));
+        }
+    }
+    free(hist);
+    free(cum);
+}
+
+/* Moves a page from the class furthest over its target to the one
+ * furthest under it, or gives it back when memory has to shrink. Returns
+ * false once there is no such class. */
+static bool slab_geometry_balance(const bool shrink_now) {
+    int i, over = 0, under = 0;
+    long most_over = 1, most_under = 0;
+
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        long gap = (long)slabclass[i].slabs - (long)geometry_target[i];
+        if (slabclass[i].size == 0 || slabclass[i].retired)
+            continue;
+        if (gap > most_over) {
+            most_over = gap;
+            over = i;
+        } else if (-gap > most_under) {
+            most_under = -gap;
+            under = i;
+        }
+    }
+    if (over == 0 || (under == 0 && !shrink_now))
+        return false;
+    slabs_reassign(over, shrink_now ? 0 : under, 1);
+    return true;
+}
+
+/* Called from the maintenance thread: drains a retired class with pages
+ * left, then hands pages over to the classes short of their share while
+ * the memory is full, then refits the geometry. When memory has to be
+ * given back, the pages of retired classes are the first to go. */
+static void slab_geometry_tick(const bool shrink_now) {
+    int i;
+
+    for (i = POWER_SMALLEST; i < power_largest; i++) {
+        if (slabclass[i].retired && slabclass[i].slabs > 0) {
+            if (shrink_now)
+                slabs_reassign(i, 0, 1);
+            else
+                slabs_reassign(i, geometry_drain_to[i], slabclass[i].slabs);
+            return;
+        }
+    }
+
+    if (geometry_balancing) {
+        /* Classes short of pages can still take new ones from the limit */
+        if (mem_limit && TOTAL_MALLOCED + settings.slab_page_size > mem_limit &&
+            slab_geometry_balance(shrink_now))
+            return;
+        geometry_balancing = false;
+    }
+
+    if (current_time < geometry_next_fit)
+        return;
+    geometry_next_fit = current_time + settings.slab_adaptive;
+    if (pthread_mutex_trylock(&slabs_rebalance_lock) != 0)
+        return;
+    if (slab_rebalance_signal == 0)
+        slab_geometry_refit();
+    pthread_mutex_unlock(&slabs_rebalance_lock);
+}
+
 /* Slab rebalancer thread.
  * Does not use spinlocks since it is not timing sensitive. Burn less CPU and
  * go to sleep if locks are contended
@@ -962,6 +2764,9 @@ static void *slab_maintenance_thread(void *arg) {
 
         bool shrink_now= mem_limit &&  (TOTAL_MALLOCED> mem_limit);
 
+        if (settings.slab_adaptive > 0)
+            slab_geometry_tick(shrink_now);
+
         if (settings.slab_automove || shrink_now) {
 
             int decision=slab_automove_decision
@@ -990,7 +2795,7 @@ static void *slab_maintenance_thread(void *arg) {
         } else {
             /* Don't wake as often if we're not enabled.
              * This is lazier than setting up a condition right now. */
-            sleep(5);
+            sleep(settings.slab_adaptive > 0 ? DECISION_SECONDS_SHORT : 5);
         }
     }
     return NULL;
@@ -1012,6 +2817,9 @@ static void *slab_rebalance_thread(void *arg) {
             was_busy = 0;
         } else if (slab_rebalance_signal && slab_rebal.slab_start != NULL) {
             was_busy = slab_rebalance_move();
+            if (slab_rebal.d_clsid == 0)
+                slab_shrink_pace((uint64_t)slab_bulk_check *
+                                 slabclass[slab_rebal.s_clsid].size);
         }
 
         if (slab_rebal.done) {
@@ -1070,9 +2878,12 @@ static enum reassign_result_type do_slabs_reassign(int src, int dst, int num_sla
     if (num_slabs < 1)
         return REASSIGN_KILL_FEW;
 
-    if (slabclass[src].slabs < 1 + num_slabs)
+    if (slabclass[src].slabs < (slabclass[src].retired ? 0 : 1) + num_slabs)
         return REASSIGN_NOSPARE;
 
+    if (dst != 0 && (slabclass[dst].retired || slabclass[dst].size == 0))
+        return REASSIGN_BADCLASS;
+
     slab_rebal.s_clsid = src;
     slab_rebal.d_clsid = dst;
     slab_rebal.num_slabs = num_slabs;
@@ -1139,29 +2950,58 @@ void stop_slab_maintenance_thread(void) {
     pthread_join(rebalance_tid, NULL);
 }
 
+static pthread_mutex_t memory_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void memory_limit_lock(void) {
+    pthread_mutex_lock(&memory_limit_mutex);
+}
+
+void memory_limit_unlock(void) {
+    pthread_mutex_unlock(&memory_limit_mutex);
+}
+
+bool slabs_over_limit(void) {
+    return mem_limit && TOTAL_MALLOCED > mem_limit;
+}
+
 /**\return -2 when the requested amount is less than one slab.
-   \return -1 when memory is inflexible because it was
-   allocated as a single chunk.
+   \return -1 when memory was allocated as a single chunk
+   and the request is larger than that chunk.
    \return non-negative value as the number of slabs that need to be killed to reach this size.*/
 long long memory_shrink_expand(const size_t new_mem_limit) {
     print_statm("shrink_expand command");
-    if (mem_base != NULL)
+    if (mem_base != NULL && new_mem_limit > mem_base_size)
         return -1;
-    /* We are not using a preallocated large memory chunk */
-    if (new_mem_limit < settings.item_size_max)
+    if (numa_base != NULL && new_mem_limit > numa_stride * numa_count)
+        return -1;
+    if (new_mem_limit < settings.slab_page_size)
         return -2;
 
+    unsigned int released;
+
     pthread_mutex_lock(&slabs_lock);
     size_t old_mem_limit = mem_limit;
     mem_limit = new_mem_limit;/*note that this does not set settings.max`bytes*/
+    /*Pooled pages hold no items: give them back before killing any slab,
+      and refill the pool if the limit went up*/
+    released = page_pool_trim();
+    if (page_pool != NULL)
+        pthread_cond_signal(&page_pool_cond);
     pthread_mutex_unlock(&slabs_lock);
+    if (released > 0 && mem_base == NULL && numa_base == NULL)
+        malloc_trim(settings.slab_page_size);
+
+    /*The hash table is part of TOTAL_MALLOCED; give it back as the
+      item count drops, instead of killing more pages to make up for it*/
+    if (new_mem_limit < old_mem_limit)
+        assoc_request_shrink();
 
     unsigned long long total = TOTAL_MALLOCED;
     if (total <= new_mem_limit)
         return 0;
 
     unsigned long long gap = total - new_mem_limit;
-    unsigned long long slabs_gap = ceil_divide(gap, settings.item_size_max);
+    unsigned long long slabs_gap = ceil_divide(gap, settings.slab_page_size);
     fprintf(stdout, "[memory gap: %lld, slabs gap: %lld] "
             "from %.2f MB to %.2f MB when currently using %.2f MB\n", gap, slabs_gap,
             TO_MB(old_mem_limit), TO_MB(new_mem_limit), TO_MB(TOTAL_MALLOCED));
@@ -28,14 +28,19 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc);
 
 unsigned int slabs_clsid(const size_t size);
 
+/** Number of chunks in a page of the given class */
+unsigned int slabs_perslab(const unsigned int id);
+
 /** Allocate object of given length. 0 on error */ /*@null@*/
 void *slabs_alloc(const size_t size, unsigned int id);
 
 /** Free previously allocated object */
 void slabs_free(void *ptr, size_t size, unsigned int id);
 
-/** Adjust the stats for memory requested */
-void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal);
+/** Adjust the stats for memory requested, and NUMA placement, as the chunk
+ *  at ptr is taken over by a new item */
+void slabs_adjust_mem_requested(unsigned int id, const void *ptr, size_t old,
+                                size_t ntotal);
 
 /** Return a datum for stats in binary protocol */
 bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c);
@@ -43,9 +48,17 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c);
 /** Fill buffer with stats */ /*@null@*/
 void slabs_stats(ADD_STAT add_stats, void *c);
 
+/** Give the calling worker thread its own cache of free chunks; node is the
+ *  NUMA node it takes them from first, or -1 */
+void slabs_thread_cache_init(const int node);
+
 int start_slab_maintenance_thread(void);
 void stop_slab_maintenance_thread(void);
 
+/** Start the thread keeping -o page_pool pages ready */
+int start_page_pool_thread(void);
+void stop_page_pool_thread(void);
+
 enum reassign_result_type {
     REASSIGN_OK=0, REASSIGN_RUNNING, REASSIGN_BADCLASS, REASSIGN_NOSPARE,
     REASSIGN_SRC_DST_SAME, REASSIGN_KILL_FEW
@@ -64,7 +77,24 @@ enum reassign_result_type {
 */
 enum reassign_result_type slabs_reassign(int src, int dst, int num_slabs);
 
+/** Progress of the current shrink: bytes left, pacing rate and ETA */
+void slabs_shrink_stats(ADD_STAT add_stats, void *c);
+
+/** Fill buffer with the memory held by each part of the server */
+void slabs_memory_stats(ADD_STAT add_stats, void *c);
+
+/** Fill buffer with the trace of the last pages the slab mover killed */
+void slabs_rebalance_stats(ADD_STAT add_stats, void *c);
+
+/** True while more memory is in use than the current limit allows */
+bool slabs_over_limit(void);
+
 /** Actually process the change of maxbytes*/
 long long memory_shrink_expand(const size_t new_mem_limit);
 
+/** Held around a change of the memory limit and settings.maxbytes, so the
+ *  "m" command and balloon mode don't interleave */
+void memory_limit_lock(void);
+void memory_limit_unlock(void);
+
 #endif
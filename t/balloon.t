@@ -0,0 +1,69 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 14;
+use File::Temp qw(tempdir);
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Stand in for our cgroup
+my $dir = tempdir(CLEANUP => 1);
+sub cgroup {
+    my ($current, $high) = @_;
+    for (['memory.current', $current], ['memory.high', $high],
+         ['memory.max', 'max']) {
+        open(my $fh, '>', "$dir/$_->[0].tmp") or die;
+        print $fh "$_->[1]\n";
+        close $fh;
+        rename("$dir/$_->[0].tmp", "$dir/$_->[0]");
+    }
+}
+cgroup(50, 100);
+$ENV{T_MEMD_BALLOON_PATH} = $dir;
+
+my $server = new_memcached('-m 32 -o slab_reassign,balloon=cgroup,'
+                           . 'balloon_min=8,balloon_step=8');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{balloon}, 'cgroup', "balloon is set");
+is($stats->{balloon_min}, 8 * 1024 * 1024, "balloon_min is set");
+is($stats->{balloon_max}, 32 * 1024 * 1024, "balloon_max defaults to -m");
+is($stats->{balloon_step}, 8 * 1024 * 1024, "balloon_step is set");
+
+sub wait_limit {
+    my ($want, $tries) = @_;
+    do {
+        sleep 1;
+        $stats = mem_stats($sock);
+    } while ($stats->{limit_maxbytes} != $want && --$tries > 0);
+    return $stats->{limit_maxbytes};
+}
+
+# Between the marks nothing moves
+cgroup(90, 100);
+sleep 3;
+$stats = mem_stats($sock);
+is($stats->{limit_maxbytes}, 32 * 1024 * 1024, "no change inside the band");
+cmp_ok($stats->{balloon_readings}, '>', 0, "pressure is being read");
+is($stats->{balloon_pressure}, '90.00', "pressure is reported");
+
+# Pressure shrinks one step at a time, down to the floor
+cgroup(99, 100);
+is(wait_limit(24 * 1024 * 1024, 5), 24 * 1024 * 1024, "lowered by a step");
+is(wait_limit(8 * 1024 * 1024, 20), 8 * 1024 * 1024, "stopped at the floor");
+
+# Once it is gone the limit comes back
+cgroup(10, 100);
+is(wait_limit(16 * 1024 * 1024, 10), 16 * 1024 * 1024, "raised by a step");
+$stats = mem_stats($sock);
+is($stats->{balloon_shrinks}, 3, "shrinks are counted");
+
+# An operator's limit caps how far the controller raises it again
+print $sock "m 20\r\n";
+like(scalar <$sock>, qr/^OK/, "limit set by hand");
+$stats = mem_stats($sock, ' settings');
+is($stats->{balloon_max}, 20 * 1024 * 1024, "it becomes balloon_max");
+is(wait_limit(32 * 1024 * 1024, 10), 20 * 1024 * 1024, "not raised past it");
@@ -2,7 +2,7 @@
 
 use strict;
 use warnings;
-use Test::More tests => 3549;
+use Test::More tests => 3633;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -0,0 +1,66 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 15;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-I 4m -m 32 -o slab_reassign,slab_automove=2');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{item_size_max}, 4 * 1024 * 1024, "item_size_max is set");
+is($stats->{slab_page_size}, 1024 * 1024, "pages stay at 1m");
+
+my $value = join('', map { chr(ord('a') + $_ % 26) } 0 .. 3 * 1024 * 1024 - 1);
+my $len = length($value);
+print $sock "set big 7 0 $len\r\n$value\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a value over a page long");
+mem_get_is({ sock => $sock, flags => 7 }, "big", $value);
+
+$stats = mem_stats($sock, ' slabs');
+ok(!grep({ /^\d+:chunk_size$/ && $stats->{$_} > 1024 * 1024 } keys %$stats),
+   "no class is larger than a page");
+
+print $sock "gets big\r\n";
+my ($cas) = (scalar <$sock>) =~ /^VALUE big 7 $len (\d+)\r\n$/;
+ok(defined $cas, "gets returns the full length");
+my $got;
+read($sock, $got, $len + 2);
+<$sock>;
+print $sock "cas big 0 0 $len $cas\r\n$value\r\n";
+is(scalar <$sock>, "STORED\r\n", "cas matches");
+
+print $sock "append big 0 0 3\r\nend\r\n";
+is(scalar <$sock>, "STORED\r\n", "appended to it");
+print $sock "prepend big 0 0 5\r\nstart\r\n";
+is(scalar <$sock>, "STORED\r\n", "prepended to it");
+mem_get_is($sock, "big", "start" . $value . "end");
+
+print $sock "incr big 1\r\n";
+like(scalar <$sock>, qr/^CLIENT_ERROR/, "not a number");
+
+my $over = 'x' x (4 * 1024 * 1024);
+print $sock "set over 0 0 " . length($over) . "\r\n$over\r\n";
+like(scalar <$sock>, qr/^SERVER_ERROR object too large/, "item_size_max holds");
+
+# Shrinking moves the pages that hold the pieces too
+for my $i (1 .. 20) {
+    print $sock "set big$i 0 0 $len\r\n$value\r\n";
+    <$sock>;
+}
+print $sock "m 8\r\n";
+like(scalar <$sock>, qr/^OK/, "lowered the limit");
+my $tries = 30;
+do {
+    sleep 1;
+    $stats = mem_stats($sock, ' slabs');
+} while ($stats->{total_malloced} > 8 * 1024 * 1024 && --$tries > 0);
+cmp_ok($stats->{total_malloced}, '<=', 8 * 1024 * 1024, "shrunk");
+
+# Sizes take the same k and m suffixes as -I
+my $small = new_memcached('-I 2m -o slab_page_size=512k');
+$stats = mem_stats($small->sock, ' settings');
+is($stats->{slab_page_size}, 512 * 1024, "slab_page_size takes a suffix");
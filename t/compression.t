@@ -0,0 +1,69 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = eval { new_memcached('-o compress_threshold=1024') };
+if (!defined $server) {
+    plan skip_all => "built without a compression library";
+}
+plan tests => 18;
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{compress_threshold}, 1024, "compress_threshold is set");
+
+my $value = '{"name":"value","list":[1,2,3]}' x 1000;
+my $len = length($value);
+print $sock "set json 5 0 $len\r\n$value\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a compressible value");
+print $sock "set small 0 0 100\r\n" . ('y' x 100) . "\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a short value");
+
+$stats = mem_stats($sock, ' slabs');
+is($stats->{compressed_items}, 1, "only the long value was compressed");
+cmp_ok($stats->{compress_ratio}, '>', 10, "it compressed well");
+cmp_ok($stats->{compress_bytes_out}, '<', 4096, "into a small class");
+my @big = grep { $stats->{"$_:chunk_size"} > $len }
+    map { /^(\d+):chunk_size$/ ? $1 : () } keys %$stats;
+ok(!grep({ $stats->{"$_:used_chunks"} > 0 } @big),
+   "the value is not held uncompressed");
+
+mem_get_is({ sock => $sock, flags => 5 }, "json", $value);
+$stats = mem_stats($sock, ' slabs');
+is($stats->{decompress_cmds}, 1, "decompressed on get");
+is($stats->{decompress_nomem}, 0, "no hit failed to decompress");
+
+# gets and cas see the stored item's cas
+print $sock "gets json\r\n";
+my ($cas) = (scalar <$sock>) =~ /^VALUE json 5 $len (\d+)\r\n$/;
+ok(defined $cas, "gets returns the full length");
+<$sock>;
+<$sock>;
+print $sock "cas json 0 0 $len $cas\r\n$value\r\n";
+is(scalar <$sock>, "STORED\r\n", "cas matches");
+
+print $sock "append json 0 0 3\r\nend\r\n";
+is(scalar <$sock>, "STORED\r\n", "appended to it");
+print $sock "prepend json 0 0 5\r\nstart\r\n";
+is(scalar <$sock>, "STORED\r\n", "prepended to it");
+mem_get_is($sock, "json", "start" . $value . "end");
+
+# With the cache full, a hit on a compressed value evicts nothing
+my $full = new_memcached('-m 2 -o compress_threshold=1024');
+my $fsock = $full->sock;
+print $fsock "set json 0 0 $len\r\n$value\r\n";
+<$fsock>;
+for my $i (1 .. 50) {
+    my $noise = join('', map { chr(int(rand(256))) } 1 .. $len);
+    print $fsock "set noise$i 0 0 $len\r\n$noise\r\n";
+    <$fsock>;
+}
+my $before = mem_stats($fsock)->{evictions};
+cmp_ok($before, '>', 0, "the cache is full");
+mem_get_is($fsock, "json", $value);
+is(mem_stats($fsock)->{evictions}, $before, "the hit evicted nothing");
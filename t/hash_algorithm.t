@@ -0,0 +1,36 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $stats = mem_stats($server->sock, ' settings');
+is($stats->{hash_algorithm}, 'jenkins', "jenkins is the default");
+
+for my $algo (qw(jenkins murmur3 crc32c)) {
+    $server = new_memcached("-o hash_algorithm=$algo");
+    my $sock = $server->sock;
+    $stats = mem_stats($sock, ' settings');
+    is($stats->{hash_algorithm}, $algo, "hash_algorithm is $algo");
+
+    # Keys of one to four digits cover every tail length of the block loops
+    my $found = 0;
+    for (1 .. 1000) {
+        print $sock "set key$_ 0 0 3\r\nbar\r\n";
+        <$sock>;
+    }
+    for (1 .. 1000) {
+        print $sock "get key$_\r\n";
+        if (scalar <$sock> =~ /^VALUE/) {
+            $found++;
+            <$sock>;
+            <$sock>;
+        }
+    }
+    is($found, 1000, "all keys found with $algo");
+    mem_get_is($sock, "nothere", undef);
+}
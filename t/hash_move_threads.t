@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Several threads move buckets while requests keep coming in
+my $server = new_memcached('-m 64 -o hash_move_threads=4,hashpower=12');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{hash_move_threads}, 4, "hash_move_threads is set");
+
+sub count_found {
+    my ($from, $to) = @_;
+    my $found = 0;
+    for ($from .. $to) {
+        print $sock "get key$_\r\n";
+        my $line = <$sock>;
+        if ($line =~ /^VALUE/) {
+            $found++;
+            <$sock>;
+            <$sock>;
+        }
+    }
+    return $found;
+}
+
+sub wait_for {
+    my $field = shift;
+    my $tries = 50;
+    do {
+        sleep 1 if $tries != 50;
+        $stats = mem_stats($sock);
+    } while ($stats->{$field} && --$tries > 0);
+}
+
+sub store {
+    my ($from, $to) = @_;
+    my $stored = 0;
+    for ($from .. $to) {
+        print $sock "set key$_ 0 0 3\r\nbar\r\n";
+        $stored++ if scalar <$sock> eq "STORED\r\n";
+    }
+    return $stored;
+}
+
+# Look keys up while the table may be half moved
+store(1, 10000);
+is(count_found(1, 10000), 10000, "keys readable during the expansion");
+is(store(10001, 20000), 10000, "stored 20000 items");
+
+wait_for('hash_is_expanding');
+cmp_ok($stats->{hash_power_level}, '>', 12, "hash table expanded");
+is($stats->{hash_is_expanding}, 0, "expansion finished");
+is($stats->{hash_bytes}, 8 * 2 ** $stats->{hash_power_level},
+   "old table was freed");
+is(count_found(1, 20000), 20000, "all items survived the expansion");
+
+# Dropping most keys and the limit merges the buckets back
+for (1 .. 19000) {
+    print $sock "delete key$_\r\n";
+    <$sock>;
+}
+my $power = $stats->{hash_power_level};
+print $sock "m 32\r\n";
+like(scalar <$sock>, qr/^(OK|WARNING)/, "lowered the memory limit");
+my $tries = 50;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while (($stats->{hash_power_level} == $power || $stats->{hash_is_shrinking})
+         && --$tries > 0);
+cmp_ok($stats->{hash_power_level}, '<', $power, "hash table was shrunk");
+is(count_found(19001, 20000), 1000, "all items survived the shrink");
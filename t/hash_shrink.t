@@ -0,0 +1,51 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Start with a hash table far larger than the few items we store
+my $server = new_memcached('-m 64 -o hashpower=16');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock);
+is($stats->{hash_power_level}, 16, "hash power starts at 16");
+is($stats->{hash_is_shrinking}, 0, "not shrinking");
+my $hash_bytes_before = $stats->{hash_bytes};
+
+my $stored = 0;
+for (1 .. 100) {
+    print $sock "set foo$_ 0 0 3\r\nbar\r\n";
+    $stored++ if scalar <$sock> eq "STORED\r\n";
+}
+is($stored, 100, "stored 100 items");
+
+# Lowering the memory limit asks the hash table to give memory back
+print $sock "m 32\r\n";
+like(scalar <$sock>, qr/^(OK|WARNING)/, "lowered the memory limit");
+
+my $tries = 50;
+do {
+    sleep 1 if $tries != 50;
+    $stats = mem_stats($sock);
+} while (($stats->{hash_power_level} == 16 || $stats->{hash_is_shrinking})
+         && --$tries > 0);
+
+cmp_ok($stats->{hash_power_level}, '<', 16, "hash table was shrunk");
+cmp_ok($stats->{hash_bytes}, '<', $hash_bytes_before, "hash_bytes went down");
+
+# All items are still there after the buckets were merged
+my $found = 0;
+for (1 .. 100) {
+    print $sock "get foo$_\r\n";
+    my $line = <$sock>;
+    if ($line =~ /^VALUE/) {
+        $found++;
+        <$sock>;
+        <$sock>;
+    }
+}
+is($found, 100, "all items survived the shrink");
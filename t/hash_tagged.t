@@ -0,0 +1,81 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 12;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# A small table fills its groups, spills onto overflow chains and expands
+my $server = new_memcached('-m 64 -o hash_index=tagged,hashpower=12');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{hash_index}, 'tagged', "hash_index is tagged");
+$stats = mem_stats($sock);
+is($stats->{hash_power_level}, 12, "hash power starts at 12");
+is($stats->{hash_bytes}, 2048 * 64, "one cache line per group");
+
+sub count_found {
+    my ($from, $to) = @_;
+    my $found = 0;
+    for ($from .. $to) {
+        print $sock "get key$_\r\n";
+        my $line = <$sock>;
+        if ($line =~ /^VALUE/) {
+            $found++;
+            <$sock>;
+            <$sock>;
+        }
+    }
+    return $found;
+}
+
+my $stored = 0;
+for (1 .. 20000) {
+    print $sock "set key$_ 0 0 3\r\nbar\r\n";
+    $stored++ if scalar <$sock> eq "STORED\r\n";
+}
+is($stored, 20000, "stored 20000 items");
+
+my $tries = 20;
+do {
+    sleep 1 if $tries != 20;
+    $stats = mem_stats($sock);
+} while ($stats->{hash_is_expanding} && --$tries > 0);
+cmp_ok($stats->{hash_power_level}, '>', 12, "hash table expanded");
+is(count_found(1, 20000), 20000, "all items found after expansion");
+
+# Replacing keeps a single entry per key
+for (1 .. 100) {
+    print $sock "set key$_ 0 0 3\r\nbaz\r\n";
+    <$sock>;
+}
+mem_get_is($sock, "key50", "baz");
+
+my $deleted = 0;
+for (1 .. 10000) {
+    print $sock "delete key$_\r\n";
+    $deleted++ if scalar <$sock> eq "DELETED\r\n";
+}
+is($deleted, 10000, "deleted half the items");
+is(count_found(1, 10000), 0, "deleted items are gone");
+is(count_found(10001, 20000), 10000, "the other half is still there");
+
+# Lowering the memory limit halves the table as items go
+print $sock "m 32\r\n";
+<$sock>;
+for (10001 .. 19000) {
+    print $sock "delete key$_\r\n";
+    <$sock>;
+}
+my $power = $stats->{hash_power_level};
+$tries = 50;
+do {
+    sleep 1 if $tries != 50;
+    $stats = mem_stats($sock);
+} while (($stats->{hash_power_level} == $power || $stats->{hash_is_shrinking})
+         && --$tries > 0);
+cmp_ok($stats->{hash_power_level}, '<', $power, "hash table was shrunk");
+is(count_found(19001, 20000), 1000, "remaining items survived the shrink");
@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 16;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $stats = mem_stats($sock, "latency");
+is(scalar keys %$stats, 0, "nothing timed when latency_stats is off");
+
+$server = new_memcached('-o latency_stats');
+$sock = $server->sock;
+$stats = mem_stats($sock, " settings");
+is($stats->{latency_stats}, "yes", "latency_stats is set");
+
+for (1 .. 100) {
+    print $sock "set key$_ 0 0 3\r\nbar\r\n";
+    <$sock>;
+}
+for (1 .. 50) {
+    print $sock "get key$_\r\n";
+    <$sock>; <$sock>; <$sock>;
+}
+print $sock "get key1 key2 key3\r\n";
+<$sock> for 1 .. 7;
+print $sock "delete key1\r\n";
+<$sock>;
+print $sock "incr key2 1\r\n";
+<$sock>;
+print $sock "touch key3 10\r\n";
+<$sock>;
+
+$stats = mem_stats($sock, "latency");
+is($stats->{"latency:text_set:count"}, 100, "sets timed");
+is($stats->{"latency:text_get:count"}, 50, "gets timed");
+is($stats->{"latency:text_multiget:count"}, 1, "multiget timed");
+is($stats->{"latency:text_delete:count"}, 1, "delete timed");
+is($stats->{"latency:text_incrdecr:count"}, 1, "incr timed");
+is($stats->{"latency:text_touch:count"}, 1, "touch timed");
+ok(!defined $stats->{"latency:binary_get:count"}, "no binary commands seen");
+cmp_ok($stats->{"latency:cache_lock:count"}, '>', 0, "cache lock waits timed");
+cmp_ok($stats->{"latency:slabs_lock:count"}, '>', 0, "slab lock waits timed");
+
+my $h = "latency:text_get";
+cmp_ok($stats->{"$h:p50_us"}, '>', 0, "p50 is reported");
+ok($stats->{"$h:p50_us"} <= $stats->{"$h:p99_us"} &&
+   $stats->{"$h:p99_us"} <= $stats->{"$h:p999_us"} &&
+   $stats->{"$h:p999_us"} <= $stats->{"$h:max_us"}, "percentiles are ordered");
+
+# Quiet binary gets count as multigets
+my $bsock = $server->new_sock;
+my $pkt = '';
+for my $i (1 .. 10) {
+    my $key = "key$i";
+    $pkt .= pack("CCnCCnNNNN", 0x80, 0x0d, length($key), 0, 0, 0,
+                 length($key), $i, 0, 0) . $key;
+}
+$pkt .= pack("CCnCCnNNNN", 0x80, 0x0a, 0, 0, 0, 0, 0, 0, 0, 0);
+print $bsock $pkt;
+while (1) {
+    my $hdr;
+    read($bsock, $hdr, 24) == 24 or last;
+    my ($op, $bodylen) = (unpack("CCnCCnNN", $hdr))[1, 6];
+    my $body;
+    read($bsock, $body, $bodylen) if $bodylen;
+    last if $op == 0x0a;
+}
+$stats = mem_stats($sock, "latency");
+is($stats->{"latency:binary_multiget:count"}, 10, "quiet gets timed");
+
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "stats reset");
+$stats = mem_stats($sock, "latency");
+ok(!defined $stats->{"latency:text_set:count"}, "reset clears the histograms");
@@ -0,0 +1,68 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o lru_crawler,lru_crawler_sleep=0');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{lru_crawler}, "yes", "lru_crawler is set");
+is($stats->{lru_crawler_sleep}, 0, "lru_crawler_sleep is set");
+
+# Half the items expire; nobody fetches them
+my $count = 1000;
+for my $i (1 .. $count) {
+    my $exp = $i % 2 ? 2 : 0;
+    print $sock "set key$i 0 $exp 1\r\nx\r\n";
+    <$sock>;
+}
+$stats = mem_stats($sock);
+is($stats->{curr_items}, $count, "all items stored");
+
+my $tries = 20;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{curr_items} != $count / 2 && --$tries > 0);
+is($stats->{curr_items}, $count / 2, "crawler freed the expired items");
+is($stats->{crawler_reclaimed}, $count / 2, "crawler_reclaimed counts them");
+cmp_ok($stats->{crawler_passes}, '>=', 1, "crawler made passes");
+is($stats->{expired_unfetched}, $count / 2, "they were never fetched");
+
+my $items = mem_stats($sock, ' items');
+is($items->{"items:1:crawler_reclaimed"}, $count / 2,
+   "per class crawler_reclaimed");
+
+my $hits = 0;
+for my $i (1 .. $count) {
+    print $sock "get key$i\r\n";
+    my $line = <$sock>;
+    if ($line =~ /^VALUE/) {
+        <$sock>;
+        <$sock>;
+        $hits++;
+    }
+}
+is($hits, $count / 2, "live items are kept");
+
+# Evictions get past the item the crawler keeps its place with. The list
+# takes many batches, so the crawler is resting on a place in it.
+my $full = new_memcached('-m 2 -o lru_crawler,lru_crawler_sleep=1000000');
+my $fsock = $full->sock;
+my $value = 'x' x 1000;
+for my $i (1 .. 3000) {
+    print $fsock "set fill$i 0 0 1000\r\n$value\r\n";
+    <$fsock>;
+}
+sleep 2;
+my $stored = 0;
+for my $i (1 .. 3000) {
+    print $fsock "set more$i 0 0 1000\r\n$value\r\n";
+    $stored++ if scalar <$fsock> eq "STORED\r\n";
+}
+is($stored, 3000, "no set ran out of memory");
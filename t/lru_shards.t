@@ -0,0 +1,65 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 8 -o lru_shards=4');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{lru_shards}, 4, "lru_shards is set");
+
+# Fill the largest class until it evicts; the shards are evicted oldest
+# first across the whole class
+my $big = 'x' x (1024 * 1024 - 250);
+my $len = length($big);
+my $stored = 0;
+for (0 .. 29) {
+    print $sock "set item_$_ 0 0 $len\r\n$big\r\n";
+    $stored++ if scalar <$sock> eq "STORED\r\n";
+}
+is($stored, 30, "stored 30 big items");
+
+$stats = mem_stats($sock);
+my $evictions = $stats->{evictions};
+cmp_ok($evictions, '>', 0, "some evictions happened");
+
+my $items = mem_stats($sock, "items");
+my $class = (grep { /^items:\d+:number$/ } keys %$items)[0];
+is($items->{$class} + $evictions, 30, "items are counted across shards");
+
+mem_get_is($sock, "item_0", undef);
+mem_get_is($sock, "item_29", $big);
+
+my $found = 0;
+for (30 - $items->{$class} .. 29) {
+    print $sock "get item_$_\r\n";
+    if (scalar <$sock> =~ /^VALUE/) {
+        $found++;
+        <$sock>;
+        <$sock>;
+    }
+}
+is($found, $items->{$class}, "the newest items are the ones kept");
+
+# Hits are queued and applied after the request; the items stay readable
+my $value = 'y' x 100;
+for (1 .. 200) {
+    print $sock "set small_$_ 0 0 100\r\n$value\r\n";
+    <$sock>;
+}
+my $keys = join(' ', map { "small_$_" } 1 .. 200);
+print $sock "get $keys\r\n";
+my $hits = 0;
+while (my $line = <$sock>) {
+    last if $line eq "END\r\n";
+    $hits++ if $line =~ /^VALUE/;
+}
+is($hits, 200, "multiget of 200 keys across shards");
+
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "flushed");
@@ -0,0 +1,39 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use Cwd;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $mcload = getcwd . "/mcload";
+plan skip_all => "mcload is not built" unless -x $mcload;
+plan tests => 8;
+
+my $server = new_memcached('-m 32 -o slab_reassign');
+my $port = $server->port;
+my $udpport = $server->udpport;
+
+sub mcload {
+    my $out = `$mcload -d 1 -t 2 -n 500 -l @_ 2>&1`;
+    my %total;
+    @total{qw(ops p50 p99 p999 hits errors)} = ($1, $2, $3, $4, $5, $6)
+        if $out =~ /^total\s+(\S+)\s+(\S+)\s+(\S+)\s+(\S+)\s+(\S+)\s+(\S+)$/m;
+    return ($out, \%total);
+}
+
+for my $proto ('text', 'binary') {
+    my ($out, $total) = mcload("-p $port -P $proto -w 4 -v 10-2000");
+    cmp_ok($total->{ops} // 0, '>', 0, "$proto: operations were run");
+    is($total->{errors}, 0, "$proto: without errors");
+    is($total->{hits}, '100.00', "$proto: every preloaded key hits");
+}
+
+my ($out, $total) = mcload("-p $port -U $udpport -P udp -v exp:200");
+is($total->{errors}, 0, "udp: without errors") or diag $out;
+
+# Open loop at a fixed rate, with a resize along the way
+($out, $total) = mcload("-p $port -r 2000 -e '0.5:m 16'");
+like($out, qr/^# +\S+  m 16 -> OK/m, "scheduled command was sent");
@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 64');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{limit_total_memory}, 'no', "limit_total_memory is off by default");
+
+$stats = mem_stats($sock, 'memory');
+cmp_ok($stats->{'memory:connections'}, '>', 0, "connections are accounted");
+cmp_ok($stats->{'memory:threads'}, '>', 0, "threads are accounted");
+is($stats->{'memory:mrc'}, 0, "no sampler without mrc_samples");
+is($stats->{'memory:limit'}, 64 * 1024 * 1024, "limit is reported");
+
+my $sum = 0;
+$sum += $stats->{"memory:$_"}
+    for qw(slab_pages slab_lists hash_table connections suffix_caches
+           threads mrc);
+is($stats->{'memory:total'}, $sum, "total is the sum of the categories");
+
+# Each open connection adds to the count, once a worker has picked it up
+my $before = $stats->{'memory:connections'};
+my @socks = map { $server->new_sock } 1 .. 10;
+for my $s (@socks) {
+    print $s "version\r\n";
+    <$s>;
+}
+$stats = mem_stats($sock, 'memory');
+cmp_ok($stats->{'memory:connections'}, '>', $before,
+       "new connections are accounted");
+# Idle ones gave their buffers back to the pools, which the first ones
+# filled
+$before = $stats->{'memory:connections'};
+my @idle = map { $server->new_sock } 1 .. 50;
+for my $s (@idle) {
+    print $s "version\r\n";
+    <$s>;
+}
+$stats = mem_stats($sock, 'memory');
+cmp_ok(($stats->{'memory:connections'} - $before) / @idle, '<', 2048,
+       "idle connections hold no buffers");
+
+# A large multiget grows the connection's buffers
+my $value = 'x' x 100;
+for (1 .. 500) {
+    print $sock "set key$_ 0 0 100\r\n$value\r\n";
+    <$sock>;
+}
+$before = mem_stats($sock, 'memory')->{'memory:connections'};
+print $sock "get " . join(' ', map { "key$_" } 1 .. 500) . "\r\n";
+while (<$sock>) {
+    last if /^END/;
+}
+$stats = mem_stats($sock, 'memory');
+cmp_ok($stats->{'memory:connections'}, '>', $before,
+       "grown buffers are accounted");
+
+$server = new_memcached('-m 64 -o limit_total_memory');
+$sock = $server->sock;
+$stats = mem_stats($sock, ' settings');
+is($stats->{limit_total_memory}, 'yes', "limit_total_memory is set");
+$stats = mem_stats($sock, 'memory');
+is($stats->{'memory:limit_usage'}, $stats->{'memory:total'},
+   "all accounted memory counts against the limit");
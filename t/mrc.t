@@ -0,0 +1,50 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $stats = mem_stats($sock, "mrc");
+is(scalar keys %$stats, 0, "no curve when sampling is off");
+
+$server = new_memcached('-o mrc_samples=1000');
+$sock = $server->sock;
+$stats = mem_stats($sock, " settings");
+is($stats->{mrc_samples}, 1000, "mrc_samples is set");
+
+# Fewer keys than samples: every key is tracked
+my $value = 'x' x 1000;
+for (1 .. 200) {
+    print $sock "set key$_ 0 0 1000\r\n$value\r\n";
+    <$sock>;
+}
+my $found = 0;
+for (1 .. 200) {
+    print $sock "get key$_\r\n";
+    $found++ if scalar <$sock> =~ /^VALUE/;
+    <$sock>; <$sock>;
+}
+is($found, 200, "read back 200 keys");
+
+$stats = mem_stats($sock, "mrc");
+is($stats->{"mrc:sample_rate"}, "1.000000", "all keys sampled");
+is($stats->{"mrc:samples"}, 200, "200 keys tracked");
+is($stats->{"mrc:all:references"}, 200, "200 lookups seen");
+# 200 keys of 1KB are re-read after less than 1MB of other keys
+is($stats->{"mrc:all:1"}, "1.0000", "all lookups hit in 1MB");
+
+# More keys than samples: the rate drops to keep the number tracked fixed
+$server = new_memcached('-o mrc_samples=100');
+$sock = $server->sock;
+for (1 .. 2000) {
+    print $sock "set key$_ 0 0 1000\r\n$value\r\n";
+    <$sock>;
+}
+$stats = mem_stats($sock, "mrc");
+cmp_ok($stats->{"mrc:sample_rate"}, '<', 1, "sample rate dropped");
+cmp_ok($stats->{"mrc:samples"}, '<=', 100, "no more than 100 keys tracked");
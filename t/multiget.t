@@ -0,0 +1,79 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 8;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# Every other key exists, so hits and misses share each batch
+for (my $i = 1; $i <= 300; $i += 2) {
+    print $sock "set key$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+    <$sock>;
+}
+
+sub multiget {
+    my ($cmd, @keys) = @_;
+    print $sock "$cmd " . join(' ', @keys) . "\r\n";
+    my @got;
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        return "error: $line" unless $line =~ /^VALUE (\S+) 0 (\d+)/;
+        my $key = $1;
+        my $value = <$sock>;
+        push @got, $key if $value eq "val" . substr($key, 3) . "\r\n";
+    }
+    return join(' ', @got);
+}
+
+my @keys = map { "key$_" } 1 .. 300;
+my @hits = map { "key$_" } grep { $_ % 2 } 1 .. 300;
+is(multiget('get', @keys), join(' ', @hits), "300 key get answered in order");
+is(multiget('gets', @keys), join(' ', @hits), "300 key gets answered in order");
+is(multiget('get', reverse @keys), join(' ', reverse @hits),
+   "reversed multiget");
+
+my $stats = mem_stats($sock);
+is($stats->{get_hits}, 3 * 150, "hits counted");
+is($stats->{get_misses}, 3 * 150, "misses counted");
+
+# A bad key in a later batch fails the command
+my $long = 'a' x 251;
+print $sock "get " . join(' ', @keys[0 .. 99], $long) . "\r\n";
+my $line = <$sock>;
+$line = <$sock> while $line =~ /^VALUE|^val/;
+is($line, "CLIENT_ERROR bad command line format\r\n", "long key is refused");
+
+# A run of binary quiet gets ended by a noop
+my $bsock = $server->new_sock;
+my $pkt = '';
+for my $i (1 .. 100) {
+    my $key = "key$i";
+    # magic, opcode GETKQ, keylen, extlen, datatype, vbucket, bodylen,
+    # opaque, cas
+    $pkt .= pack("CCnCCnNNNN", 0x80, 0x0d, length($key), 0, 0, 0,
+                 length($key), $i, 0, 0) . $key;
+}
+$pkt .= pack("CCnCCnNNNN", 0x80, 0x0a, 0, 0, 0, 0, 0, 0, 0, 0);
+print $bsock $pkt;
+
+my @found;
+while (1) {
+    my $hdr = '';
+    read($bsock, $hdr, 24) == 24 or last;
+    my ($magic, $op, $keylen, $extlen, undef, $status, $bodylen, $opaque) =
+        unpack("CCnCCnNN", $hdr);
+    my $body = '';
+    read($bsock, $body, $bodylen) if $bodylen;
+    last if $op == 0x0a;
+    my $key = substr($body, $extlen, $keylen);
+    my $value = substr($body, $extlen + $keylen);
+    push @found, $opaque if $key eq "key$opaque" && $value eq "val$opaque";
+}
+is(scalar @found, 50, "binary quiet gets found every stored key");
+is(join(',', @found), join(',', grep { $_ % 2 } 1 .. 100),
+   "binary responses in order");
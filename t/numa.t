@@ -0,0 +1,58 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = eval { new_memcached('-m 64 -o numa,slab_reassign,slab_automove=2') };
+if (!defined $server) {
+    plan skip_all => "NUMA mode is not available here";
+}
+plan tests => 10;
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{numa}, "yes", "numa is set");
+
+my $value = 'x' x 1000;
+for my $i (1 .. 20000) {
+    print $sock "set key$i 0 0 1000\r\n$value\r\n";
+    <$sock>;
+}
+
+$stats = mem_stats($sock, ' slabs');
+my $nodes = $stats->{numa_nodes};
+cmp_ok($nodes, '>=', 1, "pages are spread over nodes");
+my $sum = 0;
+$sum += $stats->{"numa:$_:malloced"} for 0 .. $nodes - 1;
+is($sum, $stats->{total_malloced}, "every page is on a node");
+is($stats->{numa_remote_chunks}, 0, "items were stored on local pages");
+is($stats->{numa_remote_pages}, 0, "and every page came from the worker's node");
+
+# Shrunk pages go back to their node's pool, and expansion takes them
+print $sock "m 20\r\n";
+like(scalar <$sock>, qr/^OK/, "lowered the limit");
+my $tries = 20;
+do {
+    sleep 1;
+    $stats = mem_stats($sock, ' slabs');
+} while ($stats->{total_malloced} > 20 * 1024 * 1024 && --$tries > 0);
+cmp_ok($stats->{total_malloced}, '<=', 20 * 1024 * 1024, "shrunk");
+my $free = 0;
+$free += $stats->{"numa:$_:free_pages"} for 0 .. $nodes - 1;
+cmp_ok($free, '>', 0, "pages are kept in the node pools");
+
+print $sock "m 64\r\n";
+<$sock>;
+for my $i (1 .. 20000) {
+    print $sock "set again$i 0 0 1000\r\n$value\r\n";
+    <$sock>;
+}
+$stats = mem_stats($sock, ' slabs');
+$free = 0;
+$free += $stats->{"numa:$_:free_pages"} for 0 .. $nodes - 1;
+is($free, 0, "expansion reused them");
+mem_get_is($sock, "again20000", $value);
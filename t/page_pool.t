@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    my $server = new_memcached('-o page_pool=4');
+};
+ok($@, "page_pool needs slab_reassign");
+
+my $server = new_memcached('-o slab_reassign,page_pool=4 -m 16');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{page_pool}, 4, "page_pool is set");
+
+sub wait_pool {
+    my $want = shift;
+    my $tries = 20;
+    my $s;
+    do {
+        select undef, undef, undef, 0.1 if $tries != 20;
+        $s = mem_stats($sock, ' slabs');
+    } while ($s->{page_pool_pages} != $want && --$tries > 0);
+    return $s;
+}
+
+$stats = wait_pool(4);
+is($stats->{page_pool_pages}, 4, "pool filled at start up");
+
+# Fill class 31 (12 items per page) up to the limit; the pool hands out
+# its pages and is refilled while there is room
+my $bigdata = 'x' x 70000;
+for (1 .. 250) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+$stats = wait_pool(0);
+is($stats->{page_pool_pages}, 0, "nothing pooled without room");
+cmp_ok($stats->{total_malloced}, '<=', 16 * 1024 * 1024,
+       "pool kept under the limit");
+mem_get_is($sock, "bfoo250", $bigdata, "new pages hold items");
+
+print $sock "m 32\r\n";
+is(scalar <$sock>, "OK\r\n", "raised the memory limit");
+$stats = wait_pool(4);
+is($stats->{page_pool_pages}, 4, "pool refilled after the expansion");
+
+# Items still fit, the pool doesn't
+print $sock "m 18\r\n";
+<$sock>;
+$stats = mem_stats($sock, ' slabs');
+cmp_ok($stats->{page_pool_pages}, '<', 4, "shrink gave pooled pages back first");
+$stats = mem_stats($sock);
+is($stats->{slabs_shrunk} // 0, 0, "no slab was killed for it");
@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = eval { new_memcached('-L -m 128 -o slab_reassign') };
+if (!$server) {
+    plan skip_all => 'large pages (-L) are not supported on this system';
+    exit 0;
+}
+plan tests => 9;
+
+my $sock = $server->sock;
+
+# Fill class 31 (12 items per page) well past the smaller limit. -L holds
+# one page for every class, so the limit can't go much below 42 MB.
+my $bigdata = 'x' x 70000;
+for (1 .. 1500) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key") if $_ == 1;
+}
+
+my $slabs = mem_stats($sock, "slabs");
+is($slabs->{prealloc_free_pages}, 0, "no free pages before the shrink");
+
+# Growing past the preallocated chunk is refused
+print $sock "m 256\r\n";
+like(scalar <$sock>, qr/^ERROR: .*cannot grow beyond/, "can't grow the chunk");
+
+print $sock "m 80\r\n";
+like(scalar <$sock>, qr/^OK: Will need to kill/, "slab shrink was ordered");
+
+my $tries = 60;
+do {
+    sleep 1;
+    $slabs = mem_stats($sock, "slabs");
+} while ($slabs->{total_malloced} > 80 * 1024 * 1024 && --$tries > 0);
+
+cmp_ok($slabs->{total_malloced}, '<=', 80 * 1024 * 1024,
+       "total_malloced is within the new limit");
+cmp_ok($slabs->{prealloc_free_pages}, '>', 0, "shrunk pages are in the pool");
+
+# Expanding again reuses the pooled pages
+print $sock "m 128\r\n";
+is(scalar <$sock>, "OK\r\n", "memory limit raised");
+
+for (1501 .. 3000) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+
+$slabs = mem_stats($sock, "slabs");
+cmp_ok($slabs->{prealloc_free_pages}, '==', 0, "pool was drained");
+cmp_ok($slabs->{total_malloced}, '>', 80 * 1024 * 1024,
+       "memory grew back");
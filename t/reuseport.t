@@ -0,0 +1,55 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+sub talk_on_many {
+    my ($server, $count) = @_;
+    my @socks = map { $server->new_sock } 1 .. $count;
+    my $ok = 0;
+    for my $i (0 .. $#socks) {
+        my $s = $socks[$i] or next;
+        my $len = length($i);
+        print $s "set conn$i 0 0 $len\r\n$i\r\n";
+        next unless scalar <$s> eq "STORED\r\n";
+        print $s "get conn$i\r\n";
+        $ok++ if scalar <$s> eq "VALUE conn$i 0 $len\r\n";
+        <$s>; <$s>;
+    }
+    return ($ok, @socks);
+}
+
+# Every worker accepts on its own socket
+my $server = new_memcached('-t 4 -o reuseport');
+my $sock = $server->sock;
+my $stats = mem_stats($sock, ' settings');
+is($stats->{reuseport}, 'yes', "reuseport is on");
+is($stats->{conn_dispatch}, 'roundrobin', "dispatch defaults to round robin");
+
+my ($ok, @socks) = talk_on_many($server, 40);
+is($ok, 40, "40 connections served");
+$stats = mem_stats($sock);
+cmp_ok($stats->{curr_connections}, '>=', 41, "all connections are open");
+cmp_ok($stats->{total_connections}, '>=', 41, "and were counted");
+@socks = ();
+
+mem_get_is($sock, "conn7", "7");
+
+# The listening thread hands connections to the least loaded worker
+$server = new_memcached('-t 4 -o conn_dispatch=leastconn');
+$sock = $server->sock;
+$stats = mem_stats($sock, ' settings');
+is($stats->{conn_dispatch}, 'leastconn', "leastconn dispatch is set");
+($ok, @socks) = talk_on_many($server, 20);
+is($ok, 20, "20 connections served");
+
+# Closing some leaves gaps that new connections fill
+splice(@socks, 0, 10);
+sleep 1;
+my ($ok2) = talk_on_many($server, 10);
+is($ok2, 10, "connections accepted after others closed");
+mem_get_is($sock, "conn3", "3");
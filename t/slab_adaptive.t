@@ -0,0 +1,64 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    my $server = new_memcached('-o slab_adaptive=1');
+};
+ok($@, "slab_adaptive needs slab_reassign");
+
+# With -f 2 these values land in 6144 byte chunks, a sixth of them slack
+my $server = new_memcached('-m 64 -f 2 -o slab_reassign,slab_adaptive=1');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{slab_adaptive}, 1, "slab_adaptive is set");
+
+my $count = 2000;
+my $value = 'x' x 5000;
+for my $i (1 .. $count) {
+    print $sock "set key$i 0 0 5000\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key$i") if $i == $count;
+    <$sock> if $i != $count;
+}
+
+# The fit adds a class for them and drains the old one into it
+my $tries = 30;
+do {
+    sleep 1;
+    $stats = mem_stats($sock, ' slabs');
+} while (($stats->{geometry_changes} == 0 ||
+          $stats->{geometry_retired_pages} != 0) && --$tries > 0);
+cmp_ok($stats->{geometry_changes}, '>=', 1, "geometry changed");
+is($stats->{geometry_retired_pages}, 0, "retired classes are drained");
+
+my ($fit) = grep { /^\d+$/ && $stats->{"$_:chunk_size"} > 5000
+                       && $stats->{"$_:chunk_size"} < 6144 }
+    map { /^(\d+):chunk_size$/ ? $1 : () } keys %$stats;
+ok(defined $fit, "a class fits the values");
+is($stats->{"$fit:used_chunks"}, $count, "items moved over to it");
+ok(!grep({ /:chunk_size$/ && $stats->{$_} == 6144 } keys %$stats),
+   "old class gave its pages away");
+
+my $hits = 0;
+for my $i (1 .. $count) {
+    print $sock "get key$i\r\n";
+    my $line = <$sock>;
+    if ($line =~ /^VALUE/) {
+        <$sock>;
+        <$sock>;
+        $hits++;
+    }
+}
+is($hits, $count, "no item was lost");
+
+# The size histogram is kept, rather than built from the LRUs
+my $sizes = mem_stats($sock, ' sizes');
+my $sized = 0;
+$sized += $sizes->{$_} for grep { $_ > 5000 } keys %$sizes;
+is($sized, $count, "stats sizes counts them");
@@ -0,0 +1,53 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 3');
+my $sock = $server->sock;
+
+# Fill class 31 (12 items per page) until it evicts
+my $bigdata = 'x' x 70000;
+for (1 .. 60) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+
+my $items = mem_stats($sock, "items");
+cmp_ok($items->{"items:31:evicted"}, '>', 0, "class 31 evicted");
+is($items->{"items:31:ghost_hits"}, 0, "no ghost hits yet");
+
+# Misses on keys that were never stored are not ghost hits
+mem_get_is($sock, "nothere", undef);
+$items = mem_stats($sock, "items");
+is($items->{"items:31:ghost_hits"}, 0, "unknown key is not a ghost hit");
+
+# Evictions in a busy class don't push out the ghosts of class 31
+for my $i (1 .. 150000) {
+    print $sock "set small$i 0 0 1 noreply\r\nx\r\n";
+}
+mem_get_is($sock, "small150000", "x");
+$items = mem_stats($sock, "items");
+cmp_ok($items->{"items:1:evicted"}, '>', 100000, "class 1 evicted a lot");
+
+# The oldest keys were evicted; asking for them again hits the ghost list
+my $missed = 0;
+for (1 .. 5) {
+    print $sock "get bfoo$_\r\n";
+    $missed++ if scalar <$sock> eq "END\r\n";
+}
+cmp_ok($missed, '>', 0, "oldest keys were evicted");
+$items = mem_stats($sock, "items");
+is($items->{"items:31:ghost_hits"}, $missed, "evicted keys are ghost hits");
+
+# A ghost is only counted once
+for (1 .. 5) {
+    print $sock "get bfoo$_\r\n";
+    <$sock>;
+}
+$items = mem_stats($sock, "items");
+is($items->{"items:31:ghost_hits"}, $missed, "ghost hits are counted once");
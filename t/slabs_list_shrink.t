@@ -0,0 +1,37 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o slab_reassign,slab_automove=2 -m 64');
+my $sock = $server->sock;
+
+# Fill class 31 (12 items per page) so its slab list grows past 16 entries
+my $bigdata = 'x' x 70000;
+for (1 .. 700) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+my $slabs = mem_stats($sock, 'slabs');
+cmp_ok($slabs->{'31:total_pages'}, '>', 32, "class 31 holds many pages");
+my $grown = mem_stats($sock, 'memory')->{'memory:slab_lists'};
+
+print $sock "m 12\r\n";
+like(scalar <$sock>, qr/^OK/, "slab shrink was ordered");
+
+my $stats;
+my $tries = 60;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{shrink_bytes_remaining} > 0 && --$tries > 0);
+is($stats->{shrink_bytes_remaining}, 0, "shrink finished");
+
+$slabs = mem_stats($sock, 'slabs');
+cmp_ok($slabs->{'31:total_pages'}, '<=', 16, "class 31 gave its pages back");
+cmp_ok(mem_stats($sock, 'memory')->{'memory:slab_lists'}, '<', $grown,
+       "slab lists shrank with the pages");
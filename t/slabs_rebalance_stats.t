@@ -0,0 +1,51 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o slab_reassign,slab_automove=2 -m 16');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' rebalance');
+is($stats->{'rebalance:pages'}, 0, "no page killed yet");
+ok(!defined $stats->{'rebalance:0:total_us'}, "history is empty");
+
+# Fill class 31 (12 items per page) up to the limit
+my $bigdata = 'x' x 70000;
+for (1 .. 250) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+
+print $sock "m 8\r\n";
+like(scalar <$sock>, qr/^OK: Will need to kill/, "slab shrink was ordered");
+
+my $tries = 60;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{shrink_bytes_remaining} > 0 && --$tries > 0);
+is($stats->{shrink_bytes_remaining}, 0, "shrink finished");
+my $shrunk = $stats->{slabs_shrunk};
+
+$stats = mem_stats($sock, ' rebalance');
+is($stats->{'rebalance:pages'}, $shrunk, "every killed page was traced");
+is($stats->{'rebalance:0:source'}, 31, "pages came from class 31");
+is($stats->{'rebalance:0:dest'}, 0, "pages were freed");
+cmp_ok($stats->{'rebalance:0:move_passes'}, '>', 0, "page was walked");
+cmp_ok($stats->{'rebalance:0:total_us'}, '>=',
+       $stats->{'rebalance:0:lock_hold_max_us'}, "lock hold fits the kill");
+
+my $kept = grep { /^rebalance:\d+:total_us$/ } keys %$stats;
+is($kept, $shrunk < 16 ? $shrunk : 16, "recent kills are kept");
+my $evicted = 0;
+for (0 .. $kept - 1) {
+    $evicted += $stats->{"rebalance:$_:evicted"}
+        + $stats->{"rebalance:$_:rescued"};
+}
+cmp_ok($stats->{'rebalance:total:evicted'} + $stats->{'rebalance:total:rescued'},
+       '>=', $evicted, "totals cover the history");
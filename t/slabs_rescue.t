@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o slab_reassign,slab_rescue -m 64');
+my $stats = mem_stats($server->sock, ' settings');
+is($stats->{slab_rescue}, "yes", "slab rescue is enabled");
+
+my $sock = $server->sock;
+
+# Fill two pages of slab 31
+my $bigdata = 'x' x 70000;
+for (1 .. 24) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+my $slabs_before = mem_stats($sock, "slabs");
+is($slabs_before->{"31:total_pages"}, 2, "slab 31 uses two pages");
+
+# Free up the second page, so the first page's items have somewhere to go
+for (13 .. 24) {
+    print $sock "delete bfoo$_\r\n";
+    <$sock>;
+}
+
+print $sock "slabs reassign 31 -1\r\n";
+is(scalar <$sock>, "OK\r\n", "slab shrink started");
+
+my $tries = 10;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{slabs_shrunk} == 0 && --$tries > 0);
+
+is($stats->{slabs_shrunk}, 1, "one page was freed");
+is($stats->{slab_items_rescued}, 12, "all live items were rescued");
+is($stats->{slab_items_evicted}, 0, "nothing was evicted");
+
+my $slabs_after = mem_stats($sock, "slabs");
+is($slabs_after->{"31:total_pages"}, 1, "slab 31 lost a page");
+
+my $found = 0;
+for (1 .. 12) {
+    print $sock "get bfoo$_\r\n";
+    my $line = <$sock>;
+    if ($line =~ /^VALUE/) {
+        $found++;
+        <$sock>;
+        <$sock>;
+    }
+}
+is($found, 12, "rescued items can still be fetched");
+
+# A page moved out of a full class doesn't come back to it as a new one
+$server = new_memcached('-o slab_reassign,slab_rescue -m 64');
+$sock = $server->sock;
+for (1 .. 24) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+print $sock "set small 0 0 1\r\nx\r\n";
+<$sock>;
+print $sock "slabs reassign 31 1\r\n";
+is(scalar <$sock>, "OK\r\n", "slab move started");
+$tries = 10;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{slabs_moved} == 0 && --$tries > 0);
+is($stats->{slabs_moved}, 1, "one page was moved");
+$slabs_after = mem_stats($sock, "slabs");
+is($slabs_after->{"31:total_pages"}, 1, "slab 31 is down a page");
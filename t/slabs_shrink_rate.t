@@ -0,0 +1,46 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 8;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o slab_reassign,slab_automove=2,shrink_rate=1 -m 16');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{shrink_rate}, 1, "shrink_rate is set");
+
+$stats = mem_stats($sock);
+is($stats->{shrink_bytes_remaining}, 0, "nothing to shrink yet");
+
+# Fill class 31 (12 items per page) up to the limit
+my $bigdata = 'x' x 70000;
+for (1 .. 250) {
+    print $sock "set bfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    <$sock>;
+}
+
+print $sock "m 8\r\n";
+like(scalar <$sock>, qr/^OK: Will need to kill/, "slab shrink was ordered");
+
+# At 1 MB/s, freeing about 8 pages takes several seconds
+my $start = time;
+my $tries = 5;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{shrink_rate} == 0 && --$tries > 0);
+is($stats->{shrink_rate}, 1024 * 1024, "shrink is paced at 1 MB/s");
+cmp_ok($stats->{shrink_bytes_remaining}, '>', 0, "bytes remain to be freed");
+cmp_ok($stats->{shrink_eta_seconds}, '>', 0, "an ETA is given");
+
+$tries = 60;
+do {
+    sleep 1;
+    $stats = mem_stats($sock);
+} while ($stats->{shrink_bytes_remaining} > 0 && --$tries > 0);
+is($stats->{shrink_bytes_remaining}, 0, "shrink finished");
+cmp_ok(time - $start, '>=', 4, "shrink was not done back to back");
@@ -0,0 +1,75 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Without recvmmsg/sendmmsg the server refuses to start with udp_batch
+my $server = eval { new_memcached('-o udp_batch=16') };
+if (!defined $server) {
+    plan skip_all => "recvmmsg/sendmmsg are not available";
+}
+plan tests => 6;
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{udp_batch}, 16, "udp_batch is set");
+
+print $sock "set foo 0 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+my $big = "abcd" x 1024;
+print $sock "set big 0 0 4096\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big");
+
+my $usock = $server->new_udp_sock;
+
+# Read every datagram that comes back, keyed by request id and sequence
+sub read_responses {
+    my ($want) = @_;
+    my %res;
+    my $got = 0;
+    while ($got < $want) {
+        my $rin = '';
+        vec($rin, fileno($usock), 1) = 1;
+        last unless select(my $rout = $rin, undef, undef, 2);
+        my $pkt;
+        $usock->recv($pkt, 1500, 0);
+        my ($id, $seq, $num) = unpack("nnnn", substr($pkt, 0, 8));
+        $res{$id}{num} = $num;
+        $res{$id}{$seq} = substr($pkt, 8);
+        $got++;
+    }
+    return \%res;
+}
+
+# A burst of requests lands in a single receive batch
+my $n = 32;
+for my $id (1 .. $n) {
+    send($usock, pack("nnnn", $id, 0, 1, 0) . "get foo\r\n", 0);
+}
+my $res = read_responses($n);
+my $ok = 0;
+for my $id (1 .. $n) {
+    $ok++ if $res->{$id} && $res->{$id}{num} == 1
+        && $res->{$id}{0} eq "VALUE foo 0 3\r\nbar\r\nEND\r\n";
+}
+is($ok, $n, "every request in the burst was answered");
+
+# Responses that span several datagrams go out in one send batch
+for my $id (100 .. 103) {
+    send($usock, pack("nnnn", $id, 0, 1, 0) . "get big\r\n", 0);
+}
+$res = read_responses(4 * 4);
+$ok = 0;
+for my $id (100 .. 103) {
+    my $r = $res->{$id} or next;
+    my $body = join '', map { $r->{$_} // '' } 0 .. $r->{num} - 1;
+    $ok++ if $body eq "VALUE big 0 4096\r\n$big\r\nEND\r\n";
+}
+is($ok, 4, "multi-datagram responses were reassembled");
+
+print $sock "get foo\r\n";
+is(scalar <$sock>, "VALUE foo 0 3\r\n", "server still answers over TCP");
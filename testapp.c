@@ -114,6 +114,48 @@ static enum test_return cache_reuse_test(void)
     return TEST_PASS;
 }
 
+static enum test_return cache_memory_test(void)
+{
+    cache_t *cache = cache_create("test", sizeof(uint32_t), sizeof(char*),
+                                  NULL, NULL);
+    size_t empty = cache_memory(cache);
+    char *ptr = cache_alloc(cache);
+    size_t held = cache_memory(cache);
+    assert(held > empty);
+    cache_free(cache, ptr);
+    /* freed objects stay in the cache for reuse */
+    assert(cache_memory(cache) == held);
+    ptr = cache_alloc(cache);
+    assert(cache_memory(cache) == held);
+    cache_free(cache, ptr);
+    cache_destroy(cache);
+    return TEST_PASS;
+}
+
+static int64_t cache_accounted;
+
+static void cache_account(int64_t delta)
+{
+    cache_accounted += delta;
+}
+
+static enum test_return cache_account_test(void)
+{
+    cache_t *cache = cache_create("test", sizeof(uint32_t), sizeof(char*),
+                                  NULL, NULL);
+    char *ptr;
+    cache_accounted = 0;
+    cache_set_account(cache, cache_account);
+    assert(cache_accounted == (int64_t)cache_memory(cache));
+    ptr = cache_alloc(cache);
+    assert(cache_accounted == (int64_t)cache_memory(cache));
+    cache_free(cache, ptr);
+    assert(cache_accounted == (int64_t)cache_memory(cache));
+    cache_destroy(cache);
+    assert(cache_accounted == 0);
+    return TEST_PASS;
+}
+
 
 static enum test_return cache_bulkalloc(size_t datasize)
 {
@@ -1863,6 +1905,8 @@ struct testcase testcases[] = {
     { "cache_constructor_fail", cache_fail_constructor_test },
     { "cache_destructor", cache_destructor_test },
     { "cache_reuse", cache_reuse_test },
+    { "cache_memory", cache_memory_test },
+    { "cache_account", cache_account_test },
     { "cache_redzone", cache_redzone_test },
     { "issue_161", test_issue_161 },
     { "strtol", test_safe_strtol },
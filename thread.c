@@ -59,9 +59,26 @@ static pthread_mutex_t *item_locks;
 static uint32_t item_lock_count;
 /* size - 1 for lookup masking */
 static uint32_t item_lock_mask;
+/* log2 of item_lock_count; the hash table never shrinks below this */
+unsigned int item_lock_hashpower;
+
+/* Taken (on top of the fine-grained lock) by workers in ITEM_LOCK_GLOBAL
+ * mode, so the hash table can be migrated without cache_lock on the read
+ * path. */
+static pthread_mutex_t item_global_lock;
+static pthread_key_t item_lock_type_key;
+
+/* The worker's own LIBEVENT_THREAD, for its queued LRU bumps and listeners */
+static pthread_key_t worker_thread_key;
 
 static LIBEVENT_DISPATCHER_THREAD dispatcher_thread;
 
+/* Each worker's stats as of the last "stats reset". Aggregation subtracts
+ * them, so resetting doesn't write to the workers' own counters. */
+static struct thread_stats *stats_base;
+static pthread_mutex_t stats_base_lock = PTHREAD_MUTEX_INITIALIZER;
+#define THREAD_STATS_WORDS (sizeof(struct thread_stats) / sizeof(uint64_t))
+
 /*
  * Each libevent instance has a wakeup pipe, which other threads
  * can use to signal that they've put a new connection on its queue.
@@ -108,12 +125,159 @@ unsigned short refcount_decr(unsigned short *refcount) {
 #endif
 }
 
+/* Orders the caller's earlier stores before its later ones, for data that
+ * is published to lockless readers */
+void memory_barrier(void) {
+#ifdef HAVE_GCC_ATOMICS
+    __sync_synchronize();
+#elif defined(__sun)
+    membar_producer();
+#else
+    mutex_lock(&atomics_mutex);
+    mutex_unlock(&atomics_mutex);
+#endif
+}
+
+/* Counts a worker's open client connections, including ones dispatched to
+ * it but not yet picked up */
+static void thread_conns_add(LIBEVENT_THREAD *t, const int delta) {
+#ifdef HAVE_GCC_ATOMICS
+    __sync_add_and_fetch(&t->open_conns, delta);
+#elif defined(__sun)
+    atomic_add_int((uint_t *)&t->open_conns, delta);
+#else
+    mutex_lock(&atomics_mutex);
+    t->open_conns += delta;
+    mutex_unlock(&atomics_mutex);
+#endif
+}
+
+void thread_conn_closed(LIBEVENT_THREAD *t) {
+    thread_conns_add(t, -1);
+}
+
+/* Bytes held outside the slab pages and the hash table, per category */
+static uint64_t memory_counters[MEMORY_CATEGORIES];
+
+void memory_account(enum memory_category category, const int64_t delta) {
+#ifdef HAVE_GCC_ATOMICS
+    __sync_add_and_fetch(&memory_counters[category], (uint64_t)delta);
+#elif defined(__sun)
+    atomic_add_64(&memory_counters[category], delta);
+#else
+    mutex_lock(&atomics_mutex);
+    memory_counters[category] += delta;
+    mutex_unlock(&atomics_mutex);
+#endif
+}
+
+/* Keeps MEMORY_SUFFIX up to date as the suffix caches grow, so reading it
+ * doesn't have to lock every worker's cache */
+static void suffix_cache_account(int64_t delta) {
+    memory_account(MEMORY_SUFFIX, delta);
+}
+
+/* Counts what the connection buffer pools hold, free or handed out, as
+ * they grow and shrink */
+static void conn_buffers_account(int64_t delta) {
+    memory_account(MEMORY_CONNECTIONS, delta);
+}
+
+uint64_t memory_accounted(enum memory_category category) {
+    uint64_t res;
+#ifdef HAVE_GCC_ATOMICS
+    res = __sync_add_and_fetch(&memory_counters[category], 0);
+#else
+    mutex_lock(&atomics_mutex);
+    res = memory_counters[category];
+    mutex_unlock(&atomics_mutex);
+#endif
+    return res;
+}
+
+uint64_t memory_accounted_total(void) {
+    uint64_t total = 0;
+    int ii;
+    for (ii = 0; ii < MEMORY_CATEGORIES; ++ii)
+        total += memory_accounted(ii);
+    return total;
+}
+
+/* Threads other than the workers (no key set) always use the fine-grained
+ * locks; they never look up items without cache_lock. */
+static inline bool item_lock_is_global(void) {
+    enum item_lock_types *lock_type = pthread_getspecific(item_lock_type_key);
+    return lock_type != NULL && *lock_type == ITEM_LOCK_GLOBAL;
+}
+
 void item_lock(uint32_t hv) {
+    if (item_lock_is_global())
+        mutex_lock(&item_global_lock);
     mutex_lock(&item_locks[hv & item_lock_mask]);
 }
 
 void item_unlock(uint32_t hv) {
     mutex_unlock(&item_locks[hv & item_lock_mask]);
+    if (item_lock_is_global())
+        mutex_unlock(&item_global_lock);
+}
+
+/* Used by paths which walk items they don't own (LRU tail, slab pages) while
+ * holding cache_lock; never blocks, so the lock order is preserved.
+ * Returns the held lock, or NULL if the item is busy. */
+void *item_trylock(uint32_t hv) {
+    pthread_mutex_t *lock = &item_locks[hv & item_lock_mask];
+    if (pthread_mutex_trylock(lock) == 0) {
+        return lock;
+    }
+    return NULL;
+}
+
+void item_trylock_unlock(void *lock) {
+    mutex_unlock((pthread_mutex_t *) lock);
+}
+
+void item_lock_global(void) {
+    mutex_lock(&item_global_lock);
+}
+
+void item_unlock_global(void) {
+    mutex_unlock(&item_global_lock);
+}
+
+/*
+ * Tells every worker to use the given item lock type, and waits until all of
+ * them have switched. The switch is only processed between commands, so a
+ * worker never unlocks a different lock than the one it took.
+ */
+void switch_item_lock_type(enum item_lock_types type) {
+    char buf[1];
+    int i;
+
+    switch (type) {
+    case ITEM_LOCK_GRANULAR:
+        buf[0] = 'l';
+        break;
+    case ITEM_LOCK_GLOBAL:
+        buf[0] = 'g';
+        break;
+    default:
+        fprintf(stderr, "Unknown lock type: %d\n", type);
+        assert(1 == 0);
+        return;
+    }
+
+    pthread_mutex_lock(&init_lock);
+    init_count = 0;
+    for (i = 0; i < settings.num_threads; i++) {
+        if (write(threads[i].notify_send_fd, buf, 1) != 1) {
+            perror("Failed writing to notify pipe");
+        }
+    }
+    while (init_count < settings.num_threads) {
+        pthread_cond_wait(&init_cond, &init_lock);
+    }
+    pthread_mutex_unlock(&init_lock);
 }
 
 /*
@@ -181,6 +345,7 @@ static CQ_ITEM *cqi_new(void) {
         item = malloc(sizeof(CQ_ITEM) * ITEMS_PER_ALLOC);
         if (NULL == item)
             return NULL;
+        memory_account(MEMORY_THREADS, sizeof(CQ_ITEM) * ITEMS_PER_ALLOC);
 
         /*
          * Link together all the new items except the first one
@@ -242,6 +407,8 @@ void accept_new_conns(const bool do_accept) {
  * Set up a thread's information.
  */
 static void setup_thread(LIBEVENT_THREAD *me) {
+    int i;
+
     me->base = event_init();
     if (! me->base) {
         fprintf(stderr, "Can't allocate event base\n");
@@ -263,19 +430,82 @@ static void setup_thread(LIBEVENT_THREAD *me) {
         perror("Failed to allocate memory for connection queue");
         exit(EXIT_FAILURE);
     }
+    memory_account(MEMORY_THREADS, sizeof(struct conn_queue));
     cq_init(me->new_conn_queue);
 
-    if (pthread_mutex_init(&me->stats.mutex, NULL) != 0) {
-        perror("Failed to initialize mutex");
-        exit(EXIT_FAILURE);
-    }
-
     me->suffix_cache = cache_create("suffix", SUFFIX_SIZE, sizeof(char*),
                                     NULL, NULL);
     if (me->suffix_cache == NULL) {
         fprintf(stderr, "Failed to create suffix cache\n");
         exit(EXIT_FAILURE);
     }
+    cache_set_account(me->suffix_cache, suffix_cache_account);
+
+    for (i = 0; i < CONN_BUF_CLASSES; i++) {
+        me->conn_buffers[i] = cache_create("conn_buffer", CONN_BUF_MIN << i,
+                                           sizeof(char *), NULL, NULL);
+        if (me->conn_buffers[i] == NULL) {
+            fprintf(stderr, "Failed to create connection buffer pool\n");
+            exit(EXIT_FAILURE);
+        }
+        cache_set_account(me->conn_buffers[i], conn_buffers_account);
+    }
+}
+
+/*
+ * Connection buffers. A connection only holds them while it has a request
+ * in flight and gives them back when it goes idle, so the pools keep about
+ * as many as there are active connections; the thread that serves the
+ * connection is the only one touching its pools, so their locks are never
+ * contended. A buffer that grows within its class doesn't move.
+ */
+static inline int conn_buf_class(const size_t size) {
+    int i = 0;
+    while (i < CONN_BUF_CLASSES && ((size_t)CONN_BUF_MIN << i) < size)
+        i++;
+    return i;
+}
+
+void *conn_buf_alloc(LIBEVENT_THREAD *t, const size_t size) {
+    int cls = conn_buf_class(size);
+    void *buf;
+
+    if (t != NULL && cls < CONN_BUF_CLASSES)
+        return cache_alloc(t->conn_buffers[cls]);
+    if ((buf = malloc(size)) != NULL)
+        memory_account(MEMORY_CONNECTIONS, size);
+    return buf;
+}
+
+void conn_buf_free(LIBEVENT_THREAD *t, void *buf, const size_t size) {
+    int cls = conn_buf_class(size);
+
+    if (t != NULL && cls < CONN_BUF_CLASSES) {
+        cache_free(t->conn_buffers[cls], buf);
+    } else {
+        free(buf);
+        memory_account(MEMORY_CONNECTIONS, -(int64_t)size);
+    }
+}
+
+void *conn_buf_realloc(LIBEVENT_THREAD *t, void *buf, const size_t size,
+                       const size_t new_size) {
+    int cls = conn_buf_class(size), new_cls = conn_buf_class(new_size);
+    void *new_buf;
+
+    if (t == NULL || (cls == CONN_BUF_CLASSES && new_cls == CONN_BUF_CLASSES)) {
+        if ((new_buf = realloc(buf, new_size)) != NULL)
+            memory_account(MEMORY_CONNECTIONS,
+                           (int64_t)new_size - (int64_t)size);
+        return new_buf;
+    }
+    if (cls == new_cls)
+        return buf;
+    if ((new_buf = conn_buf_alloc(t, new_size)) == NULL)
+        return NULL;
+    memcpy(new_buf, buf, size < new_size ? size : new_size);
+    conn_buf_free(t, buf, size);
+    return new_buf;
 }
 
 
@@ -288,6 +518,13 @@ static void *worker_libevent(void *arg) {
     /* Any per-thread setup can happen here; thread_init() will block until
      * all threads have finished initializing.
      */
+    me->item_lock_type = ITEM_LOCK_GRANULAR;
+    pthread_setspecific(item_lock_type_key, &me->item_lock_type);
+    pthread_setspecific(worker_thread_key, me);
+    /* Before anything of the thread's own is allocated */
+    if (me->numa_node >= 0 && !numa_mode_pin(me->numa_node))
+        me->numa_node = -1;
+    slabs_thread_cache_init(me->numa_node);
 
     pthread_mutex_lock(&init_lock);
     init_count++;
@@ -308,9 +545,24 @@ static void thread_libevent_process(int fd, short which, void *arg) {
     CQ_ITEM *item;
     char buf[1];
 
-    if (read(fd, buf, 1) != 1)
+    if (read(fd, buf, 1) != 1) {
         if (settings.verbose > 0)
             fprintf(stderr, "Can't read from libevent pipe\n");
+        return;
+    }
+
+    switch (buf[0]) {
+    /* we were told to flip the lock type and report in */
+    case 'l':
+    case 'g':
+        me->item_lock_type = buf[0] == 'g' ? ITEM_LOCK_GLOBAL
+                                           : ITEM_LOCK_GRANULAR;
+        pthread_mutex_lock(&init_lock);
+        init_count++;
+        pthread_cond_signal(&init_cond);
+        pthread_mutex_unlock(&init_lock);
+        return;
+    }
 
     item = cq_pop(me->new_conn_queue);
 
@@ -318,8 +570,9 @@ static void thread_libevent_process(int fd, short which, void *arg) {
         conn *c = conn_new(item->sfd, item->init_state, item->event_flags,
                            item->read_buffer_size, item->transport, me->base);
         if (c == NULL) {
-            if (IS_UDP(item->transport)) {
-                fprintf(stderr, "Can't listen for events on UDP socket\n");
+            if (IS_UDP(item->transport) || item->init_state == conn_listening) {
+                fprintf(stderr, "Can't listen for events on %s socket\n",
+                        IS_UDP(item->transport) ? "UDP" : "TCP");
                 exit(1);
             } else {
                 if (settings.verbose > 0) {
@@ -327,9 +580,14 @@ static void thread_libevent_process(int fd, short which, void *arg) {
                         item->sfd);
                 }
                 close(item->sfd);
+                thread_conn_closed(me);
             }
         } else {
             c->thread = me;
+            if (item->init_state == conn_listening) {
+                c->next = me->listen_conns;
+                me->listen_conns = c;
+            }
         }
         cqi_free(item);
     }
@@ -338,19 +596,61 @@ static void thread_libevent_process(int fd, short which, void *arg) {
 /* Which thread we assigned a connection to most recently. */
 static int last_thread = -1;
 
+/* Picks the worker for a new client connection */
+static int dispatch_pick_thread(void) {
+    int tid = (last_thread + 1) % settings.num_threads;
+    int i, best = tid;
+
+    if (settings.dispatch_leastconn) {
+        /* Start after the last pick, so ties still go round robin */
+        for (i = 1; i < settings.num_threads; i++) {
+            int t = (tid + i) % settings.num_threads;
+            if (threads[t].open_conns < threads[best].open_conns)
+                best = t;
+        }
+    }
+    last_thread = best;
+    return best;
+}
+
 /*
- * Dispatches a new connection to another thread. This is only ever called
- * from the main thread, either during initialization (for UDP) or because
- * of an incoming connection.
+ * Dispatches a new connection to another thread. Called from the main
+ * thread, either during initialization (for UDP) or because of an incoming
+ * connection. A worker accepting on its own SO_REUSEPORT socket keeps the
+ * connection.
  */
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
                        int read_buffer_size, enum network_transport transport) {
-    CQ_ITEM *item = cqi_new();
-    int tid = (last_thread + 1) % settings.num_threads;
+    LIBEVENT_THREAD *me = pthread_getspecific(worker_thread_key);
+    conn *c;
+
+    if (me == NULL) {
+        thread_conns_add(threads + dispatch_pick_thread(), 1);
+        dispatch_conn_thread(last_thread, sfd, init_state, event_flags,
+                             read_buffer_size, transport);
+        return;
+    }
 
-    LIBEVENT_THREAD *thread = threads + tid;
+    c = conn_new(sfd, init_state, event_flags, read_buffer_size, transport,
+                 me->base);
+    if (c == NULL) {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Can't listen for events on fd %d\n", sfd);
+        close(sfd);
+        return;
+    }
+    c->thread = me;
+    thread_conns_add(me, 1);
+}
 
-    last_thread = tid;
+/*
+ * Hands a connection to the given worker thread.
+ */
+void dispatch_conn_thread(int tid, int sfd, enum conn_states init_state,
+                          int event_flags, int read_buffer_size,
+                          enum network_transport transport) {
+    CQ_ITEM *item = cqi_new();
+    LIBEVENT_THREAD *thread = threads + tid;
 
     item->sfd = sfd;
     item->init_state = init_state;
@@ -361,7 +661,7 @@ void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
     cq_push(thread->new_conn_queue, item);
 
     MEMCACHED_CONN_DISPATCH(sfd, thread->thread_id);
-    if (write(thread->notify_send_fd, "", 1) != 1) {
+    if (write(thread->notify_send_fd, "c", 1) != 1) {
         perror("Writing to thread notify pipe");
     }
 }
@@ -390,19 +690,26 @@ item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbyt
  * lazy-expiring as needed.
  */
 item *item_get(const char *key, const size_t nkey) {
+    return item_get_hv(key, nkey, hash(key, nkey));
+}
+
+/*
+ * item_get() for a key whose hash the caller already has.
+ */
+item *item_get_hv(const char *key, const size_t nkey, const uint32_t hv) {
     item *it;
-    uint32_t hv;
-    hv = hash(key, nkey, 0);
     item_lock(hv);
     it = do_item_get(key, nkey, hv);
     item_unlock(hv);
+    if (settings.mrc_samples)
+        mrc_reference(hv, it);
     return it;
 }
 
 item *item_touch(const char *key, size_t nkey, uint32_t exptime) {
     item *it;
     uint32_t hv;
-    hv = hash(key, nkey, 0);
+    hv = hash(key, nkey);
     item_lock(hv);
     it = do_item_touch(key, nkey, exptime, hv);
     item_unlock(hv);
@@ -416,7 +723,7 @@ int item_link(item *item) {
     int ret;
     uint32_t hv;
 
-    hv = hash(ITEM_key(item), item->nkey, 0);
+    hv = item->hv;
     item_lock(hv);
     ret = do_item_link(item, hv);
     item_unlock(hv);
@@ -429,7 +736,7 @@ int item_link(item *item) {
  */
 void item_remove(item *item) {
     uint32_t hv;
-    hv = hash(ITEM_key(item), item->nkey, 0);
+    hv = item->hv;
 
     item_lock(hv);
     do_item_remove(item);
@@ -450,7 +757,7 @@ int item_replace(item *old_it, item *new_it, const uint32_t hv) {
  */
 void item_unlink(item *item) {
     uint32_t hv;
-    hv = hash(ITEM_key(item), item->nkey, 0);
+    hv = item->hv;
     item_lock(hv);
     do_item_unlink(item, hv);
     item_unlock(hv);
@@ -460,14 +767,48 @@ void item_unlink(item *item) {
  * Moves an item to the back of the LRU queue.
  */
 void item_update(item *item) {
+    LIBEVENT_THREAD *me;
     uint32_t hv;
-    hv = hash(ITEM_key(item), item->nkey, 0);
+    int i;
+
+    /* With a sharded LRU, workers queue the bump, holding a reference, and
+     * apply them in batches once the buffer fills or the event is done. */
+    if (settings.lru_shards > 1 &&
+        (me = pthread_getspecific(worker_thread_key)) != NULL) {
+        if (item->time >= current_time - ITEM_UPDATE_INTERVAL)
+            return;
+        for (i = 0; i < me->lru_nbumps; i++) {
+            if (me->lru_bumps[i] == item)
+                return;
+        }
+        refcount_incr(&item->refcount);
+        me->lru_bumps[me->lru_nbumps++] = item;
+        if (me->lru_nbumps == LRU_BUMP_BATCH)
+            item_update_flush();
+        return;
+    }
 
+    hv = item->hv;
     item_lock(hv);
     do_item_update(item);
     item_unlock(hv);
 }
 
+/*
+ * Applies the LRU bumps this worker has queued.
+ */
+void item_update_flush(void) {
+    LIBEVENT_THREAD *me = pthread_getspecific(worker_thread_key);
+    int i;
+
+    if (me == NULL || me->lru_nbumps == 0)
+        return;
+    do_item_update_batch(me->lru_bumps, me->lru_nbumps);
+    for (i = 0; i < me->lru_nbumps; i++)
+        item_remove(me->lru_bumps[i]);
+    me->lru_nbumps = 0;
+}
+
 /*
  * Does arithmetic on a numeric item value.
  */
@@ -478,7 +819,7 @@ enum delta_result_type add_delta(conn *c, const char *key,
     enum delta_result_type ret;
     uint32_t hv;
 
-    hv = hash(key, nkey, 0);
+    hv = hash(key, nkey);
     item_lock(hv);
     ret = do_add_delta(c, key, nkey, incr, delta, buf, cas, hv);
     item_unlock(hv);
@@ -492,7 +833,7 @@ enum store_item_type store_item(item *item, int comm, conn* c) {
     enum store_item_type ret;
     uint32_t hv;
 
-    hv = hash(ITEM_key(item), item->nkey, 0);
+    hv = item->hv;
     item_lock(hv);
     ret = do_store_item(item, comm, c, hv);
     item_unlock(hv);
@@ -503,7 +844,7 @@ enum store_item_type store_item(item *item, int comm, conn* c) {
  * Flushes expired items after a flush_all call
  */
 void item_flush_expired() {
-    mutex_lock(&cache_lock);
+    latency_lock(&cache_lock, LATENCY_CACHE_LOCK, mutex_lock);
     do_item_flush_expired();
     mutex_unlock(&cache_lock);
 }
@@ -548,87 +889,56 @@ void STATS_UNLOCK() {
     pthread_mutex_unlock(&stats_lock);
 }
 
+LIBEVENT_THREAD *worker_thread_self(void) {
+    return pthread_getspecific(worker_thread_key);
+}
+
+/* One of a worker's stats counters, read while the worker may update it */
+static inline uint64_t thread_stat_load(uint64_t *word) {
+#if defined(HAVE_GCC_ATOMICS)
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+#elif defined(__sun)
+    return atomic_add_64_nv(word, 0);
+#else
+    uint64_t res;
+    mutex_lock(&atomics_mutex);
+    res = *word;
+    mutex_unlock(&atomics_mutex);
+    return res;
+#endif
+}
+
 void threadlocal_stats_reset(void) {
-    int ii, sid;
+    int ii;
+    size_t w;
+
+    pthread_mutex_lock(&stats_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&threads[ii].stats.mutex);
-
-        threads[ii].stats.get_cmds = 0;
-        threads[ii].stats.get_misses = 0;
-        threads[ii].stats.touch_cmds = 0;
-        threads[ii].stats.touch_misses = 0;
-        threads[ii].stats.delete_misses = 0;
-        threads[ii].stats.incr_misses = 0;
-        threads[ii].stats.decr_misses = 0;
-        threads[ii].stats.cas_misses = 0;
-        threads[ii].stats.bytes_read = 0;
-        threads[ii].stats.bytes_written = 0;
-        threads[ii].stats.flush_cmds = 0;
-        threads[ii].stats.conn_yields = 0;
-        threads[ii].stats.auth_cmds = 0;
-        threads[ii].stats.auth_errors = 0;
-
-        for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
-            threads[ii].stats.slab_stats[sid].set_cmds = 0;
-            threads[ii].stats.slab_stats[sid].get_hits = 0;
-            threads[ii].stats.slab_stats[sid].touch_hits = 0;
-            threads[ii].stats.slab_stats[sid].delete_hits = 0;
-            threads[ii].stats.slab_stats[sid].incr_hits = 0;
-            threads[ii].stats.slab_stats[sid].decr_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_badval = 0;
-        }
+        uint64_t *cur = (uint64_t *)&threads[ii].stats;
+        uint64_t *base = (uint64_t *)&stats_base[ii];
 
-        pthread_mutex_unlock(&threads[ii].stats.mutex);
+        for (w = 0; w < THREAD_STATS_WORDS; w++)
+            base[w] = thread_stat_load(&cur[w]);
     }
+    pthread_mutex_unlock(&stats_base_lock);
 }
 
 void threadlocal_stats_aggregate(struct thread_stats *stats) {
-    int ii, sid;
+    uint64_t *out = (uint64_t *)stats;
+    int ii;
+    size_t w;
 
-    /* The struct has a mutex, but we can safely set the whole thing
-     * to zero since it is unused when aggregating. */
     memset(stats, 0, sizeof(*stats));
 
+    pthread_mutex_lock(&stats_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&threads[ii].stats.mutex);
-
-        stats->get_cmds += threads[ii].stats.get_cmds;
-        stats->get_misses += threads[ii].stats.get_misses;
-        stats->touch_cmds += threads[ii].stats.touch_cmds;
-        stats->touch_misses += threads[ii].stats.touch_misses;
-        stats->delete_misses += threads[ii].stats.delete_misses;
-        stats->decr_misses += threads[ii].stats.decr_misses;
-        stats->incr_misses += threads[ii].stats.incr_misses;
-        stats->cas_misses += threads[ii].stats.cas_misses;
-        stats->bytes_read += threads[ii].stats.bytes_read;
-        stats->bytes_written += threads[ii].stats.bytes_written;
-        stats->flush_cmds += threads[ii].stats.flush_cmds;
-        stats->conn_yields += threads[ii].stats.conn_yields;
-        stats->auth_cmds += threads[ii].stats.auth_cmds;
-        stats->auth_errors += threads[ii].stats.auth_errors;
-
-        for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
-            stats->slab_stats[sid].set_cmds +=
-                threads[ii].stats.slab_stats[sid].set_cmds;
-            stats->slab_stats[sid].get_hits +=
-                threads[ii].stats.slab_stats[sid].get_hits;
-            stats->slab_stats[sid].touch_hits +=
-                threads[ii].stats.slab_stats[sid].touch_hits;
-            stats->slab_stats[sid].delete_hits +=
-                threads[ii].stats.slab_stats[sid].delete_hits;
-            stats->slab_stats[sid].decr_hits +=
-                threads[ii].stats.slab_stats[sid].decr_hits;
-            stats->slab_stats[sid].incr_hits +=
-                threads[ii].stats.slab_stats[sid].incr_hits;
-            stats->slab_stats[sid].cas_hits +=
-                threads[ii].stats.slab_stats[sid].cas_hits;
-            stats->slab_stats[sid].cas_badval +=
-                threads[ii].stats.slab_stats[sid].cas_badval;
-        }
+        uint64_t *cur = (uint64_t *)&threads[ii].stats;
+        uint64_t *base = (uint64_t *)&stats_base[ii];
 
-        pthread_mutex_unlock(&threads[ii].stats.mutex);
+        for (w = 0; w < THREAD_STATS_WORDS; w++)
+            out[w] += thread_stat_load(&cur[w]) - base[w];
     }
+    pthread_mutex_unlock(&stats_base_lock);
 }
 
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out) {
@@ -674,6 +984,10 @@ void thread_init(int nthreads, struct event_base *main_base) {
     pthread_mutex_init(&cqi_freelist_lock, NULL);
     cqi_freelist = NULL;
 
+    pthread_mutex_init(&item_global_lock, NULL);
+    pthread_key_create(&item_lock_type_key, NULL);
+    pthread_key_create(&worker_thread_key, NULL);
+
     /* Want a wide lock table, but don't waste memory */
     if (nthreads < 3) {
         power = 10;
@@ -686,6 +1000,12 @@ void thread_init(int nthreads, struct event_base *main_base) {
         power = 13;
     }
 
+    /* Lookups rely on every key of a hash bucket sharing one item lock, so
+     * the lock table may not be wider than the hash table. */
+    if (power > assoc_bucketpower())
+        power = assoc_bucketpower();
+
+    item_lock_hashpower = power;
     item_lock_count = ((unsigned long int)1 << (power));
     item_lock_mask  = item_lock_count - 1;
 
@@ -694,15 +1014,21 @@ void thread_init(int nthreads, struct event_base *main_base) {
         perror("Can't allocate item locks");
         exit(1);
     }
+    memory_account(MEMORY_THREADS, item_lock_count * sizeof(pthread_mutex_t));
     for (i = 0; i < item_lock_count; i++) {
         pthread_mutex_init(&item_locks[i], NULL);
     }
 
-    threads = calloc(nthreads, sizeof(LIBEVENT_THREAD));
-    if (! threads) {
+    /* aligned, so each worker's stats start a cache line */
+    if (posix_memalign((void **)&threads, CACHE_LINE_SIZE,
+                       nthreads * sizeof(LIBEVENT_THREAD)) != 0 ||
+        (stats_base = calloc(nthreads, sizeof(struct thread_stats))) == NULL) {
         perror("Can't allocate thread descriptors");
         exit(1);
     }
+    memset(threads, 0, nthreads * sizeof(LIBEVENT_THREAD));
+    memory_account(MEMORY_THREADS, nthreads * (sizeof(LIBEVENT_THREAD) +
+                                               sizeof(struct thread_stats)));
 
     dispatcher_thread.base = main_base;
     dispatcher_thread.thread_id = pthread_self();
@@ -716,6 +1042,7 @@ void thread_init(int nthreads, struct event_base *main_base) {
 
         threads[i].notify_receive_fd = fds[0];
         threads[i].notify_send_fd = fds[1];
+        threads[i].numa_node = settings.numa ? i % numa_mode_nodes() : -1;
 
         setup_thread(&threads[i]);
         /* Reserve three fds for the libevent base, and two for the pipe */
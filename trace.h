@@ -62,6 +62,12 @@
 #define MEMCACHED_SLABS_ALLOCATE_FAILED_ENABLED() (0)
 #define MEMCACHED_SLABS_FREE(arg0, arg1, arg2)
 #define MEMCACHED_SLABS_FREE_ENABLED() (0)
+#define MEMCACHED_SLABS_REBALANCE_FINISH(arg0, arg1, arg2, arg3)
+#define MEMCACHED_SLABS_REBALANCE_FINISH_ENABLED() (0)
+#define MEMCACHED_SLABS_REBALANCE_MOVE(arg0, arg1, arg2, arg3, arg4)
+#define MEMCACHED_SLABS_REBALANCE_MOVE_ENABLED() (0)
+#define MEMCACHED_SLABS_REBALANCE_START(arg0, arg1)
+#define MEMCACHED_SLABS_REBALANCE_START_ENABLED() (0)
 #define MEMCACHED_SLABS_SLABCLASS_ALLOCATE(arg0)
 #define MEMCACHED_SLABS_SLABCLASS_ALLOCATE_ENABLED() (0)
 #define MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(arg0)